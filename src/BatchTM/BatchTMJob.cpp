@@ -30,9 +30,11 @@
 #include "Libpfs/manip/copy.h"
 #include "Libpfs/manip/resize.h"
 #include "Libpfs/manip/gamma.h"
+#include "Libpfs/utils/hash.h"
 #include "Libpfs/tm/TonemapOperator.h"
 
 #include "Core/IOWorker.h"
+#include "Core/TonemapCache.h"
 #include "Common/LuminanceOptions.h"
 
 #include <QFileInfo>
@@ -75,6 +77,9 @@ void BatchTMJob::run()
         // update progress bar!
         emit increment_progress_bar(1);
 
+        // the same HDR is tonemapped with every preset: hash it only once
+        const quint64 frame_hash = pfs::utils::hash(*reference_frame);
+
         for (int idx = 0; idx < m_tm_options->size(); ++idx)
         {
             TonemappingOptions* opts = m_tm_options->at(idx);
@@ -84,24 +89,31 @@ void BatchTMJob::run()
 
 			opts->xsize = (int) opts->origxsize * opts->xsize_percent / 100;
 
-            QScopedPointer<pfs::Frame> temporary_frame;
-            if ( opts->origxsize == opts->xsize )
-            {
-                temporary_frame.reset( pfs::copy(reference_frame.data()) );
-            }
-            else
+            const QByteArray cache_key = TonemapCache::computeKey(frame_hash, *opts);
+
+            QScopedPointer<pfs::Frame> temporary_frame( TonemapCache::getInstance().get(cache_key) );
+            if ( temporary_frame.isNull() )
             {
-                temporary_frame.reset( pfs::resize(reference_frame.data(), opts->xsize) );
-            }
+                if ( opts->origxsize == opts->xsize )
+                {
+                    temporary_frame.reset( pfs::copy(reference_frame.data()) );
+                }
+                else
+                {
+                    temporary_frame.reset( pfs::resize(reference_frame.data(), opts->xsize) );
+                }
+
+                if ( opts->pregamma != 1.0f )
+                {
+                    pfs::applyGamma(temporary_frame.data(), opts->pregamma );
+                }
 
-			if ( opts->pregamma != 1.0f )
-			{
-                pfs::applyGamma(temporary_frame.data(), opts->pregamma );
-			}
+                QScopedPointer<TonemapOperator> tm_operator( TonemapOperator::getTonemapOperator(opts->tmoperator) );
 
-            QScopedPointer<TonemapOperator> tm_operator( TonemapOperator::getTonemapOperator(opts->tmoperator) );
+                tm_operator->tonemapFrame(*temporary_frame, opts, prog_helper);
 
-            tm_operator->tonemapFrame(*temporary_frame, opts, prog_helper);
+                TonemapCache::getInstance().insert(cache_key, *temporary_frame);
+            }
 
             QString output_file_name = m_output_file_name_base+"_"+opts->getPostfix()+"."+m_ldr_output_format;
 
@@ -29,6 +29,7 @@
 #include <QByteArray>
 #include <QColor>
 #include <valarray>
+#include <vector>
 
 #include "CommonFunctions.h"
 #include "LuminanceOptions.h"
@@ -44,6 +45,7 @@
 #include <Libpfs/io/framewriterfactory.h>
 #include <Libpfs/exif/exifdata.hpp>
 #include <Libpfs/utils/transform.h>
+#include <Libpfs/utils/statistics.h>
 #include <Libpfs/manip/shift.h>
 #include <Libpfs/manip/rotate.h>
 #include <Libpfs/manip/copy.h>
@@ -61,12 +63,13 @@ using namespace std;
 using namespace pfs;
 using namespace pfs::io;
 
-static void build_histogram(valarray<float> &hist, const valarray<int> &src)
+static void build_histogram(valarray<float> &hist, const vector<unsigned char> &src)
 {
-    const int size = src.size();
-    for (int i = 0; i < size; i++)
+    vector<size_t> counts;
+    utils::computeHistogram(src.data(), src.size(), counts);
+    for (size_t i = 0; i < counts.size(); i++)
     {
-        hist[src[i]] += 1.f;
+        hist[i] = static_cast<float>(counts[i]);
     }
 
     //find max
@@ -167,30 +170,32 @@ void computeAutolevels(const QImage* data, float &minHist, float &maxHist, float
     float minG, maxG;
     float minB, maxB;
 
-    //Convert to lightness
-    valarray<int> lightness(ELEMENTS);
+    //Split in lightness, red, green and blue
+    vector<unsigned char> lightness(ELEMENTS);
+    vector<unsigned char> red(ELEMENTS);
+    vector<unsigned char> green(ELEMENTS);
+    vector<unsigned char> blue(ELEMENTS);
 
+#pragma omp parallel for
     for (int i = 0;  i < ELEMENTS; i++)
     {
-        lightness[i] = QColor::fromRgb(src[i]).toHsl().lightness();
+        const int r = qRed(src[i]);
+        const int g = qGreen(src[i]);
+        const int b = qBlue(src[i]);
+        red[i] = r;
+        green[i] = g;
+        blue[i] = b;
+
+        // HSL lightness, as QColor::lightness(): (max + min)/2 on 16 bits
+        const int sum16 = (max(r, max(g, b)) + min(r, min(g, b)))*0x101;
+        lightness[i] = ((sum16 + 1)/2) >> 8;
     }
+
     //Build histogram
     valarray<float> histL(0.f, COLOR_DEPTH);
     build_histogram(histL, lightness);
     compute_histogram_minmax(histL, minL, maxL);
 
-    //get Red, Gree, Blue
-    valarray<int> red(ELEMENTS);
-    valarray<int> green(ELEMENTS);
-    valarray<int> blue(ELEMENTS);
-
-    for (int i = 0;  i < ELEMENTS; i++)
-    {
-        red[i] = qRed(src[i]);
-        green[i] = qGreen(src[i]);
-        blue[i] = qBlue(src[i]);
-    }
-
     //Build histogram
     valarray<float> histR(0.f, COLOR_DEPTH);
     build_histogram(histR, red);
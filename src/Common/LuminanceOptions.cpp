@@ -750,6 +750,46 @@ void LuminanceOptions::setTempDir(const QString& path) {
     m_settingHolder->setValue(KEY_TEMP_RESULT_PATH, path);
 }
 
+int LuminanceOptions::getTonemapCacheSize()
+{
+    return m_settingHolder->value(KEY_TM_CACHE_SIZE, 256).toInt();
+}
+
+void LuminanceOptions::setTonemapCacheSize(int size)
+{
+    m_settingHolder->setValue(KEY_TM_CACHE_SIZE, size);
+}
+
+bool LuminanceOptions::isTonemapDiskCacheActive()
+{
+    return m_settingHolder->value(KEY_TM_CACHE_DISK_ACTIVE, false).toBool();
+}
+
+void LuminanceOptions::setTonemapDiskCacheActive(bool status)
+{
+    m_settingHolder->setValue(KEY_TM_CACHE_DISK_ACTIVE, status);
+}
+
+int LuminanceOptions::getTonemapDiskCacheSize()
+{
+    return m_settingHolder->value(KEY_TM_CACHE_DISK_SIZE, 1024).toInt();
+}
+
+void LuminanceOptions::setTonemapDiskCacheSize(int size)
+{
+    m_settingHolder->setValue(KEY_TM_CACHE_DISK_SIZE, size);
+}
+
+int LuminanceOptions::getViewerTileCacheSize()
+{
+    return m_settingHolder->value(KEY_VIEWER_TILE_CACHE_SIZE, 256).toInt();
+}
+
+void LuminanceOptions::setViewerTileCacheSize(int size)
+{
+    m_settingHolder->setValue(KEY_VIEWER_TILE_CACHE_SIZE, size);
+}
+
 //--------------------PATHS & co. ----------------
 #define KEY_RECENT_PATH_SAVE_LDR "recent_path_save_ldr"
 #define KEY_RECENT_PATH_LOAD_LDR "recent_path_load_ldr"
@@ -190,6 +190,18 @@ public Q_SLOTS:
     QString getDefaultPathTmoSettings();
 
     void    setTempDir(const QString&);
+
+    // Tonemapping result cache, sizes in MB
+    int     getTonemapCacheSize();
+    void    setTonemapCacheSize(int);
+    bool    isTonemapDiskCacheActive();
+    void    setTonemapDiskCacheActive(bool);
+    int     getTonemapDiskCacheSize();
+    void    setTonemapDiskCacheSize(int);
+
+    // Tiles of the viewers' image pyramids kept in video memory, size in MB
+    int     getViewerTileCacheSize();
+    void    setViewerTileCacheSize(int);
     void    setDefaultPathHdrIn(const QString&);
     void    setDefaultPathHdrOut(const QString&);
     void    setDefaultPathLdrIn(const QString&);    // HdrWizard
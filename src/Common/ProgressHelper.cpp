@@ -33,6 +33,9 @@ ProgressHelper::ProgressHelper(QObject *p):
 
 void ProgressHelper::setValue(int value)
 {
+    // every signal is a queued event for the GUI thread
+    if (value == Progress::value())
+        return;
     Progress::setValue(value);
     emit qtSetValue(value);
 }
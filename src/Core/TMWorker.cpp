@@ -40,13 +40,39 @@
 #include "Libpfs/manip/resize.h"
 #include "Libpfs/manip/gamma.h"
 #include "Libpfs/tm/TonemapOperator.h"
+#include "Libpfs/tm/TonemapSession.h"
+#include "Libpfs/utils/hash.h"
 
 #include "Core/TonemappingOptions.h"
+#include "Core/TonemapCache.h"
 #include "Common/ProgressHelper.h"
 
+namespace
+{
+//! \brief identifies the content of the frame built by preprocessFrame()
+QString inputKey(quint64 frame_hash, const TonemappingOptions& opts)
+{
+    QString key = QString("%1:%2:%3:%4")
+            .arg(frame_hash, 16, 16, QChar('0'))
+            .arg(opts.origxsize)
+            .arg(opts.xsize)
+            .arg(opts.pregamma, 0, 'g', 9);
+    if ( opts.tonemapSelection )
+    {
+        key += QString(":%1,%2,%3,%4")
+                .arg(opts.selection_x_up_left)
+                .arg(opts.selection_y_up_left)
+                .arg(opts.selection_x_bottom_right)
+                .arg(opts.selection_y_bottom_right);
+    }
+    return key;
+}
+}
+
 TMWorker::TMWorker(QObject* parent):
     QObject(parent),
-    m_Callback(new ProgressHelper)
+    m_Callback(new ProgressHelper),
+    m_Session(new TonemapSession)
 {
 #ifdef QT_DEBUG
     qDebug() << "TMWorker::TMWorker() ctor";
@@ -73,25 +99,8 @@ pfs::Frame* TMWorker::computeTonemap(/* const */ pfs::Frame* in_frame, Tonemappi
     qDebug() << "TMWorker::getTonemappedFrame()";
 #endif
 
-    pfs::Frame* working_frame = preprocessFrame(in_frame, tm_options);
+    pfs::Frame* working_frame = getTonemappedFrame(in_frame, tm_options);
     if (working_frame == NULL) return NULL;
-    try {
-        tonemapFrame(working_frame, tm_options);
-    }
-    catch(...) {
-        emit tonemapFailed("Tonemap failed!");
-        delete working_frame;
-        return NULL;
-    }
-
-    if ( m_Callback->canceled() )
-    {
-        m_Callback->cancel(false);      // double check this
-        delete working_frame;
-        return NULL;
-    }
-
-    postprocessFrame(working_frame, tm_options);
 
     emit tonemapSuccess(working_frame, tm_options);
     return working_frame;
@@ -99,26 +108,8 @@ pfs::Frame* TMWorker::computeTonemap(/* const */ pfs::Frame* in_frame, Tonemappi
 
 void TMWorker::computeTonemapAndExport(/* const */ pfs::Frame* in_frame, TonemappingOptions* tm_options, pfs::Params params, QString exportDir, QString hdrName, QString inputfname, QVector<float> inputExpoTimes)
 {
-    pfs::Frame* working_frame = preprocessFrame(in_frame, tm_options);
+    pfs::Frame* working_frame = getTonemappedFrame(in_frame, tm_options);
     if (working_frame == NULL) return;
-    try {
-        tonemapFrame(working_frame, tm_options);
-    }
-    catch(...) {
-        emit tonemapFailed("Tonemap failed!");
-        delete working_frame;
-        return;
-    }
-
-    if ( m_Callback->canceled() )
-    {
-        m_Callback->cancel(false);      // double check this
-        delete working_frame;
-        return;
-    }
-
-    postprocessFrame(working_frame, tm_options);
-
 
     QDir dir(exportDir);
 
@@ -155,6 +146,62 @@ void TMWorker::computeTonemapAndExport(/* const */ pfs::Frame* in_frame, Tonemap
     delete working_frame;
 }
 
+pfs::Frame* TMWorker::getTonemappedFrame(pfs::Frame* in_frame, TonemappingOptions* tm_options)
+{
+    const quint64 frame_hash = pfs::utils::hash(*in_frame);
+    const QByteArray cache_key = TonemapCache::computeKey(frame_hash, *tm_options);
+
+    pfs::Frame* working_frame = TonemapCache::getInstance().get(cache_key);
+    if (working_frame != NULL) return working_frame;
+
+    if ( tm_options->tonemapSelection )
+    {
+        // the selection looks as it does in the whole frame, if the operator
+        // is able to tonemap it in context
+        std::unique_ptr<TonemapOperator> tmEngine(
+                    TonemapOperator::getTonemapOperator(tm_options->tmoperator));
+        if ( tmEngine->regionHalo(tm_options) >= 0 )
+        {
+            try {
+                working_frame = tonemapRegion(*tmEngine, in_frame, tm_options);
+            }
+            catch(...) {
+                emit tonemapFailed("Tonemap failed!");
+                return NULL;
+            }
+            if (working_frame == NULL) return NULL;
+
+            postprocessFrame(working_frame, tm_options);
+
+            TonemapCache::getInstance().insert(cache_key, *working_frame);
+            return working_frame;
+        }
+    }
+
+    working_frame = preprocessFrame(in_frame, tm_options);
+    if (working_frame == NULL) return NULL;
+    try {
+        tonemapFrameInSession(working_frame, inputKey(frame_hash, *tm_options), tm_options);
+    }
+    catch(...) {
+        emit tonemapFailed("Tonemap failed!");
+        delete working_frame;
+        return NULL;
+    }
+
+    if ( m_Callback->canceled() )
+    {
+        m_Callback->cancel(false);      // double check this
+        delete working_frame;
+        return NULL;
+    }
+
+    postprocessFrame(working_frame, tm_options);
+
+    TonemapCache::getInstance().insert(cache_key, *working_frame);
+    return working_frame;
+}
+
 void TMWorker::tonemapFrame(pfs::Frame* working_frame, TonemappingOptions* tm_options)
 {
     m_Callback->cancel(false);
@@ -170,6 +217,45 @@ void TMWorker::tonemapFrame(pfs::Frame* working_frame, TonemappingOptions* tm_op
     delete tmEngine;
 }
 
+void TMWorker::tonemapFrameInSession(pfs::Frame* working_frame, const QString& input_key,
+                                     TonemappingOptions* tm_options)
+{
+    m_Callback->cancel(false);
+
+    emit tonemapBegin();
+    m_Session->tonemapFrame(*working_frame, input_key.toStdString(),
+                            tm_options, *m_Callback);
+    emit tonemapEnd();
+}
+
+pfs::Frame* TMWorker::tonemapRegion(TonemapOperator& tmEngine, pfs::Frame* input_frame,
+                                    TonemappingOptions* tm_options)
+{
+    m_Callback->cancel(false);
+
+    emit tonemapBegin();
+    pfs::Frame* working_frame = NULL;
+    try {
+        working_frame = tmEngine.tonemapRegion(*input_frame,
+                                               tm_options->selection_x_up_left,
+                                               tm_options->selection_y_up_left,
+                                               tm_options->selection_x_bottom_right,
+                                               tm_options->selection_y_bottom_right,
+                                               tm_options, *m_Callback);
+    }
+    catch(...) {
+        emit tonemapEnd();
+        throw;
+    }
+    emit tonemapEnd();
+
+    if ( working_frame == NULL )
+    {
+        m_Callback->cancel(false);
+    }
+    return working_frame;
+}
+
 pfs::Frame* TMWorker::preprocessFrame(pfs::Frame* input_frame, TonemappingOptions* tm_options)
 {
     pfs::Frame* working_frame = NULL;
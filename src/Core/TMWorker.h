@@ -29,6 +29,8 @@
 #include <QObject>
 #include <QString>
 
+#include <memory>
+
 #include "Libpfs/params.h"
 
 // Forward declaration
@@ -37,6 +39,8 @@ namespace pfs {
 }
 
 class TonemappingOptions;
+class TonemapOperator;
+class TonemapSession;
 class ProgressHelper;
 
 class TMWorker : public QObject
@@ -62,6 +66,23 @@ public Q_SLOTS:
     void tonemapFrame(pfs::Frame*, TonemappingOptions*);
 
 private:
+    //!
+    //! Returns the tonemapped frame from TonemapCache or computes it (and
+    //! stores it in the cache). Returns NULL on failure or cancellation
+    //!
+    pfs::Frame* getTonemappedFrame(pfs::Frame*, TonemappingOptions*);
+    //!
+    //! Tonemap \a working_frame in m_Session, so the analysis stage of the
+    //! operator is reused when only its synthesis options changed
+    //!
+    void tonemapFrameInSession(pfs::Frame* working_frame, const QString& input_key,
+                               TonemappingOptions*);
+    //!
+    //! Tonemap the selection of \a input_frame in context (see
+    //! TonemapOperator::tonemapRegion()). Returns NULL on cancellation
+    //!
+    pfs::Frame* tonemapRegion(TonemapOperator& tmEngine, pfs::Frame* input_frame,
+                              TonemappingOptions*);
     pfs::Frame* preprocessFrame(pfs::Frame*, TonemappingOptions*);
     void postprocessFrame(pfs::Frame*, TonemappingOptions*);
 
@@ -78,6 +99,7 @@ Q_SIGNALS:
 
 private:
     ProgressHelper* m_Callback;
+    std::unique_ptr<TonemapSession> m_Session;
 };
 
 #endif // TMWORKER_H
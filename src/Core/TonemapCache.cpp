@@ -0,0 +1,419 @@
+/**
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "Core/TonemapCache.h"
+
+#ifdef QT_DEBUG
+#include <QDebug>
+#endif
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutexLocker>
+#include <QScopedPointer>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/utils/hash.h"
+#include "Libpfs/io/pfsreader.h"
+#include "Libpfs/io/pfswriter.h"
+
+#include "Common/LuminanceOptions.h"
+#include "Core/TonemappingOptions.h"
+
+namespace
+{
+// bump every time the output of an operator changes for the same options,
+// so stale entries on disk are not picked up
+const quint32 CACHE_KEY_VERSION = 2;
+
+const QString CACHE_DIR_NAME = "lhdr_tmcache";
+
+QAtomicInt s_nextTempId(0);
+
+int frameCost(const pfs::Frame& frame)
+{
+    qint64 bytes = qint64(frame.size())*frame.getChannels().size()*sizeof(float);
+    return qMax(1, int(bytes/1024));
+}
+
+void writeOptions(QDataStream& out, const TonemappingOptions& opts)
+{
+    out << quint16(opts.tmoperator);
+    out << qint32(opts.origxsize) << qint32(opts.xsize) << opts.pregamma;
+    out << opts.tonemapSelection;
+    if (opts.tonemapSelection)
+    {
+        out << qint32(opts.selection_x_up_left)
+            << qint32(opts.selection_y_up_left)
+            << qint32(opts.selection_x_bottom_right)
+            << qint32(opts.selection_y_bottom_right);
+    }
+
+    switch (opts.tmoperator)
+    {
+    case mantiuk06:
+        out << opts.operator_options.mantiuk06options.contrastfactor
+            << opts.operator_options.mantiuk06options.saturationfactor
+            << opts.operator_options.mantiuk06options.detailfactor
+            << opts.operator_options.mantiuk06options.contrastequalization;
+        break;
+    case mantiuk08:
+        out << opts.operator_options.mantiuk08options.colorsaturation
+            << opts.operator_options.mantiuk08options.contrastenhancement
+            << opts.operator_options.mantiuk08options.luminancelevel
+            << opts.operator_options.mantiuk08options.setluminance;
+        break;
+    case fattal:
+        out << opts.operator_options.fattaloptions.alpha
+            << opts.operator_options.fattaloptions.beta
+            << opts.operator_options.fattaloptions.color
+            << opts.operator_options.fattaloptions.noiseredux
+            << opts.operator_options.fattaloptions.newfattal
+            << opts.operator_options.fattaloptions.fftsolver;
+        break;
+    case ferradans:
+        out << opts.operator_options.ferradansoptions.rho
+            << opts.operator_options.ferradansoptions.inv_alpha;
+        break;
+    case drago:
+        out << opts.operator_options.dragooptions.bias;
+        break;
+    case durand:
+        out << opts.operator_options.durandoptions.spatial
+            << opts.operator_options.durandoptions.range
+            << opts.operator_options.durandoptions.base;
+        break;
+    case reinhard02:
+        out << opts.operator_options.reinhard02options.scales
+            << opts.operator_options.reinhard02options.key
+            << opts.operator_options.reinhard02options.phi
+            << qint32(opts.operator_options.reinhard02options.range)
+            << qint32(opts.operator_options.reinhard02options.lower)
+            << qint32(opts.operator_options.reinhard02options.upper);
+        break;
+    case reinhard05:
+        out << opts.operator_options.reinhard05options.brightness
+            << opts.operator_options.reinhard05options.chromaticAdaptation
+            << opts.operator_options.reinhard05options.lightAdaptation;
+        break;
+    case ashikhmin:
+        out << opts.operator_options.ashikhminoptions.simple
+            << opts.operator_options.ashikhminoptions.eq2
+            << opts.operator_options.ashikhminoptions.lct;
+        break;
+    case pattanaik:
+        out << opts.operator_options.pattanaikoptions.autolum
+            << opts.operator_options.pattanaikoptions.local
+            << opts.operator_options.pattanaikoptions.cone
+            << opts.operator_options.pattanaikoptions.rod
+            << opts.operator_options.pattanaikoptions.multiplier;
+        break;
+    case mai:
+        break;
+    }
+}
+
+//! \brief fills \a files with the entries in \a path, oldest first, and
+//! \a sizes with their size
+//! \return total size of the entries
+qint64 scanDisk(const QString& path, QStringList& files, QHash<QString, qint64>& sizes)
+{
+    qint64 total_size = 0;
+    const QFileInfoList infos = QDir(path).entryInfoList(QStringList("*.pfs"), QDir::Files,
+                                                         QDir::Time | QDir::Reversed);
+    foreach (const QFileInfo& info, infos)
+    {
+        files.push_back(info.absoluteFilePath());
+        sizes.insert(info.absoluteFilePath(), info.size());
+        total_size += info.size();
+    }
+    return total_size;
+}
+
+void removeFiles(const QStringList& files)
+{
+    foreach (const QString& file, files)
+    {
+        QFile::remove(file);
+    }
+}
+}
+
+TonemapCache& TonemapCache::getInstance()
+{
+    static TonemapCache instance;
+    return instance;
+}
+
+TonemapCache::TonemapCache()
+    : m_diskActive(false)
+    , m_diskMaxSize(0)
+    , m_diskTotalSize(0)
+{
+    updateSettings();
+}
+
+void TonemapCache::updateSettings()
+{
+    LuminanceOptions luminance_options;
+
+    const bool disk_active = luminance_options.isTonemapDiskCacheActive();
+    const QString disk_path = QDir(luminance_options.getTempDir()).filePath(CACHE_DIR_NAME);
+
+    // entries left by a previous session are ranked by modification time
+    QStringList disk_files;
+    QHash<QString, qint64> disk_sizes;
+    qint64 disk_total_size = 0;
+    if ( disk_active )
+    {
+        QDir().mkpath(disk_path);
+        disk_total_size = scanDisk(disk_path, disk_files, disk_sizes);
+    }
+
+    QStringList evicted;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_memory.setMaxCost(qMax(0, luminance_options.getTonemapCacheSize())*1024);
+        m_diskActive = disk_active;
+        m_diskMaxSize = qint64(luminance_options.getTonemapDiskCacheSize())*1024*1024;
+        m_diskPath = disk_path;
+        m_diskFiles.swap(disk_files);
+        m_diskSizes.swap(disk_sizes);
+        m_diskTotalSize = disk_total_size;
+
+        evicted = pruneDisk();
+    }
+    removeFiles(evicted);
+}
+
+QByteArray TonemapCache::computeKey(const pfs::Frame& hdr_frame,
+                                    const TonemappingOptions& tm_options)
+{
+    return computeKey(pfs::utils::hash(hdr_frame), tm_options);
+}
+
+QByteArray TonemapCache::computeKey(quint64 frame_hash,
+                                    const TonemappingOptions& tm_options)
+{
+    QByteArray key;
+    QDataStream out(&key, QIODevice::WriteOnly);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    out << CACHE_KEY_VERSION;
+    out << frame_hash;
+    writeOptions(out, tm_options);
+
+    return key;
+}
+
+pfs::Frame* TonemapCache::get(const QByteArray& key)
+{
+    QString file_name;
+    {
+        QMutexLocker locker(&m_mutex);
+
+        const pfs::Frame* cached = m_memory.object(key);
+        if ( cached )
+        {
+#ifdef QT_DEBUG
+            qDebug() << "TonemapCache::get() memory hit";
+#endif
+            return pfs::copy(cached);
+        }
+
+        if ( !m_diskActive ) return NULL;
+
+        file_name = diskFileName(key);
+        if ( !m_diskSizes.contains(file_name) ) return NULL;
+    }
+
+    // the file is read without holding the lock, so memory hits from other
+    // threads are not stalled by the disk
+    pfs::Frame* from_disk = readFromDisk(file_name);
+
+    QMutexLocker locker(&m_mutex);
+    if ( from_disk == NULL )
+    {
+        forgetDiskEntry(file_name);
+        return NULL;
+    }
+
+#ifdef QT_DEBUG
+    qDebug() << "TonemapCache::get() disk hit";
+#endif
+    touchDiskEntry(file_name);
+
+    // promote to the memory cache, the caller gets its own copy
+    pfs::Frame* result = pfs::copy(from_disk);
+    m_memory.insert(key, from_disk, frameCost(*from_disk));
+    return result;
+}
+
+void TonemapCache::insert(const QByteArray& key, const pfs::Frame& ldr_frame)
+{
+    QString file_name;
+    {
+        QMutexLocker locker(&m_mutex);
+
+        const int cost = frameCost(ldr_frame);
+        if ( cost <= m_memory.maxCost() )
+        {
+            m_memory.insert(key, pfs::copy(&ldr_frame), cost);
+        }
+
+        if ( !m_diskActive ) return;
+
+        file_name = diskFileName(key);
+        if ( m_diskSizes.contains(file_name) )
+        {
+            touchDiskEntry(file_name);
+            return;
+        }
+    }
+
+    const qint64 size = writeToDisk(file_name, ldr_frame);
+    if ( size < 0 ) return;
+
+    QStringList evicted;
+    {
+        QMutexLocker locker(&m_mutex);
+        addDiskEntry(file_name, size);
+        evicted = pruneDisk();
+    }
+    removeFiles(evicted);
+}
+
+void TonemapCache::clear()
+{
+    QString disk_path;
+    {
+        QMutexLocker locker(&m_mutex);
+
+        m_memory.clear();
+        m_diskFiles.clear();
+        m_diskSizes.clear();
+        m_diskTotalSize = 0;
+        disk_path = m_diskPath;
+    }
+
+    QDir dir(disk_path);
+    foreach (const QString& file,
+             dir.entryList(QStringList() << "*.pfs" << "*.tmp", QDir::Files))
+    {
+        dir.remove(file);
+    }
+}
+
+QString TonemapCache::diskFileName(const QByteArray& key) const
+{
+    const QByteArray digest = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    return QDir(m_diskPath).filePath(QString::fromLatin1(digest.toHex()) + ".pfs");
+}
+
+pfs::Frame* TonemapCache::readFromDisk(const QString& file_name)
+{
+    if ( !QFile::exists(file_name) ) return NULL;
+
+    try
+    {
+        pfs::io::PfsReader reader(QFile::encodeName(file_name).constData());
+        QScopedPointer<pfs::Frame> frame(new pfs::Frame);
+        reader.read(*frame, pfs::Params());
+        return frame.take();
+    }
+    catch (...)
+    {
+        // corrupted entry: drop it
+        QFile::remove(file_name);
+    }
+    return NULL;
+}
+
+qint64 TonemapCache::writeToDisk(const QString& file_name, const pfs::Frame& ldr_frame)
+{
+    // written under a temporary name and then renamed, so that get() never
+    // reads a partially written entry
+    const QString temp_name =
+            file_name + QString(".%1.tmp").arg(s_nextTempId.fetchAndAddRelaxed(1));
+    try
+    {
+        pfs::io::PfsWriter writer(QFile::encodeName(temp_name).constData());
+        writer.write(ldr_frame, pfs::Params());
+    }
+    catch (...)
+    {
+        QFile::remove(temp_name);
+        return -1;
+    }
+
+    // fails if another thread has just stored the same key: keep its copy
+    if ( !QFile::rename(temp_name, file_name) )
+    {
+        QFile::remove(temp_name);
+    }
+
+    const QFileInfo info(file_name);
+    return info.exists() ? info.size() : -1;
+}
+
+void TonemapCache::addDiskEntry(const QString& file_name, qint64 size)
+{
+    if ( m_diskSizes.contains(file_name) )
+    {
+        touchDiskEntry(file_name);
+        return;
+    }
+    m_diskFiles.push_back(file_name);
+    m_diskSizes.insert(file_name, size);
+    m_diskTotalSize += size;
+}
+
+void TonemapCache::touchDiskEntry(const QString& file_name)
+{
+    if ( m_diskFiles.removeOne(file_name) )
+    {
+        m_diskFiles.push_back(file_name);
+    }
+}
+
+void TonemapCache::forgetDiskEntry(const QString& file_name)
+{
+    if ( m_diskFiles.removeOne(file_name) )
+    {
+        m_diskTotalSize -= m_diskSizes.take(file_name);
+    }
+}
+
+QStringList TonemapCache::pruneDisk()
+{
+    QStringList evicted;
+    while ( m_diskTotalSize > m_diskMaxSize && !m_diskFiles.isEmpty() )
+    {
+        const QString file_name = m_diskFiles.takeFirst();
+        m_diskTotalSize -= m_diskSizes.take(file_name);
+        evicted.push_back(file_name);
+    }
+    return evicted;
+}
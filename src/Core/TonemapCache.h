@@ -0,0 +1,121 @@
+/**
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ *
+ * Content addressed cache of tonemapped frames
+ *
+ */
+
+#ifndef TONEMAPCACHE_H
+#define TONEMAPCACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// Forward declaration
+namespace pfs {
+    class Frame;
+}
+
+class TonemappingOptions;
+
+//!
+//! Holds the LDR result of previous tonemapping runs, keyed by the content of
+//! the input HDR frame and by every option that changes the output. Frames are
+//! kept in memory in LRU order and, if enabled in the preferences, spilled on
+//! disk in the temporary directory as PFS files, also evicted in LRU order.
+//!
+//! All the functions are thread safe: the cache is shared by TMWorker, the
+//! preview panel and the batch tonemapping jobs.
+//!
+class TonemapCache
+{
+public:
+    static TonemapCache& getInstance();
+
+    //!
+    //! \return key of the tonemapping of \a hdr_frame with \a tm_options
+    //! \note the hash of the frame data is computed in parallel, but it still
+    //! walks the entire frame: compute the key once per tonemap
+    //!
+    static QByteArray computeKey(const pfs::Frame& hdr_frame,
+                                 const TonemappingOptions& tm_options);
+
+    //!
+    //! \return key of the tonemapping with \a tm_options of a frame whose
+    //! content hash (pfs::utils::hash) is \a frame_hash
+    //!
+    static QByteArray computeKey(quint64 frame_hash,
+                                 const TonemappingOptions& tm_options);
+
+    //!
+    //! \return a copy of the frame stored with \a key or NULL on cache miss.
+    //! Ownership of the returned frame is transferred to the caller.
+    //!
+    pfs::Frame* get(const QByteArray& key);
+
+    //!
+    //! Stores a copy of \a ldr_frame under \a key
+    //!
+    void insert(const QByteArray& key, const pfs::Frame& ldr_frame);
+
+    //!
+    //! Removes every entry from memory and disk
+    //!
+    void clear();
+
+    //!
+    //! Re-read the cache sizes from LuminanceOptions, after the preferences
+    //! have been changed
+    //!
+    void updateSettings();
+
+private:
+    TonemapCache();
+    TonemapCache(const TonemapCache&);
+    TonemapCache& operator=(const TonemapCache&);
+
+    QString diskFileName(const QByteArray& key) const;
+    static pfs::Frame* readFromDisk(const QString& file_name);
+    //! \return size of the file, -1 on failure
+    static qint64 writeToDisk(const QString& file_name, const pfs::Frame& ldr_frame);
+
+    // bookkeeping of the entries on disk, called with m_mutex held: the files
+    // themselves are read, written and removed without holding it
+    void addDiskEntry(const QString& file_name, qint64 size);
+    void touchDiskEntry(const QString& file_name);
+    void forgetDiskEntry(const QString& file_name);
+    //! \return files to remove to get back under m_diskMaxSize
+    QStringList pruneDisk();
+
+    mutable QMutex m_mutex;
+    QCache<QByteArray, pfs::Frame> m_memory;    // cost in KB
+
+    bool m_diskActive;
+    qint64 m_diskMaxSize;                       // in bytes
+    QString m_diskPath;
+    QStringList m_diskFiles;                    // least recently used first
+    QHash<QString, qint64> m_diskSizes;         // in bytes
+    qint64 m_diskTotalSize;
+};
+
+#endif // TONEMAPCACHE_H
@@ -45,6 +45,7 @@
 #include <Libpfs/utils/msec_timer.h>
 #include <Libpfs/utils/transform.h>
 #include <Libpfs/colorspace/rgbremapper.h>
+#include <Libpfs/colorspace/displaylut.h>
 #include <Libpfs/exception.h>
 
 using namespace std;
@@ -104,3 +105,58 @@ QImage* fromLDRPFStoQImage(pfs::Frame* in_frame,
 
     return temp_qimage;
 }
+
+void mapHDRPFSToQImage(const pfs::Frame& in_frame, QImage& out_image,
+                       const QRect& region, int step,
+                       float min_luminance, float max_luminance,
+                       RGBMappingType mapping_method)
+{
+#ifdef TIMER_PROFILING
+    msec_timer stop_watch;
+    stop_watch.start();
+#endif
+
+    assert(step > 0);
+    assert(QRect(0, 0, in_frame.getWidth(), in_frame.getHeight()).contains(region));
+    assert(out_image.format() == QImage::Format_RGB32);
+
+    const pfs::Channel *Xc, *Yc, *Zc;
+    in_frame.getXYZChannels( Xc, Yc, Zc );
+    assert( Xc != NULL && Yc != NULL && Zc != NULL );
+
+    const int out_width = (region.width() + step - 1)/step;
+    const int out_height = (region.height() + step - 1)/step;
+    assert(out_image.width() >= out_width && out_image.height() >= out_height);
+
+    const colorspace::DisplayLut& lut = colorspace::DisplayLut::get(mapping_method);
+    const float offset = min_luminance;
+    const float scale = 1.f/(max_luminance - min_luminance);
+
+    const size_t in_width = in_frame.getWidth();
+    // bits() detaches the image: call it once, outside the parallel region
+    uchar* out_bits = out_image.bits();
+    const int out_bpl = out_image.bytesPerLine();
+
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < out_height; ++y)
+    {
+        const size_t offset_in = (region.top() + y*step)*in_width + region.left();
+        const float* r = Xc->data() + offset_in;
+        const float* g = Yc->data() + offset_in;
+        const float* b = Zc->data() + offset_in;
+        QRgb* out = reinterpret_cast<QRgb*>(out_bits + y*out_bpl);
+
+        for (int x = 0; x < out_width; ++x)
+        {
+            const int idx = x*step;
+            out[x] = qRgb(lut((r[idx] - offset)*scale),
+                          lut((g[idx] - offset)*scale),
+                          lut((b[idx] - offset)*scale));
+        }
+    }
+
+#ifdef TIMER_PROFILING
+    stop_watch.stop_and_update();
+    std::cout << "mapHDRPFSToQImage() = " << stop_watch.get_time() << " msec" << std::endl;
+#endif
+}
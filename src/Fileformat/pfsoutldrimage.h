@@ -31,6 +31,7 @@
 #define FROMLDRPFSTOQIMAGE
 
 #include <QImage>
+#include <QRect>
 #include <QRgb>
 
 #include <Libpfs/utils/chain.h>
@@ -69,4 +70,15 @@ QImage* fromLDRPFStoQImage(pfs::Frame* in_frame,
                            float max_luminance = 1.0f,
                            RGBMappingType mapping_method = MAP_LINEAR);
 
+//! \brief Map the HDR samples of \a region of \a in_frame into \a out_image,
+//! taking one pixel every \a step in both directions (nearest neighbour).
+//! Rows are processed in parallel and the display curve is looked up in the
+//! shared pfs::colorspace::DisplayLut of \a mapping_method.
+//! \param[out] out_image Format_RGB32 image of at least
+//! ceil(region.width()/step) x ceil(region.height()/step) pixels
+void mapHDRPFSToQImage(const pfs::Frame& in_frame, QImage& out_image,
+                       const QRect& region, int step,
+                       float min_luminance, float max_luminance,
+                       RGBMappingType mapping_method);
+
 #endif
@@ -34,6 +34,7 @@
 #include <Libpfs/array2d.h>
 #include <Libpfs/frame.h>
 #include <Libpfs/utils/transform.h>
+#include <Libpfs/utils/statistics.h>
 #include <Libpfs/colorspace/convert.h>
 #include <Libpfs/colorspace/xyz.h>
 #include <Libpfs/manip/resize.h>
@@ -180,14 +181,10 @@ int getLum(const Frame& in, Array2D8u& out, double quantile)
                      tempOut.begin(), colorspace::ConvertRGB2Y());
 
     // build histogram
-    vector<long> hist(256, 0);
+    vector<size_t> hist;
+    utils::computeHistogram(tempOut.data(), tempOut.size(), hist);
     assert(hist.size() == 256u);
 
-    for (Array2D8u::iterator it = tempOut.begin(); it != tempOut.end(); ++it)
-    {
-        ++hist[ *it ];
-    }
-
     // find the quantile...
     size_t relativeQuantile = in.size()*quantile;
     size_t idx = 0;
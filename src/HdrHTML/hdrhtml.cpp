@@ -38,12 +38,18 @@
 #include <locale>
 
 #include "Libpfs/exception.h"
+#include "Libpfs/utils/statistics.h"
 
 #ifdef WIN32
 #include <QCoreApplication>
 #endif
+#include <QFuture>
 #include <QImage>
+#include <QList>
 #include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QtConcurrentRun>
 
 using namespace std;
 
@@ -57,174 +63,50 @@ const int pix_per_fstop = 25;   // Distance in pixels between f-stops shown on t
 const char *hdrhtml_version = "1.0"; // Version of the HDRHTML code
 
 
-// ================================================
-//                Histogram
-// ================================================
-
-template<class T>
-class Histogram
-{
-public:
-  vector<T> x;                         // Bin centers
-  vector<size_t> n;                    // No of items in a bin
-  size_t bins;
-
-  Histogram() : bins( 0 )
-  {
-  }
-
-  ~Histogram()
-  {
-    free();
-  }
-
-  void free()
-  {
-    //delete []x;
-    //delete []n;
-    bins = 0;
-  }
-
-  void compute( const T *data, size_t d_size, int bins = 30, T min_val = 1, T max_val = -1, bool reject_outofrange = true )
-  {
-    assert( bins > 0 );
-
-    free();
-    this->bins = bins;
-
-    if( min_val > max_val )             // missing min/max info
-    {
-      min_val = numeric_limits<T>::max();
-      max_val = numeric_limits<T>::min();
-
-      for( size_t k=0; k < d_size; k++ ) {
-        if( data[k] > max_val ) max_val = data[k];
-        if( data[k] < min_val ) min_val = data[k];
-      }
-    }
-
-    x.resize(bins);
-    n.resize(bins);
-
-    T delta = (max_val-min_val) / (float)bins; // width of a single bin
-
-//     T *e = new T[bins+1];        // bin edges
-//     for( int k=0; k <= bins; k++ ) {
-//       e[k] = min_val + (float)k * delta;
-//     }
-    for( int k=0; k < bins; k++ ) {
-      x[k] = min_val + (float)k * delta + delta/2;
-      n[k] = 0;
-    }
-
-    if( reject_outofrange ) {
-      for( size_t k=0; k < d_size; k++ ) {
-        int ind = floor( (data[k]-min_val) / (max_val-min_val) * (float)bins );
-        if( ind < 0 )
-          continue;
-        if( ind >= bins )
-          continue;
-        n[ind]++;
-      }
-    } else {
-      for( size_t k=0; k < d_size; k++ ) {
-        int ind = floor( (data[k]-min_val) / (max_val-min_val) * (float)bins );
-        if( ind < 0 ) {
-          n[0]++;
-          continue;
-        }
-        if( ind >= bins ) {
-          n[bins-1]++;
-          continue;
-        }
-        n[ind]++;
-      }
-    }
-
-
-
-  }
-
-};
-
 // ================================================
 //                  Lookup table
 // ================================================
 
 /**
- * Lookup table on a uniform array & interpolation
+ * Lookup tables sharing the same uniform array x_i, evaluated with linear
+ * interpolation. Values outside x_i are clamped to the first or last node.
+ *
+ * The position of a value on the array is found once by locate() and can
+ * then be used with all the tables, see interp().
  *
  * x_i must be at least two elements
- * y_i must be initialized after creating an object
  */
 class UniformArrayLUT
 {
 public:
-  float *y_i;
-
-  UniformArrayLUT( size_t lut_size, const float *x_i, float *y_i = NULL ) : y_i(NULL), x_i( x_i ), lut_size( lut_size ), delta( x_i[1]-x_i[0] )
+  UniformArrayLUT( size_t lut_size, const float *x_i ) :
+    lut_size( lut_size ), x_0( x_i[0] ), inv_delta( 1.f/(x_i[1]-x_i[0]) )
   {
-    if( y_i == NULL ) {
-      this->y_i = new float[lut_size];
-      own_y_i = true;
-    } else {
-      this->y_i = y_i;
-      own_y_i = false;
-    }
+    assert( lut_size >= 2 );
   }
 
-  UniformArrayLUT() : y_i(NULL), x_i( 0 ), lut_size( 0 ), delta( 0. ) {}
-
-  UniformArrayLUT(const UniformArrayLUT& other) : y_i(NULL), x_i( other.x_i ), lut_size( other.lut_size ), delta( other.delta )
+  // Lower node and offset from it, in [0, 1]
+  inline void locate( float x, int &ind, float &alpha ) const
   {
-    this->y_i = new float[lut_size];
-    own_y_i = true;
-    memcpy(this->y_i, other.y_i, lut_size * sizeof(float));
-  }
+    float ind_f = (x - x_0)*inv_delta;
+    if( !(ind_f > 0.f) )        // Out of range checks (and NaNs)
+      ind_f = 0.f;
+    if( ind_f > (float)(lut_size-1) )
+      ind_f = (float)(lut_size-1);
 
-  UniformArrayLUT& operator = (const UniformArrayLUT& other)
-  {
-    if (this != &other)
-    {
-      this->lut_size = other.lut_size;
-      this->delta = other.delta;
-      this->x_i = other.x_i;
-      this->y_i = new float[lut_size];
-      own_y_i = true;
-      memcpy(this->y_i, other.y_i, lut_size * sizeof(float));
-    }
-    return *this;
+    ind = std::min( (int)ind_f, (int)lut_size-2 );
+    alpha = ind_f - (float)ind;
   }
 
-  ~UniformArrayLUT()
+  static inline float interp( const float *y_i, int ind, float alpha )
   {
-    if( own_y_i )
-      delete []y_i;
-  }
-
-  float interp( float x )
-  {
-    const float ind_f = (x - x_i[0])/delta;
-    const size_t ind_low = (size_t)(ind_f);
-    const size_t ind_hi = (size_t)ceil(ind_f);
-
-    if( (ind_f < 0) )           // Out of range checks
-      return y_i[0];
-    if( (ind_hi >= lut_size) )
-      return y_i[lut_size-1];
-
-    if( (ind_low == ind_hi) )
-      return y_i[ind_low];      // No interpolation necessary
-
-    return y_i[ind_low] + (y_i[ind_hi]-y_i[ind_low])*(ind_f-(float)ind_low); // Interpolation
+    return y_i[ind] + (y_i[ind+1]-y_i[ind])*alpha;
   }
 
 private:
-  const float *x_i;
   size_t lut_size;
-  float delta;
-
-  bool own_y_i;
+  float x_0;
+  float inv_delta;
 };
 
 template<class T>
@@ -243,128 +125,6 @@ inline T clamp( T x, T min, T max )
  * x_i must be at least two elements
  * y_i must be initialized after creating an object
  */
-template<class Tx, class Ty>
-class ArrayLUT
-{
-  const vector<Tx> x_i;
-  size_t lut_size;
-
-  bool own_y_i;
-public:
-  vector<Ty> y_i;
-
-  ArrayLUT( size_t lut_size, const vector<Tx> &x_i, vector<Ty> &y_i ) : x_i( x_i ), lut_size( lut_size )
-  {
-    assert( lut_size > 0 );
-
-    if( y_i.size() == 0 ) {
-      this->y_i.resize(lut_size);
-      own_y_i = true;
-    } else {
-      this->y_i = y_i;
-      own_y_i = false;
-    }
-  }
-
-  ArrayLUT() : x_i( 0 ), y_i(0), lut_size( 0 ) {}
-
-  ArrayLUT(const ArrayLUT& other) : x_i( other.x_i ), lut_size( other.lut_size )
-  {
-      this->y_i = new Ty[lut_size];
-      own_y_i = true;
-      memcpy(this->y_i, other.y_i, lut_size * sizeof(Ty));
-  }
-
-  ArrayLUT& operator = (const ArrayLUT& other)
-  {
-    if (this != &other)
-    {
-      this->lut_size = other.lut_size;
-      this->x_i = other.x_i;
-      this->y_i = new Ty[lut_size];
-      own_y_i = true;
-      memcpy(this->y_i, other.y_i, lut_size * sizeof(Ty));
-    }
-    return *this;
-  }
-
-  ~ArrayLUT()
-  {
-    //if( own_y_i )
-    //  delete []y_i;
-  }
-
-  Ty interp( Tx x )
-  {
-    if( (x <= x_i[0]) )           // Out of range checks
-      return y_i[0];
-    if( (x >= x_i[lut_size-1]) )
-      return y_i[lut_size-1];
-
-    // binary search
-    size_t l = 0, r = lut_size-1;
-    while( true ) {
-      size_t m = (l+r)/2;
-      if( m == l ) break;
-      if( x < x_i[m] )
-        r = m;
-      else
-        l = m;
-    }
-
-    float alpha = (float)(x - x_i[l])/(float)(x_i[r]-x_i[l]);
-
-    return y_i[l] + (Ty)(alpha * (y_i[r]-y_i[l]));
-  }
-
-
-};
-
-// ================================================
-//                  Percentiles
-// ================================================
-
-
-/**
- * Compute prctiles using image cummulative histogram, which is less
- * accurate method but much faster than sorting.
- */
-template<class T>
-class Percentiles
-{
-  Histogram<T> hist;
-  const size_t bin_n;
-  size_t d_size;
-public:
-
-  /**
-   * @param data - table with samples
-   * @param d_size - number of samples
-   */
-  Percentiles( const T *data, size_t d_size ) :
-    bin_n( 1000 ), d_size( d_size ) // Accuracy 0.1 prctile
-  {
-    hist.compute( data, d_size, bin_n, 1, -1, false );
-    // Compute cummulative histogram
-    for( size_t k = 1; k < bin_n; k++ )
-      hist.n[k] += hist.n[k-1];
-
-//    cerr << "d_size: " << d_size << "  hist.n: " << hist.n[bin_n-1] << "\n";
-    assert( hist.n[bin_n-1] == d_size );
-  }
-
-  T prctile( double p )
-  {
-    ArrayLUT<size_t,T> lut( hist.bins, hist.n, hist.x );
-
-    return lut.interp( (size_t)(p*(double)d_size/100.) );
-  }
-
-
-
-};
-
-
 // ================================================
 //            Text template file utils
 // ================================================
@@ -636,6 +396,11 @@ public:
 //                 HDR HTML code
 // ================================================
 
+static bool save_image( QImage image, QString file_name )
+{
+  return image.save( file_name );
+}
+
 
 void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
   float *Y,
@@ -670,38 +435,59 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
     basis_table.data[0][k] = log2f( basis_table.data[0][k] );
   }
 
-// Fix zero and negative values in the image, convert to log2 space, find min and max values
-  float img_min = numeric_limits<float>::max();
-  float img_max = numeric_limits<float>::min();
+// Fix zero and negative values in the image and convert to log2 space, all
+// the channels in one pass
   {
     float *arrays[] = { R, G, B, Y };
 
-    int k;
+    // smallest positive value of each channel
+    float min_val[4];
+    for( int c = 0; c < 4; c++ )
+      min_val[c] = numeric_limits<float>::max();
+
+#pragma omp parallel
+    {
+      float thread_min[4];
+      for( int c = 0; c < 4; c++ )
+        thread_min[c] = numeric_limits<float>::max();
 
-    for( k = 0; k < 4; k++ ) {
-      float *x = arrays[k];
-      float min_val = numeric_limits<float>::max(), max_val = numeric_limits<float>::min();
+#pragma omp for nowait
       for( int i=0; i < pixels; i++ ) {
-        if( x[i] < min_val && x[i] > 0)
-          min_val = x[i];
-        if( x[i] > max_val )
-          max_val = x[i];
+        for( int c = 0; c < 4; c++ ) {
+          const float x = arrays[c][i];
+          if( x < thread_min[c] && x > 0 )
+            thread_min[c] = x;
+        }
       }
-      img_max = max( img_max, log2f(max_val) );
-      img_min = min( img_min, log2f(min_val) );
 
-      for( int i=0; i < pixels; i++ ) {
-        if( x[i] < min_val )
-          x[i] = log2f(min_val);
+#pragma omp critical
+      for( int c = 0; c < 4; c++ )
+        min_val[c] = min( min_val[c], thread_min[c] );
+    }
+
+    float log_min_val[4];
+    for( int c = 0; c < 4; c++ )
+      log_min_val[c] = log2f(min_val[c]);
+
+#pragma omp parallel for
+    for( int i=0; i < pixels; i++ ) {
+      for( int c = 0; c < 4; c++ ) {
+        float &x = arrays[c][i];
+        if( x < min_val[c] )
+          x = log_min_val[c];
         else
-          x[i] = log2f(x[i]);
+          x = log2f(x);
       }
     }
   }
 
-  Percentiles<float> prc( Y, pixels );
-  img_min = prc.prctile( 0.1 );
-  img_max = prc.prctile( 99.9 );
+  vector<float> prc_p( 3 ), prc;
+  prc_p[0] = 0.001f;
+  prc_p[1] = 0.999f;
+  prc_p[2] = 0.5f;
+  pfs::utils::quantiles( Y, pixels, prc_p, prc );
+
+  float img_min = prc[0], img_max = prc[1];
 
   img_min -= 4;  // give extra room for brightenning
   // how many 8-fstop segments we need to cover the DR
@@ -710,7 +496,7 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
   // start with this f-stop
   float l_start = img_min + (img_max-img_min-f8_stops*8)/2;
 
-  float l_med = prc.prctile( 50 );
+  float l_med = prc[2];
   float best_exp = round(l_med-l_start-4);
 
 // pix_per_fstop = 25;
@@ -724,16 +510,16 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
   float hist_start = (img_max-img_min-hist_fstops)/2;
   {
 
-    Histogram<float> hist;
-    hist.compute( Y, pixels, hist_width, img_min+hist_start, img_min+hist_start+hist_fstops );
+    pfs::utils::Histogram hist( hist_width, img_min+hist_start, img_min+hist_start+hist_fstops );
+    hist.compute( Y, pixels );
 
     unsigned short *hist_buffer = new unsigned short[hist_width*hist_height*3];
     float hist_n_max = -1;
     for( int k = 0; k < hist_width; k++ )
-      hist_n_max = max( hist_n_max, (float)hist.n[k] );
+      hist_n_max = max( hist_n_max, (float)hist.count(k) );
 
     for( int k = 0; k < hist_width; k++ ) {
-      float top = hist_height - round((float)hist.n[k]/hist_n_max * hist_height);
+      float top = hist_height - round((float)hist.count(k)/hist_n_max * hist_height);
       for( int r = 0; r < hist_height; r++ ) {
         hist_buffer[(r*hist_width+k)*3+0] = 0;
         hist_buffer[(r*hist_width+k)*3+1] = (r>=top ? (1<<16) -1 : 0);
@@ -768,16 +554,18 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
     delete []hist_buffer;
   }
 
-  // generate basis images
+  // generate basis images: the position of every pixel on the basis LUT is
+  // found once per 8-fstop segment and shared by all its basis functions.
+  // JPEG encoding and writing run on the thread pool, while the next
+  // segment is generated.
+  UniformArrayLUT basis_lut( basis_table.rows, basis_table.data[0] );
+  const float max_value = (float)numeric_limits<unsigned char>::max(); //(1<<16) -1;
 
-  //unsigned short *imgBuffer =
-    //new unsigned short[pixels*3];
-  vector<float> imgBuffer(pixels*3);
-  vector<unsigned char> imgBuffer_c(pixels*3);
-  for( int k=1; k <= f8_stops+1; k++ ) {
+  QList< QFuture<bool> > pending_saves;
+  QStringList pending_names;
+  const int max_pending = max( QThreadPool::globalInstance()->maxThreadCount(), basis_no );
 
-
-    float max_value  = (float)numeric_limits<unsigned char>::max(); //(1<<16) -1;
+  for( int k=1; k <= f8_stops+1; k++ ) {
 
     float exp_multip = log2f(1/powf( 2, l_start + k*8 ));
 
@@ -785,29 +573,36 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
     if( k == f8_stops+1 )     // Do only one shared basis for the last 8-fstop segment
       max_basis = 1;
 
-    for( int b=0; b < max_basis; b++ ) {
-      UniformArrayLUT basis_lut( basis_table.rows, basis_table.data[0], basis_table.data[b+1] );
-
-      int i = 0;
-      for( int pix = 0; pix < pixels; pix++ ) {
+    vector<QImage> basis_images;
+    for( int b=0; b < max_basis; b++ )
+      basis_images.push_back( QImage( width, height, QImage::Format_RGB888 ) );
 
-        float rgb[3];
-        rgb[0] = R[pix];
-        rgb[1] = G[pix];
-        rgb[2] = B[pix];
+#pragma omp parallel
+    {
+      vector<int> ind( width*3 );
+      vector<float> alpha( width*3 );
+
+#pragma omp for schedule(static)
+      for( int y = 0; y < height; y++ ) {
+        for( int x = 0; x < width; x++ ) {
+          const int pix = y*width + x;
+          basis_lut.locate( R[pix] + exp_multip, ind[3*x], alpha[3*x] );
+          basis_lut.locate( G[pix] + exp_multip, ind[3*x+1], alpha[3*x+1] );
+          basis_lut.locate( B[pix] + exp_multip, ind[3*x+2], alpha[3*x+2] );
+        }
 
-        for( int c=0; c < 3; c++ ) {
-          float exposure_comp_v = rgb[c] + exp_multip;
-          float v = (basis_lut.interp(exposure_comp_v)*max_value);
-          imgBuffer[i++] = v;
+        for( int b=0; b < max_basis; b++ ) {
+          const float *y_i = basis_table.data[b+1];
+          uchar *line = basis_images[b].scanLine( y );
+          for( int i = 0; i < width*3; i++ ) {
+            const float v = UniformArrayLUT::interp( y_i, ind[i], alpha[i] )*max_value;
+            line[i] = (unsigned char)clamp( v, 0.f, max_value );
+          }
         }
       }
-      for( int pix = 0; pix < pixels*3; pix++ ) {
-          float r = imgBuffer[pix];
-          imgBuffer_c[pix] = (unsigned char)r;
-      }
-      QImage imImage(imgBuffer_c.data(), width, height, QImage::Format_RGB888);
+    }
 
+    for( int b=0; b < max_basis; b++ ) {
       ostringstream img_filename;
       if( out_dir != NULL )
         img_filename << out_dir << "/";
@@ -816,9 +611,25 @@ void HDRHTMLSet::add_image( int width, int height, float *R, float *G, float *B,
       img_filename << base_name << '_' << k-1 << '_' << b+1 << ".jpg";
       if (verbose)
         cout << QObject::tr("Writing: ").toStdString() << img_filename.str() << endl;
-      imImage.save( QString::fromStdString(img_filename.str()));
+
+      // bound the number of images waiting to be written
+      while( pending_saves.size() >= max_pending ) {
+        pending_saves.front().waitForFinished();
+        if( !pending_saves.front().result() )
+          throw pfs::Exception( ("Cannot write '" + pending_names.front() + "'").toStdString() );
+        pending_saves.pop_front();
+        pending_names.pop_front();
+      }
+
+      const QString file_name = QString::fromStdString( img_filename.str() );
+      pending_saves.push_back( QtConcurrent::run( save_image, basis_images[b], file_name ) );
+      pending_names.push_back( file_name );
     }
+  }
 
+  for( int i = 0; i < pending_saves.size(); i++ ) {
+    if( !pending_saves[i].result() )
+      throw pfs::Exception( ("Cannot write '" + pending_names[i] + "'").toStdString() );
   }
 
   HDRHTMLImage new_image( base_name, width, height );
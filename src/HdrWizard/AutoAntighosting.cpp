@@ -26,20 +26,15 @@
 #include <QDebug>
 
 #include <boost/bind.hpp>
-#include <boost/math/constants/constants.hpp>
 #include <cmath>
 #include <stdlib.h>
-#ifdef _OPENMP
-#include <omp.h>
-#endif
 
 #include "Common/CommonFunctions.h"
 #include <Libpfs/frame.h>
 #include <Libpfs/colorspace/colorspace.h>
 #include <Libpfs/manip/copy.h>
 #include <Libpfs/utils/minmax.h>
-
-#include <fftw3.h>
+#include "TonemappingOperators/fattal02/pde.h"
 
 #include "AutoAntighosting.h"
 // --- LEGACY CODE ---
@@ -60,65 +55,9 @@ void solve_pde_dct(Array2Df &F, Array2Df &U)
     msec_timer stop_watch;
     stop_watch.start();
 #endif
-  // activate parallel execution of fft routines
-  fftwf_init_threads();
-#ifdef _OPENMP
-  fftwf_plan_with_nthreads( omp_get_max_threads() );
-#else
-  fftwf_plan_with_nthreads( 2 );
-#endif
-
-    const int width = U.getCols();
-    const int height = U.getRows();
-    assert((int)F.getCols()==width && (int)F.getRows()==height);
-
-    Array2Df Ftr(width, height);
-
-    fftwf_plan p = NULL; // Let's see if this blocks compiler warnings
-    #pragma omp parallel for private(p) schedule(static)
-    for ( int j = 0; j < height; j++ ) {
-        #pragma omp critical (make_plan)
-        p = fftwf_plan_r2r_1d(width, F.data()+width*j, Ftr.data()+width*j, FFTW_REDFT00, FFTW_ESTIMATE);
-        fftwf_execute(p); 
-    }
-    
-  #pragma omp parallel 
-  {
-    vector<float> c(height);
-    #pragma omp for
-    for ( int i = 0; i < width; i++ ) {
-        for (int j = 0; j < height; j++) {
-            c[j] = 1.0f; 
-        }
-        float b = 2.0f*(cos(boost::math::double_constants::pi*i/width) - 2.0f);
-        c[0] /= b;
-        Ftr(i, 0) /= b;
-        for (int j = 1; j < height - 1; j++ ) {
-            float m = (b - c[j-1]);
-            c[j] /= m;
-            Ftr(i, j) = (Ftr(i, j) - Ftr(i, j-1))/m;   
-        }
-        Ftr(i, height - 1) = (Ftr(i, height - 1) - Ftr(i, height - 2))/(b - c[height - 2]);
-        U(i, height - 1) = Ftr(i, height - 1);
-        for (int j = height - 2; j >= 0; j--) {
-            U(i, j) = Ftr(i, j) - c[j]*U(i, j+1);
-        }
-    }
-  }
-
-    const float invDivisor = 1.0f / (2.0f*(width-1));
-    #pragma omp parallel for schedule(static) lastprivate(p)
-    for ( int j = 0; j < height; j++ ) {
-        #pragma omp critical (make_plan)
-        p = fftwf_plan_r2r_1d(width, U.data()+width*j, U.data()+width*j, FFTW_REDFT00, FFTW_ESTIMATE);
-        fftwf_execute(p); 
-        
-        for ( int i = 0; i < width; i++ ) {
-            U(i, j) *= invDivisor;
-        }
-    }
-
-    fftwf_destroy_plan(p);
+    PoissonSolverDct solver(U.getCols(), U.getRows(),
+                            PoissonSolverDct::BOUNDARY_NEUMANN_DIRICHLET);
+    solver.solve(F, U);
 #ifdef TIMER_PROFILING
     stop_watch.stop_and_update();
     std::cout << "solve_pde_dct = " << stop_watch.get_time() << " msec" << std::endl;
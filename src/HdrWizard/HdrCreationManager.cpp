@@ -715,22 +715,26 @@ pfs::Frame *HdrCreationManager::doAntiGhosting(bool patches[][agGridSize], int h
     gradientYBlended_G.reset();
     //END BLUE
 
+    // the three channels have the same size: plan the transforms once
+    PoissonSolverDct solver(width, height,
+                            PoissonSolverDct::BOUNDARY_NEUMANN_DIRICHLET);
+
     qDebug() << "solve_pde";
-    solve_pde_dct(divergence_R, logIrradiance_R);
+    solver.solve(divergence_R, logIrradiance_R);
     ph->setValue(60);
     if (ph->canceled()) { 
         return NULL;
     }
 
     qDebug() << "solve_pde";
-    solve_pde_dct(divergence_G, logIrradiance_G);
+    solver.solve(divergence_G, logIrradiance_G);
     ph->setValue(76);
     if (ph->canceled()) { 
         return NULL;
     }
 
     qDebug() << "solve_pde";
-    solve_pde_dct(divergence_B, logIrradiance_B);
+    solver.solve(divergence_B, logIrradiance_B);
     ph->setValue(93);
     if (ph->canceled()) { 
         return NULL;
@@ -13,64 +13,29 @@
 #include <Libpfs/utils/transform.h>
 #include <Libpfs/utils/chain.h>
 #include <Libpfs/utils/clamp.h>
+#include <Libpfs/utils/statistics.h>
 #include <Libpfs/colorspace/colorspace.h>
 #include <Libpfs/colorspace/normalizer.h>
 
 using namespace pfs;
 using namespace pfs::colorspace;
 
-void computeHistogram(const pfs::Array2Df& data, std::vector<size_t>& histogram,
-                      float min, float max)
-{
-    Normalizer norm(min, max);
-    for (pfs::Array2Df::const_iterator it = data.begin(), itEnd = data.end(); it != itEnd; ++it)
-    {
-        // 1.0f -> histogram.size() - 1
-
-        size_t bin = static_cast<size_t>(norm(*it)*(histogram.size()-1)+0.5f);
-        ++histogram[bin];
-    }
-}
-
 std::pair<float, float> quantiles(const pfs::Array2Df& data,
-                                  float nb_min, float nb_max,
-                                  float min, float max)
+                                  float nb_min, float nb_max)
 {
-    // compute histogram (less expensive than sorting the entire sequence...
-    std::vector<size_t> hist(65535, 0);
-    computeHistogram(data, hist, min, max);
+    std::vector<float> p(2);
+    p[0] = nb_min;
+    p[1] = nb_max;
 
-    // normalize percentiles to image size...
-    size_t lb_percentile = static_cast<size_t>(nb_min*data.size() + 0.5f);
-    size_t ub_percentile = static_cast<size_t>(nb_max*data.size() + 0.5f);
-
-    size_t counter = 0;
-    std::pair<float, float> minmax;
-    for (size_t idx = 0; idx < hist.size(); ++idx)
-    {
-        counter += hist[idx];
-        if (counter >= lb_percentile) {
-            minmax.first = static_cast<float>(idx)/(hist.size()-1)*(max - min) + min;
-            break;
-        }
-    }
-
-    counter = 0;
-    for (size_t idx = 0; idx < hist.size(); ++idx)
-    {
-        counter += hist[idx];
-        if (counter >= ub_percentile) {
-            minmax.second = static_cast<float>(idx)/(hist.size()-1)*(max - min) + min;
-            break;
-        }
-    }
+    std::vector<float> q;
+    utils::quantiles(data.data(), data.size(), p, q);
 
 #ifndef NDEBUG
-    std::cout << "([" << nb_min << ", " << min << ", " << lb_percentile << "]"
-                 ", [" << nb_max << ", " << max << ", " << ub_percentile << "])" << std::endl;
+    std::cout << "([" << nb_min << ", " << q[0] << "]"
+                 ", [" << nb_max << ", " << q[1] << "])" << std::endl;
 #endif
 
-    return minmax;
+    return std::pair<float, float>(q[0], q[1]);
 }
 
 std::pair<float, float> getMinMax(const pfs::Array2Df& data)
@@ -86,7 +51,7 @@ void balance(pfs::Array2Df& data, float nb_min, float nb_max)
     std::pair<float, float> minmax = getMinMax(data);
     if (nb_min > 0.f || nb_max < 1.f)
     {
-        minmax = quantiles(data, nb_min, nb_max, minmax.first, minmax.second);
+        minmax = quantiles(data, nb_min, nb_max);
     }
     std::transform(
                 data.begin(),
@@ -334,4 +299,9 @@ void whiteBalance(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B, WhiteBal
         shadesOfGrayAWB(R, G, B);
     } break;
     }
+
+    // the channels are balanced in place, through their elements
+    R.touch();
+    G.touch();
+    B.touch();
 }
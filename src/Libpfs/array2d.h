@@ -26,6 +26,7 @@
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 #include <Libpfs/strideiterator.h>
 
@@ -46,6 +47,12 @@ namespace pfs
 //! It offers an undirect access to the data (using (x)(y) or (elem) ) or a
 //! direct access to the data (using getRawData() or data()).
 //!
+//! The whole-buffer accessors (data(), begin(), row_begin(), ...), fill(),
+//! resize() and assignment mark the content as modified (see generation()),
+//! so that values derived from it can be cached by their users. Writes
+//! through the element accessors are not tracked, to keep them as cheap as a
+//! plain vector access: a pass writing through them calls touch() at the end.
+//!
 template <typename Type>
 class Array2D
 {
@@ -101,7 +108,7 @@ public:
     void resize(size_t width, size_t height);
 
     //! \brief Direct access to the raw data
-    Type*       data()          { return m_data.data(); }
+    Type*       data()          { touch(); return m_data.data(); }
     //! \brief Direct access to the raw data
     const Type* data() const    { return m_data.data(); }
 
@@ -113,15 +120,26 @@ public:
     //! \brief Swap the content of the current instance with \a other
     void swap(self& other);
 
+    //! \brief Generation of the content: it changes after the first
+    //! tracked modification that follows the call, and is never shared with
+    //! another \c Array2D. Values computed from the content right after this
+    //! call stay valid as long as it returns the same generation.
+    //! \note Element writes, and writes through a pointer or an iterator
+    //! obtained before the call, are not tracked: call touch() after them.
+    size_t generation() const;
+
+    //! \brief Marks the content as modified
+    void touch();
+
 public:
     // element/row iterator
     typedef typename DataBuffer::iterator       iterator;
     typedef typename DataBuffer::const_iterator const_iterator;
 
     iterator begin()
-    { return m_data.begin(); }
+    { touch(); return m_data.begin(); }
     iterator end()
-    { return m_data.begin() + size(); }
+    { touch(); return m_data.begin() + size(); }
 
     const_iterator begin() const
     { return m_data.begin(); }
@@ -129,9 +147,9 @@ public:
     { return m_data.begin() + size(); }
 
     iterator row_begin(size_t r)
-    { return m_data.begin() + r*m_cols; }
+    { touch(); return m_data.begin() + r*m_cols; }
     iterator row_end(size_t r)
-    { return m_data.begin() + (r+1)*m_cols; }
+    { touch(); return m_data.begin() + (r+1)*m_cols; }
 
     const_iterator row_begin(size_t r) const
     { return m_data.begin() + r*m_cols; }
@@ -163,6 +181,11 @@ private:
 
     size_t     m_cols;
     size_t     m_rows;
+
+    // the generation only moves on the first write after generation() has
+    // been called: writes in the inner loops only read m_observed
+    std::atomic<size_t>         m_generation;
+    mutable std::atomic<bool>   m_observed;
 };
 
 //! \brief typedef provided for backward compatibility with the old API
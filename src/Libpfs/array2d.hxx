@@ -37,11 +37,23 @@ using namespace std;
 
 namespace pfs {
 
+namespace detail
+{
+//! \brief generations of the content of every Array2D, unique in the process
+inline size_t nextGeneration()
+{
+    static std::atomic<size_t> s_generation(0);
+    return s_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+}
+
 template <typename Type>
 Array2D<Type>::Array2D()
     : m_data()
     , m_cols(0)
     , m_rows(0) 
+    , m_generation(detail::nextGeneration())
+    , m_observed(false)
 {}
 
 template <typename Type>
@@ -49,6 +61,8 @@ Array2D<Type>::Array2D(size_t cols, size_t rows)
     : m_data(cols*rows)
     , m_cols(cols)
     , m_rows(rows)
+    , m_generation(detail::nextGeneration())
+    , m_observed(false)
 {
     assert( m_data.size() >= m_cols*m_rows);
 }
@@ -58,6 +72,8 @@ Array2D<Type>::Array2D(const self& rhs)
     : m_data(rhs.m_data)
     , m_cols(rhs.m_cols)
     , m_rows(rhs.m_rows)
+    , m_generation(detail::nextGeneration())
+    , m_observed(false)
 {
     assert( m_data.size() >= m_cols*m_rows);
 }
@@ -76,6 +92,7 @@ Array2D<Type>& Array2D<Type>::operator=(const Array2D<Type>& other)
 template <typename Type>
 void Array2D<Type>::resize(size_t width, size_t height)
 {
+    touch();
     m_data.resize( width*height );
     m_cols = width;
     m_rows = height;
@@ -86,11 +103,32 @@ void Array2D<Type>::resize(size_t width, size_t height)
 template <typename Type>
 void Array2D<Type>::swap(self& other)
 {
+    touch();
+    other.touch();
     std::swap(m_cols, other.m_cols);
     std::swap(m_rows, other.m_rows);
     std::swap(m_data, other.m_data);
 }
 
+template <typename Type>
+inline
+size_t Array2D<Type>::generation() const
+{
+    m_observed.store(true, std::memory_order_seq_cst);
+    return m_generation.load(std::memory_order_seq_cst);
+}
+
+template <typename Type>
+inline
+void Array2D<Type>::touch()
+{
+    if ( m_observed.load(std::memory_order_relaxed) )
+    {
+        m_observed.store(false, std::memory_order_relaxed);
+        m_generation.store(detail::nextGeneration(), std::memory_order_seq_cst);
+    }
+}
+
 template <typename Type>
 inline
 Type& Array2D<Type>::operator()(size_t cols, size_t rows)
@@ -138,12 +176,14 @@ const Type& Array2D<Type>::operator()( size_t index ) const
 template <typename Type>
 void Array2D<Type>::fill(const Type& value)
 {
+    touch();
     std::fill(m_data.begin(), m_data.end(), value);
 }
 
 template <typename Type>
 void Array2D<Type>::reset()
 {
+    touch();
     std::fill(m_data.begin(), m_data.end(), Type());
 }
 
@@ -34,11 +34,27 @@ Channel::Channel( size_t width, size_t height, const std::string& channelName)
     : ChannelData( width, height )
     , m_name( channelName )
     , m_tags()
+    , m_statisticsGeneration(0)
+    , m_statistics()
 {}
 
 Channel::~Channel()
 {}
 
+utils::Statistics Channel::getStatistics() const
+{
+    boost::mutex::scoped_lock lock(m_statisticsMutex);
+
+    // 0 is never a generation: the first request always computes
+    const size_t current = generation();
+    if ( current != m_statisticsGeneration )
+    {
+        m_statistics = utils::computeStatistics(ChannelData::data(), size());
+        m_statisticsGeneration = current;
+    }
+    return m_statistics;
+}
+
 } // pfs
 
 
@@ -30,9 +30,11 @@
 #include <string>
 #include <map>
 #include <cstddef>
+#include <boost/thread/mutex.hpp>
 
 #include <Libpfs/array2d.h>
 #include <Libpfs/tag.h>
+#include <Libpfs/utils/statistics.h>
 
 namespace pfs {
 
@@ -47,8 +49,10 @@ public:
 
     virtual ~Channel();
 
-    using ChannelData::data;
-    using ChannelData::resize;
+    //! \brief Returns min, max, mean and log-mean of the channel, computed on
+    //! the first request and kept as long as the generation() of the data
+    //! does not change
+    utils::Statistics getStatistics() const;
 
     //!
     //! \brief Returns TagContainer that can be used to access or modify
@@ -78,6 +82,10 @@ public:
 private:
     std::string     m_name;
     TagContainer    m_tags;
+
+    mutable boost::mutex        m_statisticsMutex;
+    mutable size_t              m_statisticsGeneration;
+    mutable utils::Statistics   m_statistics;
 };
 
 } // namespace pfs
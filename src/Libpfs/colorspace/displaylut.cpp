@@ -0,0 +1,66 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <Libpfs/colorspace/displaylut.h>
+#include <Libpfs/colorspace/convert.h>
+
+#include <cassert>
+
+namespace pfs {
+namespace colorspace {
+
+const DisplayLut& DisplayLut::get(RGBMappingType mapping_method)
+{
+    assert(mapping_method >= 0);
+    assert(mapping_method < 6);
+
+    static const DisplayLut luts[] =
+    {
+        DisplayLut(MAP_LINEAR),
+        DisplayLut(MAP_GAMMA1_4),
+        DisplayLut(MAP_GAMMA1_8),
+        DisplayLut(MAP_GAMMA2_2),
+        DisplayLut(MAP_GAMMA2_6),
+        DisplayLut(MAP_LOGARITHMIC)
+    };
+    return luts[mapping_method];
+}
+
+DisplayLut::DisplayLut(RGBMappingType mapping_method)
+    : m_lut(OCTAVES << MANTISSA_BITS)
+{
+    MappingFunc callback(s_callbacks[mapping_method]);
+
+    m_zero = convertSample<uint8_t>(callback(0.f));
+    m_one = convertSample<uint8_t>(callback(1.f));
+
+    for (uint32_t idx = 0; idx < m_lut.size(); ++idx)
+    {
+        // sample in the middle of the bin
+        const uint32_t bits = ((idx + s_base) << SHIFT) | (1u << (SHIFT - 1));
+        float sample;
+        std::memcpy(&sample, &bits, sizeof(sample));
+
+        m_lut[idx] = convertSample<uint8_t>(callback(sample));
+    }
+}
+
+}   // colorspace
+}   // pfs
@@ -0,0 +1,86 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PFS_COLORSPACE_DISPLAYLUT_H
+#define PFS_COLORSPACE_DISPLAYLUT_H
+
+//! \file displaylut.h
+//! \brief Lookup table mapping normalized HDR samples to 8 bit display values
+
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+#include <Libpfs/colorspace/rgbremapper.h>
+
+namespace pfs {
+namespace colorspace {
+
+//! \brief Maps a sample normalized in [0, 1] through one of the
+//! RGBMappingType curves into an 8 bit value.
+//!
+//! The table is indexed in the log domain, using the exponent and the top
+//! mantissa bits of the float sample: the bins have a constant relative
+//! width, so dark samples are not crushed as it happens when quantizing to 8
+//! bit before applying the curve. The table does not depend on the range
+//! window, so one instance per mapping method is built and shared.
+class DisplayLut : public RemapperBase
+{
+public:
+    //! \return the (lazily built) table of \a mapping_method
+    static const DisplayLut& get(RGBMappingType mapping_method);
+
+    uint8_t operator()(float sample) const
+    {
+        // integer comparisons only: negative samples and NaN have the sign
+        // bit set or a bit pattern above +inf
+        uint32_t bits;
+        std::memcpy(&bits, &sample, sizeof(bits));
+
+        if ( bits < (s_base << SHIFT) ) return m_zero;
+        if ( bits >= ONE_BITS ) return (bits <= INF_BITS) ? m_one : m_zero;
+
+        return m_lut[(bits >> SHIFT) - s_base];
+    }
+
+private:
+    explicit DisplayLut(RGBMappingType mapping_method);
+
+    // number of octaves below 1.f covered by the table
+    static const int OCTAVES = 20;
+    // mantissa bits used to index each octave
+    static const int MANTISSA_BITS = 8;
+    static const int SHIFT = 23 - MANTISSA_BITS;
+
+    static const uint32_t ONE_BITS = 0x3f800000u;   // 1.f
+    static const uint32_t INF_BITS = 0x7f800000u;   // +inf
+
+    // index of 2^-OCTAVES, given the IEEE 754 single precision bias (127)
+    static const uint32_t s_base = uint32_t(127 - OCTAVES) << MANTISSA_BITS;
+
+    std::vector<uint8_t> m_lut;
+    uint8_t m_zero;
+    uint8_t m_one;
+};
+
+}   // colorspace
+}   // pfs
+
+#endif // PFS_COLORSPACE_DISPLAYLUT_H
@@ -0,0 +1,440 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <Libpfs/colorspace/iccmanager.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include <Libpfs/array2d.h>
+
+namespace pfs {
+namespace colorspace {
+
+namespace
+{
+// rows transformed by one task: large enough to hide the call overhead of
+// cmsDoTransform, small enough to balance the threads
+const int ROWS_PER_BAND = 16;
+
+void closeProfile(void* profile)
+{
+    if ( profile ) cmsCloseProfile(profile);
+}
+
+void deleteTransform(void* transform)
+{
+    if ( transform ) cmsDeleteTransform(transform);
+}
+
+cmsHPROFILE createLinearSRGBProfile()
+{
+    const cmsCIExyY d65 = { 0.3127, 0.3290, 1.0 };
+    const cmsCIExyYTRIPLE primaries = {
+        { 0.6400, 0.3300, 1.0 },
+        { 0.3000, 0.6000, 1.0 },
+        { 0.1500, 0.0600, 1.0 }
+    };
+
+    cmsToneCurve* linear = cmsBuildGamma(NULL, 1.0);
+    cmsToneCurve* curves[3] = { linear, linear, linear };
+
+    cmsHPROFILE profile = cmsCreateRGBProfile(&d65, &primaries, curves);
+    cmsFreeToneCurve(linear);
+
+    return profile;
+}
+}
+
+const char* const IccManager::SRGB = "<sRGB>";
+const char* const IccManager::LINEAR_SRGB = "<linear sRGB>";
+
+IccManager& IccManager::instance()
+{
+    static IccManager manager;
+    return manager;
+}
+
+IccManager::IccManager()
+{}
+
+bool IccManager::TransformKey::operator<(const TransformKey& other) const
+{
+    if ( m_input != other.m_input ) return m_input < other.m_input;
+    if ( m_output != other.m_output ) return m_output < other.m_output;
+    if ( m_proofing != other.m_proofing ) return m_proofing < other.m_proofing;
+    if ( m_inputFormat != other.m_inputFormat ) return m_inputFormat < other.m_inputFormat;
+    if ( m_outputFormat != other.m_outputFormat ) return m_outputFormat < other.m_outputFormat;
+    if ( m_intent != other.m_intent ) return m_intent < other.m_intent;
+    if ( m_proofingIntent != other.m_proofingIntent ) return m_proofingIntent < other.m_proofingIntent;
+    return m_flags < other.m_flags;
+}
+
+IccProfilePtr IccManager::openProfile(const std::string& name)
+{
+    std::map<std::string, IccProfilePtr>::const_iterator it = m_profiles.find(name);
+    if ( it != m_profiles.end() )
+    {
+        return it->second;
+    }
+
+    cmsHPROFILE handle = NULL;
+    if ( name == SRGB )
+    {
+        handle = cmsCreate_sRGBProfile();
+    }
+    else if ( name == LINEAR_SRGB )
+    {
+        handle = createLinearSRGBProfile();
+    }
+    else
+    {
+        handle = cmsOpenProfileFromFile(name.c_str(), "r");
+    }
+
+    if ( !handle )
+    {
+#ifndef NDEBUG
+        std::clog << "IccManager: cannot open profile " << name << "\n";
+#endif
+        // failures are not cached, the file may appear later
+        return IccProfilePtr();
+    }
+
+    IccProfilePtr profile(handle, closeProfile);
+    m_profiles[name] = profile;
+    return profile;
+}
+
+IccProfilePtr IccManager::profile(const std::string& name)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return openProfile(name);
+}
+
+const std::vector<char>& IccManager::sRGBProfileData()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if ( m_sRGBData.empty() )
+    {
+        IccProfilePtr sRGB = openProfile(SRGB);
+
+        cmsUInt32Number profileSize = 0;
+        cmsSaveProfileToMem(sRGB.get(), NULL, &profileSize);    // get the size
+        m_sRGBData.resize(profileSize);
+        cmsSaveProfileToMem(sRGB.get(), m_sRGBData.data(), &profileSize);
+    }
+    return m_sRGBData;
+}
+
+IccTransformPtr IccManager::getTransform(const TransformKey& key)
+{
+    std::map<TransformKey, IccTransformPtr>::const_iterator it = m_transforms.find(key);
+    if ( it != m_transforms.end() )
+    {
+        return it->second;
+    }
+
+    IccProfilePtr input = openProfile(key.m_input);
+    IccProfilePtr output = openProfile(key.m_output);
+    if ( !input || !output )
+    {
+        return IccTransformPtr();
+    }
+
+    cmsHTRANSFORM handle = NULL;
+    if ( key.m_proofing.empty() )
+    {
+        handle = cmsCreateTransform(input.get(), key.m_inputFormat,
+                                    output.get(), key.m_outputFormat,
+                                    key.m_intent, key.m_flags);
+    }
+    else
+    {
+        IccProfilePtr proofing = openProfile(key.m_proofing);
+        if ( !proofing )
+        {
+            return IccTransformPtr();
+        }
+
+        // the alarm codes are copied in the transform when it is built
+        cmsUInt16Number alarmCodes[cmsMAXCHANNELS] = { 0 };
+        alarmCodes[1] = 0xFFFF;
+        cmsSetAlarmCodes(alarmCodes);
+
+        handle = cmsCreateProofingTransform(input.get(), key.m_inputFormat,
+                                            output.get(), key.m_outputFormat,
+                                            proofing.get(),
+                                            key.m_intent, key.m_proofingIntent,
+                                            key.m_flags);
+    }
+
+    if ( !handle )
+    {
+        return IccTransformPtr();
+    }
+
+    IccTransformPtr transform(handle, deleteTransform);
+    m_transforms[key] = transform;
+    return transform;
+}
+
+IccTransformPtr IccManager::transform(const std::string& input, cmsUInt32Number inputFormat,
+                                      const std::string& output, cmsUInt32Number outputFormat,
+                                      cmsUInt32Number intent, cmsUInt32Number flags)
+{
+    TransformKey key;
+    key.m_input = input;
+    key.m_output = output;
+    key.m_inputFormat = inputFormat;
+    key.m_outputFormat = outputFormat;
+    key.m_intent = intent;
+    key.m_proofingIntent = 0;
+    key.m_flags = flags;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    return getTransform(key);
+}
+
+IccTransformPtr IccManager::proofingTransform(const std::string& input, cmsUInt32Number inputFormat,
+                                              const std::string& output, cmsUInt32Number outputFormat,
+                                              const std::string& proofing,
+                                              cmsUInt32Number intent, cmsUInt32Number proofingIntent,
+                                              cmsUInt32Number flags)
+{
+    assert( !proofing.empty() );
+
+    TransformKey key;
+    key.m_input = input;
+    key.m_output = output;
+    key.m_proofing = proofing;
+    key.m_inputFormat = inputFormat;
+    key.m_outputFormat = outputFormat;
+    key.m_intent = intent;
+    key.m_proofingIntent = proofingIntent;
+    key.m_flags = flags;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    return getTransform(key);
+}
+
+IccLut8Ptr IccManager::lut8(const IccTransformPtr& xform)
+{
+    assert( xform );
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::pair<IccTransformPtr, IccLut8Ptr>& entry = m_luts[xform.get()];
+    if ( !entry.second )
+    {
+        entry.first = xform;
+        entry.second = std::make_shared<IccLut8>(xform);
+    }
+    return entry.second;
+}
+
+void IccManager::clear()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_luts.clear();
+    m_transforms.clear();
+    m_profiles.clear();
+}
+
+IccLut8::IccLut8(const IccTransformPtr& xform)
+    : m_table(4*GRID_SIZE*GRID_SIZE*GRID_SIZE)
+{
+    assert( xform );
+
+    // one BGRA row of nodes per (r, g)
+#pragma omp parallel for schedule(dynamic)
+    for (int rg = 0; rg < GRID_SIZE*GRID_SIZE; ++rg)
+    {
+        unsigned char* row = &m_table[4*rg*GRID_SIZE];
+        for (int b = 0; b < GRID_SIZE; ++b)
+        {
+            row[4*b] = static_cast<unsigned char>(b*GRID_STEP);
+            row[4*b + 1] = static_cast<unsigned char>((rg % GRID_SIZE)*GRID_STEP);
+            row[4*b + 2] = static_cast<unsigned char>((rg / GRID_SIZE)*GRID_STEP);
+            row[4*b + 3] = 0;
+        }
+        cmsDoTransform(xform.get(), row, row, GRID_SIZE);
+    }
+}
+
+void IccLut8::apply(unsigned char* pixels, size_t bytesPerLine,
+                    size_t width, size_t height) const
+{
+    // offsets of the neighbours of a node, in bytes
+    const int dr = 4*GRID_SIZE*GRID_SIZE;
+    const int dg = 4*GRID_SIZE;
+    const int db = 4;
+
+    // node below every 8 bit value and position in the cell; 255 sits on
+    // the far side of the last cell
+    int node[256];
+    int frac[256];
+    for (int v = 0; v < 256; ++v)
+    {
+        node[v] = std::min(v/GRID_STEP, GRID_SIZE - 2);
+        frac[v] = v - node[v]*GRID_STEP;
+    }
+
+    const unsigned char* table = m_table.data();
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < static_cast<int>(height); band += ROWS_PER_BAND)
+    {
+        const int bandEnd = std::min(band + ROWS_PER_BAND, static_cast<int>(height));
+        for (int y = band; y < bandEnd; ++y)
+        {
+            unsigned char* pixel = pixels + y*bytesPerLine;
+            for (size_t x = 0; x < width; ++x, pixel += 4)
+            {
+                const int b = pixel[0];
+                const int g = pixel[1];
+                const int r = pixel[2];
+
+                const int fr = frac[r];
+                const int fg = frac[g];
+                const int fb = frac[b];
+
+                const unsigned char* c000 = table + node[r]*dr + node[g]*dg + node[b]*db;
+                const unsigned char* c111 = c000 + dr + dg + db;
+
+                // the cell is split in 6 tetrahedra along its diagonal
+                const unsigned char* c1;
+                const unsigned char* c2;
+                int w0, w1, w2, w3;
+                if ( fr >= fg )
+                {
+                    if ( fg >= fb )         // r >= g >= b
+                    {
+                        c1 = c000 + dr; c2 = c000 + dr + dg;
+                        w0 = GRID_STEP - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb;
+                    }
+                    else if ( fr >= fb )    // r >= b > g
+                    {
+                        c1 = c000 + dr; c2 = c000 + dr + db;
+                        w0 = GRID_STEP - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg;
+                    }
+                    else                    // b > r >= g
+                    {
+                        c1 = c000 + db; c2 = c000 + dr + db;
+                        w0 = GRID_STEP - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg;
+                    }
+                }
+                else
+                {
+                    if ( fr >= fb )         // g > r >= b
+                    {
+                        c1 = c000 + dg; c2 = c000 + dr + dg;
+                        w0 = GRID_STEP - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb;
+                    }
+                    else if ( fg >= fb )    // g >= b > r
+                    {
+                        c1 = c000 + dg; c2 = c000 + dg + db;
+                        w0 = GRID_STEP - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr;
+                    }
+                    else                    // b > g > r
+                    {
+                        c1 = c000 + db; c2 = c000 + dg + db;
+                        w0 = GRID_STEP - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr;
+                    }
+                }
+
+                for (int c = 0; c < 3; ++c)
+                {
+                    pixel[c] = static_cast<unsigned char>(
+                                (w0*c000[c] + w1*c1[c] + w2*c2[c] + w3*c111[c] +
+                                 GRID_STEP/2)/GRID_STEP);
+                }
+            }
+        }
+    }
+}
+
+void transformImage(const IccTransformPtr& xform,
+                    const void* in, size_t inBytesPerLine,
+                    void* out, size_t outBytesPerLine,
+                    size_t width, size_t height)
+{
+    assert( xform );
+
+    const char* inBytes = static_cast<const char*>(in);
+    char* outBytes = static_cast<char*>(out);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < static_cast<int>(height); band += ROWS_PER_BAND)
+    {
+        const int bandEnd = std::min(band + ROWS_PER_BAND, static_cast<int>(height));
+        for (int row = band; row < bandEnd; ++row)
+        {
+            cmsDoTransform(xform.get(),
+                           inBytes + row*inBytesPerLine,
+                           outBytes + row*outBytesPerLine,
+                           static_cast<cmsUInt32Number>(width));
+        }
+    }
+}
+
+void transformImage(const IccTransformPtr& xform,
+                    Array2Df& red, Array2Df& green, Array2Df& blue)
+{
+    assert( xform );
+    assert( red.getCols() == green.getCols() && red.getCols() == blue.getCols() );
+    assert( red.getRows() == green.getRows() && red.getRows() == blue.getRows() );
+
+    const size_t width = red.getCols();
+    const int height = static_cast<int>(red.getRows());
+
+#pragma omp parallel
+    {
+        std::vector<float> buffer(3*width);
+
+#pragma omp for schedule(dynamic, ROWS_PER_BAND)
+        for (int row = 0; row < height; ++row)
+        {
+            float* r = red.data() + row*width;
+            float* g = green.data() + row*width;
+            float* b = blue.data() + row*width;
+
+            for (size_t x = 0; x < width; ++x)
+            {
+                buffer[3*x] = r[x];
+                buffer[3*x + 1] = g[x];
+                buffer[3*x + 2] = b[x];
+            }
+
+            cmsDoTransform(xform.get(), buffer.data(), buffer.data(),
+                           static_cast<cmsUInt32Number>(width));
+
+            for (size_t x = 0; x < width; ++x)
+            {
+                r[x] = buffer[3*x];
+                g[x] = buffer[3*x + 1];
+                b[x] = buffer[3*x + 2];
+            }
+        }
+    }
+}
+
+}   // colorspace
+}   // pfs
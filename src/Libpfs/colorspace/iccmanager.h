@@ -0,0 +1,162 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PFS_COLORSPACE_ICCMANAGER_H
+#define PFS_COLORSPACE_ICCMANAGER_H
+
+//! \file iccmanager.h
+//! \brief Cache of ICC profiles and LCMS2 transforms
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <lcms2.h>
+
+#include <Libpfs/array2d_fwd.h>
+
+namespace pfs {
+namespace colorspace {
+
+//! \brief owning handles, shared between the cache and its users
+typedef std::shared_ptr<void> IccProfilePtr;
+typedef std::shared_ptr<void> IccTransformPtr;
+
+//! \brief 8 bit BGRA transform tabulated on a regular grid, evaluated with
+//! tetrahedral interpolation: the same approximation LCMS2 makes for its
+//! optimised 8 bit transforms, without the per pixel overhead of
+//! cmsDoTransform. Used to colour manage the images on screen.
+class IccLut8
+{
+public:
+    //! \brief nodes per channel: 255 = 51*5, so every node is an 8 bit value
+    static const int GRID_SIZE = 52;
+    static const int GRID_STEP = 5;
+
+    //! \param xform transform taking and returning TYPE_BGRA_8 pixels
+    explicit IccLut8(const IccTransformPtr& xform);
+
+    //! \brief transform \a height rows of \a width BGRA pixels in place, in
+    //! parallel. The alpha channel is not changed.
+    void apply(unsigned char* pixels, size_t bytesPerLine,
+               size_t width, size_t height) const;
+
+private:
+    // BGRA per node, index ((r*GRID_SIZE + g)*GRID_SIZE + b)
+    std::vector<unsigned char> m_table;
+};
+typedef std::shared_ptr<const IccLut8> IccLut8Ptr;
+
+//! \brief Opens every ICC profile and builds every transform only once.
+//!
+//! Profiles are identified by their path, or by one of the names of the
+//! built-in profiles (IccManager::SRGB, IccManager::LINEAR_SRGB); transforms
+//! by their profiles, pixel formats, intents and flags. The handles returned
+//! stay valid after clear(), which only drops the references of the cache.
+//! All the members are thread safe; LCMS2 transforms can be shared between
+//! threads.
+class IccManager
+{
+public:
+    //! \brief built-in sRGB profile
+    static const char* const SRGB;
+    //! \brief built-in sRGB primaries with a linear transfer curve, the
+    //! colour space of the HDR frames
+    static const char* const LINEAR_SRGB;
+
+    static IccManager& instance();
+
+    //! \return profile \a name, NULL if it cannot be opened
+    IccProfilePtr profile(const std::string& name);
+
+    //! \return built-in sRGB profile serialised, to be embedded in files
+    const std::vector<char>& sRGBProfileData();
+
+    //! \return transform from \a input to \a output, NULL if it cannot be
+    //! built
+    IccTransformPtr transform(const std::string& input, cmsUInt32Number inputFormat,
+                              const std::string& output, cmsUInt32Number outputFormat,
+                              cmsUInt32Number intent, cmsUInt32Number flags = 0);
+
+    //! \return transform from \a input to \a output simulating \a proofing,
+    //! NULL if it cannot be built. Gamut alarms are drawn in green.
+    IccTransformPtr proofingTransform(const std::string& input, cmsUInt32Number inputFormat,
+                                      const std::string& output, cmsUInt32Number outputFormat,
+                                      const std::string& proofing,
+                                      cmsUInt32Number intent, cmsUInt32Number proofingIntent,
+                                      cmsUInt32Number flags);
+
+    //! \return table of \a xform (see IccLut8), built on the first request
+    IccLut8Ptr lut8(const IccTransformPtr& xform);
+
+    //! \brief forget all the profiles and transforms (e.g. the files changed)
+    void clear();
+
+private:
+    IccManager();
+    IccManager(const IccManager&);
+    IccManager& operator=(const IccManager&);
+
+    struct TransformKey
+    {
+        std::string m_input;
+        std::string m_output;
+        std::string m_proofing;
+        cmsUInt32Number m_inputFormat;
+        cmsUInt32Number m_outputFormat;
+        cmsUInt32Number m_intent;
+        cmsUInt32Number m_proofingIntent;
+        cmsUInt32Number m_flags;
+
+        bool operator<(const TransformKey& other) const;
+    };
+
+    IccProfilePtr openProfile(const std::string& name);
+    IccTransformPtr getTransform(const TransformKey& key);
+
+    boost::mutex m_mutex;
+    std::map<std::string, IccProfilePtr> m_profiles;
+    std::map<TransformKey, IccTransformPtr> m_transforms;
+    // the tables keep their transform alive, so its address is a valid key
+    std::map<void*, std::pair<IccTransformPtr, IccLut8Ptr> > m_luts;
+    std::vector<char> m_sRGBData;
+};
+
+//! \brief apply \a xform to an image of \a height rows of \a width pixels.
+//! Bands of rows are transformed in parallel; \a in and \a out can be the same
+//! buffer if the two pixel formats have the same size.
+void transformImage(const IccTransformPtr& xform,
+                    const void* in, size_t inBytesPerLine,
+                    void* out, size_t outBytesPerLine,
+                    size_t width, size_t height);
+
+//! \brief float pipeline: apply \a xform, built with TYPE_RGB_FLT on both
+//! sides, to three planar channels in place. Values above 1 are preserved by
+//! matrix-shaper profiles (LCMS2 unbounded mode).
+void transformImage(const IccTransformPtr& xform,
+                    Array2Df& red, Array2Df& green, Array2Df& blue);
+
+}   // colorspace
+}   // pfs
+
+#endif // PFS_COLORSPACE_ICCMANAGER_H
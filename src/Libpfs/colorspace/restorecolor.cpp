@@ -0,0 +1,35 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <Libpfs/colorspace/restorecolor.h>
+
+namespace pfs {
+namespace colorspace {
+
+void restoreColor(Array2Df& R, Array2Df& G, Array2Df& B,
+                  const Array2Df& Y, const Array2Df& L, float saturation)
+{
+    restoreColor(CS_RGB, R, G, B,
+                 LuminanceArray(Y), ToneArray(L, saturation), TransferLinear(),
+                 CS_RGB, R, G, B);
+}
+
+}   // colorspace
+}   // pfs
@@ -0,0 +1,141 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PFS_COLORSPACE_RESTORECOLOR_H
+#define PFS_COLORSPACE_RESTORECOLOR_H
+
+//! \brief Colour of a tone mapped image, from the colour ratios of the input
+//!
+//! Most operators tone map the luminance only, the colour is then restored
+//! pixel by pixel:
+//!
+//!     C_out = transfer( max(C/Y, minRatio)^s * L )
+//!
+//! where C is one of the linear RGB channels of the input, Y its luminance,
+//! L the tone mapped luminance and s the saturation. restoreColor() does it
+//! in a single parallel pass over the frame, converting the input and the
+//! output between RGB and XYZ on the fly. The operators provide the
+//! luminance, the tone mapped luminance and the transfer function as
+//! functors, so they are inlined in the loop.
+
+#include <cstddef>
+
+#include <Libpfs/array2d_fwd.h>
+#include <Libpfs/colorspace/colorspace.h>
+
+namespace pfs {
+namespace colorspace {
+
+//! \brief luminance of the pixels, read from an array: it must be the
+//! luminance the tone mapped one was computed from
+struct LuminanceArray
+{
+    //! \param minimum if positive, the luminance is clamped to it
+    explicit LuminanceArray(const Array2Df& Y, float minimum = 0.f);
+    explicit LuminanceArray(const float* Y, float minimum = 0.f);
+
+    float operator()(size_t i, float r, float g, float b) const;
+
+    const float* m_Y;
+    float m_minimum;
+};
+
+//! \brief luminance of the pixels, from their RGB values
+struct LuminanceRGB
+{
+    float operator()(size_t i, float r, float g, float b) const;
+};
+
+//! \brief tone mapped luminance of the pixels, read from an array, with a
+//! constant saturation
+struct ToneArray
+{
+    //! \param minimum if positive, the luminance is clamped to it
+    explicit ToneArray(const Array2Df& L, float saturation = 1.f,
+                       float minimum = 0.f);
+
+    void operator()(size_t i, float Y, float& L, float& s) const;
+
+    const float* m_L;
+    float m_saturation;
+    float m_minimum;
+};
+
+//! \brief output values as they are
+struct TransferLinear
+{
+    float operator()(float v) const;
+};
+
+//! \brief output values clamped to [min, max]
+struct TransferClamp
+{
+    TransferClamp(float min = 0.f, float max = 1.f);
+
+    float operator()(float v) const;
+
+    float m_min;
+    float m_max;
+};
+
+//! \brief Restore the colour of the tone mapped image, in parallel.
+//!
+//! \param inCS colour space of the input channels, CS_RGB or CS_XYZ
+//! \param luminance functor float(size_t i, float r, float g, float b),
+//! luminance of the pixel \a i, given its linear RGB values. A pixel with
+//! luminance <= 0 has no colour: its ratios are \a minRatio.
+//! \param tone functor void(size_t i, float Y, float& L, float& s), tone mapped
+//! luminance and saturation of the pixel \a i, given its luminance
+//! \param transfer functor float(float v), applied to every output value, in
+//! the output colour space
+//! \param outCS colour space of the output channels, CS_RGB or CS_XYZ. The
+//! output can be the input.
+//! \param minRatio lower bound of the ratios C/Y, before the saturation is
+//! applied
+template <typename Luminance, typename Tone, typename Transfer>
+void restoreColor(ColorSpace inCS,
+                  const Array2Df& in1, const Array2Df& in2, const Array2Df& in3,
+                  const Luminance& luminance, const Tone& tone,
+                  const Transfer& transfer,
+                  ColorSpace outCS,
+                  Array2Df& out1, Array2Df& out2, Array2Df& out3,
+                  float minRatio = 0.f);
+
+//! \brief Restore the colour of the \a size pixels of the channels
+//! \a in1, \a in2, \a in3 into \a out1, \a out2, \a out3
+template <typename Luminance, typename Tone, typename Transfer>
+void restoreColor(ColorSpace inCS,
+                  const float* in1, const float* in2, const float* in3,
+                  const Luminance& luminance, const Tone& tone,
+                  const Transfer& transfer,
+                  ColorSpace outCS,
+                  float* out1, float* out2, float* out3, size_t size,
+                  float minRatio = 0.f);
+
+//! \brief Restore the colour, with the luminance and the tone mapped
+//! luminance in \a Y and \a L: RGB in, RGB out, no transfer function
+void restoreColor(Array2Df& R, Array2Df& G, Array2Df& B,
+                  const Array2Df& Y, const Array2Df& L, float saturation = 1.f);
+
+}   // colorspace
+}   // pfs
+
+#include <Libpfs/colorspace/restorecolor.hxx>
+#endif // PFS_COLORSPACE_RESTORECOLOR_H
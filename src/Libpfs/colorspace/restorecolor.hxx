@@ -0,0 +1,225 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PFS_COLORSPACE_RESTORECOLOR_HXX
+#define PFS_COLORSPACE_RESTORECOLOR_HXX
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <Libpfs/array2d.h>
+#include <Libpfs/exception.h>
+#include <Libpfs/colorspace/restorecolor.h>
+#include <Libpfs/colorspace/xyz.h>
+
+namespace pfs {
+namespace colorspace {
+
+inline
+LuminanceArray::LuminanceArray(const Array2Df& Y, float minimum)
+    : m_Y(Y.data())
+    , m_minimum(minimum)
+{}
+
+inline
+LuminanceArray::LuminanceArray(const float* Y, float minimum)
+    : m_Y(Y)
+    , m_minimum(minimum)
+{}
+
+inline
+float LuminanceArray::operator()(size_t i, float, float, float) const
+{
+    return (m_minimum > 0.f) ? std::max(m_Y[i], m_minimum) : m_Y[i];
+}
+
+inline
+float LuminanceRGB::operator()(size_t, float r, float g, float b) const
+{
+    return rgb2xyzD65Mat[1][0]*r + rgb2xyzD65Mat[1][1]*g + rgb2xyzD65Mat[1][2]*b;
+}
+
+inline
+ToneArray::ToneArray(const Array2Df& L, float saturation, float minimum)
+    : m_L(L.data())
+    , m_saturation(saturation)
+    , m_minimum(minimum)
+{}
+
+inline
+void ToneArray::operator()(size_t i, float, float& L, float& s) const
+{
+    L = (m_minimum > 0.f) ? std::max(m_L[i], m_minimum) : m_L[i];
+    s = m_saturation;
+}
+
+inline
+float TransferLinear::operator()(float v) const
+{
+    return v;
+}
+
+inline
+TransferClamp::TransferClamp(float min, float max)
+    : m_min(min)
+    , m_max(max)
+{}
+
+inline
+float TransferClamp::operator()(float v) const
+{
+    return std::min(std::max(v, m_min), m_max);
+}
+
+namespace detail {
+
+//! \brief in place conversion of a pixel, only when \a Convert is true
+template <bool Convert>
+inline
+void convertPixel(const float (&mat)[3][3], float& c1, float& c2, float& c3)
+{
+    if ( !Convert ) return;
+
+    const float o1 = mat[0][0]*c1 + mat[0][1]*c2 + mat[0][2]*c3;
+    const float o2 = mat[1][0]*c1 + mat[1][1]*c2 + mat[1][2]*c3;
+    const float o3 = mat[2][0]*c1 + mat[2][1]*c2 + mat[2][2]*c3;
+    c1 = o1;
+    c2 = o2;
+    c3 = o3;
+}
+
+template <bool InXYZ, bool OutXYZ,
+          typename Luminance, typename Tone, typename Transfer>
+void restoreColor(const float* in1, const float* in2, const float* in3,
+                  const Luminance& luminance, const Tone& tone,
+                  const Transfer& transfer,
+                  float* out1, float* out2, float* out3, long size,
+                  float minRatio)
+{
+#pragma omp parallel for schedule(static) default(none) \
+    shared(in1, in2, in3, luminance, tone, transfer, out1, out2, out3, size, minRatio, \
+           xyz2rgbD65Mat, rgb2xyzD65Mat)
+    for (long i = 0; i < size; ++i)
+    {
+        float r = in1[i];
+        float g = in2[i];
+        float b = in3[i];
+        convertPixel<InXYZ>(xyz2rgbD65Mat, r, g, b);
+
+        const float Y = luminance(i, r, g, b);
+        float L;
+        float s;
+        tone(i, Y, L, s);
+
+        const float invY = (Y > 0.f) ? 1.f/Y : 0.f;
+        r = std::max(r*invY, minRatio);
+        g = std::max(g*invY, minRatio);
+        b = std::max(b*invY, minRatio);
+        if ( s != 1.f )
+        {
+            r = std::pow(r, s);
+            g = std::pow(g, s);
+            b = std::pow(b, s);
+        }
+        r *= L;
+        g *= L;
+        b *= L;
+
+        convertPixel<OutXYZ>(rgb2xyzD65Mat, r, g, b);
+        out1[i] = transfer(r);
+        out2[i] = transfer(g);
+        out3[i] = transfer(b);
+    }
+}
+
+}   // detail
+
+template <typename Luminance, typename Tone, typename Transfer>
+void restoreColor(ColorSpace inCS,
+                  const float* in1, const float* in2, const float* in3,
+                  const Luminance& luminance, const Tone& tone,
+                  const Transfer& transfer,
+                  ColorSpace outCS,
+                  float* out1, float* out2, float* out3, size_t size,
+                  float minRatio)
+{
+    if ( (inCS != CS_RGB && inCS != CS_XYZ) ||
+         (outCS != CS_RGB && outCS != CS_XYZ) )
+    {
+        throw pfs::Exception("restoreColor: unsupported color space");
+    }
+
+    const long pixels = static_cast<long>(size);
+    if ( inCS == CS_XYZ )
+    {
+        if ( outCS == CS_XYZ )
+        {
+            detail::restoreColor<true, true>(in1, in2, in3,
+                                             luminance, tone, transfer,
+                                             out1, out2, out3, pixels, minRatio);
+        }
+        else
+        {
+            detail::restoreColor<true, false>(in1, in2, in3,
+                                              luminance, tone, transfer,
+                                              out1, out2, out3, pixels, minRatio);
+        }
+    }
+    else
+    {
+        if ( outCS == CS_XYZ )
+        {
+            detail::restoreColor<false, true>(in1, in2, in3,
+                                              luminance, tone, transfer,
+                                              out1, out2, out3, pixels, minRatio);
+        }
+        else
+        {
+            detail::restoreColor<false, false>(in1, in2, in3,
+                                               luminance, tone, transfer,
+                                               out1, out2, out3, pixels, minRatio);
+        }
+    }
+}
+
+template <typename Luminance, typename Tone, typename Transfer>
+void restoreColor(ColorSpace inCS,
+                  const Array2Df& in1, const Array2Df& in2, const Array2Df& in3,
+                  const Luminance& luminance, const Tone& tone,
+                  const Transfer& transfer,
+                  ColorSpace outCS,
+                  Array2Df& out1, Array2Df& out2, Array2Df& out3,
+                  float minRatio)
+{
+    assert( in1.size() == in2.size() && in2.size() == in3.size() );
+    assert( out1.size() == in1.size() && out2.size() == in1.size() &&
+            out3.size() == in1.size() );
+
+    restoreColor(inCS, in1.data(), in2.data(), in3.data(),
+                 luminance, tone, transfer,
+                 outCS, out1.data(), out2.data(), out3.data(), in1.size(),
+                 minRatio);
+}
+
+}   // colorspace
+}   // pfs
+
+#endif // PFS_COLORSPACE_RESTORECOLOR_HXX
@@ -21,6 +21,9 @@
 
 #include <Libpfs/io/fitsreader.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <boost/algorithm/minmax_element.hpp>
 
 #include <boost/lexical_cast.hpp>
@@ -170,6 +173,74 @@ void FitsReader::close()
     m_data.reset();
 }
 
+namespace
+{
+// pixels read from the file per call: whole rows, big enough to let CFITSIO
+// read the data in large contiguous chunks, small enough to stay in the cache
+// while they are converted
+const size_t FITS_BLOCK_PIXELS = 1 << 18;
+
+template <typename T>
+struct FitsDataType;
+
+template <> struct FitsDataType<unsigned char> { enum { value = TBYTE }; };
+template <> struct FitsDataType<short> { enum { value = TSHORT }; };
+template <> struct FitsDataType<int> { enum { value = TINT }; };
+template <> struct FitsDataType<LONGLONG> { enum { value = TLONGLONG }; };
+template <> struct FitsDataType<float> { enum { value = TFLOAT }; };
+template <> struct FitsDataType<double> { enum { value = TDOUBLE }; };
+
+//! \brief read the image in blocks of rows of its own data type, then apply
+//! BSCALE and BZERO and write the three channels in a single parallel pass
+template <typename T>
+void readFitsImage(FitsReaderData& data, size_t width, size_t height,
+                   Channel& X, Channel& Y, Channel& Z)
+{
+    // CFITSIO would scale the values on its own, converting them to T
+    double nullscale = 1.0;
+    double nullzero = 0.0;
+    fits_set_bscale(data.m_ptr, nullscale, nullzero, &data.m_status);
+
+    const size_t blockRows = std::max<size_t>(1, FITS_BLOCK_PIXELS / width);
+    std::vector<T> buffer(blockRows*width);
+
+    const float bscale = data.m_bscale;
+    const float bzero  = data.m_bzero;
+    T nullval = 0; // don't check for null values in the image
+    int anynull;
+
+    for (size_t row = 0; row < height; row += blockRows)
+    {
+        const size_t rows = std::min(blockRows, height - row);
+        const int count = static_cast<int>(rows*width);
+
+        if ( fits_read_img(data.m_ptr, FitsDataType<T>::value, row*width + 1, count,
+                           &nullval, buffer.data(), &anynull, &data.m_status) )
+        {
+            char error_string[FLEN_ERRMSG];
+            fits_get_errstatus(data.m_status, error_string);
+            throw ReadException("Cannot read rows " +
+                                boost::lexical_cast<std::string>(row) + "-" +
+                                boost::lexical_cast<std::string>(row + rows - 1) +
+                                ". " + error_string);
+        }
+
+        const T* in = buffer.data();
+        float* x = X.data() + row*width;
+        float* y = Y.data() + row*width;
+        float* z = Z.data() + row*width;
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < count; ++i)
+        {
+            const float v = static_cast<float>(bscale*in[i] + bzero);
+            x[i] = v;
+            y[i] = v;
+            z[i] = v;
+        }
+    }
+}
+}
+
 void FitsReader::read(Frame &frame, const Params&)
 {
     if ( !isOpen() ) open();
@@ -179,148 +250,33 @@ void FitsReader::read(Frame &frame, const Params&)
     std::cout << "contents.size (pixels) = " << width()*height() << std::endl;
 #endif
 
-    long fpixel = 1;
-    long nbuffer = width();
-    int anynull;
-
     Frame tempFrame(width(), height());
     Channel *Xc, *Yc, *Zc;
     tempFrame.createXYZChannels(Xc, Yc, Zc);
 
-    Channel::iterator it = Xc->begin();
-
-    float bscale = m_data->m_bscale;
-    float bzero  = m_data->m_bzero;
-
-    if (m_data->m_format == FLOAT_IMG)
+    switch (m_data->m_format)
     {
-        std::vector<float> buffer(width());
-        float nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TFLOAT, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("FLOAT: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer.begin(),
-                    [bscale, bzero](float c) { return bscale * c + bzero; });
-            it = std::copy(buffer.begin(), buffer.end(), it);
-       }
-    }
-    else if (m_data->m_format == DOUBLE_IMG)
-    {
-        std::vector<double> buffer(width());
-        double nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TDOUBLE, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("DOUBLE: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer.begin(),
-                    [bscale, bzero](double c) { return bscale * c + bzero; });
-            it = std::copy(buffer.begin(), buffer.end(), it);
-        }
-    }
-    else if (m_data->m_format == BYTE_IMG)
-    {
-        std::vector<short> buffer(width());
-        std::vector<float> buffer_flt(width());
-        short nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TINT, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("BYTE: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer_flt.begin(),
-                    [bscale, bzero](short c) { return bscale * c + bzero; });
-            it = std::copy(buffer_flt.begin(), buffer_flt.end(), it);
-        }
-    }
-    else if (m_data->m_format == SHORT_IMG)
-    {
-        std::vector<int> buffer(width());
-        std::vector<float> buffer_flt(width());
-        int nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TINT, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("SHORT: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer_flt.begin(),
-                    [bscale, bzero](int c) { return bscale * c + bzero; });
-            it = std::copy(buffer_flt.begin(), buffer_flt.end(), it);
-        }
-    }
-    else if (m_data->m_format == LONG_IMG)
-    {
-        std::vector<long> buffer(width());
-        std::vector<float> buffer_flt(width());
-        long nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TLONG, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("LONG: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer_flt.begin(),
-                    [bscale, bzero](long c) { return bscale * c + bzero; });
-            it = std::copy(buffer_flt.begin(), buffer_flt.end(), it);
-        }
-    }
-    else if (m_data->m_format == LONGLONG_IMG)
-    {
-        std::vector<long long> buffer(width());
-        std::vector<float> buffer_flt(width());
-        long long nullval = 0; // don't check for null values in the image
-        for (size_t i = 0; i < height(); ++i, fpixel += nbuffer)
-        {
-            if (fits_read_img(m_data->m_ptr, TLONGLONG, fpixel, nbuffer, &nullval,
-                              buffer.data(), &anynull, &m_data->m_status) )
-            {
-                char error_string[FLEN_ERRMSG];
-                fits_get_errstatus(m_data->m_status, error_string);
-                fits_close_file(m_data->m_ptr, &m_data->m_status);
-                throw std::runtime_error("LONG: Cannot read strip " +
-                                         boost::lexical_cast<std::string>(i) + ". " + error_string);
-            }
-
-            std::transform(buffer.begin(), buffer.end(), buffer_flt.begin(),
-                    [bscale, bzero](long long c) { return bscale * c + bzero; });
-            it = std::copy(buffer_flt.begin(), buffer_flt.end(), it);
-        }
+    case BYTE_IMG:
+        readFitsImage<unsigned char>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    case SHORT_IMG:
+        readFitsImage<short>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    case LONG_IMG:
+        readFitsImage<int>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    case LONGLONG_IMG:
+        readFitsImage<LONGLONG>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    case FLOAT_IMG:
+        readFitsImage<float>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    case DOUBLE_IMG:
+        readFitsImage<double>(*m_data, width(), height(), *Xc, *Yc, *Zc);
+        break;
+    default:
+        throw ReadException("Unsupported BITPIX " +
+                            boost::lexical_cast<std::string>(m_data->m_format));
     }
 
 #ifndef NDEBUG
@@ -330,12 +286,13 @@ void FitsReader::read(Frame &frame, const Params&)
     std::cout << "FITS max luminance = " << *minmax.second << std::endl;
 #endif
 
-    // copy into other channels
-    std::copy(Xc->begin(), Xc->end(), Yc->begin());
-    std::copy(Xc->begin(), Xc->end(), Zc->begin());
-
     frame.swap(tempFrame);
 }
 
+bool FitsReader::isThreadSafe()
+{
+    return fits_is_reentrant() != 0;
+}
+
 }   // io
 }   // pfs
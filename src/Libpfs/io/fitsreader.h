@@ -55,6 +55,10 @@ public:
     void read(Frame &frame, const Params &);
     int  getBitDepth() const { return 20; }
 
+    //! \return true if CFITSIO has been built to read different files from
+    //! different threads at the same time
+    static bool isThreadSafe();
+
 private:
     std::unique_ptr<FitsReaderData> m_data;
 };
@@ -30,6 +30,7 @@
 #include <sstream>
 
 #include <stdio.h>
+#include <omp.h>
 #include <lcms2.h>
 #include <jpeglib.h>
 
@@ -37,7 +38,7 @@
 #include <Libpfs/colorspace/rgbremapper.h>
 #include <Libpfs/colorspace/normalizer.h>
 #include <Libpfs/utils/resourcehandlerstdio.h>
-#include <Libpfs/utils/resourcehandlerlcms.h>
+#include <Libpfs/colorspace/iccmanager.h>
 #include <Libpfs/utils/transform.h>
 #include <Libpfs/utils/chain.h>
 #include <Libpfs/utils/clamp.h>
@@ -158,6 +159,7 @@ struct JpegWriterParams
         , minLuminance_(0.f)
         , maxLuminance_(1.f)
         , luminanceMapping_(MAP_LINEAR)
+        , targetSize_(0)
     {}
 
     void parse(const Params& params)
@@ -181,6 +183,10 @@ struct JpegWriterParams
                 luminanceMapping_ = it->second.as<RGBMappingType>(luminanceMapping_);
                 continue;
             }
+            if ( it->first == "target_size" ) {
+                targetSize_ = it->second.as<size_t>(targetSize_);
+                continue;
+            }
         }
     }
 
@@ -188,6 +194,7 @@ struct JpegWriterParams
     float minLuminance_;
     float maxLuminance_;
     RGBMappingType luminanceMapping_;
+    size_t targetSize_;     // in bytes, 0: use quality_
 };
 
 ostream& operator<<(ostream& out, const JpegWriterParams& params)
@@ -197,235 +204,421 @@ ostream& operator<<(ostream& out, const JpegWriterParams& params)
     ss << "quality: " << params.quality_ << ", ";
     ss << "min_luminance: " << params.minLuminance_ << ", ";
     ss << "max_luminance: " << params.maxLuminance_ << ", ";
-    ss << "mapping_method: " << params.luminanceMapping_ << "]";
+    ss << "mapping_method: " << params.luminanceMapping_ << ", ";
+    ss << "target_size: " << params.targetSize_ << "]";
 
     return (out << ss.str());
 }
 
-class JpegWriterImpl
+//! \ref http://www.andrewewhite.net/wordpress/2010/04/07/simple-cc-jpeg-writer-part-2-write-to-buffer-in-memory/
+typedef std::vector<JOCTET> JpegBuffer;
+
+#define BLOCK_SIZE 16384
+
+//! \brief libjpeg destination appending to a JpegBuffer
+struct JpegBufferDestination
 {
-public:
-    JpegWriterImpl() {}
-    virtual ~JpegWriterImpl() {}
+    struct jpeg_destination_mgr m_dmgr;     // must be the first member
+    JpegBuffer* m_buffer;
+};
 
-    virtual void setupJpegDest(j_compress_ptr cinfo, const std::string& filename) = 0;
-    virtual void close() = 0;
-    virtual size_t getFileSize() const = 0;
+static
+JpegBuffer& getBuffer(j_compress_ptr cinfo)
+{
+    return *reinterpret_cast<JpegBufferDestination*>(cinfo->dest)->m_buffer;
+}
 
-    bool write(const pfs::Frame &frame, const JpegWriterParams& params,
-               const std::string& filename)
+static
+void my_init_destination(j_compress_ptr cinfo)
+{
+    JpegBuffer& myBuffer = getBuffer(cinfo);
+
+    myBuffer.resize(BLOCK_SIZE);
+    cinfo->dest->next_output_byte = &myBuffer[0];
+    cinfo->dest->free_in_buffer = myBuffer.size();
+}
+
+static
+boolean my_empty_output_buffer(j_compress_ptr cinfo)
+{
+    JpegBuffer& myBuffer = getBuffer(cinfo);
+
+    size_t oldsize = myBuffer.size();
+    myBuffer.resize(oldsize + std::max<size_t>(oldsize/2, BLOCK_SIZE));
+    cinfo->dest->next_output_byte = &myBuffer[oldsize];
+    cinfo->dest->free_in_buffer = myBuffer.size() - oldsize;
+    return true;
+}
+
+static
+void my_term_destination(j_compress_ptr cinfo)
+{
+    JpegBuffer& myBuffer = getBuffer(cinfo);
+
+    myBuffer.resize(myBuffer.size() - cinfo->dest->free_in_buffer);
+}
+#undef BLOCK_SIZE
+
+//! \brief offset of the first byte after the SOS marker segment, where the
+//! entropy coded data starts. If \a sofOffset is not NULL, it receives the
+//! offset of the SOF marker.
+static
+size_t findScanData(const JpegBuffer& buffer, size_t* sofOffset = NULL)
+{
+    size_t pos = 2;     // skip SOI
+    while ( pos + 4 <= buffer.size() && buffer[pos] == 0xFF )
+    {
+        const JOCTET code = buffer[pos + 1];
+        const size_t length = (buffer[pos + 2] << 8) | buffer[pos + 3];
+        if ( code == 0xC0 && sofOffset ) *sofOffset = pos;
+        if ( code == 0xDA ) return pos + 2 + length;
+
+        pos += 2 + length;
+    }
+    throw pfs::io::WriteException("JpegWriter: cannot find the scan data");
+}
+
+//! \brief Encodes a frame as a baseline JPEG, in parallel.
+//!
+//! The frame is cut into horizontal slices of whole MCU rows, that are
+//! remapped and encoded concurrently as separate JPEG streams with identical
+//! tables. Each slice holds exactly one restart interval, so their entropy
+//! coded segments can be joined with RSTn markers under the headers of the
+//! first slice.
+class JpegEncoder
+{
+public:
+    JpegEncoder(const pfs::Frame& frame, const JpegWriterParams& params)
+        : m_frame(frame)
+        , m_params(params)
+        , m_iccProfile(colorspace::IccManager::instance().sRGBProfileData())
+    {}
+
+    //! \brief encodes the frame with quality \a quality into \a output
+    //! \return size of the headers at the beginning of \a output
+    size_t encode(size_t quality, JpegBuffer& output) const
     {
-        cmsUInt32Number cmsProfileSize = 0;
-        utils::ScopedCmsProfile hsRGB( cmsCreate_sRGBProfile() );
+        return encodeRows(quality, std::vector<size_t>(), output);
+    }
 
-        cmsSaveProfileToMem(hsRGB.data(), NULL, &cmsProfileSize);           // get the size
+    //! \brief predicts the highest quality whose output does not exceed
+    //! \a targetSize bytes, encoding a sample of the rows of the frame
+    size_t predictQuality(size_t targetSize) const;
 
-        std::vector<JOCTET> cmsOutputProfile(cmsProfileSize);
+private:
+    // rows of the frame to encode, all of them if empty
+    typedef std::vector<size_t> RowList;
 
-        cmsSaveProfileToMem(hsRGB.data(), cmsOutputProfile.data(), &cmsProfileSize);
+    size_t encodeRows(size_t quality, const RowList& rows, JpegBuffer& output) const;
 
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr errorHandler;
+    void encodeSlice(size_t quality, const RowList& rows,
+                     size_t firstRow, size_t numRows,
+                     unsigned int restartInterval, bool writeHeaders,
+                     JpegBuffer& output) const;
 
-        jpeg_create_compress(&cinfo);
+    const pfs::Frame& m_frame;
+    const JpegWriterParams& m_params;
+    const std::vector<char>& m_iccProfile;
+};
 
-        cinfo.err                        = jpeg_std_error(&errorHandler);
-        errorHandler.error_exit          = my_writer_error_handler;
-        errorHandler.output_message      = my_writer_output_message;
+static
+size_t mcuSize(size_t quality)
+{
+    // no chroma subsampling on high quality factors (see encodeSlice())
+    return (quality >= 70) ? 8 : 16;
+}
 
-        cinfo.image_width           = frame.getWidth();                 // image width and height, in pixels
-        cinfo.image_height          = frame.getHeight();
+void JpegEncoder::encodeSlice(size_t quality, const RowList& rows,
+                              size_t firstRow, size_t numRows,
+                              unsigned int restartInterval, bool writeHeaders,
+                              JpegBuffer& output) const
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr errorHandler;
+
+    cinfo.err                        = jpeg_std_error(&errorHandler);
+    errorHandler.error_exit          = my_writer_error_handler;
+    errorHandler.output_message      = my_writer_output_message;
+
+    jpeg_create_compress(&cinfo);
+
+    try
+    {
+        cinfo.image_width           = m_frame.getWidth();               // image width and height, in pixels
+        cinfo.image_height          = numRows;
         cinfo.input_components      = cinfo.num_components = 3;         // # of color components per pixel
         cinfo.in_color_space        = JCS_RGB;                          // colorspace of input image
         cinfo.jpeg_color_space      = JCS_YCbCr;
-        cinfo.density_unit          = 1;                                // dots/inch
-        cinfo.X_density             = cinfo.Y_density = 72;
 
         jpeg_set_defaults(&cinfo);
         jpeg_set_colorspace(&cinfo, JCS_YCbCr);
 
+        cinfo.density_unit          = 1;                                // dots/inch
+        cinfo.X_density             = cinfo.Y_density = 72;
+        cinfo.write_JFIF_header     = writeHeaders;
+        cinfo.restart_interval      = restartInterval;
+
         // avoid subsampling on high quality factor
-        jpeg_set_quality(&cinfo, params.quality_, 1);
-        if ( params.quality_ >= 70 ) {
+        jpeg_set_quality(&cinfo, quality, 1);
+        if ( quality >= 70 ) {
             for (int i = 0; i < cinfo.num_components; i++) {
                 cinfo.comp_info[i].h_samp_factor = 1;
                 cinfo.comp_info[i].v_samp_factor = 1;
             }
         }
 
-        try
-        {
-            setupJpegDest(&cinfo, filename);
+        JpegBufferDestination destination;
+        destination.m_dmgr.init_destination = my_init_destination;
+        destination.m_dmgr.empty_output_buffer = my_empty_output_buffer;
+        destination.m_dmgr.term_destination = my_term_destination;
+        destination.m_buffer = &output;
+        cinfo.dest = &destination.m_dmgr;
 
-            jpeg_start_compress(&cinfo, true);
+        jpeg_start_compress(&cinfo, true);
 
-            const Channel* rChannel;
-            const Channel* gChannel;
-            const Channel* bChannel;
-            frame.getXYZChannels(rChannel, gChannel, bChannel);
+        if ( writeHeaders )
+        {
+            write_icc_profile(&cinfo,
+                              reinterpret_cast<const JOCTET*>(m_iccProfile.data()),
+                              m_iccProfile.size());
+        }
 
-            write_icc_profile(&cinfo, cmsOutputProfile.data(), cmsProfileSize);
+        const Channel* rChannel;
+        const Channel* gChannel;
+        const Channel* bChannel;
+        m_frame.getXYZChannels(rChannel, gChannel, bChannel);
 
-            // If an exception is raised, this buffer gets automatically destructed!
-            std::vector<JSAMPLE> scanLineOut(cinfo.image_width * cinfo.num_components);
-            JSAMPROW scanLineOutArray[1] = { scanLineOut.data() };
+        std::vector<JSAMPLE> scanLineOut(cinfo.image_width * cinfo.num_components);
+        JSAMPROW scanLineOutArray[1] = { scanLineOut.data() };
 
-            while (cinfo.next_scanline < cinfo.image_height)
-            {
-                // copy line from Frame into scanLineOut
-                utils::transform(
-                            rChannel->row_begin(cinfo.next_scanline),
-                            rChannel->row_end(cinfo.next_scanline),
-                            gChannel->row_begin(cinfo.next_scanline),
-                            bChannel->row_begin(cinfo.next_scanline),
-                            FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data()),
-                            FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data() + 1),
-                            FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data() + 2),
-                            utils::chain(
-                                colorspace::Normalizer(params.minLuminance_, params.maxLuminance_),
-                                utils::CLAMP_F32,
-                                Remapper<JSAMPLE>(params.luminanceMapping_)
-                                )
-                            );
-                jpeg_write_scanlines(&cinfo, scanLineOutArray, 1);
-            }
-        }
-        catch (const std::runtime_error& err)
+        while (cinfo.next_scanline < cinfo.image_height)
         {
-            std::clog << err.what() << std::endl;
-
-            jpeg_destroy_compress(&cinfo);
-
-            return false;
+            const size_t idx = firstRow + cinfo.next_scanline;
+            const size_t row = rows.empty() ? idx : rows[idx];
+
+            // copy line from Frame into scanLineOut
+            utils::transform(
+                        rChannel->row_begin(row),
+                        rChannel->row_end(row),
+                        gChannel->row_begin(row),
+                        bChannel->row_begin(row),
+                        FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data()),
+                        FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data() + 1),
+                        FixedStrideIterator<JSAMPLE*, 3>(scanLineOut.data() + 2),
+                        utils::chain(
+                            colorspace::Normalizer(m_params.minLuminance_, m_params.maxLuminance_),
+                            utils::CLAMP_F32,
+                            Remapper<JSAMPLE>(m_params.luminanceMapping_)
+                            )
+                        );
+            jpeg_write_scanlines(&cinfo, scanLineOutArray, 1);
         }
 
         jpeg_finish_compress(&cinfo);
+    }
+    catch (...)
+    {
         jpeg_destroy_compress(&cinfo);
-
-        close();
-
-        return true;
+        throw;
     }
-};
-
-//! \ref http://www.andrewewhite.net/wordpress/2010/04/07/simple-cc-jpeg-writer-part-2-write-to-buffer-in-memory/
-typedef std::vector<JOCTET> JpegBuffer;
+    jpeg_destroy_compress(&cinfo);
+}
 
-struct JpegWriterImplMemory : public JpegWriterImpl
+size_t JpegEncoder::encodeRows(size_t quality, const RowList& rows, JpegBuffer& output) const
 {
-    typedef std::map<j_compress_ptr, JpegBuffer*> JpegRegistry;
+    const size_t width = m_frame.getWidth();
+    const size_t height = rows.empty() ? m_frame.getHeight() : rows.size();
+    const size_t mcu = mcuSize(quality);
+    const size_t mcusPerRow = std::max<size_t>((width + mcu - 1)/mcu, 1);
+    const size_t mcuRows = (height + mcu - 1)/mcu;
+
+    // a few slices per thread balance the load, and the restart interval
+    // (MCUs in a slice) is a 16 bit field
+    const size_t maxSlices = 4*omp_get_max_threads();
+    size_t mcuRowsPerSlice = (mcuRows + maxSlices - 1)/maxSlices;
+    mcuRowsPerSlice = std::min(mcuRowsPerSlice, 65535/mcusPerRow);
+
+    size_t numSlices = 1;
+    unsigned int restartInterval = 0;
+    if ( mcuRowsPerSlice > 0 && mcuRowsPerSlice < mcuRows )
+    {
+        numSlices = (mcuRows + mcuRowsPerSlice - 1)/mcuRowsPerSlice;
+        restartInterval = mcusPerRow*mcuRowsPerSlice;
+    }
+    const size_t sliceRows = (numSlices == 1) ? height : mcuRowsPerSlice*mcu;
 
-    JpegWriterImplMemory()
-        : JpegWriterImpl()
-        , m_cinfo(NULL)
-        , m_buffer(0)
-    {}
+    std::vector<JpegBuffer> slices(numSlices);
+    std::vector<std::string> errors(numSlices);
 
-    ~JpegWriterImplMemory() { close(); }
+#pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < static_cast<int>(numSlices); ++s)
+    {
+        const size_t firstRow = s*sliceRows;
+        const size_t numRows = std::min(sliceRows, height - firstRow);
+        // exceptions cannot leave the parallel region
+        try
+        {
+            encodeSlice(quality, rows, firstRow, numRows,
+                        restartInterval, s == 0, slices[s]);
+        }
+        catch (const std::exception& e)
+        {
+            errors[s] = e.what();
+            if ( errors[s].empty() ) errors[s] = "JpegWriter: error encoding a slice";
+        }
+    }
 
-    // implementation below!
-    void setupJpegDest(j_compress_ptr cinfo, const std::string& filename);
+    for (size_t s = 0; s < numSlices; ++s)
+    {
+        if ( !errors[s].empty() ) throw pfs::io::WriteException(errors[s]);
+    }
 
-    void close() {
-        sm_registry.erase(m_cinfo);
-        m_cinfo->dest = NULL;
+    if ( numSlices == 1 )
+    {
+        output.swap(slices[0]);
+        return findScanData(output);
     }
-    size_t getFileSize() const  { return (m_buffer.size()*sizeof(JOCTET)); }
 
-    static
-    JpegBuffer& getBuffer(j_compress_ptr cinfo) {
-        JpegRegistry::iterator it = sm_registry.find(cinfo);
-        if ( it != sm_registry.end() ) {
-            return *it->second;
+    // headers of the first slice, with the height of the whole image
+    size_t sofOffset = 0;
+    const size_t headerSize = findScanData(slices[0], &sofOffset);
+    slices[0][sofOffset + 5] = static_cast<JOCTET>((height >> 8) & 0xFF);
+    slices[0][sofOffset + 6] = static_cast<JOCTET>(height & 0xFF);
+
+    size_t totalSize = headerSize + 2*numSlices;
+    for (size_t s = 0; s < numSlices; ++s) totalSize += slices[s].size();
+
+    output.clear();
+    output.reserve(totalSize);
+    output.insert(output.end(), slices[0].begin(), slices[0].begin() + headerSize);
+    for (size_t s = 0; s < numSlices; ++s)
+    {
+        if ( s > 0 )
+        {
+            output.push_back(0xFF);
+            output.push_back(static_cast<JOCTET>(0xD0 + ((s - 1) & 7)));  // RSTn
         }
-        throw pfs::io::WriteException("Cannot find a valid buffer for the current writer");
+        const size_t begin = (s == 0) ? headerSize : findScanData(slices[s]);
+        // skip EOI
+        output.insert(output.end(),
+                      slices[s].begin() + begin, slices[s].end() - 2);
+        JpegBuffer().swap(slices[s]);
     }
+    output.push_back(0xFF);
+    output.push_back(0xD9);                                         // EOI
 
-private:
-    struct jpeg_destination_mgr m_dmgr;
-    j_compress_ptr m_cinfo;
-    JpegBuffer m_buffer;
+    return headerSize;
+}
 
-    static JpegRegistry sm_registry;
-};
+size_t JpegEncoder::predictQuality(size_t targetSize) const
+{
+    // bands of rows (one MCU high at any quality) are sampled across the
+    // whole frame, so the sample has the same statistics of the full image
+    const size_t BAND = 16;
+    const size_t SAMPLE_RATIO = 16;
 
-JpegWriterImplMemory::JpegRegistry JpegWriterImplMemory::sm_registry;
+    const size_t height = m_frame.getHeight();
+    const size_t numBands = (height + BAND - 1)/BAND;
+    if ( numBands == 0 ) return m_params.quality_;
 
-#define BLOCK_SIZE 16384
+    RowList rows;
+    for (size_t band = 0; band < numBands; band += SAMPLE_RATIO)
+    {
+        for (size_t row = band*BAND; row < std::min(height, (band + 1)*BAND); ++row)
+        {
+            rows.push_back(row);
+        }
+    }
+    const double scale = static_cast<double>(height)/rows.size();
 
-static
-void my_init_destination(j_compress_ptr cinfo)
-{
-    JpegBuffer& myBuffer = JpegWriterImplMemory::getBuffer(cinfo);
+    // the size is monotonic in the quality factor: binary search
+    size_t low = 1;
+    size_t high = 100;
+    JpegBuffer sample;
+    while ( low < high )
+    {
+        const size_t quality = (low + high + 1)/2;
+        const size_t headerSize = encodeRows(quality, rows, sample);
+        const double predicted = headerSize + (sample.size() - headerSize)*scale;
 
-    myBuffer.resize(BLOCK_SIZE);
-    cinfo->dest->next_output_byte = &myBuffer[0];
-    cinfo->dest->free_in_buffer = myBuffer.size();
+        if ( predicted <= targetSize ) low = quality;
+        else high = quality - 1;
+    }
+    return low;
 }
 
-static
-boolean my_empty_output_buffer(j_compress_ptr cinfo)
+class JpegWriterImpl
 {
-    JpegBuffer& myBuffer = JpegWriterImplMemory::getBuffer(cinfo);
+public:
+    JpegWriterImpl() : m_quality(0) {}
+    virtual ~JpegWriterImpl() {}
 
-    size_t oldsize = myBuffer.size();
-    myBuffer.resize(oldsize + BLOCK_SIZE);
-    cinfo->dest->next_output_byte = &myBuffer[oldsize];
-    cinfo->dest->free_in_buffer = myBuffer.size() - oldsize;
-    return true;
-}
+    virtual void output(const JpegBuffer& buffer, const std::string& filename) = 0;
+    virtual size_t getFileSize() const = 0;
 
-static
-void my_term_destination(j_compress_ptr cinfo)
-{
-    JpegBuffer& myBuffer = JpegWriterImplMemory::getBuffer(cinfo);
+    size_t getQuality() const { return m_quality; }
 
-    myBuffer.resize(myBuffer.size() - cinfo->dest->free_in_buffer);
-}
-#undef BLOCK_SIZE
+    bool write(const pfs::Frame &frame, const JpegWriterParams& params,
+               const std::string& filename)
+    {
+        try
+        {
+            JpegEncoder encoder(frame, params);
 
-void JpegWriterImplMemory::setupJpegDest(j_compress_ptr cinfo, const string &/*filename*/)
-{
-    // remember the j_compress_struct ... it will be necessary in the dtor!
-    m_cinfo = cinfo;
-    // add entry into registry!
-    sm_registry.insert( JpegRegistry::value_type(cinfo, &m_buffer) );
+            m_quality = params.quality_;
+            if ( params.targetSize_ > 0 )
+            {
+                m_quality = encoder.predictQuality(params.targetSize_);
+            }
 
-    // update destinations...
-    m_dmgr.init_destination = my_init_destination;
-    m_dmgr.empty_output_buffer = my_empty_output_buffer;
-    m_dmgr.term_destination = my_term_destination;
+            JpegBuffer buffer;
+            encoder.encode(m_quality, buffer);
 
-    cinfo->dest = &m_dmgr;
-}
+            output(buffer, filename);
+        }
+        catch (const std::runtime_error& err)
+        {
+            std::clog << err.what() << std::endl;
 
-//! \brief Writer to file basic implementation
-struct JpegWriterImplFile : public JpegWriterImpl
-{
-    JpegWriterImplFile()
-        : JpegWriterImpl()
-        , m_handle()
-    {}
+            return false;
+        }
+        return true;
+    }
+
+private:
+    size_t m_quality;
+};
 
-    void setupJpegDest(j_compress_ptr cinfo, const std::string& filename) {
-        open(filename);
-        jpeg_stdio_dest(cinfo, handle());
+struct JpegWriterImplMemory : public JpegWriterImpl
+{
+    void output(const JpegBuffer& buffer, const std::string& /*filename*/) {
+        m_size = buffer.size();
     }
+    size_t getFileSize() const  { return m_size*sizeof(JOCTET); }
 
-    void close()                { m_handle.reset(); }
-    size_t getFileSize() const  { return 0; }
+    JpegWriterImplMemory()
+        : JpegWriterImpl()
+        , m_size(0)
+    {}
 
 private:
-    void open(const std::string& filename) {
-        m_handle.reset( fopen(filename.c_str(), "wb") );
-        if ( !m_handle ) {
+    size_t m_size;
+};
+
+//! \brief Writer to file basic implementation
+struct JpegWriterImplFile : public JpegWriterImpl
+{
+    void output(const JpegBuffer& buffer, const std::string& filename) {
+        utils::ScopedStdIoFile handle( fopen(filename.c_str(), "wb") );
+        if ( !handle ) {
             throw pfs::io::InvalidFile( "Cannot open the output file " + filename );
         }
+        if ( fwrite(buffer.data(), sizeof(JOCTET), buffer.size(), handle.data()) != buffer.size() ) {
+            throw pfs::io::WriteException( "Cannot write the output file " + filename );
+        }
     }
 
-    FILE* handle()              { return m_handle.data(); }
-
-    utils::ScopedStdIoFile m_handle;
+    size_t getFileSize() const  { return 0; }
 };
 
 
@@ -458,5 +651,19 @@ size_t JpegWriter::getFileSize() const
     return m_impl->getFileSize();
 }
 
+size_t JpegWriter::getQuality() const
+{
+    return m_impl->getQuality();
+}
+
+size_t JpegWriter::predictQuality(const pfs::Frame& frame, const pfs::Params& params,
+                                  size_t targetSize)
+{
+    JpegWriterParams p;
+    p.parse( params );
+
+    return JpegEncoder(frame, p).predictQuality(targetSize);
+}
+
 }   // io
 }   // pfs
@@ -52,11 +52,22 @@ public:
     ~JpegWriter();
 
     //! \brief write a pfs::Frame into file or memory
+    //! If the parameter "target_size" (bytes) is set, the quality factor is
+    //! the one returned by predictQuality() and "quality" is ignored
     bool write(const pfs::Frame& frame, const pfs::Params& params);
 
     //! \brief return size in bytes of the file written
     size_t getFileSize() const;
 
+    //! \brief return quality factor used by the last write()
+    size_t getQuality() const;
+
+    //! \brief highest quality factor whose file is predicted not to exceed
+    //! \a targetSize bytes. The prediction encodes one band of rows every 16,
+    //! so it is much faster than trying full encodes.
+    static size_t predictQuality(const pfs::Frame& frame, const pfs::Params& params,
+                                 size_t targetSize);
+
 private:
     std::unique_ptr<JpegWriterImpl> m_impl;
 };
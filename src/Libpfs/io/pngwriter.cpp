@@ -30,11 +30,15 @@
 #include <lcms2.h>
 #include <stdio.h>
 #include <png.h>
+#include <zlib.h>
+#include <omp.h>
+#include <cstdlib>
+#include <cstring>
 
 #include <Libpfs/frame.h>
 #include <Libpfs/colorspace/rgbremapper.h>
 #include <Libpfs/colorspace/normalizer.h>
-#include <Libpfs/utils/resourcehandlerlcms.h>
+#include <Libpfs/colorspace/iccmanager.h>
 #include <Libpfs/utils/resourcehandlerstdio.h>
 #include <Libpfs/utils/transform.h>
 #include <Libpfs/utils/chain.h>
@@ -110,26 +114,286 @@ ostream& operator<<(ostream& out, const PngWriterParams& params)
 static
 void png_write_icc_profile(png_structp png_ptr, png_infop info_ptr)
 {
-    cmsUInt32Number profileSize = 0;
-    cmsHPROFILE hsRGB = cmsCreate_sRGBProfile();
-    cmsSaveProfileToMem(hsRGB, NULL, &profileSize);        // get the size
+    const std::vector<char>& profile =
+            colorspace::IccManager::instance().sRGBProfileData();
+#ifndef NDEBUG
+    std::clog << "sRGB profile size: " << profile.size() << "\n";
+#endif
 
+    // char profileName[5] = "sRGB";
 #if PNG_LIBPNG_VER_MINOR < 5
-    std::vector<char> profileBuffer(profileSize);
+    png_set_iCCP(png_ptr, info_ptr, "sRGB" /*profileName*/, 0,
+                 const_cast<char*>(profile.data()), (png_uint_32)profile.size());
 #else
-    std::vector<unsigned char> profileBuffer(profileSize);
+    png_set_iCCP(png_ptr, info_ptr, "sRGB" /*profileName*/, 0,
+                 reinterpret_cast<png_const_bytep>(profile.data()),
+                 (png_uint_32)profile.size());
 #endif
+}
 
-    cmsSaveProfileToMem(hsRGB, profileBuffer.data(), &profileSize);
-#ifndef NDEBUG
-    std::clog << "sRGB profile size: " << profileSize << "\n";
-#endif
+//! \brief PNG filter that minimizes the sum of absolute differences, the
+//! same heuristic used by libpng for adaptive filtering.
+//! \param[in] row, prev raw scanlines, prev is all zeros for the first one
+//! \param[out] out filter type byte followed by the filtered scanline
+static
+void filterRow(const png_byte* row, const png_byte* prev, size_t rowBytes,
+               png_byte* out, std::vector<png_byte>& candidate)
+{
+    const size_t bpp = 3;
 
-    // char profileName[5] = "sRGB";
-    png_set_iCCP(png_ptr, info_ptr, "sRGB" /*profileName*/, 0,
-                 profileBuffer.data(), (png_uint_32)profileSize);
+    candidate.resize(rowBytes);
+    unsigned long bestSum = ~0UL;
+
+    for (int type = PNG_FILTER_VALUE_NONE; type <= PNG_FILTER_VALUE_PAETH; ++type)
+    {
+        unsigned long sum = 0;
+        for (size_t i = 0; i < rowBytes; ++i)
+        {
+            const int a = (i >= bpp) ? row[i - bpp] : 0;
+            const int b = prev[i];
+            const int c = (i >= bpp) ? prev[i - bpp] : 0;
+
+            int predictor = 0;
+            switch (type)
+            {
+            case PNG_FILTER_VALUE_SUB: predictor = a; break;
+            case PNG_FILTER_VALUE_UP: predictor = b; break;
+            case PNG_FILTER_VALUE_AVG: predictor = (a + b)/2; break;
+            case PNG_FILTER_VALUE_PAETH:
+            {
+                const int p = a + b - c;
+                const int pa = std::abs(p - a);
+                const int pb = std::abs(p - b);
+                const int pc = std::abs(p - c);
+                predictor = (pa <= pb && pa <= pc) ? a : ((pb <= pc) ? b : c);
+            }
+                break;
+            }
+            const png_byte value = static_cast<png_byte>(row[i] - predictor);
+            candidate[i] = value;
+            // bytes are taken as signed, so small negative residuals are small
+            sum += (value < 128) ? value : (256 - value);
+        }
+
+        if ( sum < bestSum )
+        {
+            bestSum = sum;
+            out[0] = static_cast<png_byte>(type);
+            std::memcpy(out + 1, candidate.data(), rowBytes);
+        }
+    }
+}
+
+//! \brief deflate \a size bytes as a piece of a raw deflate stream
+//! \param dictionary the (up to) 32 KB preceding \a data in the stream
+//! \param last whether this is the end of the stream
+static
+bool deflateBlock(const png_byte* data, size_t size,
+                  const png_byte* dictionary, size_t dictionarySize,
+                  int level, bool last, std::vector<png_byte>& out)
+{
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    if ( deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                      Z_DEFAULT_STRATEGY) != Z_OK )
+    {
+        return false;
+    }
+    if ( dictionarySize > 0 )
+    {
+        deflateSetDictionary(&strm, dictionary, dictionarySize);
+    }
+
+    // room for the empty stored block that terminates a sync flush
+    out.resize(deflateBound(&strm, size) + 16);
+
+    strm.next_in = const_cast<png_byte*>(data);
+    strm.avail_in = size;
+    strm.next_out = out.data();
+    strm.avail_out = out.size();
+
+    const int status = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    const bool ok = (last ? (status == Z_STREAM_END) : (status == Z_OK)) &&
+            strm.avail_in == 0;
+
+    out.resize(out.size() - strm.avail_out);
+    deflateEnd(&strm);
+    return ok;
+}
+
+//! \brief compresses the image data of a PNG into a zlib stream in parallel,
+//! in the way of pigz: blocks are deflated independently, each one primed
+//! with the last 32 KB of the previous one, and joined with sync flushes.
+//! The stream is written as one IDAT chunk per batch of blocks.
+template <typename RowRemapper>
+void writeParallelIDAT(png_structp png_ptr, png_uint_32 width, png_uint_32 height,
+                       int level, const RowRemapper& remapRow)
+{
+    const size_t WINDOW = 32*1024;
+    const size_t BLOCK_TARGET = 128*1024;
+
+    const size_t rowBytes = size_t(width)*3;
+    const size_t filteredRowBytes = rowBytes + 1;
+    const size_t rowsPerBlock = std::max<size_t>(1, BLOCK_TARGET/filteredRowBytes);
+    const size_t blocksPerBatch = 4*omp_get_max_threads();
+    const size_t rowsPerBatch = rowsPerBlock*blocksPerBatch;
+
+    png_byte idatName[5] = { 'I', 'D', 'A', 'T', '\0' };
+
+    // last raw row of the previous batch and tail of its filtered data
+    std::vector<png_byte> prevRow(rowBytes, 0);
+    std::vector<png_byte> history;
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    bool firstChunk = true;
+
+    for (png_uint_32 firstRow = 0; firstRow < height; firstRow += rowsPerBatch)
+    {
+        const size_t numRows = std::min<size_t>(rowsPerBatch, height - firstRow);
+        const int numBlocks = static_cast<int>((numRows + rowsPerBlock - 1)/rowsPerBlock);
+        const bool lastBatch = (firstRow + numRows == height);
+
+        // raw rows, preceded by the last row of the previous batch
+        std::vector<png_byte> raw((numRows + 1)*rowBytes);
+        std::copy(prevRow.begin(), prevRow.end(), raw.begin());
+        std::vector<png_byte> filtered(numRows*filteredRowBytes);
+
+#pragma omp parallel for schedule(static)
+        for (int r = 0; r < static_cast<int>(numRows); ++r)
+        {
+            remapRow(firstRow + r, &raw[(r + 1)*rowBytes]);
+        }
+
+#pragma omp parallel
+        {
+            std::vector<png_byte> candidate;
+#pragma omp for schedule(static)
+            for (int r = 0; r < static_cast<int>(numRows); ++r)
+            {
+                filterRow(&raw[(r + 1)*rowBytes], &raw[r*rowBytes], rowBytes,
+                          &filtered[r*filteredRowBytes], candidate);
+            }
+        }
+
+        std::vector< std::vector<png_byte> > compressed(numBlocks);
+        std::vector<uLong> adlers(numBlocks);
+        int failed = 0;
+
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            const size_t begin = b*rowsPerBlock*filteredRowBytes;
+            const size_t end = std::min(filtered.size(), (b + 1)*rowsPerBlock*filteredRowBytes);
+
+            std::vector<png_byte> dictionary;
+            if ( begin >= WINDOW )
+            {
+                dictionary.assign(filtered.begin() + (begin - WINDOW), filtered.begin() + begin);
+            }
+            else
+            {
+                const size_t fromHistory = std::min(history.size(), WINDOW - begin);
+                dictionary.assign(history.end() - fromHistory, history.end());
+                dictionary.insert(dictionary.end(), filtered.begin(), filtered.begin() + begin);
+            }
+
+            const bool last = lastBatch && (b == numBlocks - 1);
+            if ( !deflateBlock(&filtered[begin], end - begin,
+                               dictionary.data(), dictionary.size(),
+                               level, last, compressed[b]) )
+            {
+#pragma omp atomic
+                ++failed;
+            }
+            adlers[b] = adler32(adler32(0L, Z_NULL, 0), &filtered[begin], end - begin);
+        }
+
+        if ( failed )
+        {
+            png_error(png_ptr, "Cannot compress image data");
+        }
+
+        std::vector<png_byte> chunk;
+        if ( firstChunk )
+        {
+            // zlib header: deflate, 32K window, compression level hint
+            const int cmf = 0x78;
+            const int flevel = (level < 2) ? 0 : ((level < 6) ? 1 : ((level == 6) ? 2 : 3));
+            int flg = flevel << 6;
+            flg += 31 - ((cmf*256 + flg) % 31);
+            chunk.push_back(static_cast<png_byte>(cmf));
+            chunk.push_back(static_cast<png_byte>(flg));
+            firstChunk = false;
+        }
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            const size_t begin = b*rowsPerBlock*filteredRowBytes;
+            const size_t end = std::min(filtered.size(), (b + 1)*rowsPerBlock*filteredRowBytes);
+
+            chunk.insert(chunk.end(), compressed[b].begin(), compressed[b].end());
+            adler = adler32_combine(adler, adlers[b], end - begin);
+        }
+        if ( lastBatch )
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+            {
+                chunk.push_back(static_cast<png_byte>((adler >> shift) & 0xFF));
+            }
+        }
+
+        png_write_chunk(png_ptr, idatName, chunk.data(), chunk.size());
+
+        std::copy(raw.end() - rowBytes, raw.end(), prevRow.begin());
+        const size_t keep = std::min(filtered.size(), WINDOW);
+        if ( keep < WINDOW )
+        {
+            history.insert(history.end(), filtered.end() - keep, filtered.end());
+            if ( history.size() > WINDOW )
+            {
+                history.erase(history.begin(), history.end() - WINDOW);
+            }
+        }
+        else
+        {
+            history.assign(filtered.end() - keep, filtered.end());
+        }
+    }
 }
 
+//! \brief remaps a row of a frame into 8 bit RGB
+struct PngRowRemapper
+{
+    PngRowRemapper(const pfs::Frame& frame, const PngWriterParams& params)
+        : m_params(params)
+    {
+        frame.getXYZChannels(m_rChannel, m_gChannel, m_bChannel);
+    }
+
+    void operator()(size_t row, png_byte* out) const
+    {
+        utils::transform(
+                    m_rChannel->row_begin(row),
+                    m_rChannel->row_end(row),
+                    m_gChannel->row_begin(row),
+                    m_bChannel->row_begin(row),
+                    FixedStrideIterator<png_byte*, 3>(out),
+                    FixedStrideIterator<png_byte*, 3>(out + 1),
+                    FixedStrideIterator<png_byte*, 3>(out + 2),
+                    utils::chain(
+                        colorspace::Normalizer(m_params.minLuminance_, m_params.maxLuminance_),
+                        utils::CLAMP_F32,
+                        Remapper<png_byte>(m_params.luminanceMapping_)
+                        )
+                    );
+    }
+
+private:
+    const PngWriterParams& m_params;
+    const Channel* m_rChannel;
+    const Channel* m_gChannel;
+    const Channel* m_bChannel;
+};
+
 class PngWriterImpl
 {
 public:
@@ -186,37 +450,17 @@ public:
                      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                      PNG_FILTER_TYPE_DEFAULT);
 
-        png_set_compression_level(png_ptr, params.compressionLevel());
-        png_set_bgr(png_ptr);
         png_write_icc_profile(png_ptr, info_ptr);   // user defined function, see above
         png_write_info(png_ptr, info_ptr);
 
-        const Channel* rChannel;
-        const Channel* gChannel;
-        const Channel* bChannel;
-        frame.getXYZChannels(rChannel, gChannel, bChannel);
+        // the image data is not handed to libpng: filtering and compression
+        // run in parallel and the IDAT chunks are written as they are
+        writeParallelIDAT(png_ptr, width, height, params.compressionLevel(),
+                          PngRowRemapper(frame, params));
 
-        std::vector<png_byte> scanLineOut( width * 3 );
-        for (png_uint_32 row = 0; row < height; ++row)
-        {
-            utils::transform(
-                        rChannel->row_begin(row),
-                        rChannel->row_end(row),
-                        gChannel->row_begin(row),
-                        bChannel->row_begin(row),
-                        FixedStrideIterator<png_byte*, 3>(scanLineOut.data() + 2),
-                        FixedStrideIterator<png_byte*, 3>(scanLineOut.data() + 1),
-                        FixedStrideIterator<png_byte*, 3>(scanLineOut.data()),
-                        utils::chain(
-                            colorspace::Normalizer(params.minLuminance_, params.maxLuminance_),
-                            utils::CLAMP_F32,
-                            Remapper<png_byte>(params.luminanceMapping_)
-                            )
-                        );
-            png_write_row(png_ptr, scanLineOut.data());
-        }
+        png_byte iendName[5] = { 'I', 'E', 'N', 'D', '\0' };
+        png_write_chunk(png_ptr, iendName, NULL, 0);
 
-        png_write_end(png_ptr, info_ptr);
         png_destroy_write_struct(&png_ptr, &info_ptr);
 
         computeSize();
@@ -25,6 +25,11 @@
 #include <cmath>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <Libpfs/frame.h>
 #include <Libpfs/array2d.h>
@@ -37,19 +42,170 @@ using namespace std;
 namespace pfs {
 namespace io {
 
-void rgbe2rgb(const Trgbe_pixel& rgbe, float exposure, float &r, float &g, float &b)
+namespace
 {
-    if ( rgbe.e != 0 )		// a non-zero pixel
+//! \brief scale factor of every exponent: the colour of a pixel is
+//! (mantissa * scale[exponent]). Exponent 0 is the zero pixel.
+struct RGBEScaleTable
+{
+    explicit RGBEScaleTable(float exposure)
+    {
+        scale[0] = 0.f;
+        for (int e = 1; e < 256; ++e)
+        {
+            scale[e] = static_cast<float>(ldexp(1.0, e - int(128+8)) * WHITE_EFFICACY / exposure);
+        }
+    }
+
+    float scale[256];
+};
+
+//! \brief converts a scanline stored as 4 planes (R, G, B, E) of \a width bytes
+void planarRGBE2RGB(const Trgbe* scanline, int width, const RGBEScaleTable& table,
+                    float* r, float* g, float* b)
+{
+    const Trgbe* inR = scanline;
+    const Trgbe* inG = scanline + width;
+    const Trgbe* inB = scanline + 2*width;
+    const Trgbe* inE = scanline + 3*width;
+
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i vR = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inR + x));
+        const __m128i vG = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inG + x));
+        const __m128i vB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inB + x));
+
+        const __m128i lowR = _mm_unpacklo_epi8(vR, zero);
+        const __m128i highR = _mm_unpackhi_epi8(vR, zero);
+        const __m128i lowG = _mm_unpacklo_epi8(vG, zero);
+        const __m128i highG = _mm_unpackhi_epi8(vG, zero);
+        const __m128i lowB = _mm_unpacklo_epi8(vB, zero);
+        const __m128i highB = _mm_unpackhi_epi8(vB, zero);
+
+        const __m128i wordsR[4] = { _mm_unpacklo_epi16(lowR, zero), _mm_unpackhi_epi16(lowR, zero),
+                                    _mm_unpacklo_epi16(highR, zero), _mm_unpackhi_epi16(highR, zero) };
+        const __m128i wordsG[4] = { _mm_unpacklo_epi16(lowG, zero), _mm_unpackhi_epi16(lowG, zero),
+                                    _mm_unpacklo_epi16(highG, zero), _mm_unpackhi_epi16(highG, zero) };
+        const __m128i wordsB[4] = { _mm_unpacklo_epi16(lowB, zero), _mm_unpackhi_epi16(lowB, zero),
+                                    _mm_unpacklo_epi16(highB, zero), _mm_unpackhi_epi16(highB, zero) };
+
+        for (int i = 0; i < 4; ++i)
+        {
+            const Trgbe* e = inE + x + 4*i;
+            const __m128 scale = _mm_setr_ps(table.scale[e[0]], table.scale[e[1]],
+                                             table.scale[e[2]], table.scale[e[3]]);
+
+            _mm_storeu_ps(r + x + 4*i, _mm_mul_ps(_mm_cvtepi32_ps(wordsR[i]), scale));
+            _mm_storeu_ps(g + x + 4*i, _mm_mul_ps(_mm_cvtepi32_ps(wordsG[i]), scale));
+            _mm_storeu_ps(b + x + 4*i, _mm_mul_ps(_mm_cvtepi32_ps(wordsB[i]), scale));
+        }
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        const float scale = table.scale[inE[x]];
+        r[x] = inR[x] * scale;
+        g[x] = inG[x] * scale;
+        b[x] = inB[x] * scale;
+    }
+}
+
+//! \brief converts a flat scanline, stored as RGBE quadruplets
+void interleavedRGBE2RGB(const Trgbe* scanline, int width, const RGBEScaleTable& table,
+                         float* r, float* g, float* b)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        const Trgbe* pixel = scanline + 4*x;
+        const float scale = table.scale[pixel[3]];
+        r[x] = pixel[0] * scale;
+        g[x] = pixel[1] * scale;
+        b[x] = pixel[2] * scale;
+    }
+}
+
+//! \brief checks the RLE data of a channel starting at \a offset
+//! \return offset of the first byte after the channel
+size_t RLEScan(const std::vector<Trgbe>& data, size_t offset, int size)
+{
+    int peek = 0;
+    while ( peek < size )
+    {
+        if ( offset + 2 > data.size() ) {
+            throw pfs::io::ReadException("RGBE: Invalid data size");
+        }
+        const Trgbe count = data[offset];
+        if ( count > 128 )
+        {
+            // a run
+            peek += count - 128;
+            offset += 2;
+        }
+        else
+        {
+            // a non-run: a count of 0 still carries one value
+            const int nonrun_len = std::max<int>(count, 1);
+            peek += nonrun_len;
+            offset += 1 + nonrun_len;
+        }
+    }
+    if ( peek != size || offset > data.size() )
+    {
+        throw pfs::io::ReadException( "RGBE: difference in size while reading RLE scanline");
+    }
+    return offset;
+}
+
+//! \brief decodes a channel checked by RLEScan()
+const Trgbe* RLEDecode(const Trgbe* data, Trgbe* scanline, int size)
+{
+    Trgbe* peek = scanline;
+    Trgbe* const end = scanline + size;
+    while ( peek < end )
+    {
+        const Trgbe count = *data++;
+        if ( count > 128 )
+        {
+            std::memset(peek, *data++, count - 128);
+            peek += count - 128;
+        }
+        else
+        {
+            const int nonrun_len = std::max<int>(count, 1);
+            std::memcpy(peek, data, nonrun_len);
+            data += nonrun_len;
+            peek += nonrun_len;
+        }
+    }
+    return data;
+}
+
+//! \brief reads all the remaining content of \a file
+void readAll(FILE* file, std::vector<Trgbe>& data)
+{
+    // size of the remaining data, when the file is seekable
+    size_t chunkSize = 1 << 20;
+    long start = ftell(file);
+    if ( start >= 0 && fseek(file, 0, SEEK_END) == 0 )
     {
-        int e = rgbe.e - int(128+8);
-        double f = ldexp( 1.0, e ) * WHITE_EFFICACY / exposure;
+        long end = ftell(file);
+        fseek(file, start, SEEK_SET);
+        if ( end > start ) chunkSize = end - start;
+    }
 
-        r = (float)(rgbe.r * f);
-        g = (float)(rgbe.g * f);
-        b = (float)(rgbe.b * f);
+    size_t size = 0;
+    for (;;)
+    {
+        data.resize(size + chunkSize);
+        const size_t read = fread(data.data() + size, 1, chunkSize, file);
+        size += read;
+        if ( read < chunkSize ) break;
     }
-    else
-        r = g = b = 0.f;
+    data.resize(size);
+}
 }
 
 // Reading RGBE files
@@ -133,112 +289,77 @@ void readRadianceHeader(FILE *file, int &width, int &height, float &exposure, Co
     // DEBUG_STR << "RGBE: image size " << width << "x" << height << endl;
 }
 
-void RLERead(FILE* file, Trgbe* scanline, int size)
-{
-    int peek = 0;
-    while ( peek < size )
-    {
-        Trgbe p[2];
-        if ( fread(p, sizeof(p), 1, file) == 0) {
-            throw pfs::io::ReadException("RGBE: Invalid data size");
-        }
-        if ( p[0]>128 )
-        {
-            // a run
-            int run_len = p[0]-128;
-
-            while ( run_len > 0 )
-            {
-                scanline[peek++] = p[1];
-                run_len--;
-            }
-        }
-        else
-        {
-            // a non-run
-            scanline[peek++] = p[1];
-
-            int nonrun_len = p[0]-1;
-            if ( nonrun_len > 0 )
-            {
-                if ( fread(scanline+peek, sizeof(*scanline), nonrun_len, file) == 0) {
-                    throw pfs::io::ReadException("RGBE: Invalid data size");
-                }
-                else {
-                    peek += nonrun_len;
-                }
-            }
-        }
-    }
-    if ( peek != size )
-    {
-        throw pfs::io::ReadException( "RGBE: difference in size while reading RLE scanline");
-    }
-
-}
-
-
 void readRadiance(FILE *file, int width, int height, float exposure,
                   pfs::Array2Df &X, pfs::Array2Df &Y, pfs::Array2Df &Z)
 {
-    // read image
+    // the whole pixel data is read at once, then the start of every scanline
+    // is found with a quick pass on the RLE counts, so that the scanlines can
+    // be decoded in parallel
+    std::vector<Trgbe> data;
+    readAll(file, data);
+
     // depending on format read either rle or normal (note: only rle supported)
-    std::vector<Trgbe> scanline(width*4);
+    std::vector<size_t> offsets(height + 1);
+    std::vector<char> isRLE(height);
 
+    size_t offset = 0;
     for (int y = 0; y < height; ++y)
     {
+        offsets[y] = offset;
+
         // read rle header
-        Trgbe header[4];
-        if ( fread(header, sizeof(header), 1, file) == sizeof(header) ) {
+        if ( offset + 4 > data.size() ) {
             throw pfs::io::ReadException("RGBE: invalid data size");
         }
+        const Trgbe* header = &data[offset];
         if ( header[0] != 2 || header[1] != 2 || (header[2]<<8) + header[3] != width )
         {
-            //--- simple scanline (not rle)
-            size_t rez = fread(scanline.data()+4, sizeof(Trgbe), 4*width-4, file);
-            if ( rez != (size_t)4*width-4 )
-            {
-                // 	DEBUG_STR << "RGBE: scanline " << y
-                // 		  << "(" << (int)rez << "/" << width << ")" <<endl;
+            //--- simple scanline (not rle), the header is the first pixel
+            if ( offset + size_t(4)*width > data.size() ) {
                 throw pfs::Exception( "RGBE: not enough data to read "
                                       "in the simple format." );
             }
-            //--- yes, we've read one pixel as a header
-            scanline[0] = header[0];
-            scanline[1] = header[1];
-            scanline[2] = header[2];
-            scanline[3] = header[3];
-
-            //--- write scanline to the image
-            for (int x=0 ; x<width ; ++x)
-            {
-                Trgbe_pixel rgbe;
-                rgbe.r = scanline[4*x+0];
-                rgbe.g = scanline[4*x+1];
-                rgbe.b = scanline[4*x+2];
-                rgbe.e = scanline[4*x+3];
-
-                rgbe2rgb(rgbe, exposure, X(x,y), Y(x,y), Z(x,y));
-            }
+            isRLE[y] = false;
+            offset += size_t(4)*width;
         }
         else
         {
-            //--- rle scanline
-            //--- each channel is encoded separately
+            //--- rle scanline, each channel is encoded separately
+            isRLE[y] = true;
+            offset += 4;
             for (int ch = 0; ch < 4 ; ++ch) {
-                RLERead(file, scanline.data()+width*ch, width);
+                offset = RLEScan(data, offset, width);
             }
+        }
+    }
+    offsets[height] = offset;
 
-            //--- write scanline to the image
-            for (int x = 0; x < width; ++x)
-            {
-                Trgbe_pixel rgbe;
-                rgbe.r = scanline[x+width*0];
-                rgbe.g = scanline[x+width*1];
-                rgbe.b = scanline[x+width*2];
-                rgbe.e = scanline[x+width*3];
+    const RGBEScaleTable table(exposure);
+
+#pragma omp parallel
+    {
+        std::vector<Trgbe> scanline(size_t(4)*width);
 
-                rgbe2rgb(rgbe, exposure, X(x,y), Y(x,y), Z(x,y));
+#pragma omp for schedule(dynamic, 16)
+        for (int y = 0; y < height; ++y)
+        {
+            if ( isRLE[y] )
+            {
+                const Trgbe* in = &data[offsets[y] + 4];
+                for (int ch = 0; ch < 4 ; ++ch) {
+                    in = RLEDecode(in, scanline.data() + size_t(width)*ch, width);
+                }
+                planarRGBE2RGB(scanline.data(), width, table,
+                               X.data() + size_t(y)*width,
+                               Y.data() + size_t(y)*width,
+                               Z.data() + size_t(y)*width);
+            }
+            else
+            {
+                interleavedRGBE2RGB(&data[offsets[y]], width, table,
+                                    X.data() + size_t(y)*width,
+                                    Y.data() + size_t(y)*width,
+                                    Z.data() + size_t(y)*width);
             }
         }
     }
@@ -24,6 +24,9 @@
 #include <vector>
 #include <cstdio>
 #include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <omp.h>
 
 #include <Libpfs/frame.h>
 #include <Libpfs/channel.h>
@@ -37,9 +40,9 @@ using namespace std;
 namespace pfs {
 namespace io {
 
-int RLEWrite(FILE* file, Trgbe* scanline, int size)
+void RLEWrite(const Trgbe* scanline, int size, std::vector<Trgbe>& out)
 {
-    Trgbe* scanend = scanline + size;
+    const Trgbe* scanend = scanline + size;
     while ( scanline < scanend )
     {
         int run_start   = 0;
@@ -64,41 +67,25 @@ int RLEWrite(FILE* file, Trgbe* scanline, int size)
             // write a non run: scanline[0] to scanline[run_start]
             if ( run_start > 0 )
             {
-                std::vector<Trgbe> buf(run_start+1);
-
-                buf[0] = run_start;
-                for ( int i=0 ; i < run_start ; i++ ) {
-                    buf[i+1] = scanline[i];
-                }
-                fwrite(buf.data(), sizeof(Trgbe), run_start + 1, file);
+                out.push_back(run_start);
+                out.insert(out.end(), scanline, scanline + run_start);
             }
 
             // write a run: scanline[run_start], run_len
-            Trgbe buf[2];
-            buf[0] = 128+run_len;
-            buf[1] = scanline[run_start];
-            fwrite(buf, sizeof(*buf), 2, file);
+            out.push_back(128+run_len);
+            out.push_back(scanline[run_start]);
         }
         else
         {
             // write a non run: scanline[0] to scanline[peek]
-            std::vector<Trgbe> buf(peek+1);
-
-            buf[0] = peek;
-            for ( int i=0 ; i<peek ; i++ ) {
-                buf[i+1] = scanline[i];
-            }
-            fwrite(buf.data(), sizeof(Trgbe), peek+1, file);
+            out.push_back(peek);
+            out.insert(out.end(), scanline, scanline + peek);
         }
         scanline += peek;
     }
 
-    if ( scanline != scanend )
-    {
-        throw pfs::io::WriteException( "RGBE: difference in size while writing RLE scanline");
-    }
-
-    return 0;
+    // called from a parallel region: must not throw
+    assert( scanline == scanend );
 }
 
 void rgb2rgbe( float r, float g, float b, Trgbe_pixel& rgbe)
@@ -155,35 +142,60 @@ void writeRadiance(FILE *file,
     fprintf(file, "-Y %d +X %d\n", (int)height, (int)width);
 
     // image run length encoded
-    std::vector<Trgbe> scanlineR(width);
-    std::vector<Trgbe> scanlineG(width);
-    std::vector<Trgbe> scanlineB(width);
-    std::vector<Trgbe> scanlineE(width);
+    // scanlines are encoded in parallel, a batch at a time, and written in
+    // order once the whole batch is ready
+    const int batchSize = 16*omp_get_max_threads();
+    std::vector< std::vector<Trgbe> > encoded(batchSize);
 
-    for ( size_t y=0 ; y<height ; ++y )
+    for (size_t firstRow = 0; firstRow < height; firstRow += batchSize)
     {
-        // write rle header
-        unsigned char header[4];
-        header[0] = 2;
-        header[1] = 2;
-        header[2] = width >> 8;;
-        header[3] = width & 0xFF;
-        fwrite(header, sizeof(header), 1, file);
-
-        // each channel is encoded separately
-        for ( size_t x=0 ; x < width ; x++ )
+        const int numRows = static_cast<int>(std::min<size_t>(batchSize, height - firstRow));
+
+#pragma omp parallel
         {
-            Trgbe_pixel p;
-            rgb2rgbe( X(x,y), Y(x,y), Z(x,y), p );
-            scanlineR[x] = p.r;
-            scanlineG[x] = p.g;
-            scanlineB[x] = p.b;
-            scanlineE[x] = p.e;
+            std::vector<Trgbe> scanline(4*width);
+
+#pragma omp for schedule(dynamic)
+            for (int row = 0; row < numRows; ++row)
+            {
+                const size_t y = firstRow + row;
+                std::vector<Trgbe>& out = encoded[row];
+                out.clear();
+
+                // write rle header
+                out.push_back(2);
+                out.push_back(2);
+                out.push_back(width >> 8);
+                out.push_back(width & 0xFF);
+
+                // each channel is encoded separately
+                Trgbe* scanlineR = scanline.data();
+                Trgbe* scanlineG = scanlineR + width;
+                Trgbe* scanlineB = scanlineG + width;
+                Trgbe* scanlineE = scanlineB + width;
+                for ( size_t x=0 ; x < width ; x++ )
+                {
+                    Trgbe_pixel p;
+                    rgb2rgbe( X(x,y), Y(x,y), Z(x,y), p );
+                    scanlineR[x] = p.r;
+                    scanlineG[x] = p.g;
+                    scanlineB[x] = p.b;
+                    scanlineE[x] = p.e;
+                }
+                RLEWrite(scanlineR, width, out);
+                RLEWrite(scanlineG, width, out);
+                RLEWrite(scanlineB, width, out);
+                RLEWrite(scanlineE, width, out);
+            }
+        }
+
+        for (int row = 0; row < numRows; ++row)
+        {
+            if ( fwrite(encoded[row].data(), 1, encoded[row].size(), file) != encoded[row].size() )
+            {
+                throw pfs::io::WriteException("RGBE: cannot write the image data");
+            }
         }
-        RLEWrite(file, scanlineR.data(), width);
-        RLEWrite(file, scanlineG.data(), width);
-        RLEWrite(file, scanlineB.data(), width);
-        RLEWrite(file, scanlineE.data(), width);
     }
 }
 
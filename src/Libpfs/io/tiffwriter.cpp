@@ -35,8 +35,11 @@
 #include <Libpfs/io/tiffcommon.h>
 
 #include <tiffio.h>
+#include <zlib.h>
+#include <omp.h>
 
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -50,7 +53,7 @@
 #include <boost/current_function.hpp>
 
 #include <Libpfs/io/ioexception.h>
-#include <Libpfs/utils/resourcehandlerlcms.h>
+#include <Libpfs/colorspace/iccmanager.h>
 #include <Libpfs/colorspace/rgbremapper.h>
 #include <Libpfs/colorspace/xyz.h>
 #include <Libpfs/colorspace/normalizer.h>
@@ -82,6 +85,9 @@ struct TiffWriterParams
         , luminanceMapping_(MAP_LINEAR)
         , tiffWriterMode_(0)        // 8bit uint by default
         , deflateCompression_(true)
+        , deflateLevel_(Z_DEFAULT_COMPRESSION)
+        , predictor_(PREDICTOR_NONE)
+        , rowsPerStrip_(0)          // automatic
     {}
 
     void parse(const Params& params)
@@ -111,6 +117,18 @@ struct TiffWriterParams
             }
             if ( it->first == "deflateCompression" ) {
                 deflateCompression_ = it->second.as<bool>(deflateCompression_);
+                continue;
+            }
+            if ( it->first == "deflate_level" ) {
+                deflateLevel_ = it->second.as<int>(deflateLevel_);
+                continue;
+            }
+            if ( it->first == "predictor" ) {
+                predictor_ = it->second.as<int>(predictor_);
+                continue;
+            }
+            if ( it->first == "rows_per_strip" ) {
+                rowsPerStrip_ = it->second.as<size_t>(rowsPerStrip_);
                 //continue;
             }
         }
@@ -122,6 +140,9 @@ struct TiffWriterParams
     RGBMappingType luminanceMapping_;
     int tiffWriterMode_;
     bool deflateCompression_;
+    int deflateLevel_;          // zlib level, 1 (fast) to 9 (small)
+    int predictor_;             // PREDICTOR_NONE, _HORIZONTAL, _FLOATINGPOINT
+    size_t rowsPerStrip_;       // 0: strips of about STRIP_TARGET_SIZE bytes
 };
 
 ostream& operator<<(ostream& out, const TiffWriterParams& params)
@@ -132,34 +153,226 @@ ostream& operator<<(ostream& out, const TiffWriterParams& params)
     ss << "quality: " << params.quality_ << ", ";
     ss << "min_luminance: " << params.minLuminance_ << ", ";
     ss << "max_luminance: " << params.maxLuminance_ << ", ";
-    ss << "mapping_method: " << params.luminanceMapping_ << "]";
-    ss << "deflateCompression: " << params.deflateCompression_ << "]";
+    ss << "mapping_method: " << params.luminanceMapping_ << ", ";
+    ss << "deflateCompression: " << params.deflateCompression_ << ", ";
+    ss << "deflate_level: " << params.deflateLevel_ << ", ";
+    ss << "predictor: " << params.predictor_ << ", ";
+    ss << "rows_per_strip: " << params.rowsPerStrip_ << "]";
 
     return (out << ss.str());
 }
 
-void writeCommonHeader(TIFF* tif, uint32_t width, uint32_t height)
+// uncompressed size of a strip when the number of rows is not set
+const size_t STRIP_TARGET_SIZE = 256*1024;
+
+void writeCommonHeader(TIFF* tif, uint32_t width, uint32_t height,
+                       uint32_t rowsPerStrip)
 {
     TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)width);
     TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)height);
-    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)rowsPerStrip);
     TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 }
 
-void writeSRGBProfile(TIFF* tif)
+uint32_t rowsPerStrip(const TiffWriterParams& params, uint32_t height,
+                      size_t bytesPerRow)
 {
-    utils::ScopedCmsProfile hsRGB( cmsCreate_sRGBProfile() );
-    cmsUInt32Number profileSize = 0;
-    cmsSaveProfileToMem(hsRGB.data(), NULL, &profileSize);	// get the size
+    size_t rows = params.rowsPerStrip_;
+    if ( rows == 0 )
+    {
+        rows = std::max<size_t>(1, STRIP_TARGET_SIZE/bytesPerRow);
+    }
+    return static_cast<uint32_t>(std::min<size_t>(rows, std::max<uint32_t>(height, 1)));
+}
+
+//! \brief sets compression and predictor, \return the predictor to apply
+//! \a isFloat whether the samples are IEEE floating point
+int writeCompression(TIFF* tif, const TiffWriterParams& params, bool isFloat)
+{
+    if ( !params.deflateCompression_ ) return PREDICTOR_NONE;
+
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+
+    switch (params.predictor_)
+    {
+    case PREDICTOR_NONE:
+        return PREDICTOR_NONE;
+    case PREDICTOR_HORIZONTAL:
+        if ( isFloat ) break;
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+        return PREDICTOR_HORIZONTAL;
+    case PREDICTOR_FLOATINGPOINT:
+        if ( !isFloat ) break;
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+        return PREDICTOR_FLOATINGPOINT;
+    }
+    throw pfs::io::WriteException("TiffWriter: predictor " +
+                                  boost::lexical_cast<std::string>(params.predictor_) +
+                                  " not supported for this sample format");
+}
+
+inline
+bool isBigEndian()
+{
+    const uint16_t word = 1;
+    uint8_t firstByte;
+    std::memcpy(&firstByte, &word, 1);
+    return firstByte == 0;
+}
+
+//! \brief horizontal differencing of a row of interleaved RGB samples
+template <typename T>
+void horizontalDiff(T* row, uint32_t width)
+{
+    for (size_t idx = size_t(width)*3 - 1; idx >= 3; --idx)
+    {
+        row[idx] = static_cast<T>(row[idx] - row[idx - 3]);
+    }
+}
+
+//! \brief floating point predictor (Adobe TIFF technical note 3): the bytes
+//! of the samples are split in planes, most significant first, and the
+//! planes are differenced bytewise
+void floatingPointDiff(float* row, uint32_t width, std::vector<uint8_t>& tmp)
+{
+    const size_t wc = size_t(width)*3;
+    const size_t bps = sizeof(float);
+    const size_t cc = wc*bps;
+    const bool bigEndian = isBigEndian();
+
+    tmp.resize(cc);
+    std::memcpy(tmp.data(), row, cc);
 
-    std::vector<char> embedBuffer(profileSize);
+    uint8_t* cp = reinterpret_cast<uint8_t*>(row);
+    for (size_t count = 0; count < wc; ++count)
+    {
+        for (size_t byte = 0; byte < bps; ++byte)
+        {
+            const size_t plane = bigEndian ? byte : (bps - byte - 1);
+            cp[plane*wc + count] = tmp[bps*count + byte];
+        }
+    }
+    for (size_t idx = cc - 1; idx >= 3; --idx)
+    {
+        cp[idx] = static_cast<uint8_t>(cp[idx] - cp[idx - 3]);
+    }
+}
 
-    cmsSaveProfileToMem(hsRGB.data(),
-                        reinterpret_cast<void*>(embedBuffer.data()),
-                        &profileSize);
+template <typename T>
+void applyPredictor(T* row, uint32_t width, int predictor, std::vector<uint8_t>&)
+{
+    if ( predictor == PREDICTOR_HORIZONTAL ) horizontalDiff(row, width);
+}
 
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, profileSize,
-                 reinterpret_cast<void*>(embedBuffer.data()) );
+template <>
+void applyPredictor(float* row, uint32_t width, int predictor, std::vector<uint8_t>& tmp)
+{
+    if ( predictor == PREDICTOR_FLOATINGPOINT ) floatingPointDiff(row, width, tmp);
+}
+
+//! \brief encodes the strips of \a frame in parallel and writes them in order.
+//!
+//! Every strip is remapped with \a remapper and, if compression is on,
+//! predicted and deflated in memory, then written with TIFFWriteRawStrip.
+//! With \a useCodec the samples are handed to the codec set in \a tif
+//! instead (used by LogLuv, whose encoder lives inside libtiff).
+template <typename T, typename Remapper>
+void writeStrips(TIFF* tif, const Frame& frame, const TiffWriterParams& params,
+                 uint32_t rowsPerStrip, int predictor, const Remapper& remapper,
+                 bool useCodec = false)
+{
+    const uint32_t width = frame.getWidth();
+    const uint32_t height = frame.getHeight();
+    const tstrip_t stripsNum = TIFFNumberOfStrips(tif);
+    const bool deflate = params.deflateCompression_ && !useCodec;
+    const int deflateLevel = params.deflateLevel_;
+
+    const Channel* rChannel;
+    const Channel* gChannel;
+    const Channel* bChannel;
+    frame.getXYZChannels(rChannel, gChannel, bChannel);
+
+    // strips are encoded in batches, so memory does not grow with the frame
+    const tstrip_t batchSize = 4*omp_get_max_threads();
+    std::vector< std::vector<uint8_t> > encoded(batchSize);
+
+    for (tstrip_t first = 0; first < stripsNum; first += batchSize)
+    {
+        const int count = static_cast<int>(std::min(batchSize, stripsNum - first));
+        // exceptions cannot leave the parallel region
+        bool deflateFailed = false;
+
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < count; ++i)
+        {
+            const uint32_t firstRow = (first + i)*rowsPerStrip;
+            const uint32_t rows = std::min(rowsPerStrip, height - firstRow);
+            const size_t rowSamples = size_t(width)*3;
+
+            std::vector<T> samples(rowSamples*rows);
+            std::vector<uint8_t> tmp;
+            for (uint32_t r = 0; r < rows; ++r)
+            {
+                T* out = samples.data() + r*rowSamples;
+                utils::transform(rChannel->row_begin(firstRow + r),
+                                 rChannel->row_end(firstRow + r),
+                                 gChannel->row_begin(firstRow + r),
+                                 bChannel->row_begin(firstRow + r),
+                                 FixedStrideIterator<T*, 3>(out),
+                                 FixedStrideIterator<T*, 3>(out + 1),
+                                 FixedStrideIterator<T*, 3>(out + 2),
+                                 remapper);
+                applyPredictor(out, width, predictor, tmp);
+            }
+
+            const Bytef* raw = reinterpret_cast<const Bytef*>(samples.data());
+            const uLong rawSize = samples.size()*sizeof(T);
+            std::vector<uint8_t>& strip = encoded[i];
+            if ( deflate )
+            {
+                uLongf stripSize = compressBound(rawSize);
+                strip.resize(stripSize);
+                if ( compress2(strip.data(), &stripSize, raw, rawSize, deflateLevel) != Z_OK )
+                {
+#pragma omp critical
+                    deflateFailed = true;
+                }
+                strip.resize(stripSize);
+            }
+            else
+            {
+                strip.assign(raw, raw + rawSize);
+            }
+        }
+
+        if ( deflateFailed )
+        {
+            throw pfs::io::WriteException("TiffWriter: cannot compress strips");
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            const tstrip_t s = first + i;
+            std::vector<uint8_t>& strip = encoded[i];
+            const tsize_t written = useCodec ?
+                        TIFFWriteEncodedStrip(tif, s, strip.data(), strip.size()) :
+                        TIFFWriteRawStrip(tif, s, strip.data(), strip.size());
+            if ( written == -1 )
+            {
+                throw pfs::io::WriteException("TiffWriter: Error writing strip " +
+                                              boost::lexical_cast<std::string>(s));
+            }
+        }
+    }
+}
+
+void writeSRGBProfile(TIFF* tif)
+{
+    const std::vector<char>& profile =
+            colorspace::IccManager::instance().sRGBProfileData();
+
+    TIFFSetField(tif, TIFFTAG_ICCPROFILE, static_cast<uint32_t>(profile.size()),
+                 const_cast<char*>(profile.data()) );
 }
 
 // Info: if you want to write the alpha channel, please use this!
@@ -177,51 +390,25 @@ bool writeUint8(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
 
     uint32_t width = frame.getWidth();
     uint32_t height = frame.getHeight();
+    uint32_t stripRows = rowsPerStrip(params, height, width*3*sizeof(uint8_t));
 
-    writeCommonHeader(tif, width, height);
+    writeCommonHeader(tif, width, height, stripRows);
     writeSRGBProfile(tif);
 
-	if (params.deflateCompression_)
-    	TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+    int predictor = writeCompression(tif, params, false);
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
     TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
     TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)8*(uint16_t)sizeof(uint8_t));
     TIFFSetField (tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
 
-    tsize_t stripSize = TIFFStripSize(tif);
-    assert( width*3 == stripSize );
-    tstrip_t stripsNum = TIFFNumberOfStrips(tif);
+    assert( (tsize_t)width*3*stripRows == TIFFStripSize(tif) );
 
-    const Channel* rChannel;
-    const Channel* gChannel;
-    const Channel* bChannel;
-    frame.getXYZChannels(rChannel, gChannel, bChannel);
-
-    std::vector<uint8_t> stripBuffer( stripSize );
-    for (tstrip_t s = 0; s < stripsNum; s++)
-    {
-        utils::transform(
-                    rChannel->row_begin(s),
-                    rChannel->row_end(s),
-                    gChannel->row_begin(s),
-                    bChannel->row_begin(s),
-                    FixedStrideIterator<uint8_t*, 3>(stripBuffer.data()),
-                    FixedStrideIterator<uint8_t*, 3>(stripBuffer.data() + 1),
-                    FixedStrideIterator<uint8_t*, 3>(stripBuffer.data() + 2),
-                    utils::chain(
-                        colorspace::Normalizer(params.minLuminance_, params.maxLuminance_),
-                        utils::CLAMP_F32,
-                        Remapper<uint8_t>(params.luminanceMapping_)
-                        )
-                    );
-
-        if (TIFFWriteEncodedStrip(tif, s, stripBuffer.data(), stripSize) != stripSize)
-        {
-            throw pfs::io::WriteException("TiffWriter: Error writing strip " +
-                                          boost::lexical_cast<std::string>(s));
-            return false;
-        }
-    }
+    writeStrips<uint8_t>(tif, frame, params, stripRows, predictor,
+                         utils::chain(
+                             colorspace::Normalizer(params.minLuminance_, params.maxLuminance_),
+                             utils::CLAMP_F32,
+                             Remapper<uint8_t>(params.luminanceMapping_)
+                             ));
     return true;
 }
 
@@ -234,29 +421,18 @@ bool writeUint16(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
 
     uint32_t width = frame.getWidth();
     uint32_t height = frame.getHeight();
+    uint32_t stripRows = rowsPerStrip(params, height, width*3*sizeof(uint16_t));
 
-    writeCommonHeader(tif, width, height);
+    writeCommonHeader(tif, width, height, stripRows);
     writeSRGBProfile(tif);
 
-    if (params.deflateCompression_)
-    {
-        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-    }
+    int predictor = writeCompression(tif, params, false);
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
     TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
     TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)8*(uint16_t)sizeof(uint16_t));
     TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
 
-    tsize_t stripSize = TIFFStripSize(tif);
-    assert( width*3*2 == stripSize );
-    tstrip_t stripsNum = TIFFNumberOfStrips(tif);
-
-    const Channel* rChannel;
-    const Channel* gChannel;
-    const Channel* bChannel;
-    frame.getXYZChannels(rChannel, gChannel, bChannel);
-
-    std::vector<uint16_t> stripBuffer( width*3 );
+    assert( (tsize_t)width*3*2*stripRows == TIFFStripSize(tif) );
 
     typedef utils::Chain<
             colorspace::Normalizer,
@@ -271,23 +447,8 @@ bool writeUint16(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
                     utils::Clamp<float>,
                     Remapper<uint16_t>
                 >(utils::Clamp<float>(0.f, 1.f), Remapper<uint16_t>(params.luminanceMapping_)));
-    for (tstrip_t s = 0; s < stripsNum; s++)
-    {
-        utils::transform(rChannel->row_begin(s), rChannel->row_end(s),
-                         gChannel->row_begin(s),
-                         bChannel->row_begin(s),
-                         FixedStrideIterator<uint16_t*, 3>(stripBuffer.data()),
-                         FixedStrideIterator<uint16_t*, 3>(stripBuffer.data() + 1),
-                         FixedStrideIterator<uint16_t*, 3>(stripBuffer.data() + 2),
-                         remapper);
-        if (TIFFWriteEncodedStrip(tif, s, stripBuffer.data(), stripSize) != stripSize)
-        {
-            throw pfs::io::WriteException("TiffWriter: Error writing strip " +
-                                          boost::lexical_cast<std::string>(s));
-            return false;
-        }
-    }
 
+    writeStrips<uint16_t>(tif, frame, params, stripRows, predictor, remapper);
     return true;
 }
 
@@ -301,32 +462,22 @@ bool writeFloat32(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
 
     uint32_t width = frame.getWidth();
     uint32_t height = frame.getHeight();
+    uint32_t stripRows = rowsPerStrip(params, height, width*3*sizeof(float));
 
-    writeCommonHeader(tif, width, height);
+    writeCommonHeader(tif, width, height, stripRows);
     // writeSRGBProfile(tif);
 
-    if (params.deflateCompression_)
-    {
-        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-    }
+    int predictor = writeCompression(tif, params, true);
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
     TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
     TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)8*(uint16_t)sizeof(float));
     TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
 
-    tsize_t stripSize = TIFFStripSize(tif);
-    assert( (tsize_t)sizeof(float)*width*3 == stripSize );
-    tstrip_t stripsNum = TIFFNumberOfStrips(tif);
-
-    const Channel* rChannel;
-    const Channel* gChannel;
-    const Channel* bChannel;
-    frame.getXYZChannels(rChannel, gChannel, bChannel);
+    assert( (tsize_t)sizeof(float)*width*3*stripRows == TIFFStripSize(tif) );
 
     PRINT_DEBUG(params.minLuminance_);
     PRINT_DEBUG(params.maxLuminance_);
 
-    std::vector<float> stripBuffer( width*3 );
     typedef utils::Chain<
             colorspace::Normalizer,
             utils::Clamp<float>
@@ -335,24 +486,8 @@ bool writeFloat32(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
     TiffRemapper remapper(
                 colorspace::Normalizer(params.minLuminance_, params.maxLuminance_),
                 utils::Clamp<float>(0.f, 1.f));
-    for (tstrip_t s = 0; s < stripsNum; s++)
-    {
-        utils::transform(rChannel->row_begin(s), rChannel->row_end(s),
-                         gChannel->row_begin(s),
-                         bChannel->row_begin(s),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data()),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data() + 1),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data() + 2),
-                         remapper);
-        if (TIFFWriteEncodedStrip(tif, s, stripBuffer.data(), stripSize) == 0)
-        {
-            throw pfs::io::WriteException("TiffWriter: Error writing strip " +
-                                          boost::lexical_cast<std::string>(s));
-
-            return -1;
-        }
-    }
 
+    writeStrips<float>(tif, frame, params, stripRows, predictor, remapper);
     return true;
 }
 
@@ -366,8 +501,9 @@ bool writeLogLuv(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
 
     uint32_t width = frame.getWidth();
     uint32_t height = frame.getHeight();
+    uint32_t stripRows = rowsPerStrip(params, height, width*3*sizeof(float));
 
-    writeCommonHeader(tif, width, height);
+    writeCommonHeader(tif, width, height, stripRows);
 
     TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_SGILOG);
     TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_LOGLUV);
@@ -377,16 +513,7 @@ bool writeLogLuv(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
     TIFFSetField(tif, TIFFTAG_SGILOGDATAFMT, SGILOGDATAFMT_FLOAT);
     TIFFSetField(tif, TIFFTAG_STONITS, 1.);	/* not known */
 
-    tsize_t stripSize = TIFFStripSize(tif);
-    assert( (tsize_t)sizeof(float)*width*3 == stripSize );
-    tstrip_t stripsNum = TIFFNumberOfStrips(tif);
-
-    const Channel* rChannel;
-    const Channel* gChannel;
-    const Channel* bChannel;
-    frame.getXYZChannels(rChannel, gChannel, bChannel);
-
-    std::vector<float> stripBuffer( width*3 );
+    assert( (tsize_t)sizeof(float)*width*3*stripRows == TIFFStripSize(tif) );
 
     // remap to [0, 1] + transform to colorspace XYZ
     // no gamma curve applied
@@ -404,24 +531,8 @@ bool writeLogLuv(TIFF* tif, const Frame& frame, const TiffWriterParams& params)
                     colorspace::ConvertRGB2XYZ
                 >(utils::Clamp<float>(0.f, 1.f), colorspace::ConvertRGB2XYZ()));
 
-    for (tstrip_t s = 0; s < stripsNum; s++)
-    {
-        utils::transform(rChannel->row_begin(s), rChannel->row_end(s),
-                         gChannel->row_begin(s),
-                         bChannel->row_begin(s),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data()),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data() + 1),
-                         FixedStrideIterator<float*, 3>(stripBuffer.data() + 2),
-                         remapper);
-        if (TIFFWriteEncodedStrip(tif, s, stripBuffer.data(), stripSize) != stripSize)
-        {
-            throw pfs::io::WriteException("TiffWriter: Error writing strip " +
-                                          boost::lexical_cast<std::string>(s));
-
-            return false;
-        }
-    }
-
+    // the SGILOG encoder runs inside libtiff: only the remapping is parallel
+    writeStrips<float>(tif, frame, params, stripRows, PREDICTOR_NONE, remapper, true);
     return true;
 }
 
@@ -26,12 +26,16 @@
 
 #include <boost/math/constants/constants.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <stdint.h>
+#include <vector>
 // #include <stdio.h>
 // #include <stdlib.h>
 
 #include "Libpfs/array2d.h"
+#include "Libpfs/frame.h"
 #include "arch/math.h"
 
 
@@ -46,101 +50,31 @@ MirrorBallProjection MirrorBallProjection::singleton(true);
 
 const double EPSILON=1e-7;
 
-class Vector3D
+namespace
 {
-  public:
-  double x, y, z;
-
-  Vector3D(double phi, double theta)
-  {
-    x = cos(phi) * sin(theta);
-    y = sin(phi) * sin(theta);
-    z = cos(theta);
-  }
-
-  Vector3D(double x, double y, double z)
-  {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-
-    normalize();
-  }
-  
-  double magnitude(void)
-  {
-    return sqrt( x * x + y * y + z * z );
-  }
-
-  void normalize(void)
-  {
-    double len = magnitude();
-
-    x = x / len;
-    y = y / len;
-    z = z / len;
-  }
-
-  double dot(Vector3D *v)
-  {
-    return x * v->x + y * v->y + z * v->z;
-  }
-
-  //TODO: optimize rotations by precomputing sines and cosines
-  void rotateX(double angle)
-  {
-    angle *= boost::math::double_constants::degree;
-
-    double c = cos(angle);
-    double s = sin(angle);
-
-    double y2 =  c * y + -s * z;
-    double z2 =  s * y + c * z;
-
-    y = y2;
-    z = z2;
-  }
-
-  void rotateY(double angle)
-  {
-    angle *= boost::math::double_constants::degree;
-
-    double c = cos(angle);
-    double s = sin(angle);
-
-    double x2 =  c * x + s * z;
-    double z2 = -s * x + c * z;
-
-    x = x2;
-    z = z2;
-  }
-
-  void rotateZ(double angle)
-  {
-    angle *= boost::math::double_constants::degree;
-
-    double c = cos(angle);
-    double s = sin(angle);
-
-    double x2 =  c * x + -s * y;
-    double y2 =  s * x + c * y;
+//! \brief \a c clamped to [-1, 1]: the dot products of unit vectors can be
+//! just outside the domain of acos after rounding
+inline double clampUnit(double c)
+{
+  return std::max(-1., std::min(c, 1.));
+}
+}
 
-    x = x2;
-    y = y2;
-  }
-};
+Vector3D::Vector3D(double phi, double theta)
+{
+  x = cos(phi) * sin(theta);
+  y = sin(phi) * sin(theta);
+  z = cos(theta);
+}
 
-class Point2D
+Vector3D::Vector3D(double x, double y, double z)
 {
-  public:
-    double x, y;
+  double len = sqrt( x * x + y * y + z * z );
 
-  Point2D(double x, double y)
-  {
-    this->x = x;
-    this->y = y;
-  }
-};
+  this->x = x / len;
+  this->y = y / len;
+  this->z = z / len;
+}
 
 
 ///PROJECTIONFACTORY
@@ -162,7 +96,8 @@ Projection *ProjectionFactory::getProjection(char *name) {
       }
 
 
-      ProjectionCreator projectionCreator = singleton.projections.find(string(name))->second;
+      map<string, ProjectionCreator>::const_iterator it = singleton.projections.find(string(name));
+      ProjectionCreator projectionCreator = (it != singleton.projections.end()) ? it->second : NULL;
 
       if(projectionCreator != NULL)
       {
@@ -204,11 +139,11 @@ const char *MirrorBallProjection::getName(void) {
     return name;
 }
 
-double MirrorBallProjection::getSizeRatio(void) {
+double MirrorBallProjection::getSizeRatio(void) const {
     return 1;
 }
 
-bool MirrorBallProjection::isValidPixel(double u, double v) {
+bool MirrorBallProjection::isValidPixel(double u, double v) const {
     // check if we are not in a boundary region (outside a circle)
     if((u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5) > 0.25)
       return false;
@@ -216,41 +151,40 @@ bool MirrorBallProjection::isValidPixel(double u, double v) {
       return true;
 }
 
-Vector3D* MirrorBallProjection::uvToDirection(double u, double v) {
+Vector3D MirrorBallProjection::uvToDirection(double u, double v) const {
     u = 2 * u - 1;
     v = 2 * v - 1;
 
     double phi = atan2( v, u );
     double theta = 2 * asin( sqrt( u * u + v * v ) );
 
-    Vector3D *direction = new Vector3D(phi, theta);
-//     double t;
+    Vector3D direction(phi, theta);
 
-    direction->y = -direction->y;
+    direction.y = -direction.y;
 
     return direction;
 }
 
-Point2D* MirrorBallProjection::directionToUV(Vector3D *direction) {
+Point2D MirrorBallProjection::directionToUV(const Vector3D& direction) const {
     double u, v;
 
-    direction->y = -direction->y;
+    const double y = -direction.y;
 
-    if(fabs(direction->x) > 0 || fabs(direction->y) > 0)
+    if(fabs(direction.x) > 0 || fabs(y) > 0)
     {
-      double distance = sqrt(direction->x * direction->x + direction->y * direction->y);
+      double distance = sqrt(direction.x * direction.x + y * y);
 
-      double r = 0.5 * (sin(acos(direction->z) / 2)) / distance;
+      double r = 0.5 * (sin(acos(clampUnit(direction.z)) / 2)) / distance;
 
-      u = direction->x * r + 0.5;
-      v = direction->y * r + 0.5;
+      u = direction.x * r + 0.5;
+      v = y * r + 0.5;
     }
     else
     {
       u = v = 0.5;
     }
 
-    return new Point2D(u, v);
+    return Point2D(u, v);
 }
 ///END MIRRORBALL
 
@@ -304,11 +238,11 @@ const char *AngularProjection::getName(void) {
     return name;
 }
 
-double AngularProjection::getSizeRatio(void) {
+double AngularProjection::getSizeRatio(void) const {
     return 1;
 }
 
-bool AngularProjection::isValidPixel(double u, double v) {
+bool AngularProjection::isValidPixel(double u, double v) const {
     // check if we are not in a boundary region (outside a circle)
     if((u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5) > 0.25)
       return false;
@@ -316,7 +250,7 @@ bool AngularProjection::isValidPixel(double u, double v) {
       return true;
 }
 
-Vector3D* AngularProjection::uvToDirection(double u, double v) {
+Vector3D AngularProjection::uvToDirection(double u, double v) const {
     u = 2 * u - 1;
     v = 2 * v - 1;
 
@@ -326,87 +260,83 @@ Vector3D* AngularProjection::uvToDirection(double u, double v) {
     double phi = atan2( v, u );
     double theta = boost::math::double_constants::pi * sqrt( u * u + v * v );
 
-    Vector3D *direction = new Vector3D(phi, theta);
-//     double t;
+    Vector3D direction(phi, theta);
 
-    direction->y = -direction->y;
+    direction.y = -direction.y;
 
     return direction;
 }
 
-Point2D* AngularProjection::directionToUV(Vector3D *direction) {
+Point2D AngularProjection::directionToUV(const Vector3D& direction) const {
     double u, v;
 
-    direction->y = -direction->y;
+    const double y = -direction.y;
 
-    if(fabs(direction->x) > 0 || fabs(direction->y) > 0)
+    if(fabs(direction.x) > 0 || fabs(y) > 0)
     {
-      double distance = sqrt(direction->x * direction->x + direction->y * direction->y);
+      double distance = sqrt(direction.x * direction.x + y * y);
 
-      double r = (boost::math::double_constants::one_div_two_pi) * acos(direction->z) / distance;
+      double r = (boost::math::double_constants::one_div_two_pi) * acos(clampUnit(direction.z)) / distance;
 
-      u = direction->x * r + 0.5;
-      v = direction->y * r + 0.5;
+      u = direction.x * r + 0.5;
+      v = y * r + 0.5;
     }
     else
     {
       u = v = 0.5;
     }
 
-    return new Point2D(u, v);
+    return Point2D(u, v);
 }
 ///END ANGULAR
 
 
 ///CYLINDRICAL
-CylindricalProjection::CylindricalProjection(bool initialization) {
+CylindricalProjection::CylindricalProjection(bool initialization)
+    : pole(0, 1, 0)
+    , equator(0, 0, -1)
+    , cross(1, 0, 0)
+{
     name = "cylindrical";
 
     if(initialization)
       ProjectionFactory::registerProjection(name, this->create);
-
-    pole = new Vector3D(0, 1, 0);
-    equator = new Vector3D(0, 0, -1);
-    cross = new Vector3D(1, 0, 0);
 }
 
 Projection* CylindricalProjection::create()  {
     return new CylindricalProjection(false);
 }
 
-CylindricalProjection::~CylindricalProjection() {
-    delete pole;
-    delete equator;
-    delete cross;
-}
-
-double CylindricalProjection::getSizeRatio(void) {
+double CylindricalProjection::getSizeRatio(void) const {
     return 2;
 }
 
-bool CylindricalProjection::isValidPixel(double /*u*/, double /*v*/) {
+bool CylindricalProjection::isValidPixel(double /*u*/, double /*v*/) const {
     return true;
 }
 
-Vector3D* CylindricalProjection::uvToDirection(double u, double v) {
-    u = 0.75 - u;
-
-    u *= boost::math::double_constants::two_pi;
+Vector3D CylindricalProjection::uvToDirection(double u, double v) const {
+    const double phi = longitude(u);
+    const double theta = colatitude(v);
 
-    v = acos( 1 - 2 * v );
+    return directionFromAngles(cos(phi), sin(phi), cos(theta), sin(theta));
+}
 
-    Vector3D *direction = new Vector3D(u, v);
+bool CylindricalProjection::isSeparable() const {
+    return true;
+}
 
-    double temp = direction->z;
-    direction->z = direction->y;
-    direction->y = temp;
+double CylindricalProjection::longitude(double u) const {
+    return (0.75 - u) * boost::math::double_constants::two_pi;
+}
 
-    return direction;
+double CylindricalProjection::colatitude(double v) const {
+    return acos( 1 - 2 * v );
 }
 
-Point2D* CylindricalProjection::directionToUV(Vector3D *direction) {
+Point2D CylindricalProjection::directionToUV(const Vector3D& direction) const {
     double u, v;
-    double lat = direction->dot(pole);
+    double lat = clampUnit(direction.dot(pole));
 
     v = ( 1 - lat ) / 2;
 
@@ -414,7 +344,7 @@ Point2D* CylindricalProjection::directionToUV(Vector3D *direction) {
       u = 0;
     else
     {
-      double ratio = equator->dot( direction ) / sin( acos( lat ) );
+      double ratio = equator.dot( direction ) / sin( acos( lat ) );
 
       if(ratio < -1)
         ratio = -1;
@@ -424,7 +354,7 @@ Point2D* CylindricalProjection::directionToUV(Vector3D *direction) {
 
       double lon = acos(ratio) / (boost::math::double_constants::two_pi);
 
-      if(cross->dot(direction) < 0)
+      if(cross.dot(direction) < 0)
         u = lon;
       else
         u = 1 - lon;
@@ -439,59 +369,57 @@ Point2D* CylindricalProjection::directionToUV(Vector3D *direction) {
   //  if ( 0 > v || v >= 1 ) fprintf(stderr, "u: %f (%f,%f,%f)\n", v, direction->x, direction->y, direction->z);
   //  assert ( -0. <= u && u < 1 );
   //  assert ( -0. <= v && v < 1 );
-    return new Point2D(u, v);
+    return Point2D(u, v);
 }
 ///END CYLINDRICAL
 
 
 ///POLAR
-PolarProjection::PolarProjection(bool initialization) {
+PolarProjection::PolarProjection(bool initialization)
+    : pole(0, 1, 0)
+    , equator(0, 0, -1)
+    , cross(1, 0, 0)
+{
     name = "polar";
 
     if(initialization)
       ProjectionFactory::registerProjection(name, this->create);
-
-    pole = new Vector3D(0, 1, 0);
-    equator = new Vector3D(0, 0, -1);
-    cross = new Vector3D(1, 0, 0);
 }
 
 Projection* PolarProjection::create() {
     return new PolarProjection(false);
 }
 
-PolarProjection::~PolarProjection() {
-    delete pole;
-    delete equator;
-    delete cross;
-}
-
-double PolarProjection::getSizeRatio(void) {
+double PolarProjection::getSizeRatio(void) const {
     return 2;
 }
 
-bool PolarProjection::isValidPixel(double /*u*/, double /*v*/) {
+bool PolarProjection::isValidPixel(double /*u*/, double /*v*/) const {
     return true;
 }
 
-Vector3D* PolarProjection::uvToDirection(double u, double v) {
-    u = 0.75 - u;
+Vector3D PolarProjection::uvToDirection(double u, double v) const {
+    const double phi = longitude(u);
+    const double theta = colatitude(v);
 
-    u *= boost::math::double_constants::two_pi;
-    v *= boost::math::double_constants::pi;
+    return directionFromAngles(cos(phi), sin(phi), cos(theta), sin(theta));
+}
 
-    Vector3D *direction = new Vector3D(u, v);
+bool PolarProjection::isSeparable() const {
+    return true;
+}
 
-    double temp = direction->z;
-    direction->z = direction->y;
-    direction->y = temp;
+double PolarProjection::longitude(double u) const {
+    return (0.75 - u) * boost::math::double_constants::two_pi;
+}
 
-    return direction;
+double PolarProjection::colatitude(double v) const {
+    return v * boost::math::double_constants::pi;
 }
 
-Point2D* PolarProjection::directionToUV(Vector3D *direction) {
+Point2D PolarProjection::directionToUV(const Vector3D& direction) const {
     double u, v;
-    double lat = acos(direction->dot(pole));
+    double lat = acos(clampUnit(direction.dot(pole)));
 
     v = lat * (1 / boost::math::double_constants::pi);
 
@@ -499,7 +427,7 @@ Point2D* PolarProjection::directionToUV(Vector3D *direction) {
       u = 0;
     else
     {
-      double ratio = equator->dot(direction) / sin(lat);
+      double ratio = equator.dot(direction) / sin(lat);
 
       if(ratio < -1)
         ratio = -1;
@@ -509,7 +437,7 @@ Point2D* PolarProjection::directionToUV(Vector3D *direction) {
 
       double lon = acos(ratio) / (boost::math::double_constants::two_pi);
 
-      if(cross->dot(direction) < 0)
+      if(cross.dot(direction) < 0)
         u = lon;
       else
         u = 1 - lon;
@@ -524,105 +452,309 @@ Point2D* PolarProjection::directionToUV(Vector3D *direction) {
   //  if ( 0 > v || v >= 1 ) fprintf(stderr, "u: %f (%f,%f,%f)\n", v, direction->x, direction->y, direction->z);
   //  assert ( -0. <= u && u < 1 );
   //  assert ( -0. <= v && v < 1 );
-    return new Point2D(u, v);
+    return Point2D(u, v);
 }
 ///END POLAR
 
 
-void transformArray( const pfs::Array2Df *in, pfs::Array2Df *out, TransformInfo *transformInfo)
+namespace
+{
+//! \brief rotation of the destination directions: the angles are negated,
+//! because we want to rotate the environment around us, not us within the
+//! environment. Same as rotating around x, then y, then z.
+class Rotation
 {
-  const double delta = 1. / transformInfo->oversampleFactor;
-  const double offset = 0.5 / transformInfo->oversampleFactor;
-  const double scaler = 1. / ( transformInfo->oversampleFactor * transformInfo->oversampleFactor );
-  
-  const int outRows = out->getRows();
-  const int outCols = out->getCols();
+  double m[3][3];
 
-  const int inRows = in->getRows();
-  const int inCols = in->getCols();
+  public:
+  Rotation(double xRotate, double yRotate, double zRotate)
+  {
+    const double ax = -xRotate * boost::math::double_constants::degree;
+    const double ay = -yRotate * boost::math::double_constants::degree;
+    const double az = -zRotate * boost::math::double_constants::degree;
+
+    const double cx = cos(ax), sx = sin(ax);
+    const double cy = cos(ay), sy = sin(ay);
+    const double cz = cos(az), sz = sin(az);
+
+    // Rz * Ry * Rx
+    m[0][0] = cz * cy;  m[0][1] = cz * sy * sx - sz * cx;  m[0][2] = cz * sy * cx + sz * sx;
+    m[1][0] = sz * cy;  m[1][1] = sz * sy * sx + cz * cx;  m[1][2] = sz * sy * cx - cz * sx;
+    m[2][0] = -sy;      m[2][1] = cy * sx;                 m[2][2] = cy * cx;
+  }
 
+  Vector3D operator()(const Vector3D& d) const
+  {
+    Vector3D r;
+    r.x = m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z;
+    r.y = m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z;
+    r.z = m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z;
+    return r;
+  }
+};
 
-  for( int y = 0; y < outRows; y++ )
-    for( int x = 0; x < outCols; x++ ) {
-      double pixVal = 0;
+//! \brief source pixels and weights of a sample along one axis
+struct FilterTaps
+{
+  static const int MAX_TAPS = 6;
+
+  int count;
+  int index[MAX_TAPS];
+  double weight[MAX_TAPS];
+};
+
+//! \brief true if \a c is a coordinate of the source, in [0, 1] up to
+//! rounding. The bits are tested first: -ffast-math folds the comparisons of
+//! NaNs, they would reach the int conversions of computeTaps()
+inline bool isValidCoordinate(double c)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &c, sizeof(bits));
+  if ( (bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL ) return false;
+
+  return c >= -EPSILON && c <= 1 + EPSILON;
+}
+
+inline int clampIndex(int i, int size)
+{
+  return std::max(0, std::min(i, size - 1));
+}
+
+//! \brief taps of \a filter at position \a p (pixel centers on integers)
+void computeTaps(ProjectionFilter filter, double p, int size, FilterTaps& taps)
+{
+  switch ( filter )
+  {
+  case PROJECTION_NEAREST:
+  {
+    taps.count = 1;
+    taps.index[0] = clampIndex((int)floor(p + 0.5), size);
+    taps.weight[0] = 1;
+  } break;
+  case PROJECTION_BILINEAR:
+  {
+    const int ip = (int)floor(p);
+    const double t = p - ip;
+
+    taps.count = 2;
+    taps.index[0] = clampIndex(ip, size);
+    taps.index[1] = clampIndex(ip + 1, size);
+    taps.weight[0] = 1 - t;
+    taps.weight[1] = t;
+  } break;
+  case PROJECTION_BICUBIC:
+  {
+    const int ip = (int)floor(p);
+    const double t = p - ip;
+
+    taps.count = 4;
+    for (int k = 0; k < 4; ++k)
+      taps.index[k] = clampIndex(ip - 1 + k, size);
+
+    // Catmull-Rom
+    taps.weight[0] = ((-0.5 * t + 1) * t - 0.5) * t;
+    taps.weight[1] = (1.5 * t - 2.5) * t * t + 1;
+    taps.weight[2] = ((-1.5 * t + 2) * t + 0.5) * t;
+    taps.weight[3] = (0.5 * t - 0.5) * t * t;
+  } break;
+  case PROJECTION_LANCZOS3:
+  {
+    using boost::math::double_constants::pi;
+
+    // sin(pi*k/3), cos(pi*k/3) for k = -2..3
+    static const double SIN_K[6] = { -0.86602540378443865, -0.86602540378443865, 0,
+                                     0.86602540378443865, 0.86602540378443865, 0 };
+    static const double COS_K[6] = { -0.5, 0.5, 1, 0.5, -0.5, -1 };
 
-      if( transformInfo->dstProjection->isValidPixel(( x + 0.5 ) / outCols, ( y + 0.5 ) / outCols ) == true )
+    const int ip = (int)floor(p);
+    const double t = p - ip;
+
+    // sin(pi*(t - k)) = (-1)^k sin(pi*t): two sines per axis, not twelve
+    const double sinT = sin(pi * t);
+    const double sinT3 = sin(pi * t / 3);
+    const double cosT3 = cos(pi * t / 3);
+
+    taps.count = 6;
+    double sum = 0;
+    for (int k = -2; k <= 3; ++k)
+    {
+      const int i = k + 2;
+      const double d = t - k;
+
+      taps.index[i] = clampIndex(ip + k, size);
+      if ( fabs(d) < EPSILON )
       {
-        for( double sy = 0, oy = 0; oy < transformInfo->oversampleFactor; sy += delta, oy++ )
-          for( double sx = 0, ox = 0; ox < transformInfo->oversampleFactor; sx += delta, ox++ )
-          {
-            Vector3D *direction = transformInfo->dstProjection->uvToDirection(
-                ( x + offset + sx ) / outCols, ( y + offset + sy ) / outRows );
+        taps.weight[i] = 1;
+      }
+      else
+      {
+        const double sinD = (k % 2 == 0) ? sinT : -sinT;
+        const double sinD3 = sinT3 * COS_K[i] - cosT3 * SIN_K[i];
+        taps.weight[i] = 3 * sinD * sinD3 / (pi * pi * d * d);
+      }
+      sum += taps.weight[i];
+    }
+    for (int i = 0; i < 6; ++i)
+      taps.weight[i] /= sum;
+  } break;
+  }
+}
 
-            if(direction == NULL)
-              continue;
+void transformChannels(const std::vector<const pfs::Array2Df*>& in,
+                       const std::vector<pfs::Array2Df*>& out,
+                       const TransformInfo& transformInfo)
+{
+  if ( in.empty() ) return;
 
-            // angles below are negated, because we want to rotate
-            // the environment around us, not us within the environment.
-            if( transformInfo->xRotate != 0 )
-              direction->rotateX( -transformInfo->xRotate );
+  const Projection& dstProjection = *transformInfo.dstProjection;
+  const Projection& srcProjection = *transformInfo.srcProjection;
+  const ProjectionFilter filter = transformInfo.filter;
 
-            if( transformInfo->yRotate != 0 )
-              direction->rotateY( -transformInfo->yRotate );
+  const int numChannels = static_cast<int>(in.size());
+  const int oversample = std::max(1, transformInfo.oversampleFactor);
 
-            if( transformInfo->zRotate != 0 )
-              direction->rotateZ( -transformInfo->zRotate );
+  const int outRows = out[0]->getRows();
+  const int outCols = out[0]->getCols();
 
-            Point2D *p = transformInfo->srcProjection->directionToUV( direction );
+  const int inRows = in[0]->getRows();
+  const int inCols = in[0]->getCols();
 
-            p->x *= inCols;
-            p->y *= inRows;
+  const Rotation rotation(transformInfo.xRotate, transformInfo.yRotate, transformInfo.zRotate);
 
-            if( transformInfo->interpolate == true )
-            {
-              int ix = (int)floor( p->x );
-              int iy = (int)floor( p->y );
-
-              double i = p->x - ix;
-              double j = p->y - iy;
-
-              // compute pixel weights for interpolation
-              double w1 = i * j;
-              double w2 = (1 - i) * j;
-              double w3 = (1 - i) * (1 - j);
-              double w4 = i * (1 - j);
-
-              int dx = ix + 1;
-              if(dx >= inCols)
-                dx = inCols - 1;
-
-              int dy = iy + 1;
-              if(dy >= inRows)
-                dy = inRows - 1;
-
-              pixVal += w3 * (*in)(ix, iy) +
-                        w4 * (*in)(dx, iy) +
-                        w1 * (*in)(dx, dy) +
-                        w2 * (*in)(ix, dy);
-            }
-            else
-            {
-              int ix = (int)floor(p->x + 0.5);
-              int iy = (int)floor(p->y + 0.5);
+  // u and v of every sample of every column and row
+  std::vector<double> sampleU(size_t(outCols) * oversample);
+  std::vector<double> sampleV(size_t(outRows) * oversample);
+  for (int x = 0; x < outCols; ++x)
+    for (int o = 0; o < oversample; ++o)
+      sampleU[x * oversample + o] = ( x + ( o + 0.5 ) / oversample ) / outCols;
+  for (int y = 0; y < outRows; ++y)
+    for (int o = 0; o < oversample; ++o)
+      sampleV[y * oversample + o] = ( y + ( o + 0.5 ) / oversample ) / outRows;
 
-              if(ix >= inCols)
-                ix = inCols - 1;
+  // separable destinations: trigonometry once per column and per row
+  const bool separable = dstProjection.isSeparable();
+  std::vector<double> cosPhi, sinPhi, cosTheta, sinTheta;
+  if ( separable )
+  {
+    cosPhi.resize(sampleU.size());
+    sinPhi.resize(sampleU.size());
+    for (size_t i = 0; i < sampleU.size(); ++i)
+    {
+      const double phi = dstProjection.longitude(sampleU[i]);
+      cosPhi[i] = cos(phi);
+      sinPhi[i] = sin(phi);
+    }
+    cosTheta.resize(sampleV.size());
+    sinTheta.resize(sampleV.size());
+    for (size_t i = 0; i < sampleV.size(); ++i)
+    {
+      const double theta = dstProjection.colatitude(sampleV[i]);
+      cosTheta[i] = cos(theta);
+      sinTheta[i] = sin(theta);
+    }
+  }
 
-              if(iy >= inRows)
-                iy = inRows - 1;
+  // Bicubic and Lanczos have negative lobes: do not let them produce
+  // negative radiance next to very bright pixels
+  const bool clampNegative = (filter == PROJECTION_BICUBIC || filter == PROJECTION_LANCZOS3);
 
-              pixVal += (*in)(ix, iy);
-            }
+#pragma omp parallel
+  {
+    std::vector<double> pixVal(numChannels);
+    FilterTaps tapsX;
+    FilterTaps tapsY;
+
+#pragma omp for schedule(dynamic, 4)
+    for( int y = 0; y < outRows; y++ )
+    {
+      for( int x = 0; x < outCols; x++ )
+      {
+        if( !dstProjection.isValidPixel(( x + 0.5 ) / outCols, ( y + 0.5 ) / outRows ) )
+        {
+          for (int c = 0; c < numChannels; ++c)
+            (*out[c])(x, y) = 0.f;
+          continue;
+        }
+
+        std::fill(pixVal.begin(), pixVal.end(), 0.);
+        int numSamples = 0;
 
+        for( int oy = 0; oy < oversample; oy++ )
+        {
+          const int sy = y * oversample + oy;
+          for( int ox = 0; ox < oversample; ox++ )
+          {
+            const int sx = x * oversample + ox;
 
-            delete direction;
-            delete p;
+            const Vector3D direction = rotation( separable ?
+                  Projection::directionFromAngles(cosPhi[sx], sinPhi[sx], cosTheta[sy], sinTheta[sy]) :
+                  dstProjection.uvToDirection(sampleU[sx], sampleV[sy]) );
 
-            (*out)(x,y) = pixVal * scaler;
+            const Point2D p = srcProjection.directionToUV( direction );
+
+            // no source pixel for this direction
+            if ( !isValidCoordinate(p.x) || !isValidCoordinate(p.y) ) continue;
+            ++numSamples;
+
+            computeTaps(filter, p.x * inCols, inCols, tapsX);
+            computeTaps(filter, p.y * inRows, inRows, tapsY);
+
+            for (int c = 0; c < numChannels; ++c)
+            {
+              const pfs::Array2Df& channel = *in[c];
+
+              double value = 0;
+              for (int j = 0; j < tapsY.count; ++j)
+              {
+                double rowValue = 0;
+                for (int i = 0; i < tapsX.count; ++i)
+                  rowValue += tapsX.weight[i] * channel(tapsX.index[i], tapsY.index[j]);
+
+                value += tapsY.weight[j] * rowValue;
+              }
+              pixVal[c] += value;
+            }
           }
+        }
+
+        const double scaler = (numSamples > 0) ? 1. / numSamples : 0.;
+        for (int c = 0; c < numChannels; ++c)
+        {
+          double value = pixVal[c] * scaler;
+          if ( clampNegative && value < 0 ) value = 0;
+          (*out[c])(x, y) = static_cast<float>(value);
+        }
       }
     }
+  }
+
+  // written through the element accessors
+  for (int c = 0; c < numChannels; ++c)
+    out[c]->touch();
+}
 }
 
+void transformArray( const pfs::Array2Df *in, pfs::Array2Df *out, TransformInfo *transformInfo)
+{
+  transformChannels(std::vector<const pfs::Array2Df*>(1, in),
+                    std::vector<pfs::Array2Df*>(1, out),
+                    *transformInfo);
+}
+
+void transformFrame( const pfs::Frame& in, pfs::Frame& out, const TransformInfo& transformInfo)
+{
+  std::vector<const pfs::Array2Df*> inChannels;
+  std::vector<pfs::Array2Df*> outChannels;
 
+  const pfs::ChannelContainer& channels = in.getChannels();
+  for (pfs::ChannelContainer::const_iterator it = channels.begin();
+       it != channels.end(); ++it)
+  {
+    inChannels.push_back(*it);
+    outChannels.push_back(out.createChannel( (*it)->getName() ));
+  }
 
+  transformChannels(inChannels, outChannels, transformInfo);
+
+  pfs::copyTags( &in, &out );
+}
@@ -34,19 +34,52 @@
 
 #include "Libpfs/array2d_fwd.h"
 
-class Vector3D;
-class Point2D;
+namespace pfs {
+class Frame;
+}
+
+//! \brief unit vector, pointing from the centre of the environment
+class Vector3D
+{
+  public:
+  double x, y, z;
+
+  Vector3D()
+    : x(0), y(0), z(1)
+  {}
+
+  //! \brief spherical coordinates, \a theta measured from the z axis
+  Vector3D(double phi, double theta);
+
+  //! \brief normalized (x, y, z)
+  Vector3D(double x, double y, double z);
+
+  double dot(const Vector3D& v) const
+  {
+    return x * v.x + y * v.y + z * v.z;
+  }
+};
+
+class Point2D
+{
+  public:
+  double x, y;
+
+  Point2D(double x, double y)
+    : x(x), y(y)
+  {}
+};
 
 class Projection
 {
   protected:
   const char *name;
   public:
-    
-    virtual Vector3D *uvToDirection(double u, double v) = 0;
-    virtual Point2D *directionToUV(Vector3D *direction) = 0;
-    virtual bool isValidPixel(double u, double v) = 0;
-    virtual double getSizeRatio(void) = 0;
+
+    virtual Vector3D uvToDirection(double u, double v) const = 0;
+    virtual Point2D directionToUV(const Vector3D& direction) const = 0;
+    virtual bool isValidPixel(double u, double v) const = 0;
+    virtual double getSizeRatio(void) const = 0;
     virtual ~Projection()
     {
     }
@@ -59,9 +92,37 @@ class Projection
     {
       return name;
     }
-};
 
+    //! \brief true if u only sets the longitude and v the colatitude: then
+    //! uvToDirection(u, v) == directionFromAngles(longitude(u), colatitude(v))
+    //! and the trigonometry can be computed once per column and per row
+    virtual bool isSeparable() const
+    {
+      return false;
+    }
+
+    virtual double longitude(double /*u*/) const
+    {
+      return 0;
+    }
+
+    virtual double colatitude(double /*v*/) const
+    {
+      return 0;
+    }
 
+    //! \brief direction of separable projections, from the sine and cosine of
+    //! longitude and colatitude
+    static Vector3D directionFromAngles(double cosPhi, double sinPhi,
+                                        double cosTheta, double sinTheta)
+    {
+      Vector3D direction;
+      direction.x = cosPhi * sinTheta;
+      direction.y = cosTheta;
+      direction.z = sinPhi * sinTheta;
+      return direction;
+    }
+};
 
 typedef Projection*(*ProjectionCreator)(void);
 class ProjectionFactory
@@ -82,10 +143,10 @@ class MirrorBallProjection : public Projection
   static MirrorBallProjection singleton;
   static Projection* create();
   const char *getName(void);
-  double getSizeRatio(void);
-  bool isValidPixel(double u, double v);
-  Vector3D* uvToDirection(double u, double v);
-  Point2D* directionToUV(Vector3D *direction);
+  double getSizeRatio(void) const;
+  bool isValidPixel(double u, double v) const;
+  Vector3D uvToDirection(double u, double v) const;
+  Point2D directionToUV(const Vector3D& direction) const;
 };
 
 class AngularProjection : public Projection
@@ -97,47 +158,60 @@ class AngularProjection : public Projection
   static Projection* create();
   void setOptions(char *opts);
   const char *getName(void);
-  double getSizeRatio(void);
-  bool isValidPixel(double u, double v);
-  Vector3D* uvToDirection(double u, double v);
-  Point2D* directionToUV(Vector3D *direction);
+  double getSizeRatio(void) const;
+  bool isValidPixel(double u, double v) const;
+  Vector3D uvToDirection(double u, double v) const;
+  Point2D directionToUV(const Vector3D& direction) const;
   void setAngle(double v) {totalAngle=v;}
 };
 
 
 class CylindricalProjection : public Projection
 {
-  Vector3D *pole;
-  Vector3D *equator;
-  Vector3D *cross;
+  Vector3D pole;
+  Vector3D equator;
+  Vector3D cross;
   explicit CylindricalProjection(bool initialization);
   public:
   static CylindricalProjection singleton;
   static Projection* create();
-  ~CylindricalProjection();
-  double getSizeRatio(void);
-  bool isValidPixel(double /*u*/, double /*v*/);
-  Vector3D* uvToDirection(double u, double v);
-  Point2D* directionToUV(Vector3D *direction);
+  double getSizeRatio(void) const;
+  bool isValidPixel(double /*u*/, double /*v*/) const;
+  Vector3D uvToDirection(double u, double v) const;
+  Point2D directionToUV(const Vector3D& direction) const;
+  bool isSeparable() const;
+  double longitude(double u) const;
+  double colatitude(double v) const;
 };
 
 class PolarProjection : public Projection
 {
-  Vector3D *pole;
-  Vector3D *equator;
-  Vector3D *cross;
+  Vector3D pole;
+  Vector3D equator;
+  Vector3D cross;
   explicit PolarProjection(bool initialization);
   public:
   static PolarProjection singleton;
   static Projection* create();
-  ~PolarProjection();
-  double getSizeRatio(void);
-  bool isValidPixel(double /*u*/, double /*v*/);
-  Vector3D* uvToDirection(double u, double v);
-  Point2D* directionToUV(Vector3D *direction);
+  double getSizeRatio(void) const;
+  bool isValidPixel(double /*u*/, double /*v*/) const;
+  Vector3D uvToDirection(double u, double v) const;
+  Point2D directionToUV(const Vector3D& direction) const;
+  bool isSeparable() const;
+  double longitude(double u) const;
+  double colatitude(double v) const;
 };
 
 
+//! \brief reconstruction filter used to sample the source image
+enum ProjectionFilter
+{
+  PROJECTION_NEAREST,
+  PROJECTION_BILINEAR,
+  PROJECTION_BICUBIC,     //!< Catmull-Rom, 4x4 taps
+  PROJECTION_LANCZOS3     //!< 6x6 taps
+};
+
 class TransformInfo
 {
   public:
@@ -145,7 +219,7 @@ class TransformInfo
   double yRotate;
   double zRotate;
   int oversampleFactor;
-  bool interpolate;
+  ProjectionFilter filter;
   Projection *srcProjection;
   Projection *dstProjection;
 
@@ -153,11 +227,19 @@ class TransformInfo
   {
     xRotate = yRotate = zRotate = 0;
     oversampleFactor = 1;
-    interpolate = true;
+    filter = PROJECTION_BILINEAR;
     srcProjection = dstProjection = NULL;
   }
 };
 
+//! \brief reprojects \a in into \a out, whose size sets the resolution of the
+//! result. Rows are processed in parallel.
 void transformArray( const pfs::Array2Df *in, pfs::Array2Df *out, TransformInfo *transformInfo);
 
+//! \brief reprojects every channel of \a in into \a out, in a single pass:
+//! the source coordinates and filter weights are computed once per sample
+//! for all the channels. The channels of \a out are created with the names
+//! of the ones of \a in, and the tags are copied.
+void transformFrame( const pfs::Frame& in, pfs::Frame& out, const TransformInfo& transformInfo);
+
 #endif // PFS_PROJECTION_H
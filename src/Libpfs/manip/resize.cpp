@@ -1,75 +1,462 @@
-/*
- * This file is a part of Luminance HDR package.
- * ---------------------------------------------------------------------- 
- * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
- * Copyright (C) 2012 Davide Anastasia
- * 
- *  This program is free software; you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation; either version 2 of the License, or
- *  (at your option) any later version.
- *
- *  This program is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with this program; if not, write to the Free Software
- *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
- * ---------------------------------------------------------------------- 
- */
-
-//! \brief Resize images in PFS stream
-//! \author Rafal Mantiuk, <mantiuk@mpi-sb.mpg.de>
-//! \author Davide Anastasia <davideanastasia@users.sourceforge.net>
-
-#include <cmath>
-#include <cassert>
-#include <iostream>
-#include <algorithm>
-#include <numeric>
-#include <cmath>
-
-#include "resize.h"
-
-#include "Libpfs/utils/msec_timer.h"
-
-#include "Libpfs/frame.h"
-
-namespace pfs
-{
-
-
-Frame* resize(Frame* frame, int xSize)
-{
-#ifdef TIMER_PROFILING
-    msec_timer f_timer;
-    f_timer.start();
-#endif
-
-    int new_x = xSize;
-    int new_y = (int)((float)frame->getHeight() * (float)xSize / (float)frame->getWidth());
-
-    pfs::Frame *resizedFrame = new pfs::Frame( new_x, new_y );
-
-    const ChannelContainer& channels = frame->getChannels();
-    for ( ChannelContainer::const_iterator it = channels.begin();
-          it != channels.end();
-          ++it)
-    {
-        pfs::Channel* newCh = resizedFrame->createChannel( (*it)->getName() );
-
-        resize(*it, newCh);
-    }
-    pfs::copyTags( frame, resizedFrame );
-
-#ifdef TIMER_PROFILING
-    f_timer.stop_and_update();
-    std::cout << "resizeFrame() = " << f_timer.get_time() << " msec" << std::endl;
-#endif 
-
-    return resizedFrame;
-}
-
-} // pfs
+/*
+ * This file is a part of Luminance HDR package.
+ * ---------------------------------------------------------------------- 
+ * Copyright (C) 2003,2004 Rafal Mantiuk and Grzegorz Krawczyk
+ * Copyright (C) 2012 Davide Anastasia
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ---------------------------------------------------------------------- 
+ */
+
+//! \brief Resize images in PFS stream
+//! \author Rafal Mantiuk, <mantiuk@mpi-sb.mpg.de>
+//! \author Davide Anastasia <davideanastasia@users.sourceforge.net>
+
+#include <cmath>
+#include <cassert>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "resize.h"
+#include "copy.h"
+
+#include "Libpfs/utils/msec_timer.h"
+
+#include "Libpfs/frame.h"
+
+namespace pfs
+{
+namespace
+{
+// reductions larger than this go through a box decimation to about twice the
+// output size first, so the filters never need more than a few taps per side
+const double MAX_FILTER_RATIO = 3.0;
+
+double boxFilter(double x)
+{
+    return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+}
+
+double triangleFilter(double x)
+{
+    x = std::fabs(x);
+    return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+double mitchellFilter(double x)
+{
+    const double B = 1.0/3.0;
+    const double C = 1.0/3.0;
+
+    x = std::fabs(x);
+    if ( x < 1.0 )
+    {
+        return ((12 - 9*B - 6*C)*x*x*x + (-18 + 12*B + 6*C)*x*x + (6 - 2*B))/6.0;
+    }
+    if ( x < 2.0 )
+    {
+        return ((-B - 6*C)*x*x*x + (6*B + 30*C)*x*x + (-12*B - 48*C)*x +
+                (8*B + 24*C))/6.0;
+    }
+    return 0.0;
+}
+
+double lanczos3Filter(double x)
+{
+    x = std::fabs(x);
+    if ( x < 1e-8 ) return 1.0;
+    if ( x >= 3.0 ) return 0.0;
+
+    const double pix = M_PI*x;
+    return 3.0*std::sin(pix)*std::sin(pix/3.0)/(pix*pix);
+}
+
+//! \brief contributions of the input samples to every output sample, along
+//! one axis. Weights are normalised and padded with zeros to \c m_taps.
+struct ResampleKernel
+{
+    ResampleKernel(size_t inSize, size_t outSize, ResizeFilter filter);
+
+    size_t m_taps;
+    std::vector<int> m_first;
+    std::vector<int> m_count;
+    std::vector<float> m_weights;
+
+private:
+    void add(size_t out, int first, std::vector<double>& weights);
+};
+
+ResampleKernel::ResampleKernel(size_t inSize, size_t outSize, ResizeFilter filter)
+    : m_taps(1)
+    , m_first(outSize)
+    , m_count(outSize)
+{
+    const double scale = static_cast<double>(inSize)/outSize;
+    std::vector< std::vector<double> > weights(outSize);
+
+    if ( filter == RESIZE_AUTO )
+    {
+        filter = (scale > 1.0) ? RESIZE_AREA : RESIZE_MITCHELL;
+    }
+
+    for (size_t i = 0; i < outSize; ++i)
+    {
+        std::vector<double>& w = weights[i];
+        int first = 0;
+
+        if ( inSize == outSize )
+        {
+            first = static_cast<int>(i);
+            w.push_back(1.0);
+        }
+        else if ( filter == RESIZE_AREA )
+        {
+            const double lo = i*scale;
+            const double hi = std::min((i + 1)*scale, static_cast<double>(inSize));
+
+            first = static_cast<int>(lo);
+            const int last = std::min(static_cast<int>(std::ceil(hi)),
+                                      static_cast<int>(inSize));
+            for (int j = first; j < last; ++j)
+            {
+                w.push_back(std::min(hi, j + 1.0) - std::max(lo, static_cast<double>(j)));
+            }
+        }
+        else
+        {
+            double (*kernel)(double) = mitchellFilter;
+            double radius = 2.0;
+            switch (filter)
+            {
+            case RESIZE_BOX: kernel = boxFilter; radius = 0.5; break;
+            case RESIZE_BILINEAR: kernel = triangleFilter; radius = 1.0; break;
+            case RESIZE_LANCZOS3: kernel = lanczos3Filter; radius = 3.0; break;
+            default: break;
+            }
+
+            // on reductions the filter is stretched over the input pixels
+            // covered by one output pixel
+            const double filterScale = std::max(1.0, scale);
+            const double support = radius*filterScale;
+            const double center = (i + 0.5)*scale;
+
+            first = std::max(0, static_cast<int>(std::ceil(center - support - 0.5)));
+            const int last = std::min(static_cast<int>(inSize) - 1,
+                                      static_cast<int>(std::floor(center + support - 0.5)));
+            for (int j = first; j <= last; ++j)
+            {
+                w.push_back(kernel((j + 0.5 - center)/filterScale));
+            }
+        }
+
+        add(i, first, w);
+    }
+
+    m_weights.assign(outSize*m_taps, 0.f);
+    for (size_t i = 0; i < outSize; ++i)
+    {
+        double sum = 0.0;
+        for (size_t k = 0; k < weights[i].size(); ++k) sum += weights[i][k];
+
+        if ( std::fabs(sum) < 1e-12 )
+        {
+            // no sample under the filter: nearest neighbour
+            m_first[i] = std::min(static_cast<int>((i + 0.5)*scale),
+                                  static_cast<int>(inSize) - 1);
+            m_count[i] = 1;
+            m_weights[i*m_taps] = 1.f;
+            continue;
+        }
+        for (size_t k = 0; k < weights[i].size(); ++k)
+        {
+            m_weights[i*m_taps + k] = static_cast<float>(weights[i][k]/sum);
+        }
+    }
+}
+
+void ResampleKernel::add(size_t out, int first, std::vector<double>& weights)
+{
+    // trim the zeros at the ends, the box and area filters produce them at
+    // exact pixel boundaries
+    size_t begin = 0;
+    size_t end = weights.size();
+    while ( begin < end && weights[begin] == 0.0 ) ++begin;
+    while ( end > begin && weights[end - 1] == 0.0 ) --end;
+
+    m_first[out] = first + static_cast<int>(begin);
+    m_count[out] = static_cast<int>(end - begin);
+    m_taps = std::max(m_taps, end - begin);
+
+    weights.erase(weights.begin() + end, weights.end());
+    weights.erase(weights.begin(), weights.begin() + begin);
+}
+
+//! \brief dst[x] = (dst[x] +) sum of rows[k][x]*w[k], 4 rows per sweep to
+//! limit the traffic on \a dst
+template <bool Accumulate>
+inline void weightedRows(const float* const rows[4], const float w[4],
+                         float* dst, size_t cols)
+{
+    size_t x = 0;
+#ifdef __SSE__
+    const __m128 w0 = _mm_set1_ps(w[0]);
+    const __m128 w1 = _mm_set1_ps(w[1]);
+    const __m128 w2 = _mm_set1_ps(w[2]);
+    const __m128 w3 = _mm_set1_ps(w[3]);
+    for (; x + 4 <= cols; x += 4)
+    {
+        __m128 sum = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(rows[0] + x)),
+                               _mm_mul_ps(w1, _mm_loadu_ps(rows[1] + x))),
+                    _mm_add_ps(_mm_mul_ps(w2, _mm_loadu_ps(rows[2] + x)),
+                               _mm_mul_ps(w3, _mm_loadu_ps(rows[3] + x))));
+        if ( Accumulate ) sum = _mm_add_ps(sum, _mm_loadu_ps(dst + x));
+        _mm_storeu_ps(dst + x, sum);
+    }
+#endif
+    for (; x < cols; ++x)
+    {
+        const float sum = w[0]*rows[0][x] + w[1]*rows[1][x] +
+                w[2]*rows[2][x] + w[3]*rows[3][x];
+        dst[x] = Accumulate ? dst[x] + sum : sum;
+    }
+}
+
+//! \brief filter the columns of \a src into \a dst, one output row
+void verticalPass(const float* src, size_t cols,
+                  int first, int count, const float* weights, float* dst)
+{
+    const float* row = src + first*cols;
+
+    for (int k = 0; k < count; k += 4)
+    {
+        // the last sweep is padded with zero weights on the first row
+        const float* rows[4];
+        float w[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const bool valid = (k + i < count);
+            rows[i] = valid ? row + (k + i)*cols : row;
+            w[i] = valid ? weights[k + i] : 0.f;
+        }
+
+        if ( k == 0 ) weightedRows<false>(rows, w, dst, cols);
+        else weightedRows<true>(rows, w, dst, cols);
+    }
+}
+
+//! \brief filter \a row into the output row \a dst
+void horizontalPass(const float* row, const ResampleKernel& kernel,
+                    float* dst, size_t cols, bool clampNegative)
+{
+    for (size_t x = 0; x < cols; ++x)
+    {
+        const float* in = row + kernel.m_first[x];
+        const float* w = &kernel.m_weights[x*kernel.m_taps];
+
+        float value = 0.f;
+        for (int k = 0, kEnd = kernel.m_count[x]; k < kEnd; ++k)
+        {
+            value += w[k]*in[k];
+        }
+        dst[x] = (clampNegative && value < 0.f) ? 0.f : value;
+    }
+}
+
+//! \brief one separable pass: every output row is built from the input rows
+//! under the vertical kernel, then filtered horizontally. All the channels
+//! are processed before moving to the next row.
+void resample(const std::vector<const Array2Df*>& from,
+              const std::vector<Array2Df*>& to,
+              ResizeFilter filterX, ResizeFilter filterY, bool clampNegative)
+{
+    const size_t inCols = from[0]->getCols();
+    const size_t inRows = from[0]->getRows();
+    const size_t outCols = to[0]->getCols();
+    const size_t outRows = to[0]->getRows();
+
+    const ResampleKernel kernelX(inCols, outCols, filterX);
+    const ResampleKernel kernelY(inRows, outRows, filterY);
+
+#pragma omp parallel
+    {
+        std::vector<float> buffer(inCols);
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < static_cast<int>(outRows); ++y)
+        {
+            const float* weights = &kernelY.m_weights[y*kernelY.m_taps];
+
+            for (size_t c = 0; c < from.size(); ++c)
+            {
+                verticalPass(from[c]->data(), inCols,
+                             kernelY.m_first[y], kernelY.m_count[y], weights,
+                             buffer.data());
+                horizontalPass(buffer.data(), kernelX,
+                               to[c]->data() + y*outCols, outCols, clampNegative);
+            }
+        }
+    }
+}
+
+bool isWideFilter(ResizeFilter filter)
+{
+    return filter != RESIZE_BOX && filter != RESIZE_AREA && filter != RESIZE_AUTO;
+}
+
+//! \brief average of blocks of input pixels: block \c i spans the input
+//! pixels [i*in/out, (i + 1)*in/out) along each axis, so they cover the input
+//! evenly. Every input row is read once and only for one output row.
+void boxDecimate(const std::vector<const Array2Df*>& from,
+                 const std::vector<Array2Df*>& to)
+{
+    const size_t inCols = from[0]->getCols();
+    const size_t inRows = from[0]->getRows();
+    const size_t outCols = to[0]->getCols();
+    const size_t outRows = to[0]->getRows();
+
+    std::vector<size_t> firstX(outCols + 1);
+    for (size_t x = 0; x <= outCols; ++x)
+    {
+        firstX[x] = x*inCols/outCols;
+    }
+
+#pragma omp parallel
+    {
+        std::vector<float> buffer(inCols);
+        std::vector<float> weights(inRows/outRows + 1);
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < static_cast<int>(outRows); ++y)
+        {
+            const size_t first = y*inRows/outRows;
+            const size_t count = (y + 1)*inRows/outRows - first;
+            std::fill(weights.begin(), weights.begin() + count, 1.f/count);
+
+            for (size_t c = 0; c < from.size(); ++c)
+            {
+                verticalPass(from[c]->data(), inCols, first, count, weights.data(),
+                             buffer.data());
+
+                float* dst = to[c]->data() + y*outCols;
+                for (size_t x = 0; x < outCols; ++x)
+                {
+                    float sum = 0.f;
+                    for (size_t k = firstX[x]; k < firstX[x + 1]; ++k)
+                    {
+                        sum += buffer[k];
+                    }
+                    dst[x] = sum/(firstX[x + 1] - firstX[x]);
+                }
+            }
+        }
+    }
+}
+}
+
+void resize(const std::vector<const Array2Df*>& from,
+            const std::vector<Array2Df*>& to,
+            ResizeFilter filter, bool clampNegative)
+{
+    assert( from.size() == to.size() );
+    if ( from.empty() ) return;
+
+    const size_t inCols = from[0]->getCols();
+    const size_t inRows = from[0]->getRows();
+    const size_t outCols = to[0]->getCols();
+    const size_t outRows = to[0]->getRows();
+
+    if ( inCols == outCols && inRows == outRows )
+    {
+        for (size_t c = 0; c < from.size(); ++c)
+        {
+            pfs::copy(from[c], to[c]);
+        }
+        return;
+    }
+
+    const bool reduceX = inCols > MAX_FILTER_RATIO*outCols;
+    const bool reduceY = inRows > MAX_FILTER_RATIO*outRows;
+    if ( !isWideFilter(filter) || (!reduceX && !reduceY) )
+    {
+        resample(from, to, filter, filter, clampNegative);
+        return;
+    }
+
+    // large reduction: box decimation down to twice the output size, then
+    // the requested filter
+    const size_t midCols = reduceX ? 2*outCols : inCols;
+    const size_t midRows = reduceY ? 2*outRows : inRows;
+
+    std::vector<Array2Df> storage(from.size());
+    std::vector<Array2Df*> mid(from.size());
+    for (size_t c = 0; c < from.size(); ++c)
+    {
+        storage[c].resize(midCols, midRows);
+        mid[c] = &storage[c];
+    }
+
+    boxDecimate(from, mid);
+    resample(std::vector<const Array2Df*>(mid.begin(), mid.end()), to,
+             filter, filter, clampNegative);
+}
+
+void resize(const Array2Df* from, Array2Df* to, ResizeFilter filter)
+{
+    resize(std::vector<const Array2Df*>(1, from), std::vector<Array2Df*>(1, to),
+           filter);
+}
+
+Frame* resize(const Frame* frame, int xSize, ResizeFilter filter)
+{
+#ifdef TIMER_PROFILING
+    msec_timer f_timer;
+    f_timer.start();
+#endif
+
+    int new_x = xSize;
+    int new_y = (int)((float)frame->getHeight() * (float)xSize / (float)frame->getWidth());
+
+    pfs::Frame *resizedFrame = new pfs::Frame( new_x, new_y );
+
+    std::vector<const Array2Df*> from;
+    std::vector<Array2Df*> to;
+
+    const ChannelContainer& channels = frame->getChannels();
+    for ( ChannelContainer::const_iterator it = channels.begin();
+          it != channels.end();
+          ++it)
+    {
+        from.push_back(*it);
+        to.push_back(resizedFrame->createChannel( (*it)->getName() ));
+    }
+    resize(from, to, filter, true);
+
+    pfs::copyTags( frame, resizedFrame );
+
+#ifdef TIMER_PROFILING
+    f_timer.stop_and_update();
+    std::cout << "resizeFrame() = " << f_timer.get_time() << " msec" << std::endl;
+#endif 
+
+    return resizedFrame;
+}
+
+} // pfs
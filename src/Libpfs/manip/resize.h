@@ -27,6 +27,8 @@
 //! \author Rafal Mantiuk, <mantiuk@mpi-sb.mpg.de>
 //! \author Davide Anastasia <davideanastasia@users.sourceforge.net>
 
+#include <vector>
+
 #include "Libpfs/array2d_fwd.h"
 
 namespace pfs
@@ -34,8 +36,34 @@ namespace pfs
 // forward declaration
 class Frame;
 
-Frame* resize(Frame* frame, int xSize);
+//! \brief reconstruction filters of the separable resampler
+enum ResizeFilter
+{
+    RESIZE_AUTO,        //!< area average on reductions, Mitchell on enlargements
+    RESIZE_BOX,         //!< nearest neighbour, widened to a box on reductions
+    RESIZE_BILINEAR,    //!< triangle filter, widened on reductions
+    RESIZE_AREA,        //!< exact average of the covered input pixels
+    RESIZE_MITCHELL,    //!< Mitchell-Netravali cubic, B = C = 1/3
+    RESIZE_LANCZOS3     //!< windowed sinc, 3 lobes
+};
+
+//! \brief resize all the channels of \a frame to \a xSize columns, keeping
+//! the aspect ratio. Channels are resampled in one pass and share the filter
+//! kernels.
+//! \note Mitchell and Lanczos ring around edges: results are clamped at zero
+Frame* resize(const Frame* frame, int xSize, ResizeFilter filter = RESIZE_AUTO);
+
+//! \brief resample \a from into \a to (whose size defines the output size)
+void resize(const Array2Df* from, Array2Df* to, ResizeFilter filter);
+
+//! \brief resample every array in \a from into the matching one in \a to.
+//! All the inputs (and all the outputs) must have the same size.
+void resize(const std::vector<const Array2Df*>& from,
+            const std::vector<Array2Df*>& to,
+            ResizeFilter filter, bool clampNegative = false);
 
+//! \brief fast bilinear resampling, for any element type
+//! \note no prefiltering: aliases on large reductions
 template <typename Type>
 void resize(const Array2D<Type> *from, Array2D<Type> *to);
 
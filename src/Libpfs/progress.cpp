@@ -24,6 +24,8 @@
 
 #include "progress.h"
 
+#include <algorithm>
+
 namespace pfs
 {
 
@@ -73,11 +75,70 @@ int Progress::value() const
 
 void Progress::cancel(bool b)
 {
-    m_canceled = b;
+    m_canceled.store(b);
 }
 bool Progress::canceled() const
 {
-    return m_canceled;
+    return m_canceled.load(std::memory_order_relaxed);
+}
+
+const int ProgressReporter::REPORT_INTERVAL_MS;
+
+ProgressReporter::ProgressReporter(Progress& ph, size_t total,
+                                   int from, int to, size_t chunk)
+    : m_ph(ph)
+    , m_total(std::max(total, size_t(1)))
+    , m_chunk(std::max(chunk, size_t(1)))
+    , m_stride(std::max(m_total/1000, size_t(1)))
+    , m_from(from)
+    , m_to(to)
+    , m_done(0)
+    , m_nextPoll(0)
+    , m_canceled(ph.canceled())
+    , m_polling(false)
+    , m_value(from - 1)
+{
+    poll(0);
+}
+
+void ProgressReporter::poll(size_t done)
+{
+    // somebody else is on it
+    if (m_polling.exchange(true, std::memory_order_acquire))
+    {
+        return;
+    }
+    m_nextPoll.store(done + m_stride, std::memory_order_relaxed);
+
+    if (m_ph.canceled())
+    {
+        m_canceled.store(true, std::memory_order_relaxed);
+    }
+
+    const int value = m_from +
+            static_cast<int>((m_to - m_from)*(double(std::min(done, m_total))/m_total));
+    if (value != m_value)
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - m_lastReport >= std::chrono::milliseconds(REPORT_INTERVAL_MS))
+        {
+            m_ph.setValue(value);
+            m_value = value;
+            m_lastReport = now;
+        }
+    }
+
+    m_polling.store(false, std::memory_order_release);
+}
+
+void ProgressReporter::finish()
+{
+    if (m_ph.canceled())
+    {
+        m_canceled.store(true, std::memory_order_relaxed);
+        return;
+    }
+    m_ph.setValue(m_to);
 }
 
 }
@@ -25,6 +25,10 @@
 #ifndef LIBPFS_PROGRESS_H
 #define LIBPFS_PROGRESS_H
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
 namespace pfs
 {
 
@@ -34,6 +38,7 @@ namespace pfs
 //! \note All the functions have an empty implementation, so it not necessary
 //! to pass a concrete instance to routine that require the presence of this
 //! class
+//! \note cancel() and canceled() can be called from any thread
 class Progress
 {
 public:
@@ -67,7 +72,89 @@ private:
 
     int m_value;
 
-    bool m_canceled;
+    std::atomic<bool> m_canceled;
+};
+
+//! \brief Progress accounting for the hot loops of the operators
+//!
+//! Counts the steps done so far (pixels, rows...) with an atomic counter, so
+//! advance() and canceled() can be called by all the threads of a parallel
+//! loop. Every 1/1000 of the work one of the threads polls the cancellation
+//! request of the underlying Progress, and forwards the value, mapped on
+//! [from, to], if it changed and the last update is older than
+//! REPORT_INTERVAL_MS.
+//!
+//! Per-pixel loops are split in tiles of \a chunk steps:
+//! \code
+//! pfs::ProgressReporter progress(ph, pix_count, 0, 100, 4096);
+//! #pragma omp parallel for schedule(dynamic)
+//! for (long c = 0; c < (long)progress.chunks(); c++)
+//! {
+//!     if (progress.canceled()) continue;
+//!     size_t begin, end;
+//!     progress.chunk(c, begin, end);
+//!     for (size_t i = begin; i < end; i++) { ... }
+//!     progress.advance(end - begin);
+//! }
+//! \endcode
+class ProgressReporter
+{
+public:
+    static const int REPORT_INTERVAL_MS = 30;
+
+    ProgressReporter(Progress& ph, size_t total,
+                     int from = 0, int to = 100, size_t chunk = 1);
+
+    //! \brief \a steps more steps are done
+    void advance(size_t steps = 1)
+    {
+        const size_t done = m_done.fetch_add(steps, std::memory_order_relaxed) + steps;
+        if (done >= m_nextPoll.load(std::memory_order_relaxed))
+        {
+            poll(done);
+        }
+    }
+
+    //! \brief cancellation request, as of the last poll
+    bool canceled() const
+    {
+        return m_canceled.load(std::memory_order_relaxed);
+    }
+
+    //! \brief number of tiles the work is split in
+    size_t chunks() const
+    {
+        return (m_total + m_chunk - 1)/m_chunk;
+    }
+
+    //! \brief steps [\a begin, \a end) of the tile \a c
+    void chunk(size_t c, size_t& begin, size_t& end) const
+    {
+        begin = c*m_chunk;
+        end = begin + m_chunk < m_total ? begin + m_chunk : m_total;
+    }
+
+    //! \brief report \a to, unless the work was canceled
+    void finish();
+
+private:
+    void poll(size_t done);
+
+    Progress& m_ph;
+    const size_t m_total;
+    const size_t m_chunk;
+    const size_t m_stride;
+    const int m_from;
+    const int m_to;
+
+    std::atomic<size_t> m_done;
+    std::atomic<size_t> m_nextPoll;
+    std::atomic<bool> m_canceled;
+
+    // owned by the polling thread
+    std::atomic<bool> m_polling;
+    int m_value;
+    std::chrono::steady_clock::time_point m_lastReport;
 };
 
 }
@@ -29,7 +29,13 @@
  *
  */
 
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <limits>
 #include <boost/assign.hpp>
 #include <boost/thread/mutex.hpp>
 
@@ -37,12 +43,66 @@
 
 #include "Libpfs/frame.h"
 #include "Libpfs/channel.h"
-#include "Libpfs/colorspace/colorspace.h"
 #include "Libpfs/progress.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/manip/cut.h"
+#include "Libpfs/manip/gamma.h"
+#include "Libpfs/manip/resize.h"
 #include "Libpfs/tm/TonemapOperator.h"
 
 using namespace boost::assign;
 
+namespace
+{
+//! \brief builds the key returned by TonemapOperator::analysisKey()
+class AnalysisKey
+{
+public:
+    explicit AnalysisKey(TMOperator tmo)
+    {
+        m_key << std::setprecision(9) << int(tmo);
+    }
+
+    template <typename T>
+    AnalysisKey& operator<<(const T& value)
+    {
+        m_key << ':' << value;
+        return *this;
+    }
+
+    operator std::string() const
+    {
+        return m_key.str();
+    }
+
+private:
+    std::ostringstream m_key;
+};
+
+//! \brief size of the copy of the frame the global statistics of
+//! TonemapOperator::tonemapRegion() are computed on
+const size_t REGION_PREVIEW_PIXELS = 1 << 20;
+
+//! \brief halo of the operators whose result depends on the whole frame
+//! beyond a few statistics: their regions are cut from the whole frame
+const int WHOLE_FRAME_HALO = std::numeric_limits<int>::max();
+
+//! \brief forwards the cancellation requests, hides the progress
+class SilentProgress : public pfs::Progress
+{
+public:
+    explicit SilentProgress(const pfs::Progress& ph)
+        : m_ph(ph)
+    {}
+
+    void setValue(int) {}
+    bool canceled() const { return m_ph.canceled(); }
+
+private:
+    const pfs::Progress& m_ph;
+};
+}
+
 template <TMOperator Key, typename ConcreteClass>
 struct TonemapOperatorRegister : public TonemapOperator
 {
@@ -62,58 +122,67 @@ class TonemapOperatorMantiuk06
 {
 public:
     void tonemapFrame(pfs::Frame& workingFrame, TonemappingOptions* opts, pfs::Progress& ph)
+    {
+        TmoAnalysisPtr analysis;
+        tonemapFrameWithAnalysis(workingFrame, opts, analysis, ph);
+    }
+
+    std::string analysisKey(const TonemappingOptions* opts) const
+    {
+        return AnalysisKey(mantiuk06)
+                << opts->operator_options.mantiuk06options.contrastfactor
+                << opts->operator_options.mantiuk06options.detailfactor
+                << opts->operator_options.mantiuk06options.contrastequalization;
+    }
+
+    void tonemapFrameWithAnalysis(pfs::Frame& workingFrame, TonemappingOptions* opts,
+                                  TmoAnalysisPtr& analysis, pfs::Progress& ph)
     {
         ph.setMaximum(100);
 
-        // pfstmo_mantiuk06 not reentrant
-        m_mutex.lock();
-        try
-        {
-            pfstmo_mantiuk06(workingFrame,
-                             opts->operator_options.mantiuk06options.contrastfactor,
-                             opts->operator_options.mantiuk06options.saturationfactor,
-                             opts->operator_options.mantiuk06options.detailfactor,
-                             opts->operator_options.mantiuk06options.contrastequalization,
-                             ph);
-        }
-        catch (...)
-        {
-            m_mutex.unlock();
-            throw std::runtime_error("Tonemap Failed");
-        }
-        m_mutex.unlock();
+        pfstmo_mantiuk06(workingFrame,
+                         opts->operator_options.mantiuk06options.contrastfactor,
+                         opts->operator_options.mantiuk06options.saturationfactor,
+                         opts->operator_options.mantiuk06options.detailfactor,
+                         opts->operator_options.mantiuk06options.contrastequalization,
+                         analysis,
+                         ph);
     }
 
-private:
-    // It may be removed, because the issue in the race condition of the
-    // operator has been solved
-    static boost::mutex m_mutex;
+    int regionHalo(const TonemappingOptions*) const
+    {
+        // the contrast domain is solved on the whole frame
+        return WHOLE_FRAME_HALO;
+    }
 };
 
-boost::mutex TonemapOperatorMantiuk06::m_mutex;   // static member
-
 struct TonemapOperatorMantiuk08
         : public TonemapOperatorRegister<mantiuk08, TonemapOperatorMantiuk08>
 {
     void tonemapFrame(pfs::Frame& workingframe, TonemappingOptions* opts, pfs::Progress& ph)
     {
-        ph.setMaximum(100);
+        TmoAnalysisPtr analysis;
+        tonemapFrameWithAnalysis(workingframe, opts, analysis, ph);
+    }
 
-        // Convert to CS_XYZ: tm operator now use this colorspace
-        pfs::Channel *X, *Y, *Z;
-        workingframe.getXYZChannels( X, Y, Z );
-        pfs::transformColorSpace(pfs::CS_RGB, X, Y, Z,
-                                 pfs::CS_XYZ, X, Y, Z);
+    std::string analysisKey(const TonemappingOptions*) const
+    {
+        // the image statistics do not depend on any option
+        return AnalysisKey(mantiuk08);
+    }
+
+    void tonemapFrameWithAnalysis(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                  TmoAnalysisPtr& analysis, pfs::Progress& ph)
+    {
+        ph.setMaximum(100);
 
         pfstmo_mantiuk08(workingframe,
                          opts->operator_options.mantiuk08options.colorsaturation,
                          opts->operator_options.mantiuk08options.contrastenhancement,
                          opts->operator_options.mantiuk08options.luminancelevel,
                          opts->operator_options.mantiuk08options.setluminance,
+                         analysis,
                          ph);
-
-        pfs::transformColorSpace(pfs::CS_XYZ, X, Y, Z,
-                                 pfs::CS_RGB, X, Y, Z);
     }
 };
 
@@ -121,9 +190,50 @@ struct TonemapOperatorFattal02
         : public TonemapOperatorRegister<fattal, TonemapOperatorFattal02>
 {
     void tonemapFrame(pfs::Frame& workingframe, TonemappingOptions* opts, pfs::Progress& ph)
+    {
+        TmoAnalysisPtr analysis;
+        tonemapFrameWithAnalysis(workingframe, opts, analysis, ph);
+    }
+
+    std::string analysisKey(const TonemappingOptions* opts) const
+    {
+        // beta drives the gradient attenuation: only the saturation is applied
+        // on top of the compressed luminance
+        return AnalysisKey(fattal)
+                << opts->operator_options.fattaloptions.alpha
+                << opts->operator_options.fattaloptions.beta
+                << opts->operator_options.fattaloptions.noiseredux
+                << opts->operator_options.fattaloptions.newfattal
+                << opts->operator_options.fattaloptions.fftsolver
+                << detailLevel(opts);
+    }
+
+    void tonemapFrameWithAnalysis(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                  TmoAnalysisPtr& analysis, pfs::Progress& ph)
     {
         ph.setMaximum(100);
 
+        pfstmo_fattal02(workingframe,
+                        opts->operator_options.fattaloptions.alpha,
+                        opts->operator_options.fattaloptions.beta,
+                        opts->operator_options.fattaloptions.color,
+                        opts->operator_options.fattaloptions.noiseredux,
+                        opts->operator_options.fattaloptions.newfattal,
+                        opts->operator_options.fattaloptions.fftsolver,
+                        detailLevel(opts),
+                        analysis,
+                        ph);
+    }
+
+    int regionHalo(const TonemappingOptions*) const
+    {
+        // the poisson equation is solved on the whole frame
+        return WHOLE_FRAME_HALO;
+    }
+
+private:
+    static int detailLevel(const TonemappingOptions* opts)
+    {
         int detail_level = 0;
         if (opts->xsize > 0) {
             float ratio = (float)opts->origxsize / (float)opts->xsize;
@@ -142,15 +252,7 @@ struct TonemapOperatorFattal02
     //    std::cout << "RATIO = " << ratio << ", ";
     //    std::cout << "DETAIL_LEVEL = " << detail_level << std::endl;
 
-        pfstmo_fattal02(workingframe,
-                        opts->operator_options.fattaloptions.alpha,
-                        opts->operator_options.fattaloptions.beta,
-                        opts->operator_options.fattaloptions.color,
-                        opts->operator_options.fattaloptions.noiseredux,
-                        opts->operator_options.fattaloptions.newfattal,
-                        opts->operator_options.fattaloptions.fftsolver,
-                        detail_level,
-                        ph);
+        return detail_level;
     }
 };
 
@@ -196,6 +298,49 @@ class TonemapOperatorDurand02
         : public TonemapOperatorRegister<durand, TonemapOperatorDurand02>
 {
     void tonemapFrame(pfs::Frame& workingframe, TonemappingOptions* opts, pfs::Progress& ph)
+    {
+        TmoAnalysisPtr analysis;
+        tonemapFrameWithAnalysis(workingframe, opts, analysis, ph);
+    }
+
+    std::string analysisKey(const TonemappingOptions* opts) const
+    {
+        return AnalysisKey(durand)
+                << opts->operator_options.durandoptions.spatial
+                << opts->operator_options.durandoptions.range;
+    }
+
+    void tonemapFrameWithAnalysis(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                  TmoAnalysisPtr& analysis, pfs::Progress& ph)
+    {
+        TmoGlobalsPtr globals;
+        tonemap(workingframe, opts, analysis, globals, ph);
+    }
+
+    int regionHalo(const TonemappingOptions* opts) const
+    {
+        // support of the spatial gaussian of the bilateral filter
+        return static_cast<int>(std::ceil(3.f*opts->operator_options.durandoptions.spatial));
+    }
+
+    void tonemapFrameWithGlobals(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                 TmoGlobalsPtr& globals, pfs::Progress& ph)
+    {
+        TmoAnalysisPtr analysis;
+        tonemap(workingframe, opts, analysis, globals, ph);
+    }
+
+protected:
+    void scaleOptions(TonemappingOptions& opts, float ratio) const
+    {
+        opts.operator_options.durandoptions.spatial =
+                std::max(opts.operator_options.durandoptions.spatial/ratio, 0.5f);
+    }
+
+private:
+    void tonemap(pfs::Frame& workingframe, TonemappingOptions* opts,
+                 TmoAnalysisPtr& analysis, TmoGlobalsPtr& globals,
+                 pfs::Progress& ph)
     {
         ph.setMaximum(100);
 
@@ -207,6 +352,8 @@ class TonemapOperatorDurand02
                             opts->operator_options.durandoptions.spatial,
                             opts->operator_options.durandoptions.range,
                             opts->operator_options.durandoptions.base,
+                            analysis,
+                            globals,
                             ph);
         }
         catch (...)
@@ -217,7 +364,6 @@ class TonemapOperatorDurand02
         m_mutex.unlock();
     }
 
-private:
     static boost::mutex m_mutex;
 };
 
@@ -229,14 +375,30 @@ struct TonemapOperatorReinhard02
 {
     void tonemapFrame(pfs::Frame& workingframe, TonemappingOptions* opts, pfs::Progress& ph)
     {
-        ph.setMaximum(100);
+        TmoGlobalsPtr globals;
+        tonemapFrameWithGlobals(workingframe, opts, globals, ph);
+    }
+
+    int regionHalo(const TonemappingOptions* opts) const
+    {
+        // the coarsest scale reads a few samples of the coarsest pyramid
+        // level, which are 2^(range - 1) pixels apart
+        const int range = opts->operator_options.reinhard02options.range;
+        return opts->operator_options.reinhard02options.scales ? (4 << (range - 1)) : 0;
+    }
+
+    int regionAlignment(const TonemappingOptions* opts) const
+    {
+        const int range = opts->operator_options.reinhard02options.range;
+        return opts->operator_options.reinhard02options.scales ? (1 << (range - 1)) : 1;
+    }
 
-        // Convert to CS_XYZ: tm operator now use this colorspace
-        pfs::Channel *X, *Y, *Z;
-        workingframe.getXYZChannels( X, Y, Z );
-        pfs::transformColorSpace(pfs::CS_RGB, X, Y, Z,
-                                 pfs::CS_XYZ, X, Y, Z);
+    void tonemapFrameWithGlobals(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                 TmoGlobalsPtr& globals, pfs::Progress& ph)
+    {
+        ph.setMaximum(100);
 
+        // RGB in, sRGB out: the operator restores the colour itself
         m_mutex.lock();
         try {
             pfstmo_reinhard02(workingframe,
@@ -246,6 +408,7 @@ struct TonemapOperatorReinhard02
                               opts->operator_options.reinhard02options.lower,
                               opts->operator_options.reinhard02options.upper,
                               opts->operator_options.reinhard02options.scales,
+                              globals,
                               ph);
         }
         catch (...) {
@@ -253,9 +416,6 @@ struct TonemapOperatorReinhard02
             throw std::runtime_error("Tonemap Failed");
         }
         m_mutex.unlock();
-
-        pfs::transformColorSpace(pfs::CS_XYZ, X, Y, Z,
-                                 pfs::CS_SRGB, X, Y, Z);
     }
 
 private:
@@ -283,6 +443,19 @@ struct TonemapOperatorAshikhmin02
         : public TonemapOperatorRegister<ashikhmin, TonemapOperatorAshikhmin02>
 {
     void tonemapFrame(pfs::Frame& workingframe, TonemappingOptions* opts, pfs::Progress& ph)
+    {
+        TmoGlobalsPtr globals;
+        tonemapFrameWithGlobals(workingframe, opts, globals, ph);
+    }
+
+    int regionHalo(const TonemappingOptions* opts) const
+    {
+        // the range of the local adaptation is taken on the whole frame
+        return opts->operator_options.ashikhminoptions.simple ? 0 : WHOLE_FRAME_HALO;
+    }
+
+    void tonemapFrameWithGlobals(pfs::Frame& workingframe, TonemappingOptions* opts,
+                                 TmoGlobalsPtr& globals, pfs::Progress& ph)
     {
         ph.setMaximum(100);
 
@@ -290,6 +463,7 @@ struct TonemapOperatorAshikhmin02
                            opts->operator_options.ashikhminoptions.simple,
                            opts->operator_options.ashikhminoptions.lct,
                            (opts->operator_options.ashikhminoptions.eq2 ? 2 : 4),
+                           globals,
                            ph);
     }
 };
@@ -301,12 +475,6 @@ struct TonemapOperatorPattanaik00
     {
         ph.setMaximum(100);
 
-        // Convert to CS_XYZ: tm operator now use this colorspace
-        pfs::Channel *X, *Y, *Z;
-        workingframe.getXYZChannels( X, Y, Z );
-        pfs::transformColorSpace(pfs::CS_RGB, X, Y, Z,
-                                 pfs::CS_XYZ, X, Y, Z);
-
         pfstmo_pattanaik00(workingframe,
                            opts->operator_options.pattanaikoptions.local,
                            opts->operator_options.pattanaikoptions.multiplier,
@@ -314,10 +482,6 @@ struct TonemapOperatorPattanaik00
                            opts->operator_options.pattanaikoptions.rod*1000,
                            opts->operator_options.pattanaikoptions.autolum,
                            ph);
-
-
-        pfs::transformColorSpace(pfs::CS_XYZ, X, Y, Z,
-                                 pfs::CS_RGB, X, Y, Z);
     }
 };
 
@@ -351,6 +515,141 @@ TonemapOperator::TonemapOperator()
 TonemapOperator::~TonemapOperator()
 {}
 
+std::string TonemapOperator::analysisKey(const TonemappingOptions*) const
+{
+    return std::string();
+}
+
+void TonemapOperator::tonemapFrameWithAnalysis(pfs::Frame& frame, TonemappingOptions* opts,
+                                               TmoAnalysisPtr&, pfs::Progress& ph)
+{
+    tonemapFrame(frame, opts, ph);
+}
+
+int TonemapOperator::regionHalo(const TonemappingOptions*) const
+{
+    return -1;
+}
+
+int TonemapOperator::regionAlignment(const TonemappingOptions*) const
+{
+    return 1;
+}
+
+void TonemapOperator::tonemapFrameWithGlobals(pfs::Frame& frame, TonemappingOptions* opts,
+                                              TmoGlobalsPtr&, pfs::Progress& ph)
+{
+    tonemapFrame(frame, opts, ph);
+}
+
+void TonemapOperator::scaleOptions(TonemappingOptions&, float) const
+{}
+
+pfs::Frame* TonemapOperator::tonemapRegion(const pfs::Frame& frame,
+                                           size_t x_ul, size_t y_ul,
+                                           size_t x_br, size_t y_br,
+                                           TonemappingOptions* opts,
+                                           pfs::Progress& ph)
+{
+    const int halo = regionHalo(opts);
+    if ( halo < 0 )
+    {
+        throw std::runtime_error("The operator cannot tonemap a region");
+    }
+    const size_t width = frame.getWidth();
+    const size_t height = frame.getHeight();
+    x_br = std::min(x_br, width);
+    y_br = std::min(y_br, height);
+    if ( x_ul >= x_br || y_ul >= y_br )
+    {
+        throw std::runtime_error("Empty region");
+    }
+
+    // region plus halo, at full resolution
+    const size_t alignment = std::max(regionAlignment(opts), 1);
+    const size_t x0 = (x_ul - std::min<size_t>(x_ul, halo))/alignment*alignment;
+    const size_t y0 = (y_ul - std::min<size_t>(y_ul, halo))/alignment*alignment;
+    const size_t x1 = std::min<size_t>(x_br + size_t(halo), width);
+    const size_t y1 = std::min<size_t>(y_br + size_t(halo), height);
+
+    if ( x0 == 0 && y0 == 0 && x1 == width && y1 == height )
+    {
+        // the operator sees the whole frame anyway: tonemap it as it is and
+        // cut the region, the result is the same as the whole frame's
+        std::unique_ptr<pfs::Frame> working( pfs::copy(&frame) );
+        if ( opts->pregamma != 1.0f )
+        {
+            pfs::applyGamma(working.get(), opts->pregamma);
+        }
+
+        TonemappingOptions region_opts(*opts);
+        region_opts.origxsize = width;
+        region_opts.xsize = width;
+        tonemapFrame(*working, &region_opts, ph);
+        if ( ph.canceled() )
+        {
+            return NULL;
+        }
+
+        return pfs::cut(working.get(), x_ul, y_ul, x_br, y_br);
+    }
+
+    // statistics of the whole frame, from a downsampled copy
+    size_t preview_width = width;
+    if ( width*height > REGION_PREVIEW_PIXELS )
+    {
+        preview_width = std::max<size_t>(1, static_cast<size_t>(
+                width*std::sqrt(double(REGION_PREVIEW_PIXELS)/(width*height))));
+    }
+    std::unique_ptr<pfs::Frame> preview( preview_width < width ?
+                                             pfs::resize(&frame, preview_width) :
+                                             pfs::copy(&frame) );
+    if ( opts->pregamma != 1.0f )
+    {
+        pfs::applyGamma(preview.get(), opts->pregamma);
+    }
+
+    TonemappingOptions preview_opts(*opts);
+    preview_opts.origxsize = width;
+    preview_opts.xsize = preview_width;
+    preview_opts.tonemapSelection = false;
+    scaleOptions(preview_opts, float(width)/preview_width);
+
+    TmoGlobalsPtr globals;
+    SilentProgress silent(ph);
+    tonemapFrameWithGlobals(*preview, &preview_opts, globals, silent);
+    preview.reset();
+    if ( ph.canceled() )
+    {
+        return NULL;
+    }
+
+    std::unique_ptr<pfs::Frame> working( pfs::cut(&frame, x0, y0, x1, y1) );
+    if ( opts->pregamma != 1.0f )
+    {
+        pfs::applyGamma(working.get(), opts->pregamma);
+    }
+
+    if ( globals )
+    {
+        const float scale = float(preview_width)/width;
+        globals->m_left = x0*scale;
+        globals->m_top = y0*scale;
+        globals->m_scale = scale;
+    }
+
+    TonemappingOptions region_opts(*opts);
+    region_opts.origxsize = width;
+    region_opts.xsize = width;
+    tonemapFrameWithGlobals(*working, &region_opts, globals, ph);
+    if ( ph.canceled() )
+    {
+        return NULL;
+    }
+
+    return pfs::cut(working.get(), x_ul - x0, y_ul - y0, x_br - x0, y_br - y0);
+}
+
 TonemapOperator* TonemapOperator::getTonemapOperator(const TMOperator tmo)
 {
     TonemapOperatorCreatorMap::const_iterator it = registry().find(tmo);
@@ -32,8 +32,10 @@
 #define TONEMAPOPERATOR_H
 
 #include <stdexcept>
+#include <string>
 
 #include "Core/TonemappingOptions.h"
+#include "TonemappingOperators/pfstmo.h"
 
 // Forward declaration
 namespace pfs
@@ -60,8 +62,70 @@ public:
     //!
     virtual void tonemapFrame(pfs::Frame&, TonemappingOptions*, pfs::Progress& ph) = 0;
 
+    //!
+    //! \return a key identifying the options the analysis stage of the
+    //! operator depends on (see TmoAnalysis), or an empty string if the
+    //! operator does not separate analysis and synthesis
+    //!
+    virtual std::string analysisKey(const TonemappingOptions*) const;
+
+    //!
+    //! Same as tonemapFrame(), reusing \a analysis if not empty or storing the
+    //! analysis of the input frame in it otherwise.
+    //! \note the default implementation ignores \a analysis
+    //!
+    virtual void tonemapFrameWithAnalysis(pfs::Frame&, TonemappingOptions*,
+                                          TmoAnalysisPtr& analysis,
+                                          pfs::Progress& ph);
+
+    //!
+    //! \return the margin (in pixels) needed around a region to tonemap it
+    //! as it would appear in the whole frame, or -1 if the operator does not
+    //! support tonemapRegion(). Operators depending on the whole frame return
+    //! a margin larger than any frame.
+    //!
+    virtual int regionHalo(const TonemappingOptions*) const;
+
+    //!
+    //! \return the alignment of the top left corner of the region (once
+    //! widened by the halo) the operator needs to give consistent results
+    //! (ie: its pyramid levels line up with the ones of the whole frame)
+    //!
+    virtual int regionAlignment(const TonemappingOptions*) const;
+
+    //!
+    //! Same as tonemapFrame(), using the statistics of the whole frame in
+    //! \a globals if not empty or storing the ones of the input frame in it
+    //! otherwise.
+    //! \note the default implementation ignores \a globals
+    //!
+    virtual void tonemapFrameWithGlobals(pfs::Frame&, TonemappingOptions*,
+                                         TmoGlobalsPtr& globals,
+                                         pfs::Progress& ph);
+
+    //!
+    //! Tonemap the rectangle [x_ul, x_br) x [y_ul, y_br) of \a frame as it
+    //! appears in the tonemapping of the whole frame: the global statistics
+    //! are taken from a downsampled copy of \a frame, and only the region
+    //! (plus regionHalo() pixels around it) is tonemapped at full resolution.
+    //! When the halo covers the whole frame, the region is cut from the
+    //! tonemapping of the whole frame instead.
+    //! \a frame is not modified: opts->pregamma is applied here.
+    //! \return the tonemapped region, NULL if the operation was canceled
+    //! \throw std::runtime_error if the operator does not support regions
+    //!
+    pfs::Frame* tonemapRegion(const pfs::Frame& frame,
+                              size_t x_ul, size_t y_ul, size_t x_br, size_t y_br,
+                              TonemappingOptions* opts, pfs::Progress& ph);
+
 protected:
     TonemapOperator();
+
+    //!
+    //! Adapt the options expressed in pixels to a copy of the frame
+    //! downsampled by \a ratio (ie: size of the filters)
+    //!
+    virtual void scaleOptions(TonemappingOptions& opts, float ratio) const;
 };
 
 #endif // TONEMAPOPERATOR_H
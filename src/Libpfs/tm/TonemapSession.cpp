@@ -0,0 +1,72 @@
+/*
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "Libpfs/tm/TonemapSession.h"
+
+#include <memory>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
+#include "Libpfs/tm/TonemapOperator.h"
+
+TonemapSession::TonemapSession()
+{}
+
+void TonemapSession::reset()
+{
+    m_key.clear();
+    m_analysis.reset();
+}
+
+void TonemapSession::tonemapFrame(pfs::Frame& frame, const std::string& input_key,
+                                  TonemappingOptions* opts, pfs::Progress& ph)
+{
+    std::unique_ptr<TonemapOperator> tm_operator(
+                TonemapOperator::getTonemapOperator(opts->tmoperator));
+
+    const std::string analysis_key = tm_operator->analysisKey(opts);
+    if ( analysis_key.empty() )
+    {
+        // nothing to keep: release the memory held by the previous analysis
+        reset();
+        tm_operator->tonemapFrame(frame, opts, ph);
+        return;
+    }
+
+    const std::string key = input_key + '/' + analysis_key;
+    if ( key != m_key )
+    {
+        reset();
+    }
+
+    try
+    {
+        tm_operator->tonemapFrameWithAnalysis(frame, opts, m_analysis, ph);
+    }
+    catch (...)
+    {
+        reset();
+        throw;
+    }
+
+    // operators do not store an incomplete analysis when canceled: an empty
+    // one will be recomputed on the next call
+    m_key = key;
+}
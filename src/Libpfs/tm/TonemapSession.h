@@ -0,0 +1,72 @@
+/*
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef TONEMAPSESSION_H
+#define TONEMAPSESSION_H
+
+#include <string>
+
+#include "Core/TonemappingOptions.h"
+#include "TonemappingOperators/pfstmo.h"
+
+// Forward declaration
+namespace pfs
+{
+class Progress;
+class Frame;
+}
+
+//!
+//! \brief Keeps the analysis stage of the last tonemapping alive, so that
+//! moving a slider which only affects the synthesis stage of the operator
+//! (ie: saturation, base contrast) does not redo the expensive part.
+//!
+//! A session is not thread safe: use one session per worker.
+//!
+class TonemapSession
+{
+public:
+    TonemapSession();
+
+    //!
+    //! Tonemap \a frame, as TonemapOperator::tonemapFrame() does.
+    //! \param input_key uniquely identifies the content of \a frame (ie: hash
+    //! of the HDR frame and of the preprocessing options): the analysis is
+    //! reused only if both the input key and the analysis options did not
+    //! change since the last call
+    //! \note \a frame is MODIFIED
+    //!
+    void tonemapFrame(pfs::Frame& frame, const std::string& input_key,
+                      TonemappingOptions* opts, pfs::Progress& ph);
+
+    //!
+    //! Drops the stored analysis
+    //!
+    void reset();
+
+private:
+    TonemapSession(const TonemapSession&);
+    TonemapSession& operator=(const TonemapSession&);
+
+    std::string m_key;
+    TmoAnalysisPtr m_analysis;
+};
+
+#endif // TONEMAPSESSION_H
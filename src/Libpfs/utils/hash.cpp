@@ -0,0 +1,109 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <Libpfs/utils/hash.h>
+#include <Libpfs/frame.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace pfs {
+namespace utils {
+
+namespace {
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// number of floats hashed sequentially by a single thread
+const size_t BLOCK_SIZE = 1 << 16;
+
+inline
+uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline
+uint64_t combine(uint64_t seed, uint64_t value)
+{
+    return mix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+uint64_t hashBlock(const float* data, size_t size)
+{
+    uint64_t h = FNV_OFFSET;
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        uint32_t word;
+        std::memcpy(&word, data + idx, sizeof(word));
+        h = (h ^ word) * FNV_PRIME;
+    }
+    return h;
+}
+}
+
+uint64_t hash(const float* data, size_t size, uint64_t seed)
+{
+    const int numBlocks = static_cast<int>((size + BLOCK_SIZE - 1)/BLOCK_SIZE);
+    std::vector<uint64_t> blocks(numBlocks);
+
+#pragma omp parallel for schedule(static)
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        const size_t offset = b*BLOCK_SIZE;
+        blocks[b] = hashBlock(data + offset,
+                              std::min(BLOCK_SIZE, size - offset));
+    }
+
+    uint64_t h = combine(seed, size);
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        h = combine(h, blocks[b]);
+    }
+    return h;
+}
+
+uint64_t hash(const pfs::Frame& frame)
+{
+    uint64_t h = combine(frame.getWidth(), frame.getHeight());
+
+    const ChannelContainer& channels = frame.getChannels();
+    for (ChannelContainer::const_iterator it = channels.begin();
+         it != channels.end(); ++it)
+    {
+        const std::string& name = (*it)->getName();
+        for (std::string::const_iterator c = name.begin(); c != name.end(); ++c)
+        {
+            h = combine(h, static_cast<unsigned char>(*c));
+        }
+        h = hash((*it)->data(), (*it)->size(), h);
+    }
+    return h;
+}
+
+}   // utils
+}   // pfs
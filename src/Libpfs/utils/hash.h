@@ -0,0 +1,46 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+//! \brief Content hash of pfs::Frame and raw sample buffers
+
+#ifndef PFS_UTILS_HASH_H
+#define PFS_UTILS_HASH_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace pfs {
+class Frame;
+
+namespace utils {
+
+//! \brief 64 bit non-cryptographic hash of \a size floats.
+//! The buffer is split in fixed size blocks which are hashed in parallel, so
+//! the result does not depend on the number of threads.
+uint64_t hash(const float* data, size_t size, uint64_t seed = 0);
+
+//! \brief 64 bit hash of the content of a frame: size, channel names and
+//! channel data (tags are not taken into account)
+uint64_t hash(const pfs::Frame& frame);
+
+}   // utils
+}   // pfs
+
+#endif // PFS_UTILS_HASH_H
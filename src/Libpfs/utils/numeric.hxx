@@ -55,6 +55,7 @@ void vmul(const _Type* A, const _Type* B, _Type* C, size_t size)
     {
         (*C)(idx) = (*A)(idx) * (*B)(idx);
     }
+    C->touch();
 }
 
 template <typename _Type>
@@ -72,6 +73,7 @@ void vadd(const _Type* A, const _Type* B, _Type* C, size_t size)
     {
         (*C)(idx) = (*A)(idx) + (*B)(idx);
     }
+    C->touch();
 }
 
 template <typename _Type>
@@ -111,6 +113,7 @@ void vsum_scalar(const _Type* I, float c, _Type* O, size_t size)
     {
         (*O)(idx) = c+(*I)(idx);
     }
+    O->touch();
 }
 
 template <typename _Type>
@@ -121,6 +124,7 @@ void vmul_scalar(const _Type* I, float c, _Type* O, size_t size)
     {
         (*O)(idx) = c*(*I)(idx);
     }
+    O->touch();
 }
 
 template <typename _Type>
@@ -131,6 +135,7 @@ void vdiv_scalar(const _Type* I, float c, _Type* O, size_t size)
     {
         (*O)(idx) = c/(*I)(idx);
     }
+    O->touch();
 }
 
 }   // utils
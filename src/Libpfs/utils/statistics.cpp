@@ -0,0 +1,520 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <Libpfs/utils/statistics.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace pfs {
+namespace utils {
+
+namespace
+{
+// values processed at once: bins are computed for the whole chunk first, in a
+// loop the compiler can vectorise, then counted
+const int CHUNK_SIZE = 256;
+
+// exact quantiles: bins of the histograms narrowing the search, number of
+// values copied and selected at the end, maximum number of histograms
+const size_t QUANTILE_BINS = 4096;
+const size_t MAX_COPIED_VALUES = 1 << 16;
+const size_t MAX_LEVELS = 4;
+
+// NaN and infinities, tested on the bits: -ffast-math folds std::isfinite()
+inline bool isFinite(float v)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return (bits & 0x7f800000u) != 0x7f800000u;
+}
+
+//! \return number of finite values, whose range is [min, max]
+size_t minMax(const float* data, size_t size, float& min, float& max)
+{
+    min = FLT_MAX;
+    max = -FLT_MAX;
+    size_t finite = 0;
+
+#pragma omp parallel
+    {
+        float tMin = FLT_MAX;
+        float tMax = -FLT_MAX;
+        size_t tFinite = 0;
+
+#pragma omp for schedule(static) nowait
+        for (long i = 0; i < static_cast<long>(size); ++i)
+        {
+            const float v = data[i];
+            if ( isFinite(v) )
+            {
+                tMin = std::min(tMin, v);
+                tMax = std::max(tMax, v);
+                ++tFinite;
+            }
+        }
+
+#pragma omp critical
+        {
+            min = std::min(min, tMin);
+            max = std::max(max, tMax);
+            finite += tFinite;
+        }
+    }
+    return finite;
+}
+
+// floats mapped to integers in the same order, to bisect them
+inline int64_t orderedKey(float f)
+{
+    int32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return (bits >= 0) ? static_cast<int64_t>(bits) : -static_cast<int64_t>(bits & 0x7fffffff);
+}
+
+inline float fromOrderedKey(int64_t key)
+{
+    const int32_t bits = (key >= 0) ? static_cast<int32_t>(key)
+                                    : static_cast<int32_t>(0x80000000u | static_cast<uint32_t>(-key));
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// smallest value in [lo, hi] whose bin is at least \a b (bins never decrease
+// with the value, so the values of a bin form an interval)
+float firstOfBin(const Histogram& h, int b, float lo, float hi)
+{
+    int64_t first = orderedKey(lo);
+    int64_t last = orderedKey(hi);
+    while ( first < last )
+    {
+        const int64_t mid = first + (last - first)/2;
+        if ( h.bin(fromOrderedKey(mid), true) >= b )
+        {
+            last = mid;
+        }
+        else
+        {
+            first = mid + 1;
+        }
+    }
+    return fromOrderedKey(first);
+}
+
+// largest value in [lo, hi] whose bin is at most \a b
+float lastOfBin(const Histogram& h, int b, float lo, float hi)
+{
+    int64_t first = orderedKey(lo);
+    int64_t last = orderedKey(hi);
+    while ( first < last )
+    {
+        const int64_t mid = last - (last - first)/2;
+        if ( h.bin(fromOrderedKey(mid), true) <= b )
+        {
+            first = mid;
+        }
+        else
+        {
+            last = mid - 1;
+        }
+    }
+    return fromOrderedKey(first);
+}
+
+// histogram of the values in [lo, hi]
+std::vector<size_t> countInRange(const float* data, size_t size,
+                                 const Histogram& h, float lo, float hi)
+{
+    std::vector<size_t> counts(h.bins(), 0);
+
+#pragma omp parallel
+    {
+        std::vector<size_t> local(h.bins(), 0);
+
+#pragma omp for schedule(static) nowait
+        for (long i = 0; i < static_cast<long>(size); ++i)
+        {
+            const float v = data[i];
+            if ( isFinite(v) && v >= lo && v <= hi )
+            {
+                ++local[h.bin(v, true)];
+            }
+        }
+
+#pragma omp critical
+        for (size_t b = 0; b < counts.size(); ++b)
+        {
+            counts[b] += local[b];
+        }
+    }
+    return counts;
+}
+
+// copy of the values in [lo, hi]
+std::vector<float> copyInRange(const float* data, size_t size, float lo, float hi)
+{
+    std::vector<float> values;
+
+#pragma omp parallel
+    {
+        std::vector<float> local;
+
+#pragma omp for schedule(static) nowait
+        for (long i = 0; i < static_cast<long>(size); ++i)
+        {
+            const float v = data[i];
+            if ( isFinite(v) && v >= lo && v <= hi )
+            {
+                local.push_back(v);
+            }
+        }
+
+#pragma omp critical
+        values.insert(values.end(), local.begin(), local.end());
+    }
+    return values;
+}
+}
+
+Statistics::Statistics()
+    : size(0)
+    , positive(0)
+    , min(0.f)
+    , max(0.f)
+    , minPositive(FLT_MAX)
+    , mean(0.0)
+    , logMean(0.0)
+{}
+
+namespace
+{
+//! \brief single pass of computeStatistics(), the sums are skipped if
+//! \a Sums is false
+template <bool Sums>
+Statistics summarize(const float* data, size_t size)
+{
+    Statistics stats;
+    if ( size == 0 )
+    {
+        return stats;
+    }
+
+    float min = FLT_MAX;
+    float max = -FLT_MAX;
+    double sum = 0.0;
+    double logSum = 0.0;
+
+    const long chunks = static_cast<long>((size + CHUNK_SIZE - 1)/CHUNK_SIZE);
+
+#pragma omp parallel
+    {
+        float tMin = FLT_MAX;
+        float tMax = -FLT_MAX;
+        float tMinPositive = FLT_MAX;
+        size_t tPositive = 0;
+        double tSum = 0.0;
+        double tLogSum = 0.0;
+
+#pragma omp for schedule(static) nowait
+        for (long c = 0; c < chunks; ++c)
+        {
+            const size_t begin = c*CHUNK_SIZE;
+            const size_t end = std::min(begin + CHUNK_SIZE, size);
+
+            // partial sums of a chunk are exact enough in single precision
+            float cSum = 0.f;
+            float cLogSum = 0.f;
+            for (size_t i = begin; i < end; ++i)
+            {
+                const float v = data[i];
+                const bool isPositive = v > 0.f;
+
+                tMin = std::min(tMin, v);
+                tMax = std::max(tMax, v);
+                tMinPositive = std::min(tMinPositive, isPositive ? v : FLT_MAX);
+                tPositive += isPositive;
+                if ( Sums )
+                {
+                    cSum += v;
+                    cLogSum += std::log(isPositive ? v : 1.f);
+                }
+            }
+            tSum += cSum;
+            tLogSum += cLogSum;
+        }
+
+#pragma omp critical
+        {
+            min = std::min(min, tMin);
+            max = std::max(max, tMax);
+            stats.minPositive = std::min(stats.minPositive, tMinPositive);
+            stats.positive += tPositive;
+            sum += tSum;
+            logSum += tLogSum;
+        }
+    }
+
+    stats.size = size;
+    stats.min = min;
+    stats.max = max;
+    stats.mean = sum/size;
+    stats.logMean = stats.positive ? logSum/stats.positive : 0.0;
+
+    return stats;
+}
+}
+
+Statistics computeStatistics(const float* data, size_t size)
+{
+    return summarize<true>(data, size);
+}
+
+Statistics computeRange(const float* data, size_t size)
+{
+    return summarize<false>(data, size);
+}
+
+Histogram::Histogram(size_t bins, float min, float max, Scale scale)
+    : m_min(min)
+    , m_max(max)
+    , m_binsPerUnit(max > min ? bins/(max - min) : 0.f)
+    , m_scale(scale)
+    , m_total(0)
+    , m_counts(bins, 0)
+{
+    assert(bins > 0);
+}
+
+void Histogram::compute(const float* data, size_t size, size_t stride, bool clamp)
+{
+    assert(stride > 0);
+
+    const size_t samples = (size + stride - 1)/stride;
+    const long chunks = static_cast<long>((samples + CHUNK_SIZE - 1)/CHUNK_SIZE);
+    const bool logScale = (m_scale == LOG10);
+
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_total = 0;
+
+#pragma omp parallel
+    {
+        std::vector<size_t> counts(m_counts.size(), 0);
+        size_t total = 0;
+        int idx[CHUNK_SIZE];
+
+#pragma omp for schedule(static) nowait
+        for (long c = 0; c < chunks; ++c)
+        {
+            const size_t begin = c*CHUNK_SIZE;
+            const int n = static_cast<int>(std::min<size_t>(CHUNK_SIZE, samples - begin));
+            const float* in = data + begin*stride;
+
+            if ( logScale )
+            {
+                for (int i = 0; i < n; ++i)
+                {
+                    const float v = in[i*stride];
+                    idx[i] = (isFinite(v) && v > 0.f) ? bin(std::log10(v), clamp) : -1;
+                }
+            }
+            else
+            {
+                for (int i = 0; i < n; ++i)
+                {
+                    const float v = in[i*stride];
+                    idx[i] = isFinite(v) ? bin(v, clamp) : -1;
+                }
+            }
+
+            for (int i = 0; i < n; ++i)
+            {
+                if ( idx[i] >= 0 )
+                {
+                    ++counts[idx[i]];
+                    ++total;
+                }
+            }
+        }
+
+#pragma omp critical
+        {
+            for (size_t b = 0; b < counts.size(); ++b)
+            {
+                m_counts[b] += counts[b];
+            }
+            m_total += total;
+        }
+    }
+}
+
+size_t Histogram::maxCount() const
+{
+    return *std::max_element(m_counts.begin(), m_counts.end());
+}
+
+float Histogram::binStart(size_t bin) const
+{
+    if ( m_binsPerUnit == 0.f )
+    {
+        return m_min;
+    }
+    return m_min + bin/m_binsPerUnit;
+}
+
+float Histogram::quantile(double p) const
+{
+    float value = m_min;
+    if ( m_total > 0 && m_binsPerUnit > 0.f )
+    {
+        const double target = std::max(0.0, std::min(1.0, p))*m_total;
+
+        size_t cumulative = 0;
+        size_t b = 0;
+        for (; b < m_counts.size() - 1; ++b)
+        {
+            if ( cumulative + m_counts[b] > target )
+            {
+                break;
+            }
+            cumulative += m_counts[b];
+        }
+        const double inBin = m_counts[b] ?
+                    std::min(1.0, (target - cumulative)/m_counts[b]) : 1.0;
+        value = static_cast<float>(binStart(b) + inBin/m_binsPerUnit);
+    }
+    return (m_scale == LOG10) ? std::pow(10.f, value) : value;
+}
+
+void quantiles(const float* data, size_t size,
+               const std::vector<float>& p, std::vector<float>& q)
+{
+    q.assign(p.size(), 0.f);
+    if ( size == 0 || p.empty() )
+    {
+        return;
+    }
+
+    float min;
+    float max;
+    const size_t finite = minMax(data, size, min, max);
+    if ( finite == 0 )
+    {
+        return;
+    }
+    if ( !(max > min) )
+    {
+        std::fill(q.begin(), q.end(), min);
+        return;
+    }
+
+    // the first histogram, over all the data, is shared by all the quantiles
+    Histogram hist(QUANTILE_BINS, min, max);
+    hist.compute(data, size, 1, true);
+    const std::vector<size_t> counts = hist.counts();
+
+    for (size_t i = 0; i < p.size(); ++i)
+    {
+        const double pi = std::max(0.0, std::min(1.0, static_cast<double>(p[i])));
+        size_t rank = std::min(finite - 1, static_cast<size_t>(pi*finite));
+
+        // Narrow down the range of values holding the rank with a histogram
+        // of the range, until there are few enough values to be copied
+        const Histogram* level = &hist;
+        const std::vector<size_t>* levelCounts = &counts;
+        Histogram narrower(QUANTILE_BINS, min, max);
+        std::vector<size_t> narrowerCounts;
+        float lo = min;
+        float hi = max;
+        for (size_t l = 1; ; ++l)
+        {
+            int b = 0;
+            while ( rank >= (*levelCounts)[b] )
+            {
+                rank -= (*levelCounts)[b];
+                ++b;
+            }
+            const float binLo = firstOfBin(*level, b, lo, hi);
+            const float binHi = lastOfBin(*level, b, lo, hi);
+            lo = binLo;
+            hi = binHi;
+
+            if ( (*levelCounts)[b] <= MAX_COPIED_VALUES || l == MAX_LEVELS || !(hi > lo) )
+            {
+                break;
+            }
+
+            narrower = Histogram(QUANTILE_BINS, lo, hi);
+            narrowerCounts = countInRange(data, size, narrower, lo, hi);
+            level = &narrower;
+            levelCounts = &narrowerCounts;
+        }
+
+        if ( !(hi > lo) )
+        {
+            q[i] = lo;
+            continue;
+        }
+        std::vector<float> values = copyInRange(data, size, lo, hi);
+        rank = std::min(rank, values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        q[i] = values[rank];
+    }
+}
+
+float quantile(const float* data, size_t size, float p)
+{
+    std::vector<float> q;
+    quantiles(data, size, std::vector<float>(1, p), q);
+    return q[0];
+}
+
+void computeHistogram(const unsigned char* data, size_t size,
+                      std::vector<size_t>& counts, size_t stride)
+{
+    assert(stride > 0);
+
+    counts.assign(256, 0);
+    const long samples = static_cast<long>((size + stride - 1)/stride);
+
+#pragma omp parallel
+    {
+        size_t local[256] = {0};
+
+#pragma omp for schedule(static) nowait
+        for (long i = 0; i < samples; ++i)
+        {
+            ++local[data[i*stride]];
+        }
+
+#pragma omp critical
+        for (int b = 0; b < 256; ++b)
+        {
+            counts[b] += local[b];
+        }
+    }
+}
+
+}   // utils
+}   // pfs
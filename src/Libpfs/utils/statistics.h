@@ -0,0 +1,160 @@
+/*
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PFS_UTILS_STATISTICS_H
+#define PFS_UTILS_STATISTICS_H
+
+//! \file statistics.h
+//! \brief Histograms, quantiles and summary statistics of float arrays,
+//! computed in parallel
+
+#include <cstddef>
+#include <vector>
+
+namespace pfs {
+namespace utils {
+
+//! \brief summary of an array, computed in a single pass
+struct Statistics
+{
+    Statistics();
+
+    size_t size;
+    //! \brief number of values > 0
+    size_t positive;
+
+    float min;
+    float max;
+    //! \brief smallest value > 0, FLT_MAX if there is none
+    float minPositive;
+
+    //! \brief mean of all the values
+    double mean;
+    //! \brief mean of the natural logarithm of the positive values:
+    //! exp(logMean) is their geometric mean
+    double logMean;
+};
+
+Statistics computeStatistics(const float* data, size_t size);
+
+//! \brief cheaper computeStatistics(), without any logarithm: only size,
+//! positive, min, max and minPositive are computed
+Statistics computeRange(const float* data, size_t size);
+
+//! \brief histogram with bins of the same width, linear or logarithmic
+class Histogram
+{
+public:
+    enum Scale
+    {
+        LINEAR,
+        //! values are binned by their log10, values <= 0 are skipped
+        LOG10
+    };
+
+    //! \param min,max range covered by the bins, in log10 units for LOG10
+    Histogram(size_t bins, float min, float max, Scale scale = LINEAR);
+
+    //! \brief count every \a stride-th value of \a data (previous counts are
+    //! discarded). Values outside the range are counted in the first or last
+    //! bin if \a clamp is true, skipped otherwise. NaN and infinities are
+    //! always skipped.
+    void compute(const float* data, size_t size, size_t stride = 1,
+                 bool clamp = false);
+
+    size_t bins() const                 { return m_counts.size(); }
+    float min() const                   { return m_min; }
+    float max() const                   { return m_max; }
+    Scale scale() const                 { return m_scale; }
+
+    size_t count(size_t bin) const      { return m_counts[bin]; }
+    const std::vector<size_t>& counts() const { return m_counts; }
+    //! \brief number of values counted
+    size_t total() const                { return m_total; }
+    size_t maxCount() const;
+
+    //! \brief lower edge of \a bin, in the units of the range
+    float binStart(size_t bin) const;
+
+    //! \brief approximate quantile \a p in [0, 1], interpolated linearly in
+    //! its bin and returned in the units of the data (10^x for LOG10).
+    //! The error is at most the width of a bin.
+    float quantile(double p) const;
+
+    //! \return bin of \a value (in the units of the range), -1 if it is out
+    //! of range and \a clamp is false
+    inline int bin(float value, bool clamp) const;
+
+private:
+    float m_min;
+    float m_max;
+    float m_binsPerUnit;
+    Scale m_scale;
+    size_t m_total;
+    std::vector<size_t> m_counts;
+};
+
+//! \brief exact quantiles: for every \a p[i] in [0, 1] stores in \a q[i] the
+//! value of rank floor(p[i]*n) of the sorted data, like sorting a copy would,
+//! but in two passes and only copying the values close to the answer.
+//! NaN and infinities are skipped (n counts the finite values only); \a q
+//! is all zeros if there is none.
+void quantiles(const float* data, size_t size,
+               const std::vector<float>& p, std::vector<float>& q);
+
+//! \brief exact quantile \a p of \a data (see quantiles())
+float quantile(const float* data, size_t size, float p);
+
+//! \brief histogram of every \a stride-th 8 bit value of \a data into
+//! \a counts, resized to 256 bins
+void computeHistogram(const unsigned char* data, size_t size,
+                      std::vector<size_t>& counts, size_t stride = 1);
+
+inline int Histogram::bin(float value, bool clamp) const
+{
+    const int last = static_cast<int>(m_counts.size()) - 1;
+    float t = (value - m_min)*m_binsPerUnit;
+
+    // keep the conversion to int in range
+    t = (t > -1.f) ? t : -1.f;
+    t = (t < last + 2.f) ? t : last + 2.f;
+
+    // floor(t), truncation is wrong in (-1, 0)
+    const int idx = static_cast<int>(t + 1.f) - 1;
+    if ( idx >= 0 && idx <= last )
+    {
+        return idx;
+    }
+    if ( t == last + 1.f )
+    {
+        // the upper edge of the range belongs to the last bin
+        return last;
+    }
+    if ( clamp )
+    {
+        return (idx < 0) ? 0 : last;
+    }
+    return -1;
+}
+
+}   // utils
+}   // pfs
+
+#endif // PFS_UTILS_STATISTICS_H
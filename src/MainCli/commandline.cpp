@@ -140,6 +140,10 @@ int CommandLineInterfaceManager::execCommandLineParams()
         ("gamma,g", po::value<float>(&tmopts->pregamma),       tr("VALUE        Gamma value to use during tone mapping. (default: 1) ").toUtf8().constData())
         ("resize,r", po::value<int>(&tmopts->xsize),       tr("VALUE       Width you want to resize your HDR to (resized before gamma and tone mapping)").toUtf8().constData())
 
+        ("projection,p", po::value<std::string>(),       tr("SRC:DST     Reproject the HDR from projection SRC to DST (before saving it). Legal values are [polar|angular|cylindrical|mirrorball], angular accepts a field of view as angular/angle=DEGREES").toUtf8().constData())
+        ("projRotate", po::value<std::string>(),       tr("X,Y,Z       Rotation in degrees around the three axes applied by --projection (default: 0,0,0)").toUtf8().constData())
+        ("projOversample", po::value<int>(),       tr("VALUE       Samples per pixel side used by --projection (default: 1)").toUtf8().constData())
+        ("projFilter", po::value<std::string>(),       tr("Interpolation used by --projection. Legal values are [nearest|bilinear|bicubic|lanczos] (default: bilinear)").toUtf8().constData())
         ("output,o", po::value<std::string>(),       tr("LDR_FILE    File name you want to save your tone mapped LDR to.").toUtf8().constData())
         ("autoag,t", po::value<float>(&threshold),       tr("THRESHOLD   Enable auto anti-ghosting with given threshold. (0.0-1.0)").toUtf8().constData())
         ("autolevels,b", tr("Apply autolevels correction after tonemapping.").toUtf8().constData())
@@ -441,6 +445,59 @@ directory must exist.  Useful to avoid clutter in the current directory. \
         if (vm.count("ldrTiffDeflate"))
             tmofileparams->set("deflateCompression", vm["ldrTiffDeflate"].as<bool>());
 
+        if (vm.count("projection")) {
+            QStringList names = QString::fromStdString(vm["projection"].as<std::string>()).split(":");
+            if (names.size() != 2)
+                printErrorAndExit(tr("Error: Projection must be specified as SRC:DST."));
+            try
+            {
+                // getProjection() splits the options in place
+                QByteArray srcName = names.at(0).toLatin1();
+                QByteArray dstName = names.at(1).toLatin1();
+                srcProjection.reset(ProjectionFactory::getProjection(srcName.data()));
+                dstProjection.reset(ProjectionFactory::getProjection(dstName.data()));
+            }
+            catch (const char* error)
+            {
+                printErrorAndExit(QString::fromLatin1(error).trimmed());
+            }
+            if (!srcProjection || !dstProjection)
+                printErrorAndExit(tr("Error: Unknown projection specified."));
+
+            projectionInfo.reset(new TransformInfo());
+            projectionInfo->srcProjection = srcProjection.data();
+            projectionInfo->dstProjection = dstProjection.data();
+        }
+        if (vm.count("projRotate")) {
+            QStringList angles = QString::fromStdString(vm["projRotate"].as<std::string>()).split(",");
+            if (!projectionInfo || angles.size() != 3)
+                printErrorAndExit(tr("Error: --projRotate needs --projection and three angles X,Y,Z."));
+            projectionInfo->xRotate = toFloatWithErrMsg(angles.at(0));
+            projectionInfo->yRotate = toFloatWithErrMsg(angles.at(1));
+            projectionInfo->zRotate = toFloatWithErrMsg(angles.at(2));
+        }
+        if (vm.count("projOversample")) {
+            int oversample = vm["projOversample"].as<int>();
+            if (!projectionInfo || oversample < 1)
+                printErrorAndExit(tr("Error: --projOversample needs --projection and a value of at least 1."));
+            projectionInfo->oversampleFactor = oversample;
+        }
+        if (vm.count("projFilter")) {
+            if (!projectionInfo)
+                printErrorAndExit(tr("Error: --projFilter needs --projection."));
+            const std::string value = vm["projFilter"].as<std::string>();
+            if (value == "nearest")
+                projectionInfo->filter = PROJECTION_NEAREST;
+            else if (value == "bilinear")
+                projectionInfo->filter = PROJECTION_BILINEAR;
+            else if (value == "bicubic")
+                projectionInfo->filter = PROJECTION_BICUBIC;
+            else if (value == "lanczos")
+                projectionInfo->filter = PROJECTION_LANCZOS3;
+            else
+                printErrorAndExit(tr("Error: Unknown projection filter specified."));
+        }
+
         if (vm.count("load"))
             loadHdrFilename = QString::fromStdString(vm["load"].as<std::string>());
         if (vm.count("save"))
@@ -624,8 +681,27 @@ void CommandLineInterfaceManager::createHDR(int errorcode)
     saveHDR();
 }
 
+void CommandLineInterfaceManager::projectHDR()
+{
+    printIfVerbose( tr("Projecting from %1 to %2.")
+                    .arg(projectionInfo->srcProjection->getName())
+                    .arg(projectionInfo->dstProjection->getName()) , verbose);
+
+    const int xSize = HDR->getWidth();
+    const int ySize = static_cast<int>(xSize / projectionInfo->dstProjection->getSizeRatio());
+
+    QScopedPointer<pfs::Frame> transformed(new pfs::Frame(xSize, ySize));
+    transformFrame(*HDR, *transformed, *projectionInfo);
+    HDR.reset(transformed.take());
+}
+
 void CommandLineInterfaceManager::saveHDR()
 {
+    if (projectionInfo)
+    {
+        projectHDR();
+    }
+
     if (!saveHdrFilename.isEmpty())
     {
         printIfVerbose( tr("Saving to file %1.").arg(saveHdrFilename) , verbose);
@@ -37,6 +37,7 @@
 #include "HdrWizard/HdrCreationManager.h"
 #include "Libpfs/frame.h"
 #include "Libpfs/params.h"
+#include "Libpfs/manip/projection.h"
 #include "ezETAProgressBar.hpp"
 
 class CommandLineInterfaceManager : public QObject
@@ -87,7 +88,11 @@ private:
     std::string pageName;
     std::string imagesDir;
     QString saveAlignedImagesPrefix;
+    QScopedPointer<Projection> srcProjection;
+    QScopedPointer<Projection> dstProjection;
+    QScopedPointer<TransformInfo> projectionInfo;
 
+    void projectHDR();
     void generateHTML();
     void startTonemap();
 
@@ -81,6 +81,7 @@
 #include "Viewers/HdrViewer.h"
 #include "Viewers/LuminanceRangeWidget.h"
 #include "Viewers/LdrViewer.h"
+#include "Viewers/ImagePyramid.h"
 #include "UI/ImageQualityDialog.h"
 #include "UI/TiffModeDialog.h"
 #include "UI/UMessageBox.h"
@@ -100,6 +101,7 @@
 #include "Preferences/PreferencesDialog.h"
 #include "Core/IOWorker.h"
 #include "Core/TMWorker.h"
+#include "Core/TonemapCache.h"
 #include "TonemappingPanel/TMOProgressIndicator.h"
 #include "HdrWizard/AutoAntighosting.h"
 #include "HdrWizard/WhiteBalance.h"
@@ -1206,6 +1208,8 @@ void MainWindow::on_OptionsAction_triggered()
     if (opts->exec() == QDialog::Accepted)
     {
         m_Ui->actionShowPreviewPanel->setChecked(luminance_options->isPreviewPanelActive());
+        TonemapCache::getInstance().updateSettings();
+        ImagePyramid::updateSettings();
     }
 }
 
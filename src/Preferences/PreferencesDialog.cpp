@@ -40,6 +40,7 @@
 #include "Common/TranslatorManager.h"
 #include "Preferences/PreferencesDialog.h"
 
+#include "Libpfs/colorspace/iccmanager.h"
 
 // UI
 #include "ui_PreferencesDialog.h"
@@ -230,6 +231,12 @@ void PreferencesDialog::on_okButton_clicked()
     // --- Batch TM
     luminance_options.setBatchTmNumThreads( m_Ui->numThreadspinBox->value() );
 
+    // --- Tonemapping cache
+    luminance_options.setTonemapCacheSize( m_Ui->tmCacheSizeSpinBox->value() );
+    luminance_options.setTonemapDiskCacheActive( m_Ui->tmDiskCacheCheckBox->isChecked() );
+    luminance_options.setTonemapDiskCacheSize( m_Ui->tmDiskCacheSizeSpinBox->value() );
+    luminance_options.setViewerTileCacheSize( m_Ui->viewerTileCacheSizeSpinBox->value() );
+
     // --- Other Parameters
 
     QStringList ais_options = m_Ui->aisParamsLineEdit->text().split(" ",QString::SkipEmptyParts);
@@ -280,6 +287,8 @@ void PreferencesDialog::on_okButton_clicked()
 	luminance_options.setCameraProfileFileName( m_Ui->camera_lineEdit->text() );
 	luminance_options.setMonitorProfileFileName( m_Ui->monitor_lineEdit->text() );
 	luminance_options.setPrinterProfileFileName( m_Ui->printer_lineEdit->text() );
+	// profiles may have been replaced on disk
+	pfs::colorspace::IccManager::instance().clear();
 
     // ---- temporary... this rubbish must go away!
     luminance_options.setValue(KEY_USER_QUAL_TOOLBUTTON, m_Ui->user_qual_toolButton->isEnabled());
@@ -599,6 +608,11 @@ void PreferencesDialog::from_options_to_gui()
 
     m_Ui->numThreadspinBox->setValue( luminance_options.getBatchTmNumThreads() );
 
+    m_Ui->tmCacheSizeSpinBox->setValue( luminance_options.getTonemapCacheSize() );
+    m_Ui->tmDiskCacheCheckBox->setChecked( luminance_options.isTonemapDiskCacheActive() );
+    m_Ui->tmDiskCacheSizeSpinBox->setValue( luminance_options.getTonemapDiskCacheSize() );
+    m_Ui->viewerTileCacheSizeSpinBox->setValue( luminance_options.getViewerTileCacheSize() );
+
     m_Ui->aisParamsLineEdit->setText( luminance_options.getAlignImageStackOptions().join(" ") );
 
     m_Ui->previewsWidthSpinBox->setValue( luminance_options.getPreviewWidth() );
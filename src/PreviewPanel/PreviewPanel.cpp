@@ -22,17 +22,21 @@
  */
 
 #include <QDebug>
-#include <QtConcurrentMap>
+#include <QRunnable>
+#include <QScopedPointer>
 #include <QSharedPointer>
 
 #include "PreviewPanel.h"
 
 #include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
 #include "Libpfs/manip/copy.h"
 #include "Libpfs/manip/resize.h"
+#include "Libpfs/manip/gamma.h"
 #include "Libpfs/manip/gamma_levels.h"
+#include "Libpfs/utils/hash.h"
 
-#include "Core/TMWorker.h"
+#include "Core/TonemapCache.h"
 #include "Libpfs/tm/TonemapOperator.h"
 
 #include "Fileformat/pfsoutldrimage.h"
@@ -42,11 +46,23 @@
 #include "Common/CommonFunctions.h"
 #include "UI/FlowLayout.h"
 
+//! \brief downsampled copies of the HDR shared by all the preview jobs,
+//! from the coarsest (level 0) to the full preview size
+struct PreviewPyramid
+{
+    QVector< QSharedPointer<pfs::Frame> > m_levels;
+    QVector<quint64> m_hashes;
+};
+
 namespace // anoymous namespace
 {
 const int PREVIEW_WIDTH = 120;
 const int PREVIEW_HEIGHT = 100;
 
+//! ratio between the full preview and the first, coarse, pass
+const int COARSE_FACTOR = 4;
+const int COARSE_MIN_WIDTH = 16;
+
 //! \note It is not the most efficient way to do this thing, but I will fix it later
 //! this function get calls multiple time
 void resetTonemappingOptions(TonemappingOptions* tm_options, const pfs::Frame* frame)
@@ -57,91 +73,125 @@ void resetTonemappingOptions(TonemappingOptions* tm_options, const pfs::Frame* f
     tm_options->tonemapSelection   = false;
 }
 
-class PreviewLabelUpdater
+//! \brief reports the job as canceled as soon as a newer preview is requested
+//! for the same label
+class PreviewProgress : public pfs::Progress
 {
 public:
-    explicit PreviewLabelUpdater(QSharedPointer<pfs::Frame> reference_frame):
-        m_isAutolevels(false),
-        m_ReferenceFrame(reference_frame)
+    PreviewProgress(const QAtomicInt& generation, int expected)
+        : m_generation(generation)
+        , m_expected(expected)
     {}
 
-    void setAutolevels(bool al) { m_isAutolevels = al; }
-    //! \brief QRunnable::run() definition
-    //! \caption I use shared pointer in this function, so I don't have to worry about memory allocation
-    //! in case something wrong happens, it shouldn't leak
-    void operator()(PreviewLabel* to_update)
+    bool canceled() const
     {
-#ifdef QT_DEBUG
-        //qDebug() << QThread::currentThread() << "running...";
-#endif
+        return m_generation.load() != m_expected;
+    }
+
+private:
+    const QAtomicInt& m_generation;
+    int m_expected;
+};
 
-        // retrieve TM parameters
-        TonemappingOptions* tm_options = to_update->getTonemappingOptions();
-        resetTonemappingOptions(tm_options, m_ReferenceFrame.data());
+class PreviewJob : public QRunnable
+{
+public:
+    PreviewJob(PreviewPanel* panel, int index,
+               QSharedPointer<QAtomicInt> generation,
+               QSharedPointer<pfs::Frame> frame, quint64 frame_hash,
+               int level, const QSize& final_size,
+               const TonemappingOptions& tm_options, bool autolevels)
+        : m_panel(panel)
+        , m_index(index)
+        , m_generation(generation)
+        , m_expected(generation->load())
+        , m_frame(frame)
+        , m_frameHash(frame_hash)
+        , m_level(level)
+        , m_finalSize(final_size)
+        , m_options(tm_options)
+        , m_isAutolevels(autolevels)
+    {
+        resetTonemappingOptions(&m_options, m_frame.data());
+    }
 
-        if ( m_ReferenceFrame.isNull() )
+    void run()
+    {
+        PreviewProgress progress(*m_generation, m_expected);
+        if ( progress.canceled() ) return;
+
+        const QByteArray cache_key = TonemapCache::computeKey(m_frameHash, m_options);
+        QScopedPointer<pfs::Frame> frame( TonemapCache::getInstance().get(cache_key) );
+
+        if ( frame.isNull() )
         {
-#ifdef QT_DEBUG
-            qDebug() << "operator()() for TM" << static_cast<int>(tm_options->tmoperator) << " received a NULL pointer";
-            return;
-#endif
-        }
+            frame.reset( pfs::copy(m_frame.data()) );
+            if ( m_options.pregamma != 1.0f )
+            {
+                pfs::applyGamma( frame.data(), m_options.pregamma );
+            }
 
-        // Copy Reference Frame
-        QSharedPointer<pfs::Frame> temp_frame( pfs::copy(m_ReferenceFrame.data()) );
+            try
+            {
+                QScopedPointer<TonemapOperator> tm_operator( TonemapOperator::getTonemapOperator(m_options.tmoperator) );
+                tm_operator->tonemapFrame(*frame, &m_options, progress);
+            }
+            catch (...)
+            {
+                frame.reset();
+            }
 
-        // Tone Mapping
-        //QScopedPointer<TonemapOperator> tm_operator( TonemapOperator::getTonemapOperator(tm_options->tmoperator));
-        //tm_operator->tonemapFrame(temp_frame.data(), tm_options, fake_progress_helper);
+            if ( progress.canceled() ) return;
 
-        //try { //Since nothing here actually throws this isn't useful, i need to check if returned frame != NULL
-        QScopedPointer<TMWorker> tmWorker(new TMWorker);
-        QSharedPointer<pfs::Frame> frame (tmWorker->computeTonemap(temp_frame.data(), tm_options));
-        
-        if (!frame.isNull())
+            if ( !frame.isNull() )
+            {
+                TonemapCache::getInstance().insert(cache_key, *frame);
+            }
+        }
+
+        QSharedPointer<QImage> qimage;
+        if ( !frame.isNull() )
         {
-            // Create QImage from pfs::Frame into QSharedPointer, and I give it to the preview panel
-            //QSharedPointer<QImage> qimage(fromLDRPFStoQImage(temp_frame.data()));
             if (m_isAutolevels) {
-                QSharedPointer<QImage> temp_qimage(fromLDRPFStoQImage(frame.data()));
+                QScopedPointer<QImage> temp_qimage(fromLDRPFStoQImage(frame.data()));
                 float minL, maxL, gammaL;
                 computeAutolevels(temp_qimage.data(), minL, maxL, gammaL);
                 pfs::gammaAndLevels(frame.data(), minL, maxL, 0.f, 1.f, gammaL);
             }
 
-            QSharedPointer<QImage> qimage(fromLDRPFStoQImage(frame.data()));
-
-            //! \note I cannot use these 2 functions, because setPixmap must run in the GUI thread
-            //m_PreviewLabel->setPixmap( QPixmap::fromImage(*qimage) );
-            //m_PreviewLabel->adjustSize();
-            //! \note So I queue a SLOT request on the m_PreviewPanel
-            QMetaObject::invokeMethod(to_update, "assignNewQImage", Qt::QueuedConnection,
-                                      Q_ARG(QSharedPointer<QImage>, qimage));
+            qimage = QSharedPointer<QImage>(fromLDRPFStoQImage(frame.data()));
+            if ( qimage->size() != m_finalSize )
+            {
+                // coarse pass: stretch it, so the layout does not jump
+                qimage = QSharedPointer<QImage>(new QImage(qimage->scaled(m_finalSize)));
+            }
         }
         else
         {
-            QSharedPointer<QImage> qimage(new QImage(PREVIEW_WIDTH, PREVIEW_HEIGHT, QImage::Format_ARGB32_Premultiplied));
+            qimage = QSharedPointer<QImage>(new QImage(PREVIEW_WIDTH, PREVIEW_HEIGHT, QImage::Format_ARGB32_Premultiplied));
             qimage->fill(QColor(255,0,0)); //TODO Tonemapping failed, let's show a RED preview...
-            QMetaObject::invokeMethod(to_update, "assignNewQImage", Qt::QueuedConnection,
-                                      Q_ARG(QSharedPointer<QImage>, qimage));
-        }
-        /*
-        }
-        catch (...) {
-            qDebug() << "PreviewLabelUpdater: caught exception";
-            QSharedPointer<QImage> qimage(new QImage);
-            QMetaObject::invokeMethod(to_update, "assignNewQImage", Qt::QueuedConnection,
-                                      Q_ARG(QSharedPointer<QImage>, qimage));
         }
-        */
-#ifdef QT_DEBUG
-        //qDebug() << QThread::currentThread() << "done!";
-#endif
+
+        //! \note setPixmap must run in the GUI thread: queue a request on the
+        //! panel, which also drops results that became stale in the meantime
+        QMetaObject::invokeMethod(m_panel, "assignPreview", Qt::QueuedConnection,
+                                  Q_ARG(int, m_index),
+                                  Q_ARG(int, m_expected),
+                                  Q_ARG(int, m_level),
+                                  Q_ARG(QSharedPointer<QImage>, qimage));
     }
 
 private:
+    PreviewPanel* m_panel;
+    int m_index;
+    QSharedPointer<QAtomicInt> m_generation;
+    int m_expected;
+    QSharedPointer<pfs::Frame> m_frame;
+    quint64 m_frameHash;
+    int m_level;
+    QSize m_finalSize;
+    TonemappingOptions m_options;
     bool m_isAutolevels;
-    QSharedPointer<pfs::Frame> m_ReferenceFrame;
 };
 
 }
@@ -149,7 +199,8 @@ private:
 PreviewPanel::PreviewPanel(QWidget *parent):
     QWidget(parent),
     m_original_width_frame(0),
-    m_isAutolevels(false)
+    m_isAutolevels(false),
+    m_pyramidSource(NULL)
 {
     //! \note I need to register the new object to pass this class as parameter inside invokeMethod()
     //! see run() inside PreviewLabelUpdater
@@ -247,6 +298,12 @@ PreviewPanel::PreviewPanel(QWidget *parent):
     flowLayout->addWidget(labelMai);
 
     setLayout(flowLayout);
+
+    for (int idx = 0; idx < m_ListPreviewLabel.size(); ++idx)
+    {
+        m_generations.push_back(QSharedPointer<QAtomicInt>(new QAtomicInt(0)));
+        m_shownLevels.push_back(-1);
+    }
 }
 
 PreviewPanel::~PreviewPanel()
@@ -254,13 +311,42 @@ PreviewPanel::~PreviewPanel()
 #ifdef QT_DEBUG
     qDebug() << "PreviewPanel::~PreviewPanel()";
 #endif
+    // cancel everything and wait for the running jobs: they hold a pointer to
+    // this panel
+    foreach (const QSharedPointer<QAtomicInt>& generation, m_generations)
+    {
+        generation->ref();
+    }
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
 }
 
 void PreviewPanel::updatePreviews(pfs::Frame* frame, int index)
 {
     if ( frame == NULL ) return;
 
+    // a single label is updated when its options change: the frame is the
+    // same, so is the pyramid
+    if ( index == -1 || frame != m_pyramidSource || m_pyramid.isNull() )
+    {
+        buildPyramid(frame);
+    }
+
+    if (index == -1) {
+        for (int idx = 0; idx < m_ListPreviewLabel.size(); ++idx)
+        {
+            schedulePreview(idx);
+        }
+    }
+    else {
+        schedulePreview(index);
+    }
+}
+
+void PreviewPanel::buildPyramid(pfs::Frame* frame)
+{
     m_original_width_frame = frame->getWidth();
+    m_pyramidSource = frame;
 
     int frame_width = frame->getWidth();
     int frame_height = frame->getHeight();
@@ -271,25 +357,64 @@ void PreviewPanel::updatePreviews(pfs::Frame* frame, int index)
         float ratio = ((float)frame_width)/frame_height;
         resized_width = PREVIEW_HEIGHT*ratio;
     }
-    // 1. make a resized copy
-    QSharedPointer<pfs::Frame> current_frame( pfs::resize(frame, resized_width));
 
-    // 2. (non concurrent) for each PreviewLabel, call PreviewLabelUpdater::operator()
-    if (index == -1) {
-        foreach(PreviewLabel* current_label, m_ListPreviewLabel)
-        {
-            PreviewLabelUpdater updater(current_frame);
-            updater.setAutolevels(m_isAutolevels);
-            updater(current_label);
-        }
+    // only the full preview is built from the HDR, the coarse level is
+    // downsampled from it
+    QSharedPointer<pfs::Frame> full( pfs::resize(frame, resized_width) );
+
+    QSharedPointer<PreviewPyramid> pyramid(new PreviewPyramid);
+    const int coarse_width = resized_width/COARSE_FACTOR;
+    if ( coarse_width >= COARSE_MIN_WIDTH )
+    {
+        QSharedPointer<pfs::Frame> coarse( pfs::resize(full.data(), coarse_width) );
+        pyramid->m_levels.push_back(coarse);
     }
-    else {
-        PreviewLabelUpdater updater(current_frame);
-        updater.setAutolevels(m_isAutolevels);
-        updater(m_ListPreviewLabel.at(index));
+    pyramid->m_levels.push_back(full);
+
+    foreach (const QSharedPointer<pfs::Frame>& level, pyramid->m_levels)
+    {
+        pyramid->m_hashes.push_back(pfs::utils::hash(*level));
     }
-    // 2. (concurrent) for each PreviewLabel, call PreviewLabelUpdater::operator()
-    //QtConcurrent::map (m_ListPreviewLabel, PreviewLabelUpdater(current_frame) );
+
+    m_pyramid = pyramid;
+}
+
+void PreviewPanel::schedulePreview(int index)
+{
+    // invalidate queued and running jobs for this label
+    QSharedPointer<QAtomicInt> generation = m_generations[index];
+    generation->ref();
+    m_shownLevels[index] = -1;
+
+    PreviewLabel* label = m_ListPreviewLabel.at(index);
+    const bool visible = !label->visibleRegion().isEmpty();
+
+    const QSharedPointer<pfs::Frame>& full = m_pyramid->m_levels.last();
+    const QSize final_size(full->getWidth(), full->getHeight());
+
+    const int levels = m_pyramid->m_levels.size();
+    for (int level = 0; level < levels; ++level)
+    {
+        // coarse passes first, visible labels first within each pass
+        const int priority = 2*(levels - level) + (visible ? 1 : 0);
+
+        m_threadPool.start(new PreviewJob(this, index, generation,
+                                          m_pyramid->m_levels[level],
+                                          m_pyramid->m_hashes[level],
+                                          level, final_size,
+                                          *label->getTonemappingOptions(),
+                                          m_isAutolevels),
+                           priority);
+    }
+}
+
+void PreviewPanel::assignPreview(int index, int generation, int level, QSharedPointer<QImage> qimage)
+{
+    if ( m_generations[index]->load() != generation ) return;   // stale
+    if ( level < m_shownLevels[index] ) return;                 // already refined
+
+    m_shownLevels[index] = level;
+    m_ListPreviewLabel.at(index)->assignNewQImage(qimage);
 }
 
 void PreviewPanel::tonemapPreview(TonemappingOptions* opts)
@@ -25,6 +25,11 @@
 #define PREVIEWPANEL_IMPL_H
 
 #include <QWidget>
+#include <QAtomicInt>
+#include <QImage>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QVector>
 
 // forward declaration
 namespace pfs {
@@ -38,6 +43,15 @@ namespace Ui {
 class TonemappingOptions;   // #include "Core/TonemappingOptions.h"
 class PreviewLabel;         // #include "PreviewPanel/PreviewLabel.h"
 
+struct PreviewPyramid;      // defined in PreviewPanel.cpp
+
+//!
+//! Shows a thumbnail of the current HDR tonemapped with every operator.
+//! Previews are computed progressively in a private thread pool: a very low
+//! resolution result first, then the full preview size. Visible labels are
+//! served first and jobs belonging to an old frame or to old options are
+//! dropped (or canceled, if already running).
+//!
 class PreviewPanel : public QWidget
 {
     Q_OBJECT
@@ -55,12 +69,28 @@ public Q_SLOTS:
 protected Q_SLOTS:
     void tonemapPreview(TonemappingOptions*);
 
+private Q_SLOTS:
+    //! \brief receives the result of a preview job, in the GUI thread
+    void assignPreview(int index, int generation, int level, QSharedPointer<QImage> qimage);
+
 Q_SIGNALS:
     void startTonemapping(TonemappingOptions*);
 
 private:
+    void buildPyramid(pfs::Frame* frame);
+    void schedulePreview(int index);
+
     int m_original_width_frame;
     bool m_isAutolevels;
     QList<PreviewLabel*> m_ListPreviewLabel;
+
+    QThreadPool m_threadPool;
+    QSharedPointer<PreviewPyramid> m_pyramid;
+    const pfs::Frame* m_pyramidSource;
+    //! per label counter, bumped every time its preview is requested: jobs
+    //! holding an older value are stale
+    QVector< QSharedPointer<QAtomicInt> > m_generations;
+    //! per label, highest pyramid level shown for the current generation
+    QVector<int> m_shownLevels;
 };
 #endif
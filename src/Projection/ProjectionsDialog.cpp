@@ -30,19 +30,9 @@
 #include "Libpfs/frame.h"
 #include "Libpfs/manip/projection.h"
 
-static void worker(pfs::Frame *original, pfs::Frame *transformed, int xSize, int ySize, TransformInfo *transforminfo)
+static void worker(pfs::Frame *original, pfs::Frame *transformed, TransformInfo *transforminfo)
 {
-    const pfs::ChannelContainer& channels = original->getChannels();
-
-    for (pfs::ChannelContainer::const_iterator it = channels.begin();
-         it != channels.end(); ++it)
-    {
-        pfs::Channel *newCh = transformed->createChannel( (*it)->getName() );
-
-        transformArray(*it, newCh, transforminfo);
-    }
-
-    pfs::copyTags( original, transformed );
+    transformFrame(*original, *transformed, *transforminfo);
 }
 
 ProjectionsDialog::ProjectionsDialog(QWidget *parent,pfs::Frame *orig):
@@ -66,7 +56,7 @@ ProjectionsDialog::ProjectionsDialog(QWidget *parent,pfs::Frame *orig):
     connect(m_Ui->okButton,SIGNAL(clicked()),this,SLOT(okClicked()));
     connect(m_Ui->sourceProjection,SIGNAL(activated(int)),this,SLOT(srcProjActivated(int)));
     connect(m_Ui->destProjection,SIGNAL(activated(int)),this,SLOT(dstProjActivated(int)));
-    connect(m_Ui->bilinearCheckBox,SIGNAL(toggled(bool)),this,SLOT(bilinearToggled(bool)));
+    connect(m_Ui->filterComboBox,SIGNAL(activated(int)),this,SLOT(filterActivated(int)));
     connect(m_Ui->oversampleSpinBox,SIGNAL(valueChanged(int)),this,SLOT(oversampleChanged(int)));
     connect(m_Ui->XrotSpinBox,SIGNAL(valueChanged(int)),this,SLOT(XRotChanged(int)));
     connect(m_Ui->YrotSpinBox,SIGNAL(valueChanged(int)),this,SLOT(YRotChanged(int)));
@@ -92,8 +82,8 @@ void ProjectionsDialog::ZRotChanged(int v) {
 void ProjectionsDialog::oversampleChanged(int v) {
 	transforminfo->oversampleFactor=v;
 }
-void ProjectionsDialog::bilinearToggled(bool v) {
-	transforminfo->interpolate=v;
+void ProjectionsDialog::filterActivated(int gui_index) {
+	transforminfo->filter=static_cast<ProjectionFilter>(gui_index);
 }
 void ProjectionsDialog::dstProjActivated(int gui_index) {
 	transforminfo->dstProjection=projectionList.at(gui_index);
@@ -128,7 +118,7 @@ void ProjectionsDialog::okClicked()
     int ySize = static_cast<int>(xSize / transforminfo->dstProjection->getSizeRatio());
     transformed = new pfs::Frame( xSize,ySize );
 
-    m_future = QtConcurrent::run(boost::bind(&worker, original, transformed, xSize, ySize, transforminfo));
+    m_future = QtConcurrent::run(boost::bind(&worker, original, transformed, transforminfo));
 
     m_futureWatcher.setFuture(m_future);
 
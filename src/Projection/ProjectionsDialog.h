@@ -59,7 +59,7 @@ private slots:
 	void YRotChanged(int);
 	void ZRotChanged(int);
 	void oversampleChanged(int);
-	void bilinearToggled(bool);
+	void filterActivated(int);
 	void dstProjActivated(int);
 	void srcProjActivated(int);
 	void anglesAngularDestinationProj(int);
@@ -34,7 +34,9 @@
 
 #include "Libpfs/frame.h"
 #include "Libpfs/colorspace/colorspace.h"
+#include "Libpfs/colorspace/restorecolor.h"
 #include "Libpfs/progress.h"
+#include "TonemappingOperators/pfstmo.h"
 
 #include "tmo_ashikhmin02.h"
 
@@ -56,9 +58,56 @@ void calculateLuminance( pfs::Array2Df* Y, float& avLum, float& maxLum, float& m
     }
     avLum =exp( avLum/ size);
 }
+
+//! \brief range of the input luminance and of the tonemapped values
+struct Ashikhmin02Globals : public TmoGlobals
+{
+    float m_maxLum;
+    float m_minLum;
+    float m_avLum;
+    float m_maxL;
+    float m_minL;
+};
+
+//! \brief range used to normalize the tonemapped values: it always includes 0
+void outputRange(const pfs::Array2Df& L, float& minL, float& maxL)
+{
+    minL = maxL = 0.0f;
+    for ( size_t i=0 ; i<L.size() ; i++ )
+    {
+        maxL = ( L(i) > maxL ) ? L(i) : maxL;
+        minL = ( L(i) < minL ) ? L(i) : minL;
+    }
+}
+
+//! \brief tonemapped values, normalized to [0, 1]
+struct NormalizedTone
+{
+    NormalizedTone(const pfs::Array2Df& L, float minL, float maxL)
+        : m_L(L)
+        , m_minL(minL)
+        , m_scale(1.f/(maxL - minL))
+    {}
+
+    void operator()(size_t i, float, float& L, float& s) const
+    {
+        L = (m_L(i) - m_minL)*m_scale;
+        s = 1.f;
+    }
+
+    const pfs::Array2Df& m_L;
+    float m_minL;
+    float m_scale;
+};
 }
 
 void pfstmo_ashikhmin02(pfs::Frame& frame, bool simple_flag, float lc_value, int eq, pfs::Progress &ph)
+{
+    TmoGlobalsPtr globals;
+    pfstmo_ashikhmin02(frame, simple_flag, lc_value, eq, globals, ph);
+}
+
+void pfstmo_ashikhmin02(pfs::Frame& frame, bool simple_flag, float lc_value, int eq, TmoGlobalsPtr& globals, pfs::Progress &ph)
 {
 #ifndef NDEBUG
     //--- default tone mapping parameters;
@@ -68,44 +117,56 @@ void pfstmo_ashikhmin02(pfs::Frame& frame, bool simple_flag, float lc_value, int
     std::cout << ", eq: " << eq << ")" << std::endl;
 #endif
 
-    pfs::Channel *Xr, *Yr, *Zr;
-    frame.getXYZChannels(Xr, Yr, Zr);
-    assert( Xr != NULL );
-    assert( Yr != NULL );
-    assert( Zr != NULL );
-    if ( !Xr || !Yr || !Zr )
+    pfs::Channel *R, *G, *B;
+    frame.getXYZChannels(R, G, B);
+    assert( R != NULL );
+    assert( G != NULL );
+    assert( B != NULL );
+    if ( !R || !G || !B )
     {
         throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
     }
-    
 
-    pfs::transformColorSpace( pfs::CS_RGB, Xr, Yr, Zr, pfs::CS_XYZ, Xr, Yr, Zr );
-    float maxLum, avLum, minLum;
-    calculateLuminance(Yr, avLum, maxLum, minLum);
+    int w = R->getCols();
+    int h = R->getRows();
 
-    int w = Yr->getCols();
-    int h = Yr->getRows();
+    // the operator only needs the luminance: the colour is restored from the
+    // RGB ratios, no conversion of the frame to XYZ and back
+    pfs::Array2Df Y(w,h);
+    pfs::transformRGB2Y(R, G, B, &Y);
+
+    Ashikhmin02Globals* stats = dynamic_cast<Ashikhmin02Globals*>(globals.get());
+    std::shared_ptr<Ashikhmin02Globals> new_stats;
+    if ( stats == NULL )
+    {
+        new_stats.reset(new Ashikhmin02Globals);
+        stats = new_stats.get();
+        calculateLuminance(&Y, stats->m_avLum, stats->m_maxLum, stats->m_minLum);
+    }
 
     pfs::Array2Df L(w,h);
-    tmo_ashikhmin02(Yr, &L, maxLum, minLum, avLum, simple_flag, lc_value, eq, ph);
+    tmo_ashikhmin02(&Y, &L, stats->m_maxLum, stats->m_minLum, stats->m_avLum,
+                    simple_flag, lc_value, eq, ph);
 
-    // TODO: this section can be rewritten using SSE Function
-    for ( int x=0 ; x<w ; x++ )
+    if ( new_stats )
     {
-        for ( int y=0 ; y<h ; y++ )
+        outputRange(L, new_stats->m_minL, new_stats->m_maxL);
+        if ( !ph.canceled() )
         {
-            float scale = L(x,y) / (*Yr)(x,y);
-            (*Yr)(x,y) = (*Yr)(x,y) * scale;
-            (*Xr)(x,y) = (*Xr)(x,y) * scale;
-            (*Zr)(x,y) = (*Zr)(x,y) * scale;
+            globals = new_stats;
         }
     }
 
+    pfs::colorspace::restoreColor(
+                pfs::CS_RGB, *R, *G, *B,
+                pfs::colorspace::LuminanceArray(Y),
+                NormalizedTone(L, stats->m_minL, stats->m_maxL),
+                pfs::colorspace::TransferLinear(),
+                pfs::CS_RGB, *R, *G, *B);
+
     if (!ph.canceled())
     {
         ph.setValue( 100 );
     }
-
-    pfs::transformColorSpace(pfs::CS_XYZ, Xr, Yr, Zr, pfs::CS_RGB, Xr, Yr, Zr);
 }
 
@@ -53,8 +53,9 @@ class Pyramid { // each level of a Gaussian pyramid
   pfs::Array2Df* GP;
   int flag;
 
-  inline double getPixel(int x, int y) {
-    return (*GP)(x,y);
+  inline double getPixel(int x, int y) const {
+    // read only: the const accessor does not mark the level as modified
+    return static_cast<const pfs::Array2Df&>(*GP)(x,y);
   }
 
   inline void setPixel(int x, int y, double val) {
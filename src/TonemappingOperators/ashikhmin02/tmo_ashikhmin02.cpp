@@ -140,26 +140,6 @@ inline float TM(float lum_val, float maxLum, float minLum) {
 
 ////////////////////////////////////////////////////////
 
-void getMaxMin(pfs::Array2Df* lum_map, float& maxLum, float& minLum) {
-  maxLum = minLum = 0.0;
-
-  for(unsigned int i=0; i<lum_map->getCols() * lum_map->getRows(); i++) {
-    maxLum = ((*lum_map)(i) > maxLum) ? (*lum_map)(i) : maxLum;
-    minLum = ((*lum_map)(i) < minLum) ? (*lum_map)(i) : minLum;
-  }
-}
-
-void Normalize(pfs::Array2Df* lum_map, int nrows, int ncols) {
-  float maxLum, minLum;
-  getMaxMin(lum_map, maxLum, minLum);
-  float range = maxLum - minLum;
-  for(int y=0; y<nrows; y++)
-    for(int x=0; x<ncols; x++)
-      (*lum_map)(x,y) = ((*lum_map)(x,y)-minLum) / range;
-}
-
-////////////////////////////////////////////////////////
-
 int tmo_ashikhmin02(pfs::Array2Df* Y, pfs::Array2Df* L, float maxLum, float minLum, float /*avLum*/, bool simple_flag, float lc_value, int eq, pfs::Progress &ph)
 {
   assert(Y!=NULL);
@@ -184,7 +164,6 @@ int tmo_ashikhmin02(pfs::Array2Df* Y, pfs::Array2Df* L, float maxLum, float minL
         // to keep output values in range 0.01 - 1
 	//        (*L)(x,y) /= 100.0f;
       }
-    Normalize(L, nrows, ncols);
     
     return 0;
   }
@@ -244,8 +223,6 @@ int tmo_ashikhmin02(pfs::Array2Df* Y, pfs::Array2Df* L, float maxLum, float minL
       //(*L)(x,y) /= 100.0f;
     }
   }
-  Normalize(L, nrows, ncols);
-
   // cleaning
   delete(la);
   delete(tm);
@@ -46,6 +46,7 @@ class Progress;
 //! \param simple_flag true: use only tone mapping function (global version of the operator)
 //! \param lc_value local contrast threshold
 //! \param eq chose equation number from the paper (ie equation 2. or 4. )
+//! \note \a L is not normalized: its range depends on the whole frame
 //!
 int tmo_ashikhmin02(pfs::Array2Df* Y, pfs::Array2Df* L, float maxLum, float minLum, float avLum, bool simple_flag, float lc_value, int eq, pfs::Progress &ph);
 
@@ -30,16 +30,36 @@
  */
 
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
-
-#include <boost/math/special_functions/fpclassify.hpp>
+#include <sstream>
 
 #include "Libpfs/frame.h"
 #include "Libpfs/progress.h"
 #include "Libpfs/exception.h"
+#include "Libpfs/utils/statistics.h"
+#include "TonemappingOperators/tonecurve_lut.h"
 #include "tmo_drago03.h"
 
+namespace
+{
+//! \brief ratio between the tone mapped and the input luminance
+struct ToneCurveScale
+{
+    explicit ToneCurveScale(const Drago03Curve& curve)
+        : m_curve(curve)
+    {}
+
+    float operator()(float Y) const
+    {
+        return m_curve(Y)/Y;
+    }
+
+    Drago03Curve m_curve;
+};
+}
+
 void pfstmo_drago03(pfs::Frame& frame, float opt_biasValue, pfs::Progress &ph)
 {
 #ifndef NDEBUG
@@ -72,31 +92,12 @@ void pfstmo_drago03(pfs::Frame& frame, float opt_biasValue, pfs::Progress &ph)
     float avLum;
     calculateLuminance(w, h, Yr.data(), avLum, maxLum);
 
-    pfs::Array2Df L(w, h);
-    tmo_drago03(Yr, L, maxLum, avLum, opt_biasValue, ph);
-
-    for (int x=0 ; x<w ; x++)
-    {
-        for (int y=0 ; y<h ; y++)
-        {
-            float yr = Yr(x,y);
-            float scale = 0.f;
-            if (yr != 0.f)
-            {
-                scale = L(x,y)/yr;
-            }
-
-            assert(!boost::math::isnan(scale));
-
-            Yr(x,y) = Yr(x,y) * scale;
-            Xr(x,y) = Xr(x,y) * scale;
-            Zr(x,y) = Zr(x,y) * scale;
-        }
-    }
-
-    if (!ph.canceled())
-    {
-        ph.setValue( 100 );
-    }
+    // the curve is a function of the luminance only: compile it once and
+    // scale the colour channels by its ratio to the input luminance
+    const float minLum = Y->getStatistics().minPositive;
+    ToneCurveLut scale;
+    scale.compile(std::min(minLum, maxLum), maxLum,
+                  ToneCurveScale(Drago03Curve(maxLum, avLum, opt_biasValue)));
+    // reports the progress up to 100 and finishes it
+    applyToneCurveScale(scale, Yr.data(), Xr.data(), Yr.data(), Zr.data(), w*h, ph);
 }
-
@@ -32,13 +32,6 @@
 #include "tmo_drago03.h"
 
 #include <cmath>
-#include <cassert>
-
-#include <boost/math/special_functions/fpclassify.hpp>
-
-#include "Libpfs/frame.h"
-#include "Libpfs/progress.h"
-#include "TonemappingOperators/pfstmo.h"
 
 namespace
 {
@@ -67,35 +60,18 @@ void calculateLuminance(unsigned int width, unsigned int height,
 }
 
 
-void tmo_drago03(const pfs::Array2Df& Y, pfs::Array2Df& L,
-                 float maxLum, float avLum, float bias, 
-                 pfs::Progress &ph)
-{
-    assert(Y.getRows() == L.getRows());
-    assert(Y.getCols() == L.getCols());
-
+Drago03Curve::Drago03Curve(float maxLum, float avLum, float bias)
+    : m_avLum(avLum)
     // normalize maximum luminance by average luminance
-    maxLum /= avLum;
-
-    float divider = std::log10(maxLum + 1.0f);
-    float biasP = log(bias)/LOG05;
+    , m_maxLum(maxLum/avLum)
+    , m_divider(std::log10(m_maxLum + 1.0f))
+    , m_biasP(log(bias)/LOG05)
+{}
 
-    // Normal tone mapping of every pixel
-    for (int y=0, yEnd = Y.getRows(); y < yEnd; y++)
-    {
-        ph.setValue(100*y/yEnd);
-        if (ph.canceled())
-            break;
-
-        for (int x=0, xEnd = Y.getCols(); x < xEnd; x++)
-        {
-            float Yw = Y(x,y) / avLum;
-            float interpol = std::log (2.0f + biasFunc(biasP, Yw / maxLum) * 8.0f);
-            //L(x,y) = ( std::log(Yw+1.0f)/interpol ) / divider;
-            L(x,y) = ( std::log1p(Yw)/interpol ) / divider; // avoid loss of precision
-
-            assert(!boost::math::isnan(L(x,y)));
-        }
-    }
+float Drago03Curve::operator()(float Y) const
+{
+    float Yw = Y / m_avLum;
+    float interpol = std::log (2.0f + biasFunc(m_biasP, Yw / m_maxLum) * 8.0f);
+    //return ( std::log(Yw+1.0f)/interpol ) / m_divider;
+    return ( std::log1p(Yw)/interpol ) / m_divider; // avoid loss of precision
 }
-
@@ -28,28 +28,24 @@
 #ifndef TMO_DRAGO03_H
 #define TMO_DRAGO03_H
 
-#include <Libpfs/array2d_fwd.h>
-
-namespace pfs
-{
-class Progress;
-}
-
-//! \brief Frederic Drago Logmapping Algorithm
+//! \brief Tone curve of the Drago operator: tone mapped value of the
+//! luminance \a Y, for the statistics of the image.
 //!
 //! Original implementation obtained from source code provided
 //! by Frederic Drago on 16 May 2003 (pfstmo)
-//!
-//! \param width image width
-//! \param height image height
-//! \param Y [in] image luminance values
-//! \param L [out] tone mapped values
-//! \param maxLum maximum luminance in the image
-//! \param avLum logarithmic average of luminance in the image
-//! \param bias bias parameter of tone mapping algorithm (eg 0.85)
-//!
-void tmo_drago03(const pfs::Array2Df& Y, pfs::Array2Df& L,
-                 float maxLum, float avLum, float bias, pfs::Progress &ph);
+class Drago03Curve
+{
+public:
+    Drago03Curve(float maxLum, float avLum, float bias);
+
+    float operator()(float Y) const;
+
+private:
+    float m_avLum;
+    float m_maxLum;
+    float m_divider;
+    float m_biasP;
+};
 
 //! \brief Find average and maximum luminance in an image
 //!
@@ -31,9 +31,11 @@
 #include <cmath>
 
 #include <fftw3.h>
+#include <boost/thread/mutex.hpp>
 
 #include "Libpfs/array2d.h"
 #include "Libpfs/progress.h"
+#include "TonemappingOperators/fftw_planner.h"
 #include "fastbilateral.h"
 
 #ifdef BRANCH_PREDICTION
@@ -67,6 +69,7 @@ public:
     freq = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * osize);
 //    if( source == NULL || freq == NULL )
     //TODO: throw exception
+    boost::mutex::scoped_lock lock(fftwPlannerMutex());
     fplan_fw = fftwf_plan_dft_r2c_2d(nx, ny, source, freq, FFTW_ESTIMATE);
     fplan_in = fftwf_plan_dft_c2r_2d(nx, ny, freq, source, FFTW_ESTIMATE);    
   }
@@ -115,6 +118,7 @@ public:
   {
     fftwf_free(source); 
     fftwf_free(freq);
+    boost::mutex::scoped_lock lock(fftwPlannerMutex());
     fftwf_destroy_plan(fplan_fw);
     fftwf_destroy_plan(fplan_in);
   }
@@ -38,17 +38,34 @@
 #include "Libpfs/colorspace/colorspace.h"
 #include "Libpfs/exception.h"
 #include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
+#include "TonemappingOperators/pfstmo.h"
 #include "tmo_durand02.h"
 
-namespace pfs
-{
-class Progress;
-}
-
 namespace
 {
-const int downsample = 1;
 const bool original_algorithm = false;
+
+//! \brief bilateral filtered log intensity: depends on sigma_s and sigma_r
+struct Durand02Analysis : public TmoAnalysis
+{
+    Durand02Analysis(size_t cols, size_t rows)
+        : m_base(cols, rows)
+        , m_minB(0.f)
+        , m_maxB(0.f)
+    {}
+
+    pfs::Array2Df m_base;
+    float m_minB;
+    float m_maxB;
+};
+
+//! \brief robust range of the base layer of the whole frame
+struct Durand02Globals : public TmoGlobals
+{
+    float m_minB;
+    float m_maxB;
+};
 }
 
 //--- default tone mapping parameters;
@@ -63,6 +80,24 @@ const bool original_algorithm = false;
 void pfstmo_durand02(pfs::Frame& frame,
                      float sigma_s, float sigma_r, float baseContrast,
                      pfs::Progress &ph)
+{
+    TmoAnalysisPtr analysis;
+    pfstmo_durand02(frame, sigma_s, sigma_r, baseContrast, analysis, ph);
+}
+
+void pfstmo_durand02(pfs::Frame& frame,
+                     float sigma_s, float sigma_r, float baseContrast,
+                     TmoAnalysisPtr& analysis,
+                     pfs::Progress &ph)
+{
+    TmoGlobalsPtr globals;
+    pfstmo_durand02(frame, sigma_s, sigma_r, baseContrast, analysis, globals, ph);
+}
+
+void pfstmo_durand02(pfs::Frame& frame,
+                     float sigma_s, float sigma_r, float baseContrast,
+                     TmoAnalysisPtr& analysis, TmoGlobalsPtr& globals,
+                     pfs::Progress &ph)
 { 
 #ifndef NDEBUG
     std::stringstream ss;
@@ -91,8 +126,39 @@ void pfstmo_durand02(pfs::Frame& frame,
     throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
   }
   
-  tmo_durand02(*X, *Y, *Z,
-               sigma_s, sigma_r, baseContrast, downsample, !original_algorithm,
-               ph);
+  Durand02Analysis* base = dynamic_cast<Durand02Analysis*>(analysis.get());
+  if ( base == NULL )
+  {
+    std::shared_ptr<Durand02Analysis> new_base(
+          new Durand02Analysis(frame.getWidth(), frame.getHeight()));
+
+    tmo_durand02_base(*X, *Y, *Z, sigma_s, sigma_r,
+                      new_base->m_base, new_base->m_minB, new_base->m_maxB,
+                      ph);
+    if ( ph.canceled() )
+    {
+      return;
+    }
+
+    analysis = new_base;
+    base = new_base.get();
+  }
+
+  Durand02Globals* range = dynamic_cast<Durand02Globals*>(globals.get());
+  if ( range == NULL )
+  {
+    std::shared_ptr<Durand02Globals> new_range(new Durand02Globals);
+    new_range->m_minB = base->m_minB;
+    new_range->m_maxB = base->m_maxB;
+
+    globals = new_range;
+    range = new_range.get();
+  }
+
+  tmo_durand02_apply(*X, *Y, *Z,
+                     base->m_base, range->m_minB, range->m_maxB,
+                     baseContrast, !original_algorithm);
+
+  ph.setValue( 100 );
 }
 
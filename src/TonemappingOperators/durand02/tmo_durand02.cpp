@@ -39,7 +39,10 @@
 
 #include "Libpfs/array2d.h"
 #include "Libpfs/progress.h"
+#include "Libpfs/colorspace/restorecolor.h"
+#include "Libpfs/utils/statistics.h"
 #include "TonemappingOperators/pfstmo.h"
+#include "tmo_durand02.h"
 
 //#undef HAVE_FFTW3F
 
@@ -69,10 +72,15 @@ void findMaxMinPercentile(pfs::Array2Df* I,
             vI.push_back((*I)(i));
     }
 
-    std::sort(vI.begin(), vI.end());
+    std::vector<float> p(2);
+    p[0] = minPrct;
+    p[1] = maxPrct;
 
-    minLum = vI.at( int(minPrct*vI.size()) );
-    maxLum = vI.at( int(maxPrct*vI.size()) );
+    std::vector<float> q;
+    pfs::utils::quantiles(vI.data(), vI.size(), p, q);
+
+    minLum = q[0];
+    maxLum = q[1];
 }
 
 template <typename T>
@@ -85,6 +93,110 @@ T decode(const T& value)
     }
     return (1.055f * std::pow( value, 1.f/2.4f ) - 0.055f);
 }
+
+inline
+float intensity(float r, float g, float b)
+{
+    return 1.0f/61.0f * ( 20.0f*r + 40.0f*g + b );
+}
+
+inline
+float intensity(const pfs::Array2Df& R, const pfs::Array2Df& G, const pfs::Array2Df& B,
+                int i)
+{
+    return intensity(R(i), G(i), B(i));
+}
+
+//! \brief intensity of pixel \a i, clamped to \a min_pos to avoid log(0)
+inline
+float intensity(const pfs::Array2Df& R, const pfs::Array2Df& G, const pfs::Array2Df& B,
+                int i, float min_pos)
+{
+    float L = intensity(R, G, B, i);
+    if ( L <= 0.0f )
+    {
+        L = min_pos;
+    }
+    return L;
+}
+
+//! \brief minimum positive intensity
+float minPositiveIntensity(const pfs::Array2Df& R, const pfs::Array2Df& G,
+                           const pfs::Array2Df& B)
+{
+    const int size = R.getCols()*R.getRows();
+
+    float min_pos = 1e10f;
+    for (int i = 0 ; i < size ; i++)
+    {
+        const float L = intensity(R, G, B, i);
+        if ( L < min_pos && L > 0.0f )
+        {
+            min_pos = L;
+        }
+    }
+    return min_pos;
+}
+
+//! \brief intensity of a pixel, clamped to \a min_pos
+struct Intensity
+{
+    explicit Intensity(float min_pos)
+        : m_minPos(min_pos)
+    {}
+
+    float operator()(size_t, float r, float g, float b) const
+    {
+        const float L = intensity(r, g, b);
+        return ( L <= 0.0f ) ? m_minPos : L;
+    }
+
+    float m_minPos;
+};
+
+//! \brief output intensity: compressed base layer plus the detail layer
+struct OutputIntensity
+{
+    OutputIntensity(const pfs::Array2Df& BASE, float compressionfactor,
+                    float minB, float saturation, bool decodeIntensity)
+        : m_BASE(BASE)
+        , m_compressionfactor(compressionfactor)
+        , m_minB(minB)
+        , m_saturation(saturation)
+        , m_decode(decodeIntensity)
+    {}
+
+    void operator()(size_t i, float L, float& out, float& s) const
+    {
+        float I = std::log( L );
+        float DETAIL = I - m_BASE(i);
+        I = m_BASE(i) * m_compressionfactor + DETAIL;
+
+        //!! FIX: this to keep the output in normalized range 0.01 - 1.0
+        //intensitites are related only to minimum luminance because I
+        //would say this is more stable over time than using maximum
+        //luminance and is also robust against random peaks of very high
+        //luminance
+        I -=  4.3f+m_minB*m_compressionfactor;
+
+        out = m_decode ? decode( std::exp( I ) ) : std::exp( I );
+        s = m_saturation;
+    }
+
+    const pfs::Array2Df& m_BASE;
+    float m_compressionfactor;
+    float m_minB;
+    float m_saturation;
+    bool m_decode;
+};
+
+struct Decode
+{
+    float operator()(float value) const
+    {
+        return decode(value);
+    }
+};
 }
 
 /*
@@ -105,54 +217,54 @@ R output = r*exp(log(output intensity)), etc.
 */
 
 void tmo_durand02(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
-                  float sigma_s, float sigma_r, float baseContrast, int downsample,
+                  float sigma_s, float sigma_r, float baseContrast, int /*downsample*/,
                   bool color_correction,
                   pfs::Progress &ph)
+{
+    pfs::Array2Df BASE(R.getCols(), R.getRows()); // base layer
+    float maxB;
+    float minB;
+
+    tmo_durand02_base(R, G, B, sigma_s, sigma_r, BASE, minB, maxB, ph);
+    tmo_durand02_apply(R, G, B, BASE, minB, maxB, baseContrast, color_correction);
+
+    if (!ph.canceled())
+    {
+        ph.setValue( 100 );
+    }
+}
+
+void tmo_durand02_base(const pfs::Array2Df& R, const pfs::Array2Df& G, const pfs::Array2Df& B,
+                       float sigma_s, float sigma_r,
+                       pfs::Array2Df& BASE, float& minB, float& maxB,
+                       pfs::Progress &ph)
 {
     int w = R.getCols();
     int h = R.getRows();
     int size = w*h;
 
     pfs::Array2Df I(w,h); // intensities
-    pfs::Array2Df BASE(w,h); // base layer
-    pfs::Array2Df DETAIL(w,h); // detail layer
 
-    float min_pos = 1e10f; // minimum positive value (to avoid log(0))
+    const float min_pos = minPositiveIntensity(R, G, B);
     for (int i = 0 ; i < size ; i++)
     {
-        I(i) = 1.0f/61.0f * ( 20.0f*R(i) + 40.0f*G(i) + B(i) );
-        if ( I(i) < min_pos && I(i) > 0.0f )
-        {
-            min_pos = I(i);
-        }
-    }
-
-    for (int i = 0 ; i < size ; i++)
-    {
-        float L = I(i);
-        if ( L <= 0.0f )
-        {
-            L = min_pos;
-        }
-
-        R(i) /= L;
-        G(i) /= L;
-        B(i) /= L;
-
-        I(i) = std::log( L );
+        I(i) = std::log( intensity(R, G, B, i, min_pos) );
     }
 
 #ifdef HAVE_FFTW3F
-    fastBilateralFilter( I, BASE, sigma_s, sigma_r, downsample, ph );
+    fastBilateralFilter( I, BASE, sigma_s, sigma_r, 1, ph );
 #else
     bilateralFilter( &I, &BASE, sigma_s, sigma_r, ph );
 #endif
 
     //!! FIX: find minimum and maximum luminance, but skip 1% of outliers
-    float maxB;
-    float minB;
     findMaxMinPercentile(&BASE, 0.01f, 0.99f, minB, maxB);
+}
 
+void tmo_durand02_apply(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                        const pfs::Array2Df& BASE, float minB, float maxB,
+                        float baseContrast, bool color_correction)
+{
     float compressionfactor = baseContrast / (maxB - minB);
 
     // Color correction factor
@@ -160,35 +272,22 @@ void tmo_durand02(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
     const float k2 = 0.82f;
     const float s = ( (1 + k1)*pow(compressionfactor,k2) )/( 1 + k1*pow(compressionfactor,k2) );
 
-    for (int i = 0 ; i < size ; i++)
-    {
-        DETAIL(i) = I(i) - BASE(i);
-        I(i) = BASE(i) * compressionfactor + DETAIL(i);
-
-        //!! FIX: this to keep the output in normalized range 0.01 - 1.0
-        //intensitites are related only to minimum luminance because I
-        //would say this is more stable over time than using maximum
-        //luminance and is also robust against random peaks of very high
-        //luminance
-        I(i) -=  4.3f+minB*compressionfactor;
+    const float min_pos = minPositiveIntensity(R, G, B);
 
-        if ( color_correction )
-        {
-            R(i) = decode( std::pow( R(i), s ) *  std::exp( I(i) ) );
-            G(i) = decode( std::pow( G(i), s ) *  std::exp( I(i) ) );
-            B(i) = decode( std::pow( B(i), s ) *  std::exp( I(i) ) );
-        }
-        else
-        {
-            R(i) *= decode( std::exp( I(i) ) );
-            G(i) *= decode( std::exp( I(i) ) );
-            B(i) *= decode( std::exp( I(i) ) );
-        }
+    if ( color_correction )
+    {
+        pfs::colorspace::restoreColor(pfs::CS_RGB, R, G, B,
+                                      Intensity(min_pos),
+                                      OutputIntensity(BASE, compressionfactor, minB, s, false),
+                                      Decode(),
+                                      pfs::CS_RGB, R, G, B);
     }
-
-    if (!ph.canceled())
+    else
     {
-        ph.setValue( 100 );
+        pfs::colorspace::restoreColor(pfs::CS_RGB, R, G, B,
+                                      Intensity(min_pos),
+                                      OutputIntensity(BASE, compressionfactor, minB, 1.f, true),
+                                      pfs::colorspace::TransferLinear(),
+                                      pfs::CS_RGB, R, G, B);
     }
 }
-
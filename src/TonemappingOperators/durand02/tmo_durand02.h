@@ -54,12 +54,33 @@ class Progress;
 //! \param sigma_r sigma for range kernel
 //! \param baseContrast contrast of the base layer
 //! \param color_correction enable automatic color correction
-//! \param downsample down sampling factor for speeding up fast-bilateral (1..20)
+//! \param downsample down sampling factor for speeding up fast-bilateral
+//! (1..20), currently ignored: the base layer is always computed at full size
 //!
 void tmo_durand02(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
                   float sigma_s, float sigma_r, float baseContrast, int downsample,
                   bool color_correction /*= true*/,
                   pfs::Progress &ph);
 
+//!
+//! \brief Analysis stage of tmo_durand02: bilateral filtering of the log
+//! intensity. Depends only on the input and on \a sigma_s, \a sigma_r
+//!
+//! \param BASE base layer, must have the same size of the input channels
+//! \param minB robust minimum of the base layer
+//! \param maxB robust maximum of the base layer
+//!
+void tmo_durand02_base(const pfs::Array2Df& R, const pfs::Array2Df& G, const pfs::Array2Df& B,
+                       float sigma_s, float sigma_r,
+                       pfs::Array2Df& BASE, float& minB, float& maxB,
+                       pfs::Progress &ph);
+
+//!
+//! \brief Synthesis stage of tmo_durand02: compresses the base layer
+//! computed by tmo_durand02_base() on the same input and restores colors
+//!
+void tmo_durand02_apply(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                        const pfs::Array2Df& BASE, float minB, float maxB,
+                        float baseContrast, bool color_correction);
 
 #endif // TMO_DURAND02_H
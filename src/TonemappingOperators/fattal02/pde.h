@@ -32,6 +32,8 @@
 #ifndef FMG_PDE_H
 #define FMG_PDE_H
 
+#include <vector>
+
 #include <Libpfs/array2d_fwd.h>
 
 namespace pfs
@@ -39,13 +41,22 @@ namespace pfs
 class Progress;
 }
 
+// fftwf_plan, without including fftw3.h
+struct fftwf_plan_s;
+
 /**
  * @brief solve pde using full multrigrid algorithm
  *
+ * V-cycles of red-black Gauss-Seidel, in parallel, stopping as soon as the
+ * defect is small enough.
+ *
  * @param F array with divergence
  * @param U [out] sollution
+ * @param full_multigrid start from the solution on the coarsest grid; if
+ * false, U is the initial guess and only the finest grid is iterated on
  */
-void solve_pde_multigrid(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph);
+void solve_pde_multigrid(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph,
+                         bool full_multigrid = true);
 
 /**
  * @brief solve poisson pde (Laplace U = F) using discrete cosine transform
@@ -57,6 +68,58 @@ void solve_pde_multigrid(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph);
 void solve_pde_fft(pfs::Array2Df *F, pfs::Array2Df *U,
                    pfs::Progress &ph, bool adjust_bound = false);
 
+/**
+ * @brief Poisson pde solver (Laplace U = F) using the discrete cosine
+ * transform
+ *
+ * The transforms are planned once for the size of the image, in place on a
+ * buffer owned by the solver: several right hand sides of the same size are
+ * solved at the cost of the transforms only. One object must not be used by
+ * several threads at the same time.
+ */
+class PoissonSolverDct
+{
+public:
+    enum Boundary
+    {
+        //! reflective borders, as in solve_pde_fft(): the solution is
+        //! defined up to a constant, it is shifted so that its maximum is 0
+        BOUNDARY_NEUMANN,
+        //! reflective left and right borders, zero above and below the
+        //! image, as in solve_pde_dct()
+        BOUNDARY_NEUMANN_DIRICHLET
+    };
+
+    /**
+     * @param width, height size of the image, at least 2x2
+     */
+    PoissonSolverDct(int width, int height,
+                     Boundary boundary = BOUNDARY_NEUMANN);
+    ~PoissonSolverDct();
+
+    /**
+     * @param F right hand side
+     * @param U [out] solution, it can be F
+     */
+    void solve(const pfs::Array2Df& F, pfs::Array2Df& U);
+
+private:
+    PoissonSolverDct(const PoissonSolverDct&);
+    PoissonSolverDct& operator=(const PoissonSolverDct&);
+
+    void solveNeumann(pfs::Array2Df& U);
+    void solveNeumannDirichlet(pfs::Array2Df& U);
+
+    int m_width;
+    int m_height;
+    Boundary m_boundary;
+    float* m_buffer;
+    // REDFT00 is its own inverse, up to a factor: one plan does both ways
+    fftwf_plan_s* m_plan;
+    std::vector<double> m_lambdaX;
+    std::vector<double> m_lambdaY;
+};
+
 /**
  * @brief returns the residual error of the solution U, ie norm(Laplace U - F) 
  *
@@ -60,8 +60,7 @@
 //        i=0: U(1) - 2(0) + U(1) = -2 U(0) + 2 U(1)
 //
 // The multi grid solver solve_pde_multigrid() solves the 2d Poisson pde
-// with the right Neumann boundary conditions, U(-1)=U(0), see function
-// atimes(). This means the assembly of the right hand side F is different
+// with the right Neumann boundary conditions, U(-1)=U(0). This means the assembly of the right hand side F is different
 // for both solvers.
 
 #include <iostream>
@@ -76,10 +75,14 @@
 #include <omp.h>
 #endif
 #include <vector>
+#include <algorithm>
+#include <new>
 #include <fftw3.h>
+#include <boost/thread/mutex.hpp>
 
 #include "Libpfs/progress.h"
 #include "Libpfs/array2d.h"
+#include "TonemappingOperators/fftw_planner.h"
 #include "pde.h"
 
 using namespace std;
@@ -90,78 +93,10 @@ using namespace std;
 #endif
 
 
-// returns T = EVy A EVx^tr
-// note, modifies input data
-void transform_ev2normal(pfs::Array2Df *A, pfs::Array2Df *T)
+namespace
 {
-  int width = A->getCols();
-  int height = A->getRows();
-  assert((int)T->getCols()==width && (int)T->getRows()==height);
-
-  // the discrete cosine transform is not exactly the transform needed
-  // need to scale input values to get the right transformation
-  for(int y=1 ; y<height-1 ; y++ )
-    for(int x=1 ; x<width-1 ; x++ )
-      (*A)(x,y)*=0.25f;
-
-  for(int x=1 ; x<width-1 ; x++ )
-  {
-    (*A)(x,0)*=0.5f;
-    (*A)(x,height-1)*=0.5f;
-  }
-  for(int y=1 ; y<height-1 ; y++ )
-  {
-    (*A)(0,y)*=0.5;
-    (*A)(width-1,y)*=0.5f;
-  }
-
-  // note, fftw provides its own memory allocation routines which
-  // ensure that memory is properly 16/32 byte aligned so it can
-  // use SSE/AVX operations (2/4 double ops in parallel), if our
-  // data is not properly aligned fftw won't use SSE/AVX
-  // (I believe new() aligns memory to 16 byte so avoid overhead here)
-  //
-  // double* in = (double*) fftwf_malloc(sizeof(double) * width*height);
-  // fftwf_free(in);
-
-  // executes 2d discrete cosine transform
-  fftwf_plan p;
-  p=fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                        FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-  fftwf_execute(p); 
-  fftwf_destroy_plan(p);
-}
-
-
-// returns T = EVy^-1 * A * (EVx^-1)^tr
-void transform_normal2ev(pfs::Array2Df *A, pfs::Array2Df *T)
-{
-  int width = A->getCols();
-  int height = A->getRows();
-  assert((int)T->getCols()==width && (int)T->getRows()==height);
-
-  // executes 2d discrete cosine transform
-  fftwf_plan p;
-  p=fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                        FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-  fftwf_execute(p); 
-  fftwf_destroy_plan(p);
-
-  // need to scale the output matrix to get the right transform
-  for(int y=0 ; y<height ; y++ )
-    for(int x=0 ; x<width ; x++ )
-      (*T)(x,y)*=(1.0f/((height-1)*(width-1)));
-
-  for(int x=0 ; x<width ; x++ )
-  {
-    (*T)(x,0)*=0.5f;
-    (*T)(x,height-1)*=0.5f;
-  }
-  for(int y=0 ; y<height ; y++ )
-  {
-    (*T)(0,y)*=0.5f;
-    (*T)(width-1,y)*=0.5f;
-  }
+// columns of a block of the tridiagonal solver
+const int BLOCK = 16;
 }
 
 // returns the eigenvalues of the 1d laplace operator
@@ -214,21 +149,23 @@ void make_compatible_boundary(pfs::Array2Df *F)
 }
 
 
-
-// solves Laplace U = F with Neumann boundary conditions
-// if adjust_bound is true then boundary values in F are modified so that
-// the equation has a solution, if adjust_bound is set to false then F is
-// not modified and the equation might not have a solution but an
-// approximate solution with a minimum error is then calculated
-// double precision version
-void solve_pde_fft(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph,
-                   bool adjust_bound)
+PoissonSolverDct::PoissonSolverDct(int width, int height, Boundary boundary)
+    : m_width(width)
+    , m_height(height)
+    , m_boundary(boundary)
+    , m_buffer(NULL)
+    , m_plan(NULL)
+    , m_lambdaX(get_lambda(width))
+    , m_lambdaY(get_lambda(height))
 {
-   ph.setValue(20);
-  //DEBUG_STR << "solve_pde_fft: solving Laplace U = F ..." << std::endl;
-  int width = F->getCols();
-  int height = F->getRows();
-  assert((int)U->getCols()==width && (int)U->getRows()==height);
+  // note, fftw provides its own memory allocation routines which
+  // ensure that memory is properly 16/32 byte aligned so it can
+  // use SSE/AVX operations
+  m_buffer = static_cast<float*>(fftwf_malloc(sizeof(float)*width*height));
+  if ( m_buffer == NULL )
+    throw std::bad_alloc();
+
+  boost::mutex::scoped_lock lock(fftwPlannerMutex());
 
   // activate parallel execution of fft routines
   fftwf_init_threads();
@@ -238,74 +175,190 @@ void solve_pde_fft(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph,
   fftwf_plan_with_nthreads( 2 );
 #endif
 
-  // in general there might not be a solution to the Poisson pde
-  // with Neumann boundary conditions unless the boundary satisfies
-  // an integral condition, this function modifies the boundary so that
-  // the condition is exactly satisfied
-  if(adjust_bound)
+  if ( boundary == BOUNDARY_NEUMANN )
   {
-    //DEBUG_STR << "solve_pde_fft: checking boundary conditions" << std::endl;
-    make_compatible_boundary(F);
+    // 2d discrete cosine transform, in place
+    m_plan = fftwf_plan_r2r_2d(height, width, m_buffer, m_buffer,
+                               FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
   }
-
-  // transforms F into eigenvector space: Ftr = 
-  //DEBUG_STR << "solve_pde_fft: transform F to ev space (fft)" << std::endl;
-  pfs::Array2Df* F_tr = new pfs::Array2Df(width,height);
-  transform_normal2ev(F, F_tr);
-  // TODO: F no longer needed so could release memory, but as it is an
-  // input parameter we won't do that
-  ph.setValue(50);
-  if (ph.canceled())
+  else
   {
-    delete F_tr;
-    return;
+    // 1d discrete cosine transform of every row, in place
+    const fftwf_r2r_kind kind = FFTW_REDFT00;
+    m_plan = fftwf_plan_many_r2r(1, &width, height,
+                                 m_buffer, NULL, 1, width,
+                                 m_buffer, NULL, 1, width,
+                                 &kind, FFTW_ESTIMATE);
   }
-  
-  //DEBUG_STR << "solve_pde_fft: F_tr(0,0) = " << (*F_tr)(0,0);
-  //DEBUG_STR << " (must be 0 for solution to exist)" << std::endl;
+}
+
+PoissonSolverDct::~PoissonSolverDct()
+{
+  boost::mutex::scoped_lock lock(fftwPlannerMutex());
+  fftwf_destroy_plan(m_plan);
+  fftwf_free(m_buffer);
+}
+
+void PoissonSolverDct::solve(const pfs::Array2Df& F, pfs::Array2Df& U)
+{
+  assert((int)F.getCols()==m_width && (int)F.getRows()==m_height);
+  assert((int)U.getCols()==m_width && (int)U.getRows()==m_height);
+
+  std::copy(F.begin(), F.end(), m_buffer);
+
+  if ( m_boundary == BOUNDARY_NEUMANN )
+    solveNeumann(U);
+  else
+    solveNeumannDirichlet(U);
+}
+
+// let F_tr be the transform of F into the eigenvector space, the
+// solution there is U_tr = F_tr/(l1+l2), where l1 and l2 are the
+// eigenvalues of L_y and L_x. The discrete cosine transform is not
+// exactly the transform needed: on the way in, its output is scaled by
+// 1/((height-1)*(width-1)) and halved on the first and last row and
+// column; on the way back, its input is scaled by 1/4 inside, 1/2 on the
+// borders, 1 at the corners. The two scale factors multiply to the same
+// 1/4 everywhere, they are applied together with the divide.
+void PoissonSolverDct::solveNeumann(pfs::Array2Df& U)
+{
+  const int width = m_width;
+  const int height = m_height;
+
+  // transforms F into eigenvector space
+  fftwf_execute(m_plan);
 
   // in the eigenvector space the solution is very simple
-  //DEBUG_STR << "solve_pde_fft: solve in eigenvector space" << std::endl;
-  pfs::Array2Df* U_tr = new pfs::Array2Df(width,height);
-  std::vector<double> l1=get_lambda(height);
-  std::vector<double> l2=get_lambda(width);
+  const double scale = 0.25/((height-1)*(width-1));
+#pragma omp parallel for schedule(static)
   for(int y=0 ; y<height ; y++ )
   {
+    float* row = m_buffer + y*width;
     for(int x=0 ; x<width ; x++ )
-    {
-      if(x==0 && y==0)
-        (*U_tr)(x,y)=0.0; // any value ok, only adds a const to the solution
-      else
-        (*U_tr)(x,y)=(*F_tr)(x,y)/(l1[y]+l2[x]);
-    }
+      row[x]*=(float)(scale/(m_lambdaY[y]+m_lambdaX[x]));
   }
-  delete F_tr;    // no longer needed so release memory
-  ph.setValue(55);
-
+  m_buffer[0]=0.f; // any value ok, only adds a const to the solution
 
   // transforms U_tr back to the normal space
-  //DEBUG_STR << "solve_pde_fft: transform U_tr to normal space (fft)" << std::endl;
-  transform_ev2normal(U_tr, U);
-  delete U_tr;    // no longer needed so release memory
-  ph.setValue(85);
+  fftwf_execute(m_plan);
 
   // the solution U as calculated will satisfy something like int U = 0
   // since for any constant c, U-c is also a solution and we are mainly
   // working in the logspace of (0,1) data we prefer to have
   // a solution which has no positive values: U_new(x,y)=U(x,y)-max
   // (not really needed but good for numerics as we later take exp(U))
-  //DEBUG_STR << "solve_pde_fft: removing constant from solution" << std::endl;
-  double max=0.0;
-  for(int i=0; i<width*height; i++)
-    if(max<(*U)(i))
-      max=(*U)(i);
+  const long size = (long)width*height;
+  float max=0.f;
+#pragma omp parallel
+  {
+    float threadMax=0.f;
+#pragma omp for schedule(static) nowait
+    for(long i=0; i<size; i++)
+      threadMax=std::max(threadMax, m_buffer[i]);
+#pragma omp critical (poisson_max)
+    max=std::max(max, threadMax);
+  }
 
-  for(int i=0; i<width*height; i++)
-    (*U)(i)-=max;
+#pragma omp parallel for schedule(static)
+  for(long i=0; i<size; i++)
+    U(i)=m_buffer[i]-max;
+}
+
+// the discrete cosine transform of the rows diagonalises the laplace
+// operator along x, what remains is a tridiagonal system along every
+// column: it is solved on blocks of columns, so that the rows are still
+// read sequentially
+void PoissonSolverDct::solveNeumannDirichlet(pfs::Array2Df& U)
+{
+  const int width = m_width;
+  const int height = m_height;
+
+  fftwf_execute(m_plan);
+
+#pragma omp parallel
+  {
+    std::vector<float> c(height*BLOCK);
+
+#pragma omp for schedule(static)
+    for(int i0=0 ; i0<width ; i0+=BLOCK)
+    {
+      const int n = std::min(BLOCK, width-i0);
+      float b[BLOCK];
+      for(int k=0 ; k<n ; k++)
+        b[k]=(float)(m_lambdaX[i0+k]-2.0);
+
+      // forward elimination
+      float* u = m_buffer + i0;
+      for(int k=0 ; k<n ; k++)
+      {
+        c[k]=1.f/b[k];
+        u[k]*=c[k];
+      }
+      for(int j=1 ; j<height ; j++)
+      {
+        float* cj = &c[j*BLOCK];
+        const float* cp = &c[(j-1)*BLOCK];
+        float* uj = u + j*width;
+        const float* up = uj - width;
+        for(int k=0 ; k<n ; k++)
+        {
+          const float m = 1.f/(b[k]-cp[k]);
+          cj[k]=m;
+          uj[k]=(uj[k]-up[k])*m;
+        }
+      }
+
+      // back substitution
+      for(int j=height-2 ; j>=0 ; j--)
+      {
+        const float* cj = &c[j*BLOCK];
+        float* uj = u + j*width;
+        const float* un = uj + width;
+        for(int k=0 ; k<n ; k++)
+          uj[k]-=cj[k]*un[k];
+      }
+    }
+  }
+
+  fftwf_execute(m_plan);
+
+  const float invDivisor = 1.0f/(2.0f*(width-1));
+#pragma omp parallel for schedule(static)
+  for(long i=0; i<(long)width*height; i++)
+    U(i)=m_buffer[i]*invDivisor;
+}
 
 
-  // fft parallel threads cleanup, better handled outside this function?
-  fftwf_cleanup_threads();
+// solves Laplace U = F with Neumann boundary conditions
+// if adjust_bound is true then boundary values in F are modified so that
+// the equation has a solution, if adjust_bound is set to false then F is
+// not modified and the equation might not have a solution but an
+// approximate solution with a minimum error is then calculated
+void solve_pde_fft(pfs::Array2Df *F, pfs::Array2Df *U, pfs::Progress &ph,
+                   bool adjust_bound)
+{
+  ph.setValue(20);
+  //DEBUG_STR << "solve_pde_fft: solving Laplace U = F ..." << std::endl;
+  int width = F->getCols();
+  int height = F->getRows();
+  assert((int)U->getCols()==width && (int)U->getRows()==height);
+
+  // in general there might not be a solution to the Poisson pde
+  // with Neumann boundary conditions unless the boundary satisfies
+  // an integral condition, this function modifies the boundary so that
+  // the condition is exactly satisfied
+  if(adjust_bound)
+  {
+    //DEBUG_STR << "solve_pde_fft: checking boundary conditions" << std::endl;
+    make_compatible_boundary(F);
+  }
+
+  PoissonSolverDct solver(width, height);
+  ph.setValue(30);
+  if (ph.canceled())
+    return;
+
+  solver.solve(*F, *U);
 
   ph.setValue(90);
   //DEBUG_STR << "solve_pde_fft: done" << std::endl;
@@ -40,12 +40,39 @@
 
 #include "Libpfs/frame.h"
 #include "Libpfs/colorspace/colorspace.h"
+#include "Libpfs/colorspace/restorecolor.h"
 #include "Libpfs/exception.h"
 #include "Libpfs/progress.h"
+#include "TonemappingOperators/pfstmo.h"
 
 namespace
 {
 const float epsilon = 1e-4f;
+
+//! \brief compressed luminance: depends on every parameter but the saturation
+struct Fattal02Analysis : public TmoAnalysis
+{
+    Fattal02Analysis(size_t cols, size_t rows)
+        : m_L(cols, rows)
+    {}
+
+    pfs::Array2Df m_L;
+};
+}
+
+void pfstmo_fattal02(pfs::Frame& frame,
+                     float opt_alpha,
+                     float opt_beta,
+                     float opt_saturation,
+                     float opt_noise,
+                     bool newfattal,
+                     bool fftsolver,
+                     int detail_level,
+                     pfs::Progress &ph)
+{
+  TmoAnalysisPtr analysis;
+  pfstmo_fattal02(frame, opt_alpha, opt_beta, opt_saturation, opt_noise,
+                  newfattal, fftsolver, detail_level, analysis, ph);
 }
 
 void pfstmo_fattal02(pfs::Frame& frame,
@@ -56,6 +83,7 @@ void pfstmo_fattal02(pfs::Frame& frame,
                      bool newfattal,
                      bool fftsolver,
                      int detail_level,
+                     TmoAnalysisPtr& analysis,
                      pfs::Progress &ph)
 {
   if (fftsolver)
@@ -95,30 +123,33 @@ void pfstmo_fattal02(pfs::Frame& frame,
   const int h = frame.getHeight();
   
   pfs::Array2Df Yr(w,h);
-  pfs::Array2Df L(w,h);
 
   pfs::transformRGB2Y(R, G, B, &Yr);
 
-  tmo_fattal02(w, h, Yr, L,
-               opt_alpha, opt_beta, opt_noise, newfattal,
-               fftsolver, detail_level,
-               ph);
-
-  if ( !ph.canceled() )
+  Fattal02Analysis* luminance = dynamic_cast<Fattal02Analysis*>(analysis.get());
+  if ( luminance == NULL )
   {
-      pfs::Array2Df& arrayRed = *R;
-      pfs::Array2Df& arrayGreen = *G;
-      pfs::Array2Df& arrayBlue = *B;
+      std::shared_ptr<Fattal02Analysis> new_luminance(new Fattal02Analysis(w, h));
 
-      for (int i=0; i < w*h; i++)
+      tmo_fattal02(w, h, Yr, new_luminance->m_L,
+                   opt_alpha, opt_beta, opt_noise, newfattal,
+                   fftsolver, detail_level,
+                   ph);
+      if ( ph.canceled() )
       {
-          float y = std::max( Yr(i), epsilon );
-          float l = std::max( L(i), epsilon );
-          arrayRed(i) = std::pow( std::max(arrayRed(i)/y, 0.f), opt_saturation ) * l;
-          arrayGreen(i) = std::pow( std::max(arrayGreen(i)/y, 0.f), opt_saturation ) * l;
-          arrayBlue(i) = std::pow( std::max(arrayBlue(i)/y, 0.f), opt_saturation ) * l;
+          return;
       }
 
-      ph.setValue( 100 );
+      analysis = new_luminance;
+      luminance = new_luminance.get();
   }
+
+  pfs::colorspace::restoreColor(
+              pfs::CS_RGB, *R, *G, *B,
+              pfs::colorspace::LuminanceArray(Yr, epsilon),
+              pfs::colorspace::ToneArray(luminance->m_L, opt_saturation, epsilon),
+              pfs::colorspace::TransferLinear(),
+              pfs::CS_RGB, *R, *G, *B);
+
+  ph.setValue( 100 );
 }
@@ -42,6 +42,7 @@
 
 #include "Libpfs/array2d.h"
 #include "Libpfs/progress.h"
+#include "Libpfs/utils/statistics.h"
 #include "TonemappingOperators/pfstmo.h"
 
 #include "pde.h"
@@ -71,243 +72,287 @@ using namespace std;
 //   fclose( fh );
 // }
 
+namespace
+{
 //--------------------------------------------------------------------
 
-void downSample(const pfs::Array2Df& A, pfs::Array2Df& B)
+//! \brief horizontal [1 2 1]/4 blur of a row, the border pixel is repeated
+inline
+void blurRow(const float* in, float* out, int width)
 {
-    const int width = B.getCols();
-    const int height = B.getRows();
-
-    // Note, I've uncommented all omp directives. They are all ok but are
-    // applied to too small problems and in total don't lead to noticable
-    // speed improvements. The main issue is the pde solver and in case of the
-    // fft solver uses optimised threaded fftw routines.
-    //#pragma omp parallel for
-    for ( int y=0 ; y<height ; y++ )
+    for ( int x=1 ; x<width-1 ; x++ )
     {
-        for ( int x=0 ; x<width ; x++ )
-        {
-            float p = A(2*x,2*y);
-            p += A(2*x+1,2*y);
-            p += A(2*x,2*y+1);
-            p += A(2*x+1,2*y+1);
-            B(x,y) = p * 0.25f; // p / 4.0f;
-        }
+        float t = 2.f * in[x];
+        t += in[x-1];
+        t += in[x+1];
+        out[x] = t * 0.25f; // t / 4.f;
     }
+    out[0] = ( 3.f * in[0] + in[1] ) * 0.25f; // / 4.f;
+    out[width-1] = ( 3.f * in[width-1] + in[width-2] ) * 0.25f; // / 4.f;
 }
-	
-void gaussianBlur(const pfs::Array2Df& I, pfs::Array2Df& L)
-{
-    const int width = I.getCols();
-    const int height = I.getRows();
-
-    pfs::Array2Df T(width,height);
 
-    //--- X blur
-    //#pragma omp parallel for shared(I, T)
-    for ( int y=0 ; y<height ; y++ )
+//! \brief vertical [1 2 1]/4 blur of the row \a y, given the rows \a n, \a c
+//! and \a s of the horizontal blur above, at and below it
+inline
+float blurColumn(const float* n, const float* c, const float* s,
+                 int x, int y, int height)
+{
+    if ( y == 0 )
     {
-        for ( int x=1 ; x<width-1 ; x++ )
-        {
-            float t = 2.f * I(x,y);
-            t += I(x-1,y);
-            t += I(x+1,y);
-            T(x,y) = t * 0.25f; // t / 4.f;
-        }
-        T(0,y) = ( 3.f * I(0,y)+ I(1,y) ) * 0.25f; // / 4.f;
-        T(width-1,y) = ( 3.f * I(width-1,y) + I(width-2,y) ) * 0.25f; // / 4.f;
+        return ( 3.f * c[x] + s[x] ) * 0.25f; // / 4.0f;
     }
-
-    //--- Y blur
-    //#pragma omp parallel for shared(T, L)
-    for ( int x=0 ; x<width ; x++ )
+    if ( y == height-1 )
     {
-        for ( int y=1 ; y<height-1 ; y++ )
-        {
-            float t = 2.f * T(x,y);
-            t += T(x,y-1);
-            t += T(x,y+1);
-            L(x,y) = t * 0.25f; // t/4.0f;
-        }
-        L(x,0) = ( 3.f * T(x,0) + T(x,1) ) * 0.25f; // / 4.0f;
-        L(x,height-1) = ( 3.f * T(x,height-1) + T(x,height-2) ) * 0.25f; // / 4.0f;
+        return ( 3.f * c[x] + n[x] ) * 0.25f; // / 4.0f;
     }
+    float t = 2.f * c[x];
+    t += n[x];
+    t += s[x];
+    return t * 0.25f; // t/4.0f;
 }
 
-void createGaussianPyramids( pfs::Array2Df* H, pfs::Array2Df** pyramids, int nlevels)
+//! \brief next level of the gaussian pyramid: \a I blurred and downsampled
+//! by 2 into \a B, in one pass. Every thread blurs horizontally the four rows
+//! of \a I an output row depends on, the blurred level is never stored.
+void blurDownSample(const pfs::Array2Df& I, pfs::Array2Df& B)
 {
-  int width = H->getCols();
-  int height = H->getRows();
-  const int size = width*height;
+    const int width = I.getCols();
+    const int height = I.getRows();
+    const int bwidth = B.getCols();
+    const int bheight = B.getRows();
 
-  pyramids[0] = new pfs::Array2Df(width,height);
-//#pragma omp parallel for shared(pyramids, H)
-  for( int i=0 ; i<size ; i++ )
-    (*pyramids[0])(i) = (*H)(i);
+#pragma omp parallel
+    {
+        std::vector<float> T(4*width);
 
-  pfs::Array2Df* L = new pfs::Array2Df(width,height);
-  gaussianBlur( *pyramids[0], *L );
-	
-  for ( int k=1 ; k<nlevels ; k++ )
-  {
-    width /= 2;
-    height /= 2;		
-    pyramids[k] = new pfs::Array2Df(width,height);
-    downSample(*L, *pyramids[k]);
-    
-    delete L;
-    L = new pfs::Array2Df(width,height);
-    gaussianBlur( *pyramids[k], *L );
-  }
+#pragma omp for schedule(static)
+        for ( int y=0 ; y<bheight ; y++ )
+        {
+            // rows 2y-1 .. 2y+2, within the image
+            for ( int i=0 ; i<4 ; i++ )
+            {
+                const int r = std::min(std::max(2*y-1+i, 0), height-1);
+                blurRow(I.data() + r*width, &T[i*width], width);
+            }
+            const float* t0 = &T[0];
+            const float* t1 = &T[width];
+            const float* t2 = &T[2*width];
+            const float* t3 = &T[3*width];
 
-  delete L;
+            for ( int x=0 ; x<bwidth ; x++ )
+            {
+                float p = blurColumn(t0, t1, t2, 2*x, 2*y, height);
+                p += blurColumn(t0, t1, t2, 2*x+1, 2*y, height);
+                p += blurColumn(t1, t2, t3, 2*x, 2*y+1, height);
+                p += blurColumn(t1, t2, t3, 2*x+1, 2*y+1, height);
+                B(x,y) = p * 0.25f; // p / 4.0f;
+            }
+        }
+    }
 }
 
-//--------------------------------------------------------------------
-
-float calculateGradients(pfs::Array2Df* H, pfs::Array2Df* G, int k)
+//! \brief gradient magnitudes of the pyramid level \a k into \a G
+//! \return their average
+float calculateGradients(const pfs::Array2Df& H, pfs::Array2Df& G, int k)
 {
-  const int width = H->getCols();
-  const int height = H->getRows();
-  const float divider = pow( 2.0f, k+1 );
-  float avgGrad = 0.0f;
+  const int width = H.getCols();
+  const int height = H.getRows();
+  // a power of 2: multiplying by its inverse is exact
+  const float divider = 1.f / pow( 2.0f, k+1 );
+  double avgGrad = 0.0;
 
-//#pragma omp parallel for shared(G,H) reduction(+:avgGrad)
+#pragma omp parallel for schedule(static) reduction(+:avgGrad)
   for( int y=0 ; y<height ; y++ )
   {
+    const int n = (y == 0 ? 0 : y-1);
+    const int s = (y+1 == height ? y : y+1);
+    float sum = 0.f;
     for( int x=0 ; x<width ; x++ )
     {
       float gx, gy;
-      int w, n, e, s;
+      int w, e;
       w = (x == 0 ? 0 : x-1);
-      n = (y == 0 ? 0 : y-1);
-      s = (y+1 == height ? y : y+1);
       e = (x+1 == width ? x : x+1);
 
-      gx = ((*H)(w,y)-(*H)(e,y)) / divider;
+      gx = (H(w,y)-H(e,y)) * divider;
         
-      gy = ((*H)(x,s)-(*H)(x,n)) / divider;
+      gy = (H(x,s)-H(x,n)) * divider;
       // note this implicitely assumes that H(-1)=H(0)
       // for the fft-pde slover this would need adjustment as H(-1)=H(1)
       // is assumed, which means gx=0.0, gy=0.0 at the boundaries
       // however, the impact is not visible so we ignore this here
       
-      (*G)(x,y) = sqrt(gx*gx+gy*gy);
-      avgGrad += (*G)(x,y);
+      G(x,y) = sqrt(gx*gx+gy*gy);
+      sum += G(x,y);
     }
+    avgGrad += sum;
   }
 
-  return avgGrad / (width*height);
+  return static_cast<float>( avgGrad / (width*height) );
 }
 
-//--------------------------------------------------------------------
+//! \brief attenuation of the gradients of a level, in place: \a G holds the
+//! gradient magnitudes on input
+void attenuateGradients(pfs::Array2Df& G, float avgGrad,
+                        float alfa, float beta, float noise)
+{
+    const float a = alfa * avgGrad;
+    const long size = static_cast<long>(G.size());
 
-void upSample(const pfs::Array2Df& A, pfs::Array2Df& B)
+#pragma omp parallel for schedule(static)
+    for ( long i = 0; i < size; i++ )
+    {
+        float grad = (G(i) < 1e-4f) ? 1e-4 : G(i);
+        G(i) = powf((grad+noise)/a, beta - 1.0f);
+    }
+}
+
+//! \brief \a A upsampled by 2 (nearest neighbour) and blurred into \a B,
+//! multiplied by \a attenuation if not NULL: \a B can be \a attenuation
+void upSampleBlur(const pfs::Array2Df& A, pfs::Array2Df& B,
+                  const pfs::Array2Df* attenuation)
 {
     const int width = B.getCols();
     const int height = B.getRows();
     const int awidth = A.getCols();
     const int aheight = A.getRows();
 
-    //#pragma omp parallel for shared(A, B)
-    for ( int y=0 ; y<height ; y++ )
+    // the rows of the upsampled image are the rows of A: they are
+    // upsampled and blurred horizontally once
+    pfs::Array2Df T(width, aheight);
+#pragma omp parallel
     {
-        for ( int x=0 ; x<width ; x++ )
+        std::vector<float> row(width);
+
+#pragma omp for schedule(static)
+        for ( int ay=0 ; ay<aheight ; ay++ )
         {
-            int ax = static_cast<int>(x * 0.5f); //x / 2.f;
-            int ay = static_cast<int>(y * 0.5f); //y / 2.f;
-            ax = (ax<awidth) ? ax : awidth-1;
-            ay = (ay<aheight) ? ay : aheight-1;
+            for ( int x=0 ; x<width ; x++ )
+            {
+                int ax = static_cast<int>(x * 0.5f); //x / 2.f;
+                ax = (ax<awidth) ? ax : awidth-1;
+                row[x] = A(ax,ay);
+            }
+            blurRow(row.data(), T.data() + ay*width, width);
+        }
 
-            B(x,y) = A(ax,ay);
+#pragma omp barrier
+
+#pragma omp for schedule(static)
+        for ( int y=0 ; y<height ; y++ )
+        {
+            const int ay = std::min(static_cast<int>(y * 0.5f), aheight-1);
+            const int an = std::min(static_cast<int>(std::max(y-1, 0) * 0.5f), aheight-1);
+            const int as = std::min(static_cast<int>(std::min(y+1, height-1) * 0.5f), aheight-1);
+            const float* n = T.data() + an*width;
+            const float* c = T.data() + ay*width;
+            const float* s = T.data() + as*width;
+
+            for ( int x=0 ; x<width ; x++ )
+            {
+                const float value = blurColumn(n, c, s, x, y, height);
+                B(x,y) = attenuation ? value * (*attenuation)(x,y) : value;
+            }
         }
     }
-//--- this code below produces 'use of uninitialized value error'
-//   int width = A->getCols();
-//   int height = A->getRows();
-//   int x,y;
-
-//   for( y=0 ; y<height ; y++ )
-//     for( x=0 ; x<width ; x++ )
-//     {
-//       (*B)(2*x,2*y) = (*A)(x,y);
-//       (*B)(2*x+1,2*y) = (*A)(x,y);
-//       (*B)(2*x,2*y+1) = (*A)(x,y);
-//       (*B)(2*x+1,2*y+1) = (*A)(x,y);
-//     }	
 }
 
-
-void calculateFiMatrix(pfs::Array2Df* FI, pfs::Array2Df* gradients[],
-                       float avgGrad[], int nlevels, int detail_level,
-                       float alfa, float beta, float noise, bool newfattal)
+//! \brief attenuation of the gradients of the finest level: the attenuation
+//! of the levels is in \a fi on input, \a needed tells the levels it is
+//! applied to. With \a newfattal, the attenuation of the coarser levels is
+//! propagated to the finer ones (in place).
+pfs::Array2Df& calculateFiMatrix(std::vector<pfs::Array2Df>& fi,
+                                 const std::vector<bool>& needed,
+                                 bool newfattal)
 {
-    int width = gradients[nlevels-1]->getCols();
-    int height = gradients[nlevels-1]->getRows();
-    pfs::Array2Df** fi = new pfs::Array2Df*[nlevels];
-
-    fi[nlevels-1] = new pfs::Array2Df(width,height);
-    if (newfattal)
+    const int nlevels = static_cast<int>(fi.size());
+    if ( newfattal )
     {
-        //#pragma omp parallel for shared(fi)
-        for ( int k = 0 ; k < width*height ; k++ )
+        for ( int k = nlevels-1; k > 0 ; k-- )
         {
-            (*fi[nlevels-1])(k) = 1.0f;
+            upSampleBlur(fi[k], fi[k-1], needed[k-1] ? &fi[k-1] : NULL);
         }
     }
+    return fi[0];
+}
 
-    for ( int k = nlevels-1; k >= 0 ; k-- )
+//! \brief attenuated gradients of H, forward differences
+struct AttenuatedGradient
+{
+    AttenuatedGradient(const pfs::Array2Df& H, const pfs::Array2Df& FI,
+                       bool fftsolver)
+        : m_H(H)
+        , m_FI(FI)
+        , m_fftsolver(fftsolver)
+        , m_width(H.getCols())
+        , m_height(H.getRows())
+    {}
+
+    // the fft solver solves the Poisson pde but with slightly different
+    // boundary conditions, so we need to adjust the assembly of the right hand
+    // side accordingly (basically fft solver assumes U(-1) = U(1), whereas zero
+    // Neumann conditions assume U(-1)=U(0)), see also divergence calculation
+    float x(size_t x, size_t y) const
     {
-        width = gradients[k]->getCols();
-        height = gradients[k]->getRows();
-
-        // only apply gradients to levels>=detail_level but at least to the coarsest
-        if ( k >= detail_level
-             ||k==nlevels-1
-             || newfattal == false)
+        if ( m_fftsolver )
         {
-            //DEBUG_STR << "calculateFiMatrix: apply gradient to level " << k << endl;
-            //#pragma omp parallel for shared(fi,avgGrad)
-            for ( int y = 0; y < height; y++ )
-            {
-                for ( int x = 0; x < width; x++ )
-                {
-                    float grad = ((*gradients[k])(x,y) < 1e-4f) ? 1e-4 : (*gradients[k])(x,y);
-                    float a = alfa * avgGrad[k];
-
-                    float value = powf((grad+noise)/a, beta - 1.0f);
-
-                    if (newfattal)
-                        (*fi[k])(x,y) *= value;
-                    else
-                        (*fi[k])(x,y) = value;
-                }
-            }
+            // sets index+1 based on the boundary assumption H(N+1)=H(N-1)
+            size_t xp1 = (x+1 >= m_width ?  m_width-2  : x+1);
+            // forward differences in H, so need to use between-points approx of FI
+            return (m_H(xp1,y)-m_H(x,y)) * 0.5*(m_FI(xp1,y)+m_FI(x,y));
         }
+        size_t e = (x+1 == m_width ? x : x+1);
+        return (m_H(e,y)-m_H(x,y)) * m_FI(x,y);
+    }
 
-
-        // create next level
-        if ( k>1 )
+    float y(size_t x, size_t y) const
+    {
+        if ( m_fftsolver )
         {
-            width = gradients[k-1]->getCols();
-            height = gradients[k-1]->getRows();
-            fi[k-1] = new pfs::Array2Df(width,height);
+            size_t yp1 = (y+1 >= m_height ? m_height-2 : y+1);
+            return (m_H(x,yp1)-m_H(x,y)) * 0.5*(m_FI(x,yp1)+m_FI(x,y));
         }
-        else
-            fi[0] = FI;                         // highest level -> result
+        size_t s = (y+1 == m_height ? y : y+1);
+        return (m_H(x,s)-m_H(x,y)) * m_FI(x,y);
+    }
+
+    const pfs::Array2Df& m_H;
+    const pfs::Array2Df& m_FI;
+    bool m_fftsolver;
+    size_t m_width;
+    size_t m_height;
+};
+
+//! \brief divergence of the gradients of \a H attenuated by \a FI: the
+//! gradients are computed on the fly, they are never stored
+void calculateDivergence(const pfs::Array2Df& H, const pfs::Array2Df& FI,
+                         pfs::Array2Df& DivG, bool fftsolver)
+{
+    const AttenuatedGradient G(H, FI, fftsolver);
+    const long width = H.getCols();
+    const long height = H.getRows();
 
-        if ( k>0  && newfattal )
+#pragma omp parallel for schedule(static)
+    for ( long y = 0; y < height; ++y )
+    {
+        for ( long x = 0; x < width; ++x )
         {
-            upSample(*fi[k], *fi[k-1]);           // upsample to next level
-            gaussianBlur(*fi[k-1], *fi[k-1]);
+            const float gx = G.x(x,y);
+            const float gy = G.y(x,y);
+            float div = gx + gy;
+            if ( x > 0 ) div -= G.x(x-1,y);
+            if ( y > 0 ) div -= G.y(x,y-1);
+
+            if (fftsolver)
+            {
+                if (x==0) div += gx;
+                if (y==0) div += gy;
+            }
+            DivG(x,y) = div;
         }
     }
+}
 
-    for ( int k=1 ; k<nlevels ; k++ )
-    {
-        delete fi[k];
-    }
-    delete[] fi;
 }
 
 inline
@@ -315,17 +360,15 @@ void findMaxMinPercentile(const pfs::Array2Df& I,
                                  float minPrct, float& minLum,
                                  float maxPrct, float& maxLum)
 {
-    using namespace std;
-
-    const int size = I.getRows() * I.getCols();
-    const float* data = I.data();
-    std::vector<float> vI;
+    std::vector<float> p(2);
+    p[0] = minPrct;
+    p[1] = maxPrct;
 
-    copy(data, data + size, back_inserter(vI));
-    sort(vI.begin(), vI.end());
+    std::vector<float> q;
+    pfs::utils::quantiles(I.data(), I.size(), p, q);
 
-    minLum = vI.at( int(minPrct*vI.size()) );
-    maxLum = vI.at( int(maxPrct*vI.size()) );
+    minLum = q[0];
+    maxLum = q[1];
 }
 
 void tmo_fattal02(size_t width,
@@ -365,18 +408,13 @@ void tmo_fattal02(size_t width,
   // int i, k;
 
   // find max & min values, normalize to range 0..100 and take logarithm
-  float minLum = Y(0,0);
-  float maxLum = Y(0,0);
+  float minLum;
+  float maxLum = pfs::utils::computeRange(Y.data(), size).max;
+  pfs::Array2Df H(width, height);
+#pragma omp parallel for schedule(static)
   for ( int i=0 ; i<size ; i++ )
   {
-      minLum = ( Y(i) < minLum ) ? Y(i) : minLum;
-      maxLum = ( Y(i) > maxLum ) ? Y(i) : maxLum;
-  }
-  pfs::Array2Df* H = new pfs::Array2Df(width, height);
-  //#pragma omp parallel for private(i) shared(H, Y, maxLum)
-  for ( int i=0 ; i<size ; i++ )
-  {
-      (*H)(i) = logf( 100.0f* Y(i)/maxLum + 1e-4 );
+      H(i) = logf( 100.0f* Y(i)/maxLum + 1e-4 );
   }
   ph.setValue(4);
 
@@ -392,98 +430,59 @@ void tmo_fattal02(size_t width,
   // The following lines solves a bug with images particularly small
   if (nlevels == 0) nlevels = 1;
 
-  pfs::Array2Df** pyramids = new pfs::Array2Df*[nlevels];
-  createGaussianPyramids(H, pyramids, nlevels);
-  ph.setValue(8);
+  // levels the attenuation is applied to: only the finest one in the
+  // original algorithm, otherwise the ones >= detail_level but at least the
+  // coarsest
+  std::vector<bool> needed(nlevels);
+  for ( int k=0 ; k<nlevels ; k++ )
+  {
+    needed[k] = newfattal ? ( k >= detail_level || k == nlevels-1 ) : ( k == 0 );
+  }
 
-  // calculate gradients and its average values on pyramid levels
-  pfs::Array2Df** gradients = new pfs::Array2Df*[nlevels];
-  float* avgGrad = new float[nlevels];
+  // level by level: the next level of the gaussian pyramid, then the
+  // gradients of the current one, their average and their attenuation.
+  // Only two levels of the pyramid are alive at a time, in two buffers
+  // allocated once; the level 0 is H.
+  std::vector<pfs::Array2Df> fi(nlevels);
+  std::vector<float> avgGrad(nlevels);
+  pfs::Array2Df pool[2];
+  const pfs::Array2Df* level = &H;
   for ( int k=0 ; k<nlevels ; k++ )
   {
-    gradients[k] = new pfs::Array2Df(pyramids[k]->getCols(), pyramids[k]->getRows());
-    avgGrad[k] = calculateGradients(pyramids[k],gradients[k], k);
+    const int lwidth = level->getCols();
+    const int lheight = level->getRows();
+    const pfs::Array2Df* next = NULL;
+    if ( k+1 < nlevels )
+    {
+      pfs::Array2Df& buffer = pool[k%2];
+      buffer.resize(lwidth/2, lheight/2);
+      blurDownSample(*level, buffer);
+      next = &buffer;
+    }
+
+    fi[k].resize(lwidth, lheight);
+    avgGrad[k] = calculateGradients(*level, fi[k], k);
+    if ( needed[k] )
+    {
+      attenuateGradients(fi[k], avgGrad[k], alfa, beta, noise);
+    }
+
+    level = next;
+    ph.setValue(4 + 10*(k+1)/nlevels);
   }
-  ph.setValue(12);
 
   // calculate fi matrix
-  pfs::Array2Df* FI = new pfs::Array2Df(width, height);
-  calculateFiMatrix(FI, gradients, avgGrad, nlevels, detail_level, alfa, beta, noise, newfattal);
+  const pfs::Array2Df& FI = calculateFiMatrix(fi, needed, newfattal);
 //  dumpPFS( "FI.pfs", FI, "Y" );
-  for ( int i=0 ; i<nlevels ; i++ )
-  {
-    delete pyramids[i];
-    delete gradients[i];
-  }
-  delete[] pyramids;
-  delete[] gradients;
-  delete[] avgGrad;
   ph.setValue(16);
   if (ph.canceled()){
-    delete FI;
-    delete H;
     return;
   }
 
 
-  // attenuate gradients
-  pfs::Array2Df* Gx = new pfs::Array2Df(width, height);
-  pfs::Array2Df* Gy = new pfs::Array2Df(width, height);
-
-  // the fft solver solves the Poisson pde but with slightly different
-  // boundary conditions, so we need to adjust the assembly of the right hand
-  // side accordingly (basically fft solver assumes U(-1) = U(1), whereas zero
-  // Neumann conditions assume U(-1)=U(0)), see also divergence calculation
-  if (fftsolver)
-    for ( size_t y=0 ; y<height ; y++ )
-      for ( size_t x=0 ; x<width ; x++ )
-      {
-        // sets index+1 based on the boundary assumption H(N+1)=H(N-1)
-        unsigned int yp1 = (y+1 >= height ? height-2 : y+1);
-        unsigned int xp1 = (x+1 >= width ?  width-2  : x+1);
-        // forward differences in H, so need to use between-points approx of FI
-        (*Gx)(x,y) = ((*H)(xp1,y)-(*H)(x,y)) * 0.5*((*FI)(xp1,y)+(*FI)(x,y));
-        (*Gy)(x,y) = ((*H)(x,yp1)-(*H)(x,y)) * 0.5*((*FI)(x,yp1)+(*FI)(x,y));
-      }
-  else
-    for ( size_t y=0 ; y<height ; y++ )
-      for ( size_t x=0 ; x<width ; x++ )
-      {
-        int s, e;
-        s = (y+1 == height ? y : y+1);
-        e = (x+1 == width ? x : x+1);
-
-        (*Gx)(x,y) = ((*H)(e,y)-(*H)(x,y)) * (*FI)(x,y);        
-        (*Gy)(x,y) = ((*H)(x,s)-(*H)(x,y)) * (*FI)(x,y);      
-      }
-  delete H;
-  delete FI;
-  ph.setValue(18);
-
-
-//   dumpPFS( "Gx.pfs", Gx, "Y" );
-//   dumpPFS( "Gy.pfs", Gy, "Y" );
-  
-  // calculate divergence
+  // attenuate gradients and calculate divergence, in one pass
   pfs::Array2Df DivG(width, height);
-  for ( size_t y = 0; y < height; ++y )
-  {
-      for ( size_t x = 0; x < width; ++x )
-      {
-          DivG(x,y) = (*Gx)(x,y) + (*Gy)(x,y);
-          if ( x > 0 ) DivG(x,y) -= (*Gx)(x-1,y);
-          if ( y > 0 ) DivG(x,y) -= (*Gy)(x,y-1);
-
-          if (fftsolver)
-          {
-              if (x==0) DivG(x,y) += (*Gx)(x,y);
-              if (y==0) DivG(x,y) += (*Gy)(x,y);
-          }
-
-      }
-  }
-  delete Gx;
-  delete Gy;
+  calculateDivergence(H, FI, DivG, fftsolver);
   ph.setValue(20);
   if (ph.canceled())
   {
@@ -512,7 +511,8 @@ void tmo_fattal02(size_t width,
       return;
   }
 
-  for ( size_t idx = 0 ; idx < height*width; ++idx )
+#pragma omp parallel for schedule(static)
+  for ( int idx = 0 ; idx < size; ++idx )
   {
       L(idx) = expf( gamma * U(idx) );
   }
@@ -524,7 +524,8 @@ void tmo_fattal02(size_t width,
   float cut_max = 1.0f - 0.01f * white_point;
   assert(cut_min>=0.0f && (cut_max<=1.0f) && (cut_min<cut_max));
   findMaxMinPercentile(L, cut_min, minLum, cut_max, maxLum);
-  for ( size_t idx = 0; idx < height*width; ++idx )
+#pragma omp parallel for schedule(static)
+  for ( int idx = 0; idx < size; ++idx )
   {
       L(idx) = (L(idx) - minLum) / (maxLum - minLum);
       if ( L(idx) <= 0.0f )
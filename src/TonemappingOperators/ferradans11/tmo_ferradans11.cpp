@@ -48,6 +48,7 @@
 #include "Libpfs/progress.h"
 #include "Libpfs/utils/msec_timer.h"
 #include "TonemappingOperators/pfstmo.h"
+#include "TonemappingOperators/fftw_planner.h"
 #include "tmo_ferradans11.h"
 #include <boost/math/constants/constants.hpp>
 #include <cmath>
@@ -265,6 +266,10 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
     msec_timer stop_watch;
     stop_watch.start();
 #endif
+  // the fftw planner is not thread safe: it is locked whenever plans are
+  // created or destroyed
+  boost::mutex::scoped_lock planner_lock(fftwPlannerMutex());
+
   // activate parallel execution of fft routines
   fftwf_init_threads();
 #ifdef _OPENMP
@@ -272,6 +277,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
 #else
   fftwf_plan_with_nthreads( 2 );
 #endif
+  planner_lock.unlock();
 
     ph.setValue(0);
 
@@ -438,6 +444,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
     copy(RGB[0], RGB[0]+length, u6);
     copy(RGB[0], RGB[0]+length, u7);
 
+    planner_lock.lock();
     fftwf_complex* U = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * length);
     fftwf_plan pU = fftwf_plan_dft_r2c_2d(fil, col, u0, U,FFTW_ESTIMATE);
     fftwf_complex* U2 = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * length);
@@ -482,6 +489,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
 
     float *iu7 = fftwf_alloc_real(length);
     fftwf_plan pinvU7 = fftwf_plan_dft_c2r_2d(fil, col, U7G, iu7, FFTW_ESTIMATE);
+    planner_lock.unlock();
     
     float alpha=min(col,fil)/invalpha;
     float *g = fftwf_alloc_real(length);
@@ -499,9 +507,13 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
         g[i] *= w;
 
     fftwf_complex* G = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * length);
+    planner_lock.lock();
     fftwf_plan pG = fftwf_plan_dft_r2c_2d(fil, col, g, G, FFTW_ESTIMATE);
+    planner_lock.unlock();
     fftwf_execute(pG);
+    planner_lock.lock();
     fftwf_destroy_plan(pG);
+    planner_lock.unlock();
 
     fftwf_free(g);
 
@@ -513,6 +525,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
         delete[] RGB[0];
         delete[] RGB[1];
         delete[] RGB[2];
+        planner_lock.lock();
         fftwf_destroy_plan(pU);
         fftwf_destroy_plan(pU2);
         fftwf_destroy_plan(pU3);
@@ -528,6 +541,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
         fftwf_destroy_plan(pinvU5);
         fftwf_destroy_plan(pinvU6);
         fftwf_destroy_plan(pinvU7);
+        planner_lock.unlock();
 
         fftwf_free(RGB0);
         fftwf_free(u0);
@@ -686,6 +700,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
         if (iteration > 1)
             ph.setValue(30+69/(steps+1));
     }
+    planner_lock.lock();
     fftwf_destroy_plan(pU);
     fftwf_destroy_plan(pU2);
     fftwf_destroy_plan(pU3);
@@ -701,6 +716,7 @@ void tmo_ferradans11(pfs::Array2Df& imR, pfs::Array2Df& imG, pfs::Array2Df& imB,
     fftwf_destroy_plan(pinvU5);
     fftwf_destroy_plan(pinvU6);
     fftwf_destroy_plan(pinvU7);
+    planner_lock.unlock();
 
     fftwf_free(RGB0);
     fftwf_free(u0);
@@ -0,0 +1,32 @@
+/**
+ * @brief Lock of the FFTW planner, shared by every operator using FFTW
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "fftw_planner.h"
+
+namespace
+{
+boost::mutex s_planner_mutex;
+}
+
+boost::mutex& fftwPlannerMutex()
+{
+    return s_planner_mutex;
+}
@@ -0,0 +1,35 @@
+/**
+ * @brief Lock of the FFTW planner, shared by every operator using FFTW
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FFTW_PLANNER_H
+#define FFTW_PLANNER_H
+
+#include <boost/thread/mutex.hpp>
+
+//! \brief Mutex of the FFTW planner.
+//!
+//! Only fftwf_execute() is thread safe: fftwf_init_threads(),
+//! fftwf_plan_with_nthreads(), the fftwf_plan_*() functions and
+//! fftwf_destroy_plan() share the state of the planner, so they must be
+//! called holding this lock, from every operator.
+boost::mutex& fftwPlannerMutex();
+
+#endif // FFTW_PLANNER_H
@@ -35,6 +35,8 @@
 
 #include "compression_tmo.h"
 #include "Libpfs/utils/msec_timer.h"
+#include "Libpfs/utils/statistics.h"
+#include "TonemappingOperators/tonecurve_lut.h"
 
 #ifdef BRANCH_PREDICTION
 #define likely(x)	__builtin_expect((x),1)
@@ -174,6 +176,24 @@ inline float safelog10f( float x )
 
 
 
+/**
+ * Tone curve as a function of the linear value
+ */
+class LogLUTCurve
+{
+    UniformArrayLUT& lut;
+
+public:
+    explicit LogLUTCurve( UniformArrayLUT& lut ) : lut( lut )
+    {
+    }
+
+    float operator()( float x ) const
+    {
+        return lut.interp( safelog10f( x ) );
+    }
+};
+
 void CompressionTMO::tonemap( const float *R_in, const float *G_in, float *B_in, int width, int height,
                               float *R_out, float *G_out, float *B_out, const float *L_in, pfs::Progress &ph)
 {
@@ -187,7 +207,8 @@ void CompressionTMO::tonemap( const float *R_in, const float *G_in, float *B_in,
     // Compute log of Luminance
     float *logL = new float[pix_count];
 //    std::unique_ptr<float[]> logL(new float[pix_count]);
-    for( size_t pp = 0; pp < pix_count; pp++ ) {
+    #pragma omp parallel for
+    for( long pp = 0; pp < (long)pix_count; pp++ ) {
         logL[pp] = safelog10f( L_in[pp] );
     }
 
@@ -203,18 +224,15 @@ void CompressionTMO::tonemap( const float *R_in, const float *G_in, float *B_in,
     {
         double d = 0;
         for( int bb = 0; bb < H.bin_count; bb++ ) {
-            ph.setValue(35*bb/H.bin_count);
-            if (ph.canceled())
-                goto end;
             d += pow( H.p[bb], 1./3. );
         }
         d *= H.delta;
         for( int bb = 0; bb < H.bin_count; bb++ ) {
-            ph.setValue(50*bb/H.bin_count);
-            if (ph.canceled())
-                goto end;
             s[bb] = pow( H.p[bb], 1./3. )/d;
         }
+        ph.setValue(50);
+        if (ph.canceled())
+            goto end;
 
     }
 
@@ -241,20 +259,20 @@ void CompressionTMO::tonemap( const float *R_in, const float *G_in, float *B_in,
     //Create a tone-curve
     lut.y_i[0] = 0;
     for( int bb = 1; bb < H.bin_count; bb++ ) {
-        ph.setValue(60*bb/H.bin_count);
-        if (ph.canceled())
-            goto end;
         lut.y_i[bb] = lut.y_i[bb-1] + s[bb] * H.delta;
     }
 
-    // Apply the tone-curve
-    for( unsigned int pp = 0; pp < pix_count; pp++ ) {
-        ph.setValue(100*pp/pix_count);
-        if (ph.canceled())
-            goto end;
-        R_out[pp] = lut.interp( safelog10f(R_in[pp]) );
-        G_out[pp] = lut.interp( safelog10f(G_in[pp]) );
-        B_out[pp] = lut.interp( safelog10f(B_in[pp]) );
+    // Apply the tone-curve, compiled over the range of the colour channels:
+    // safelog10f() is constant below 1e-5
+    {
+        float max_value = 1e-5f;
+        max_value = std::max( max_value, pfs::utils::computeRange( R_in, pix_count ).max );
+        max_value = std::max( max_value, pfs::utils::computeRange( G_in, pix_count ).max );
+        max_value = std::max( max_value, pfs::utils::computeRange( B_in, pix_count ).max );
+
+        ToneCurveLut curve;
+        curve.compile( 1e-5f, max_value, LogLUTCurve( lut ) );
+        applyToneCurve( curve, R_in, G_in, B_in, R_out, G_out, B_out, pix_count, ph, 60, 100 );
     }
 end:
     delete [] s;
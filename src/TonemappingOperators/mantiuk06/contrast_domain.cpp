@@ -84,6 +84,7 @@
 #include "Libpfs/utils/dotproduct.h"
 #include "Libpfs/utils/msec_timer.h"
 #include "Libpfs/progress.h"
+#include "Libpfs/colorspace/restorecolor.h"
 
 using namespace pfs;
 
@@ -91,13 +92,9 @@ using namespace pfs;
 void multiplyA(PyramidT& px, const PyramidT& pC,
                const Array2Df& x, Array2Df& sumOfDivG)
 {
-    px.computeGradients( x );
-
-    // scale gradients by Cx,Cy from main pyramid
-    px.multiply( pC );
-
-    // calculate the sum of divergences
-    px.computeSumOfDivergence( sumOfDivG );
+    // gradients, scaled by Cx,Cy from main pyramid, and the sum of their
+    // divergences
+    px.computeSumOfDivergence( x, pC, sumOfDivG );
 }
 
 // conjugate linear equation solver overwrites pyramid!
@@ -268,7 +265,7 @@ void transformToLuminance(PyramidT& pp, Array2Df& Y,
                           const int itmax, const float tol,
                           Progress& ph)
 {
-    PyramidT pC = pp; // copy ctor
+    PyramidT pC( pp.getRows(), pp.getCols() );
 
     pp.computeScaleFactors( pC );
 
@@ -324,8 +321,8 @@ void contrastEqualization(PyramidT& pp, const float contrastFactor)
           itCurr != itEnd;
           ++itCurr)
     {
-        PyramidS::const_iterator xyGradIter = itCurr->begin();
-        PyramidS::const_iterator xyGradEnd = itCurr->end();
+        PyramidLevel::const_iterator xyGradIter = itCurr->begin();
+        PyramidLevel::const_iterator xyGradEnd = itCurr->end();
 
         for (; xyGradIter != xyGradEnd; ++xyGradIter)
         {
@@ -360,15 +357,20 @@ void contrastEqualization(PyramidT& pp, const float contrastFactor)
           itCurr != itEnd;
           ++itCurr)
     {
-        PyramidS::iterator xyGradIter = itCurr->begin();
-        PyramidS::iterator xyGradEnd = itCurr->end();
+        PyramidLevel::iterator xyGradIter = itCurr->begin();
+        PyramidLevel::iterator xyGradEnd = itCurr->end();
 
         for (; xyGradIter != xyGradEnd; ++xyGradIter)
         {
-            float scaleFactor =
-                    contrastFactor * hist[offset].cdf / hist[offset].data;
+            // null gradients (e.g. on the borders) stay null: dividing by
+            // their magnitude would turn them into NaN
+            if ( hist[offset].data > 0.f )
+            {
+                float scaleFactor =
+                        contrastFactor * hist[offset].cdf / hist[offset].data;
 
-            *xyGradIter *= scaleFactor;
+                *xyGradIter *= scaleFactor;
+            }
 
             offset++;
         }
@@ -447,20 +449,50 @@ T decode(const T& value)
     return (1.055f * std::pow( value, 1.f/2.4f ) - 0.055f);
 }
 
-void denormalizeRGB(Array2Df& R, Array2Df& G, Array2Df& B, const Array2Df& Y,
-                    float saturationFactor)
+//! \brief the RGB channels hold the colour ratios already
+struct UnitLuminance
 {
-    const int size = static_cast<int>(Y.size());
+    float operator()(size_t, float, float, float) const
+    {
+        return 1.f;
+    }
+};
 
-    /* Transform to sRGB */
-#pragma omp parallel for
-    for (int j = 0; j < size; j++)
+//! \brief luminance from its log10
+struct ExpLuminance
+{
+    ExpLuminance(const Array2Df& Y, float saturationFactor)
+        : m_Y(Y)
+        , m_saturationFactor(saturationFactor)
+    {}
+
+    void operator()(size_t j, float, float& L, float& s) const
+    {
+        L = std::pow( 10.f, m_Y(j) );
+        s = m_saturationFactor;
+    }
+
+    const Array2Df& m_Y;
+    float m_saturationFactor;
+};
+
+struct Decode
+{
+    float operator()(float value) const
     {
-        float myY = std::pow( 10.f, Y(j) );
-        R(j) = decode( std::pow( R(j), saturationFactor ) * myY );
-        G(j) = decode( std::pow( G(j), saturationFactor ) * myY );
-        B(j) = decode( std::pow( B(j), saturationFactor ) * myY );
+        return decode(value);
     }
+};
+
+void denormalizeRGB(Array2Df& R, Array2Df& G, Array2Df& B, const Array2Df& Y,
+                    float saturationFactor)
+{
+    /* Transform to sRGB */
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             UnitLuminance(),
+                             ExpLuminance(Y, saturationFactor),
+                             Decode(),
+                             CS_RGB, R, G, B);
 }
 }
 
@@ -473,6 +505,22 @@ int tmo_mantiuk06_contmap(Array2Df& R, Array2Df& G, Array2Df& B,
                           const int itmax,
                           const float tol,
                           Progress &ph)
+{
+    int res = tmo_mantiuk06_contmap_luminance(R, G, B, Y,
+                                              contrastFactor, detailfactor,
+                                              itmax, tol, ph);
+    tmo_mantiuk06_contmap_color(R, G, B, Y, saturationFactor);
+
+    return res;
+}
+
+int tmo_mantiuk06_contmap_luminance(Array2Df& R, Array2Df& G, Array2Df& B,
+                                    Array2Df& Y,
+                                    const float contrastFactor,
+                                    float detailfactor,
+                                    const int itmax,
+                                    const float tol,
+                                    Progress &ph)
 {
     assert( R.getCols() == G.getCols() );
     assert( G.getCols() == B.getCols() );
@@ -512,7 +560,19 @@ int tmo_mantiuk06_contmap(Array2Df& R, Array2Df& G, Array2Df& B,
     transformToLuminance(pp, Y, itmax, tol, ph);
 
     denormalizeLuminance(Y);
-    denormalizeRGB(R, G, B, Y, saturationFactor);
 
     return PFSTMO_OK;
 }
+
+void tmo_mantiuk06_color_ratios(Array2Df& R, Array2Df& G, Array2Df& B,
+                                Array2Df& Y)
+{
+    normalizeLuminanceAndRGB(R, G, B, Y);
+}
+
+void tmo_mantiuk06_contmap_color(Array2Df& R, Array2Df& G, Array2Df& B,
+                                 const Array2Df& Y,
+                                 const float saturationFactor)
+{
+    denormalizeRGB(R, G, B, Y, saturationFactor);
+}
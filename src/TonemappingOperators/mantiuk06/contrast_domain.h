@@ -61,4 +61,24 @@ int tmo_mantiuk06_contmap( pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
                            int itmax /*= 200*/, float tol /*= 1e-3*/,
                            pfs::Progress &ph);
 
+//! \brief Luminance stage of tmo_mantiuk06_contmap: on exit \a R, \a G and
+//! \a B hold the color ratios and \a Y the tonemapped (log) luminance, which
+//! does not depend on the saturation factor
+int tmo_mantiuk06_contmap_luminance( pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                                     pfs::Array2Df& Y,
+                                     float contrastFactor, float detailFactor,
+                                     int itmax, float tol,
+                                     pfs::Progress &ph);
+
+//! \brief Replace \a R, \a G and \a B with their ratios to the luminance \a Y
+//! (\a Y is modified as well), as tmo_mantiuk06_contmap_luminance() does
+void tmo_mantiuk06_color_ratios( pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                                 pfs::Array2Df& Y );
+
+//! \brief Color stage of tmo_mantiuk06_contmap: combines the color ratios with
+//! the luminance computed by tmo_mantiuk06_contmap_luminance()
+void tmo_mantiuk06_contmap_color( pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                                  const pfs::Array2Df& Y,
+                                  float saturationFactor );
+
 #endif
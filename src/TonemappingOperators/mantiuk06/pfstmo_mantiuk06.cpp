@@ -45,6 +45,7 @@
 #include "Libpfs/pfs.h"
 #include "Libpfs/frame.h"
 #include "Libpfs/colorspace/colorspace.h"
+#include "Libpfs/progress.h"
 
 
 //--- default tone mapping parameters;
@@ -57,11 +58,31 @@ namespace
 {
 const int itmax = 200;
 const float tol = 5e-3f;
+
+//! \brief tonemapped luminance: depends on every parameter but the saturation
+struct Mantiuk06Analysis : public TmoAnalysis
+{
+    Mantiuk06Analysis(size_t cols, size_t rows)
+        : m_Y(cols, rows)
+    {}
+
+    pfs::Array2Df m_Y;
+};
 }
 
 void pfstmo_mantiuk06(pfs::Frame& frame, float scaleFactor,
                       float saturationFactor, float detailFactor,
                       bool cont_eq, pfs::Progress &ph)
+{
+    TmoAnalysisPtr analysis;
+    pfstmo_mantiuk06(frame, scaleFactor, saturationFactor, detailFactor,
+                     cont_eq, analysis, ph);
+}
+
+void pfstmo_mantiuk06(pfs::Frame& frame, float scaleFactor,
+                      float saturationFactor, float detailFactor,
+                      bool cont_eq, TmoAnalysisPtr& analysis,
+                      pfs::Progress &ph)
 {
 #ifndef NDEBUG
     std::stringstream ss;
@@ -98,12 +119,33 @@ void pfstmo_mantiuk06(pfs::Frame& frame, float scaleFactor,
     const int cols = frame.getWidth();
     const int rows = frame.getHeight();
     
-    pfs::Array2Df inY( cols, rows );
-    pfs::transformRGB2Y(inRed, inGreen, inBlue, &inY);
+    Mantiuk06Analysis* luminance = dynamic_cast<Mantiuk06Analysis*>(analysis.get());
+    if ( luminance == NULL )
+    {
+        std::shared_ptr<Mantiuk06Analysis> new_luminance(new Mantiuk06Analysis(cols, rows));
+        pfs::transformRGB2Y(inRed, inGreen, inBlue, &new_luminance->m_Y);
+
+        tmo_mantiuk06_contmap_luminance(*inRed, *inGreen, *inBlue, new_luminance->m_Y,
+                                        scaleFactor, detailFactor, itmax, tol,
+                                        ph);
+        if ( ph.canceled() )
+        {
+            return;
+        }
+
+        analysis = new_luminance;
+        luminance = new_luminance.get();
+    }
+    else
+    {
+        pfs::Array2Df inY( cols, rows );
+        pfs::transformRGB2Y(inRed, inGreen, inBlue, &inY);
+
+        tmo_mantiuk06_color_ratios(*inRed, *inGreen, *inBlue, inY);
+    }
 
-    tmo_mantiuk06_contmap(*inRed, *inGreen, *inBlue, inY,
-                          scaleFactor, saturationFactor, detailFactor, itmax, tol,
-                          ph);
+    tmo_mantiuk06_contmap_color(*inRed, *inGreen, *inBlue, luminance->m_Y,
+                                saturationFactor);
 
     frame.getTags().setTag("LUMINANCE", "RELATIVE");
 }
@@ -41,7 +41,6 @@
 
 #include "Libpfs/array2d.h"
 #include "Libpfs/utils/sse.h"
-#include "Libpfs/utils/numeric.h"
 
 using namespace pfs;
 
@@ -57,457 +56,625 @@ size_t downscaleBy2(size_t value)
 namespace
 {
 const size_t PYRAMID_MIN_PIXELS = 3;
+
+//! \brief pyramids with fewer pixels in the first level are processed by a
+//! single thread
+const size_t OMP_THRESHOLD = 16384;
 }
 
 PyramidT::PyramidT(size_t rows, size_t cols)
     : m_rows(rows)
     , m_cols(cols)
 {
+    buildLevels();
+}
+
+PyramidT::PyramidT(const PyramidT& other)
+    : m_rows(other.m_rows)
+    , m_cols(other.m_cols)
+    , m_storage(other.m_storage)
+{
+    buildLevels();
+}
+
+PyramidT& PyramidT::operator=(const PyramidT& other)
+{
+    if ( this != &other )
+    {
+        m_rows = other.m_rows;
+        m_cols = other.m_cols;
+        m_storage = other.m_storage;
+
+        buildLevels();
+    }
+    return *this;
+}
+
+void PyramidT::buildLevels()
+{
+    size_t rows = m_rows;
+    size_t cols = m_cols;
+    size_t elems = 0;
     size_t referenceSize = std::min( rows, cols );
     while ( referenceSize >= PYRAMID_MIN_PIXELS )
     {
-        m_pyramid.push_back( PyramidS(cols, rows) );
+        elems += rows*cols;
 
         rows = downscaleBy2(rows);                     // division by 2
         cols = downscaleBy2(cols);                     // division by 2
         referenceSize = downscaleBy2(referenceSize);   // division by 2
     }
+    m_storage.resize( elems );
+
+    m_pyramid.clear();
+    rows = m_rows;
+    cols = m_cols;
+    for (size_t offset = 0; offset < elems; offset += rows*cols)
+    {
+        if ( offset )
+        {
+            rows = downscaleBy2(rows);
+            cols = downscaleBy2(cols);
+        }
+        m_pyramid.push_back( PyramidLevel(m_storage.data() + offset,
+                                          cols, rows) );
+    }
+
+    m_images.resize( elems ? elems - getElems() : 0 );
+    m_divergence.resize( downscaleBy2(m_rows)*downscaleBy2(m_cols) );
 }
 
-void PyramidT::computeGradients(const pfs::Array2Df& Y)
+namespace
 {
-    assert( this->getCols() == Y.getCols() );
-    assert( this->getRows() == Y.getRows() );
+// New downsampling by Ed Brambley:
+// Experimental downsampling that assumes pixels are square and
+// integrates over each new pixel to find the average value of the
+// underlying pixels.
+//
+// Consider the original pixels laid out, and the new (larger)
+// pixels layed out over the top of them.  Then the new value for
+// the larger pixels is just the integral over that pixel of what
+// shows through; i.e., the values of the pixels underneath
+// multiplied by how much of that pixel is showing.
+//
+// (ix1, iy1) is the coordinate of the top left visible pixel.
+// (ix2, iy2) is the coordinate of the bottom right visible pixel.
+// (fx1, fy1) is the fraction of the top left pixel showing.
+// (fx2, fy2) is the fraction of the bottom right pixel showing.
+void downsampleRowFull(size_t inCols, size_t inRows,
+                       const float* inputData, size_t y, float* outputRow)
+{
+    const size_t outRows = inRows / 2;
+    const size_t outCols = inCols / 2;
 
-    if ( !m_pyramid.size() ) return;
+    const float dx = static_cast<float>(inCols) / outCols;
+    const float dy = static_cast<float>(inRows) / outRows;
+    const float normalize = 1.0f/(dx*dy);
 
-#ifndef NDEBUG
-    assert((getElems()/4) > 0);
-    assert((getElems()/16) > 0);
-#endif
+    const size_t iy1 = (  y   * inRows) / outRows;
+    const size_t iy2 = ((y+1) * inRows) / outRows;
+    const float fy1 = (iy1+1) - y * dy;
+    const float fy2 = (y+1) * dy - iy2;
 
-    Array2Df buffer1(downscaleBy2(Y.getCols()),
-                     downscaleBy2(getRows()));
-    Array2Df buffer2(downscaleBy2(buffer1.getCols()),
-                     downscaleBy2(buffer1.getRows()));
+    for (size_t x = 0; x < outCols; x++)
+    {
+        const size_t ix1 = (  x   * inCols) / outCols;
+        const size_t ix2 = ((x+1) * inCols) / outCols;
+        const float fx1 = (ix1+1) - x * dx;
+        const float fx2 = (x+1) * dx - ix2;
+
+        float pixVal = 0.0f;
+        float factorx, factory;
+        for (size_t i = iy1; i <= iy2 && i < inRows; i++)
+        {
+            if (i == iy1)
+                factory = fy1;  // We're just getting the bottom edge of this pixel
+            else if (i == iy2)
+                factory = fy2;  // We're just gettting the top edge of this pixel
+            else
+                factory = 1.0f; // We've got the full height of this pixel
+            for (size_t j = ix1; j <= ix2 && j < inCols; j++)
+            {
+                if (j == ix1)
+                    factorx = fx1;  // We've just got the right edge of this pixel
+                else if (j == ix2)
+                    factorx = fx2; // We've just got the left edge of this pixel
+                else
+                    factorx = 1.0f; // We've got the full width of this pixel
 
-    calculateGradients(Y.data(), m_pyramid[0]);
+                pixVal += inputData[j + i*inCols] * factorx * factory;
+            }
+        }
 
-    if ( m_pyramid.size() > 1 )
-    {
-        matrixDownsample(m_pyramid[0].getCols(), m_pyramid[0].getRows(),
-                         Y.data(), buffer1.data());
-        calculateGradients(buffer1.data(), m_pyramid[1]);
+        outputRow[x] = pixVal * normalize;  // Normalize by the area of the new pixel
     }
+}
 
-    for (size_t idx = 2; idx < m_pyramid.size(); ++idx)
+// Simplified downsampling by Bruce Guenter:
+//
+// Follows exactly the same math as the full downsampling above,
+// except that inRows and inCols are known to be even.  This allows
+// for all of the boundary cases to be eliminated, reducing the
+// sampling to a simple average.
+void downsampleRowSimple(size_t inCols,
+                         const float* inputData, size_t y, float* outputRow)
+{
+    const size_t outCols = inCols / 2;
+    const float* datap = inputData + 2 * y * inCols;
+
+    for (size_t x = 0; x < outCols; x++)
     {
-        matrixDownsample(m_pyramid[idx-1].getCols(), m_pyramid[idx-1].getRows(),
-                         buffer1.data(), buffer2.data());
-        calculateGradients(buffer2.data(), m_pyramid[idx]);
+        const size_t ix1 = x*2;
 
-        buffer1.swap( buffer2 );
+        outputRow[x] = ( datap[ix1] +
+                         datap[(ix1+1)] +
+                         datap[ix1     + inCols] +
+                         datap[(ix1+1) + inCols]) * 0.25f; // / 4.0f;
     }
 }
 
-void PyramidT::computeSumOfDivergence(pfs::Array2Df& sumOfdivG)
+// Transpose of experimental downsampling matrix (theoretically the correct
+// thing to do)
+void upsampleRowFull(size_t outCols, size_t outRows,
+                     const float* inputData, size_t y, float* outputRow)
 {
-    // zero dimension Array2D
-    pfs::Array2Df tempSumOfdivG( downscaleBy2(sumOfdivG.getCols()),
-                                 downscaleBy2(sumOfdivG.getRows()) );
-    
-    if ( (numLevels() % 2) )
-    {
-        sumOfdivG.swap(tempSumOfdivG);
-        tempSumOfdivG.fill(0.0f);
-    }
-    else
-    {
-        tempSumOfdivG.fill(0.0f);
-    }
+    const size_t inRows = outRows/2;
+    const size_t inCols = outCols/2;
 
-    if ( numLevels() != 0 )
-    {
-        calculateAndAddDivergence(m_pyramid[m_pyramid.size()-1],
-                                  tempSumOfdivG.data());
-        tempSumOfdivG.swap(sumOfdivG);
-    }
+    const float dx = static_cast<float>(inCols)/outCols;
+    const float dy = static_cast<float>(inRows)/outRows;
 
-    for (int idx = numLevels()-2; idx >= 0; idx--)
+    // This gives a genuine upsampling matrix, not the transpose of the downsampling matrix
+    const float factor = 1.0f / (dx*dy);
+    // Theoretically, this should be the best.
+    // const float factor = 1.0f;
+
+    const float sy = y * dy;
+    const int iy1 =      (  y   * inRows) / outRows;
+    const int iy2 = std::min(((y+1) * inRows) / outRows, inRows-1);
+
+    for (size_t x = 0; x < outCols; x++)
     {
-        matrixUpsample(m_pyramid[idx].getCols(), m_pyramid[idx].getRows(),
-                       sumOfdivG.data(), tempSumOfdivG.data());
-        calculateAndAddDivergence(m_pyramid[idx],
-                                  tempSumOfdivG.data());
-        tempSumOfdivG.swap(sumOfdivG);
+        const float sx = x * dx;
+        const int ix1 =      (  x   * inCols) / outCols;
+        const int ix2 = std::min(((x+1) * inCols) / outCols, inCols-1);
+
+        outputRow[x] = (((ix1+1) - sx)*((iy1+1 - sy)) * inputData[ix1 + iy1*inCols] +
+                        ((ix1+1) - sx)*(sy+dy - (iy1+1)) * inputData[ix1 + iy2*inCols] +
+                        (sx+dx - (ix1+1))*((iy1+1 - sy)) * inputData[ix2 + iy1*inCols] +
+                        (sx+dx - (ix1+1))*(sy+dx - (iy1+1)) * inputData[ix2 + iy2*inCols])*factor;
     }
 }
 
-namespace
+void upsampleRowSimple(size_t outCols,
+                       const float* inputData, size_t y, float* outputRow)
 {
-struct CalculateScaleFactor
-{
-    XYGradient operator()(const XYGradient& xyGrad) const
+    const float* inp = inputData + (y/2)*(outCols/2);
+    for (size_t x = 0; x < outCols; x+=2)
     {
-        return XYGradient(calculateScaleFactor(xyGrad.gX()),
-                          calculateScaleFactor(xyGrad.gY()));
+        outputRow[x] = outputRow[x+1] = inp[x/2];
     }
-};
 }
 
-void PyramidT::computeScaleFactors( PyramidT& result ) const
-{
-    PyramidContainer::const_iterator inCurr = m_pyramid.begin();
-    PyramidContainer::const_iterator inEnd = m_pyramid.end();
+// The functions below share their rows among the threads of the enclosing
+// parallel region (or run on the calling thread, outside of one), so that a
+// whole pyramid is processed inside a single parallel region
 
-    PyramidContainer::iterator outCurr = result.m_pyramid.begin();
+void downsample(size_t inCols, size_t inRows,
+                const float* inputData, float* outputData)
+{
+    const int outRows = static_cast<int>(inRows / 2);
+    const size_t outCols = inCols / 2;
+    const bool simple = !(inCols % 2) && !(inRows % 2);
 
-    while ( inCurr != inEnd )
+#pragma omp for schedule(static)
+    for (int y = 0; y < outRows; y++)
     {
-        std::transform(inCurr->begin(), inCurr->end(), outCurr->begin(),
-                       CalculateScaleFactor());
-
-        ++outCurr;
-        ++inCurr;
+        if ( simple )
+        {
+            downsampleRowSimple(inCols, inputData, y, outputData + y*outCols);
+        }
+        else
+        {
+            downsampleRowFull(inCols, inRows, inputData, y,
+                              outputData + y*outCols);
+        }
     }
 }
 
-namespace
-{
-template<typename Traits>
-struct TransformObj
+void upsample(size_t outCols, size_t outRows,
+              const float* inputData, float* outputData)
 {
-    TransformObj(float f) : t_(f) {}
+    const bool simple = !(outCols % 2) && !(outRows % 2);
 
-    XYGradient operator()(const XYGradient& xyGrad) const
+#pragma omp for schedule(static)
+    for (int y = 0; y < static_cast<int>(outRows); y++)
     {
-        return XYGradient(t_(xyGrad.gX()),
-                          t_(xyGrad.gY()));
+        if ( simple )
+        {
+            upsampleRowSimple(outCols, inputData, y, outputData + y*outCols);
+        }
+        else
+        {
+            upsampleRowFull(outCols, outRows, inputData, y,
+                            outputData + y*outCols);
+        }
     }
-private:
-    Traits t_;
-};
 }
 
-void PyramidT::transformToR(float detailFactor)
+//! \brief X and Y gradients of the row \a ky of \a inputData into \a grad,
+//! multiplied by \a multiplier (the same row of the multipliers) when it is not
+//! NULL
+inline
+void gradientRow(const float* inputData, size_t cols, size_t rows, size_t ky,
+                 const XYGradient* multiplier, XYGradient* grad)
 {
-    PyramidContainer::iterator itCurr = m_pyramid.begin();
-    PyramidContainer::iterator itEnd = m_pyramid.end();
+    const float* lum = inputData + ky*cols;
 
-    TransformObj<TransformToR> transformFunctor(detailFactor);
+    if ( ky < rows - 1 )
+    {
+        const float* lumNext = lum + cols;
+        for (size_t kx = 0; kx < cols - 1; ++kx)
+        {
+            grad[kx] = XYGradient(lum[kx + 1] - lum[kx],
+                                  lumNext[kx] - lum[kx]);
+        }
+        // last sample of the row...
+        grad[cols - 1] = XYGradient(0.0f, lumNext[cols - 1] - lum[cols - 1]);
+    }
+    else
+    {
+        for (size_t kx = 0; kx < cols - 1; ++kx)
+        {
+            grad[kx] = XYGradient(lum[kx + 1] - lum[kx], 0.0f);
+        }
+        // last sample of the row...
+        grad[cols - 1] = XYGradient(0.0f);
+    }
 
-    while ( itCurr != itEnd )
+    if ( multiplier )
     {
-        std::transform(itCurr->begin(), itCurr->end(), itCurr->begin(),
-                       transformFunctor);
+        for (size_t kx = 0; kx < cols; ++kx)
+        {
+            grad[kx] *= multiplier[kx];
+        }
+    }
+}
 
-        ++itCurr;
+void gradients(const float* inputData, size_t cols, size_t rows,
+               XYGradient* gradient)
+{
+#pragma omp for schedule(static)
+    for (int ky = 0; ky < static_cast<int>(rows); ++ky)
+    {
+        gradientRow(inputData, cols, rows, ky, NULL, gradient + ky*cols);
     }
 }
 
-void PyramidT::transformToG(float detailFactor)
+//! \brief add to \a divG the divergence of the row \a curr, given the
+//! previous row \a prev (NULL for the first row)
+//! divG(x,y) = [Gx(x,y) - Gx(x-1,y)] + [Gy(x,y) - Gy(x,y-1)]
+inline
+void addDivergenceRow(const XYGradient* curr, const XYGradient* prev,
+                      size_t cols, float* divG)
 {
-    PyramidContainer::iterator itCurr = m_pyramid.begin();
-    PyramidContainer::iterator itEnd = m_pyramid.end();
-    
-    TransformObj<TransformToG> transformFunctor(detailFactor);
-    
-    while ( itCurr != itEnd )
+    if ( !prev )
+    {
+        divG[0] += curr[0].gX() + curr[0].gY();
+        for (size_t kx = 1; kx < cols; kx++)
+        {
+            divG[kx] += (curr[kx].gX() - curr[kx - 1].gX()) + curr[kx].gY();
+        }
+    }
+    else
     {
-        std::transform(itCurr->begin(), itCurr->end(), itCurr->begin(),
-                       transformFunctor);
-        
-        ++itCurr;
+        divG[0] += curr[0].gX() + (curr[0].gY() - prev[0].gY());
+        for (size_t kx = 1; kx < cols; kx++)
+        {
+            divG[kx] += (curr[kx].gX() - curr[kx - 1].gX()) +
+                    (curr[kx].gY() - prev[kx].gY());
+        }
     }
 }
 
-struct ScalePyramidS
+//! \brief upsample the row \a ky of \a coarser, the sum of the divergences of
+//! the coarser levels, into \a divG: zeros if \a coarser is NULL
+inline
+void upsampleCoarserRow(const float* coarser, size_t cols, size_t rows,
+                        size_t ky, float* divG)
 {
-    ScalePyramidS(float multiplier)
-        : multiplier_(multiplier)
-    {}
-    
-    void operator()(PyramidS& multiply)
+    if ( !coarser )
     {
-        pfs::utils::vsmul(multiply.data(), multiplier_,
-                          multiply.data(), multiply.size());
+        std::fill(divG, divG + cols, 0.0f);
     }
-private:
-    float multiplier_;
-};
+    else if ( !(cols % 2) && !(rows % 2) )
+    {
+        upsampleRowSimple(cols, coarser, ky, divG);
+    }
+    else
+    {
+        upsampleRowFull(cols, rows, coarser, ky, divG);
+    }
+}
 
-void PyramidT::scale(float multiplier)
+//! \brief divergence of \a G plus \a coarser, upsampled, into \a sumOfDivG
+void addDivergence(const PyramidLevel& G, const float* coarser,
+                   float* sumOfDivG)
 {
-    for_each(m_pyramid.begin(), m_pyramid.end(),
-             ScalePyramidS(multiplier));
+    const size_t cols = G.getCols();
+    const size_t rows = G.getRows();
+
+#pragma omp for schedule(static)
+    for (int ky = 0; ky < static_cast<int>(rows); ky++)
+    {
+        float* divG = sumOfDivG + ky*cols;
+        upsampleCoarserRow(coarser, cols, rows, ky, divG);
+        addDivergenceRow(G[ky], ky ? G[ky - 1] : NULL, cols, divG);
+    }
 }
 
-// scale gradients for the whole one pyramid with the use of (Cx,Cy)
-// from the other pyramid
-void PyramidT::multiply(const PyramidT &other)
+//! \brief rows of a block of \c gradientsAndDivergence()
+const size_t ROWS_PER_BLOCK = 32;
+
+//! \brief gradients of \a inputData multiplied by \a multiplier into \a G
+//! and their divergence plus \a coarser, upsampled, into \a sumOfDivG, in a
+//! single pass. The rows are processed in blocks: the gradients of the row
+//! before a block are computed again (they belong to the previous block), so
+//! that the blocks are independent and each row is still in cache when its
+//! divergence is computed
+void gradientsAndDivergence(const float* inputData,
+                            const XYGradient* multiplier,
+                            const float* coarser,
+                            PyramidLevel& G, float* sumOfDivG)
 {
-    // check that the pyramids have the same number of levels
-    assert( this->numLevels() == other.numLevels() );
-    // check that the first level of the pyramid has the same size
-    assert( this->getCols() == other.getCols() );
-    assert( this->getRows() == other.getRows() );
-    
-    PyramidContainer::const_iterator inCurr = other.m_pyramid.begin();
-    PyramidContainer::const_iterator inEnd = other.m_pyramid.end();
-    PyramidContainer::iterator outCurr = m_pyramid.begin();
+    const size_t cols = G.getCols();
+    const size_t rows = G.getRows();
+    const int blocks = static_cast<int>((rows + ROWS_PER_BLOCK - 1)/ROWS_PER_BLOCK);
+
+    std::vector<XYGradient> previous(cols);
 
-    for ( ; inCurr != inEnd ; ++outCurr, ++inCurr)
+#pragma omp for schedule(static)
+    for (int block = 0; block < blocks; ++block)
     {
-        PyramidContainer::value_type::const_iterator innerItOther = inCurr->begin();
-        PyramidContainer::value_type::iterator innerIt = outCurr->begin();
-        PyramidContainer::value_type::iterator innerItEnd = outCurr->end();
+        const size_t first = block*ROWS_PER_BLOCK;
+        const size_t last = std::min(first + ROWS_PER_BLOCK, rows);
 
-        while (innerIt != innerItEnd)
+        if ( first > 0 )
         {
-            *innerIt *= *innerItOther;
+            gradientRow(inputData, cols, rows, first - 1,
+                        multiplier + (first - 1)*cols, previous.data());
+        }
 
-            innerIt++;
-            innerItOther++;
+        for (size_t ky = first; ky < last; ++ky)
+        {
+            XYGradient* grad = G[ky];
+            gradientRow(inputData, cols, rows, ky, multiplier + ky*cols, grad);
+
+            float* divG = sumOfDivG + ky*cols;
+            upsampleCoarserRow(coarser, cols, rows, ky, divG);
+            addDivergenceRow(grad,
+                             (ky == 0) ? NULL :
+                                         (ky == first) ? previous.data() : G[ky - 1],
+                             cols, divG);
         }
     }
 }
+}
 
-// downsample the matrix
-void matrixDownsampleFull(size_t inCols, size_t inRows,
-                          const float* inputData, float* outputData)
+void PyramidT::computeGradients(const pfs::Array2Df& Y)
 {
-    const size_t outRows = inRows / 2;
-    const size_t outCols = inCols / 2;
+    assert( this->getCols() == Y.getCols() );
+    assert( this->getRows() == Y.getRows() );
 
-    const float dx = static_cast<float>(inCols) / outCols;
-    const float dy = static_cast<float>(inRows) / outRows;
-    const float normalize = 1.0f/(dx*dy);
+    const int levels = static_cast<int>(numLevels());
 
-    // New downsampling by Ed Brambley:
-    // Experimental downsampling that assumes pixels are square and
-    // integrates over each new pixel to find the average value of the
-    // underlying pixels.
-    //
-    // Consider the original pixels laid out, and the new (larger)
-    // pixels layed out over the top of them.  Then the new value for
-    // the larger pixels is just the integral over that pixel of what
-    // shows through; i.e., the values of the pixels underneath
-    // multiplied by how much of that pixel is showing.
-    //
-    // (ix1, iy1) is the coordinate of the top left visible pixel.
-    // (ix2, iy2) is the coordinate of the bottom right visible pixel.
-    // (fx1, fy1) is the fraction of the top left pixel showing.
-    // (fx2, fy2) is the fraction of the bottom right pixel showing.
-
-#pragma omp parallel for
-    for (int y = 0; y < static_cast<int>(outRows); y++)
+#pragma omp parallel if (getElems() > OMP_THRESHOLD)
     {
-        const size_t iy1 = (  y   * inRows) / outRows;
-        const size_t iy2 = ((y+1) * inRows) / outRows;
-        const float fy1 = (iy1+1) - y * dy;
-        const float fy2 = (y+1) * dy - iy2;
-
-        for (size_t x = 0; x < outCols; x++)
+        const float* image = Y.data();
+        float* next = m_images.data();
+        for (int idx = 0; idx < levels; ++idx)
         {
-            const size_t ix1 = (  x   * inCols) / outCols;
-            const size_t ix2 = ((x+1) * inCols) / outCols;
-            const float fx1 = (ix1+1) - x * dx;
-            const float fx2 = (x+1) * dx - ix2;
-
-            float pixVal = 0.0f;
-            float factorx, factory;
-            for (size_t i = iy1; i <= iy2 && i < inRows; i++)
+            PyramidLevel& level = m_pyramid[idx];
+            if ( idx > 0 )
             {
-                if (i == iy1)
-                    factory = fy1;  // We're just getting the bottom edge of this pixel
-                else if (i == iy2)
-                    factory = fy2;  // We're just gettting the top edge of this pixel
-                else
-                    factory = 1.0f; // We've got the full height of this pixel
-                for (size_t j = ix1; j <= ix2 && j < inCols; j++)
-                {
-                    if (j == ix1)
-                        factorx = fx1;  // We've just got the right edge of this pixel
-                    else if (j == ix2)
-                        factorx = fx2; // We've just got the left edge of this pixel
-                    else
-                        factorx = 1.0f; // We've got the full width of this pixel
-
-                    pixVal += inputData[j + i*inCols] * factorx * factory;
-                }
+                const PyramidLevel& previous = m_pyramid[idx-1];
+                downsample(previous.getCols(), previous.getRows(), image, next);
+
+                image = next;
+                next += level.size();
             }
+            gradients(image, level.getCols(), level.getRows(), level.data());
+        }
+    }
+}
 
-            outputData[x + y * outCols] = pixVal * normalize;  // Normalize by the area of the new pixel
+void PyramidT::computeSumOfDivergence(pfs::Array2Df& sumOfdivG)
+{
+    assert( this->getCols() == sumOfdivG.getCols() );
+    assert( this->getRows() == sumOfdivG.getRows() );
+
+    const int levels = static_cast<int>(numLevels());
+    float* const buffer = m_divergence.data();
+    float* const output = sumOfdivG.data();
+
+#pragma omp parallel if (getElems() > OMP_THRESHOLD)
+    {
+        // from the coarsest level, alternating between the buffer and the
+        // output, so that the finest level ends up in the output
+        const float* coarser = NULL;
+        for (int idx = levels - 1; idx >= 0; idx--)
+        {
+            float* current = (idx % 2) ? buffer : output;
+            addDivergence(m_pyramid[idx], coarser, current);
+
+            coarser = current;
         }
     }
 }
 
-void matrixDownsampleSimple(size_t inCols, size_t inRows,
-                            const float* inputData, float* outputData)
+void PyramidT::computeSumOfDivergence(const pfs::Array2Df& Y,
+                                      const PyramidT& multiplier,
+                                      pfs::Array2Df& sumOfdivG)
 {
-    const size_t outRows = inRows / 2;
-    const size_t outCols = inCols / 2;
+    assert( this->getCols() == Y.getCols() );
+    assert( this->getRows() == Y.getRows() );
+    assert( this->getCols() == multiplier.getCols() );
+    assert( this->getRows() == multiplier.getRows() );
+    assert( this->getCols() == sumOfdivG.getCols() );
+    assert( this->getRows() == sumOfdivG.getRows() );
 
-    // Simplified downsampling by Bruce Guenter:
-    //
-    // Follows exactly the same math as the full downsampling above,
-    // except that inRows and inCols are known to be even.  This allows
-    // for all of the boundary cases to be eliminated, reducing the
-    // sampling to a simple average.
+    const int levels = static_cast<int>(numLevels());
+    float* const buffer = m_divergence.data();
+    float* const output = sumOfdivG.data();
 
-#pragma omp parallel for
-    for (int y = 0; y < static_cast<int>(outRows); y++)
+#pragma omp parallel if (getElems() > OMP_THRESHOLD)
     {
-        const int iy1 = y * 2;
-        const float* datap = inputData + iy1 * inCols;
-        float* resp = outputData + y * outCols;
+        // all the levels of the image first...
+        const float* image = Y.data();
+        float* next = m_images.data();
+        for (int idx = 1; idx < levels; ++idx)
+        {
+            const PyramidLevel& previous = m_pyramid[idx-1];
+            downsample(previous.getCols(), previous.getRows(), image, next);
 
-        for (size_t x = 0; x < outCols; x++)
+            image = next;
+            next += m_pyramid[idx].size();
+        }
+
+        // ...then gradients and divergences, from the coarsest level, as in
+        // computeSumOfDivergence()
+        const float* coarser = NULL;
+        for (int idx = levels - 1; idx >= 0; idx--)
         {
-            const size_t ix1 = x*2;
+            float* current = (idx % 2) ? buffer : output;
+            gradientsAndDivergence(image, multiplier.m_pyramid[idx].data(),
+                                   coarser, m_pyramid[idx], current);
 
-            resp[x] = ( datap[ix1] +
-                        datap[(ix1+1)] +
-                        datap[ix1     + inCols] +
-                        datap[(ix1+1) + inCols]) * 0.25f; // / 4.0f;
+            coarser = current;
+            image = (idx > 1) ? image - m_pyramid[idx-1].size() : Y.data();
         }
     }
 }
 
-void matrixDownsample(size_t inCols, size_t inRows,
-                      const float* inputData, float* outputData)
+void PyramidT::computeScaleFactors( PyramidT& result ) const
 {
-    if ( !(inCols % 2) && !(inRows % 2) )
+    assert( m_storage.size() == result.m_storage.size() );
+
+    const XYGradient* in = m_storage.data();
+    XYGradient* out = result.m_storage.data();
+    const long size = static_cast<long>(m_storage.size());
+
+#pragma omp parallel for schedule(static) if (size > long(OMP_THRESHOLD))
+    for (long idx = 0; idx < size; ++idx)
     {
-        matrixDownsampleSimple(inCols, inRows, inputData, outputData);
+        out[idx] = XYGradient(calculateScaleFactor(in[idx].gX()),
+                              calculateScaleFactor(in[idx].gY()));
     }
-    else
+}
+
+namespace
+{
+template<typename Traits>
+void transformGradients(std::vector<XYGradient>& storage, const Traits& t)
+{
+    XYGradient* data = storage.data();
+    const long size = static_cast<long>(storage.size());
+
+#pragma omp parallel for schedule(static) if (size > long(OMP_THRESHOLD))
+    for (long idx = 0; idx < size; ++idx)
     {
-        matrixDownsampleFull(inCols, inRows, inputData, outputData);
+        data[idx] = XYGradient(t(data[idx].gX()),
+                               t(data[idx].gY()));
     }
 }
+}
 
-// upsample the matrix
-// upsampled matrix is twice bigger in each direction than data[]
-// res should be a pointer to allocated memory for bigger matrix
-// cols and rows are the dimensions of the output matrix
-void matrixUpsampleFull(const size_t outCols, const size_t outRows,
-                        const float* inputData, float* outputData)
+void PyramidT::transformToR(float detailFactor)
 {
-    const size_t inRows = outRows/2;
-    const size_t inCols = outCols/2;
+    transformGradients(m_storage, TransformToR(detailFactor));
+}
 
-    // Transpose of experimental downsampling matrix (theoretically the correct thing to do)
-    const float dx = static_cast<float>(inCols)/outCols;
-    const float dy = static_cast<float>(inRows)/outRows;
+void PyramidT::transformToG(float detailFactor)
+{
+    transformGradients(m_storage, TransformToG(detailFactor));
+}
 
-    // This gives a genuine upsampling matrix, not the transpose of the downsampling matrix
-    const float factor = 1.0f / (dx*dy);
-    // Theoretically, this should be the best.
-    // const float factor = 1.0f;
+void PyramidT::scale(float multiplier)
+{
+    XYGradient* data = m_storage.data();
+    const long size = static_cast<long>(m_storage.size());
 
-#pragma omp parallel for
-    for (int y = 0; y < static_cast<int>(outRows); y++)
+#pragma omp parallel for schedule(static) if (size > long(OMP_THRESHOLD))
+    for (long idx = 0; idx < size; ++idx)
     {
-        const float sy = y * dy;
-        const int iy1 =      (  y   * inRows) / outRows;
-        const int iy2 = std::min(((y+1) * inRows) / outRows, inRows-1);
-
-        for (size_t x = 0; x < outCols; x++)
-        {
-            const float sx = x * dx;
-            const int ix1 =      (  x   * inCols) / outCols;
-            const int ix2 = std::min(((x+1) * inCols) / outCols, inCols-1);
-
-            outputData[x + y*outCols] = (((ix1+1) - sx)*((iy1+1 - sy)) * inputData[ix1 + iy1*inCols] +
-                                         ((ix1+1) - sx)*(sy+dy - (iy1+1)) * inputData[ix1 + iy2*inCols] +
-                                         (sx+dx - (ix1+1))*((iy1+1 - sy)) * inputData[ix2 + iy1*inCols] +
-                                         (sx+dx - (ix1+1))*(sy+dx - (iy1+1)) * inputData[ix2 + iy2*inCols])*factor;
-        }
+        data[idx] *= multiplier;
     }
 }
 
-void matrixUpsampleSimple(const int outCols, const int outRows,
-                          const float* const inputData, float* const outputData)
+// scale gradients for the whole one pyramid with the use of (Cx,Cy)
+// from the other pyramid
+void PyramidT::multiply(const PyramidT &other)
 {
-#pragma omp parallel for
-    for (int y = 0; y < outRows; y++)
+    // check that the pyramids have the same number of levels
+    assert( this->numLevels() == other.numLevels() );
+    // check that the first level of the pyramid has the same size
+    assert( this->getCols() == other.getCols() );
+    assert( this->getRows() == other.getRows() );
+
+    const XYGradient* in = other.m_storage.data();
+    XYGradient* out = m_storage.data();
+    const long size = static_cast<long>(m_storage.size());
+
+#pragma omp parallel for schedule(static) if (size > long(OMP_THRESHOLD))
+    for (long idx = 0; idx < size; ++idx)
     {
-        const int iy1 = y / 2;
-        float* outp = outputData + y*outCols;
-        const float* inp = inputData + iy1*(outCols/2);
-        for (int x = 0; x < outCols; x+=2)
-        {
-            const int ix1 = x / 2;
-            outp[x] = outp[x+1] = inp[ix1];
-        }
+        out[idx] *= in[idx];
     }
 }
 
+// downsample the matrix
+void matrixDownsample(size_t inCols, size_t inRows,
+                      const float* inputData, float* outputData)
+{
+#pragma omp parallel if (inCols*inRows > OMP_THRESHOLD)
+    downsample(inCols, inRows, inputData, outputData);
+}
+
+// upsample the matrix
+// upsampled matrix is twice bigger in each direction than data[]
+// res should be a pointer to allocated memory for bigger matrix
+// cols and rows are the dimensions of the output matrix
 void matrixUpsample(size_t outCols, size_t outRows,
                     const float* inputData, float* outputData)
 {
-    if ( !(outRows%2) && !(outCols%2) )
-    {
-        matrixUpsampleSimple(outCols, outRows, inputData, outputData);
-    }
-    else
-    {
-        matrixUpsampleFull(outCols, outRows, inputData, outputData);
-    }
+#pragma omp parallel if (outCols*outRows > OMP_THRESHOLD)
+    upsample(outCols, outRows, inputData, outputData);
 }
 
 // calculate gradients
 void calculateGradients(const float* inputData, PyramidS& gradient)
 {
-    const int COLS = gradient.getCols();
-    const int ROWS = gradient.getRows();
-
-#pragma omp parallel // shared(COLS, ROWS)
-    {
-#pragma omp for nowait
-        for (int ky = 0; ky < (ROWS-1); ++ky)
-        {
-            PyramidS::iterator currGxy = gradient.row_begin(ky);
-            PyramidS::iterator endGxy = gradient.row_end(ky) - 1;
-
-            const float* currLumU = inputData + ky*COLS;
-            const float* currLumL = inputData + (ky + 1)*COLS;
-
-            while ( currGxy != endGxy )
-            {
-                currGxy->gX() = *(currLumU + 1) - *currLumU;
-                currGxy->gY() = *currLumL - *currLumU;
-
-                ++currLumL;
-                ++currLumU;
-                ++currGxy;
-            }
-            // last sample of the row...
-            currGxy->gX() = 0.0f;
-            currGxy->gY() = *currLumL - *currLumU;
-        }
-
-#pragma omp single
-        {
-            PyramidS::iterator currGxy = gradient.row_begin(ROWS-1);
-            PyramidS::iterator endGxy = gradient.row_end(ROWS-1) - 1;
-
-            const float* currLumU = inputData + (ROWS-1)*COLS;
+#pragma omp parallel if (gradient.size() > OMP_THRESHOLD)
+    gradients(inputData, gradient.getCols(), gradient.getRows(),
+              gradient.data());
+}
 
-            while ( currGxy != endGxy )
-            {
-                currGxy->gX() = *(currLumU + 1) - *currLumU;
-                currGxy->gY() = 0.0f;
+//! \brief calculate divergence of two gradient maps (Gx and Gy)
+//! divG(x,y) = [Gx(x,y) - Gx(x-1,y)] + [Gy(x,y) - Gy(x,y-1)]
+//! \note \a divG will be used purely as a temporary vector of data, to store
+//! the result. The only requirement is that \a divG size is bigger or equal
+//! to \a G size
+void calculateAndAddDivergence(const PyramidS& G, float* divG)
+{
+    const size_t cols = G.getCols();
+    const int rows = static_cast<int>(G.getRows());
 
-                ++currLumU;
-                ++currGxy;
-            }
-            // last sample of the row...
-            currGxy->gX() = 0.0f;
-            currGxy->gY() = 0.0f;
-        } // pragma omp single
-    } // pragma omp parallel
+#pragma omp parallel for schedule(static) if (G.size() > OMP_THRESHOLD)
+    for (int ky = 0; ky < rows; ky++)
+    {
+        const XYGradient* curr = G.data() + ky*cols;
+        addDivergenceRow(curr, ky ? curr - cols : NULL, cols, divG + ky*cols);
+    }
 }
 
 namespace
@@ -515,7 +682,7 @@ namespace
 const float LOG10FACTOR = 2.3025850929940456840179914546844f;
 const size_t LOOKUP_W_TO_R = 107;
 
-static float W_table[] = {
+const float W_table[] = {
     0.000000f,0.010000f,0.021180f,0.031830f,0.042628f,0.053819f,0.065556f,
     0.077960f,0.091140f,0.105203f,0.120255f,0.136410f,0.153788f,0.172518f,
     0.192739f,0.214605f,0.238282f,0.263952f,0.291817f,0.322099f,0.355040f,
@@ -533,7 +700,7 @@ static float W_table[] = {
     1081.727632f,1257.276717f,1463.784297f,1707.153398f,1994.498731f,
     2334.413424f,2737.298517f,3215.770944f,3785.169959f,4464.187290f,
     5275.653272f,6247.520102f,7414.094945f,8817.590551f,10510.080619f};
-static float R_table[] = {
+const float R_table[] = {
     0.000000f,0.009434f,0.018868f,0.028302f,0.037736f,0.047170f,0.056604f,
     0.066038f,0.075472f,0.084906f,0.094340f,0.103774f,0.113208f,0.122642f,
     0.132075f,0.141509f,0.150943f,0.160377f,0.169811f,0.179245f,0.188679f,
@@ -568,32 +735,68 @@ float lookup_table(size_t n, const float* in_tab, const float* out_tab, float va
 
     return out_tab[n-1];
 }
+
+//! \brief intervals of the uniform grids of \c ResponseTables
+const int RESPONSE_LUT_SIZE = 2048;
+
+//! \brief W_table and R_table resampled on uniform grids, so that they are
+//! indexed directly instead of searched: R over log(1 + W), in
+//! [0, log(1 + W_max)], and log(1 + W) over R, in [0, 1]
+struct ResponseTables
+{
+    ResponseTables()
+        : m_logWMax( std::log1p(W_table[LOOKUP_W_TO_R - 1]) )
+    {
+        const float maxR = R_table[LOOKUP_W_TO_R - 1];
+        for (int idx = 0; idx < RESPONSE_LUT_SIZE; ++idx)
+        {
+            const double logW = static_cast<double>(m_logWMax)*idx/RESPONSE_LUT_SIZE;
+            m_R[idx] = lookup_table(LOOKUP_W_TO_R, W_table, R_table,
+                                    std::expm1(logW));
+
+            const float R = maxR*idx/RESPONSE_LUT_SIZE;
+            m_logW[idx] = std::log1p(lookup_table(LOOKUP_W_TO_R, R_table, W_table, R));
+        }
+        m_R[RESPONSE_LUT_SIZE] = maxR;
+        m_logW[RESPONSE_LUT_SIZE] = m_logWMax;
+    }
+
+    float m_logWMax;
+    float m_R[RESPONSE_LUT_SIZE + 1];
+    float m_logW[RESPONSE_LUT_SIZE + 1];
+};
+
+const ResponseTables s_responseTables;
+
+//! \brief linear interpolation of \a table at \a pos (in grid steps, >= 0),
+//! clamped to its last value
+inline
+float interpolate(const float* table, float pos)
+{
+    // clamp before the conversion to int, which is undefined out of range
+    // (std::min returns its first argument for NaN, hence the last entry)
+    pos = std::max(0.0f, std::min(float(RESPONSE_LUT_SIZE), pos));
+
+    const int idx = std::min(static_cast<int>(pos), RESPONSE_LUT_SIZE - 1);
+    return table[idx] + (table[idx + 1] - table[idx])*(pos - idx);
+}
 }
 
+// G to W is W = 10^(|G| * LOG10FACTOR * detailFactor) - 1, hence
+// log(1 + W) = |G| * LOG10FACTOR^2 * detailFactor
 TransformToR::TransformToR(float detailFactor)
-    : m_detailFactor(LOG10FACTOR*detailFactor)
+    : m_detailFactor(LOG10FACTOR*LOG10FACTOR*detailFactor*
+                     RESPONSE_LUT_SIZE/s_responseTables.m_logWMax)
 {}
 
 // transform gradient G to R
 float TransformToR::operator ()(float currG) const
 {
-    if (currG < 0.0f)
-    {
-        // G to W
-        currG = std::pow(10, (-currG) * m_detailFactor) - 1.0f;
-        // W to RESP
-        return -lookup_table(LOOKUP_W_TO_R, W_table, R_table, currG);
-    }
-    else
-    {
-        // G to W
-        currG = std::pow(10, currG * m_detailFactor) - 1.0f;
-        // W to RESP
-        return lookup_table(LOOKUP_W_TO_R, W_table, R_table, currG);
-    }
+    const float currR = interpolate(s_responseTables.m_R,
+                                    std::fabs(currG)*m_detailFactor);
+    return (currG < 0.0f) ? -currR : currR;
 }
 
-
 TransformToG::TransformToG(float detailFactor)
     : m_detailFactor(1.0f/(LOG10FACTOR*detailFactor))
 {}
@@ -601,62 +804,10 @@ TransformToG::TransformToG(float detailFactor)
 // transform from R to G
 float TransformToG::operator ()(float currR) const
 {
-    if (currR < 0.0f)
-    {
-        // RESP to W
-        currR = lookup_table(LOOKUP_W_TO_R, R_table, W_table, -currR);
-        // W to G
-        //return -std::log(currR + 1.0f) * m_detailFactor;
-        return -std::log1p(currR) * m_detailFactor; // avoid loss of precision
-    }
-    else
-    {
-        // RESP to W
-        currR = lookup_table(LOOKUP_W_TO_R, R_table, W_table, currR);
-        // W to G
-        //return std::log(currR + 1.0f) * m_detailFactor;
-        return std::log1p(currR) * m_detailFactor; // avoid loss of precision
-    }
-}
-
-//! \brief calculate divergence of two gradient maps (Gx and Gy)
-//! divG(x,y) = [Gx(x,y) - Gx(x-1,y)] + [Gy(x,y) - Gy(x,y-1)]
-//! \note \a divG will be used purely as a temporary vector of data, to store
-//! the result. The only requirement is that \a divG size is bigger or equal
-//! to \a G size
-void calculateAndAddDivergence(const PyramidS& G, float* divG)
-{
-    const int ROWS = G.getRows();
-    const int COLS = G.getCols();
-
-    // kx = 0 AND ky = 0;
-    divG[0] += G[0][0].gX() + G[0][0].gY();                       // OUT
-
-    float divGx, divGy;
-    // ky = 0
-#pragma omp parallel for private(divGx, divGy)
-    for (int kx = 1; kx < COLS; kx++)
-    {
-        divGx = G[0][kx].gX() - G[0][kx - 1].gX();
-        divGy = G[0][kx].gY();
-        divG[kx] += divGx + divGy;                    // OUT
-    }
-#pragma omp parallel for private(divGx, divGy)
-    for (int ky = 1; ky < ROWS; ky++)
-    {
-        // kx = 0
-        divGx = G[ky][0].gX();
-        divGy = G[ky][0].gY() - G[ky - 1][0].gY();
-        divG[ky*COLS] += divGx + divGy;               // OUT
-
-        // kx > 0
-        for (int kx = 1; kx < COLS; kx++)
-        {
-            divGx = G[ky][kx].gX() - G[ky][kx - 1].gX();
-            divGy = G[ky][kx].gY() - G[ky - 1][kx].gY();
-            divG[kx + ky*COLS] += divGx + divGy;        // OUT
-        }
-    }
+    // RESP to log(1 + W), then W to G
+    const float logW = interpolate(s_responseTables.m_logW,
+                                   std::fabs(currR)*RESPONSE_LUT_SIZE);
+    return (currR < 0.0f) ? -logW*m_detailFactor : logW*m_detailFactor;
 }
 
 namespace
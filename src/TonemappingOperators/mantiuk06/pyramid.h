@@ -86,10 +86,49 @@ XYGradient operator*(const XYGradient& x, const XYGradient& y)
 
 typedef ::pfs::Array2D< XYGradient > PyramidS;
 
+//! \brief a level of a \c PyramidT: \a cols times \a rows gradients, in
+//! row-major order, inside the storage of the pyramid
+class PyramidLevel
+{
+public:
+    typedef XYGradient* iterator;
+    typedef const XYGradient* const_iterator;
+
+    PyramidLevel(XYGradient* data, size_t cols, size_t rows)
+        : m_data(data), m_cols(cols), m_rows(rows) {}
+
+    size_t getCols() const              { return m_cols; }
+    size_t getRows() const              { return m_rows; }
+    size_t size() const                 { return m_cols*m_rows; }
+
+    XYGradient* data()                  { return m_data; }
+    const XYGradient* data() const      { return m_data; }
+
+    iterator begin()                    { return m_data; }
+    iterator end()                      { return m_data + size(); }
+
+    const_iterator begin() const        { return m_data; }
+    const_iterator end() const          { return m_data + size(); }
+
+    iterator row_begin(size_t r)        { return m_data + r*m_cols; }
+    const_iterator row_begin(size_t r) const { return m_data + r*m_cols; }
+
+    iterator operator[](size_t r)       { return row_begin(r); }
+    const_iterator operator[](size_t r) const { return row_begin(r); }
+
+private:
+    XYGradient* m_data;
+    size_t m_cols;
+    size_t m_rows;
+};
+
+//! \brief Gradient pyramid: the levels share a single buffer, finest level
+//! first, so that the point-wise operations run as one parallel loop over the
+//! whole pyramid
 class PyramidT
 {
 public:
-    typedef std::vector< PyramidS > PyramidContainer;
+    typedef std::vector< PyramidLevel > PyramidContainer;
 
     // iterator
     typedef PyramidContainer::iterator iterator;
@@ -104,6 +143,9 @@ public:
     // builds a Pyramid
     PyramidT(size_t rows, size_t cols);
 
+    PyramidT(const PyramidT& other);
+    PyramidT& operator=(const PyramidT& other);
+
     inline
     size_t getRows() const      { return m_rows; }
     inline
@@ -122,6 +164,12 @@ public:
     //! \param[out] data input vector of data
     void computeSumOfDivergence(pfs::Array2Df& sumOfDivG);
 
+    //! \brief computeGradients(), multiply() by \a multiplier and
+    //! computeSumOfDivergence() in a single pass over each level
+    void computeSumOfDivergence(const pfs::Array2Df& inputData,
+                                const PyramidT& multiplier,
+                                pfs::Array2Df& sumOfDivG);
+
     //! \param[out] result PyramidT structure that contains the scaling factors!
     void computeScaleFactors(PyramidT& result) const;
 
@@ -137,12 +185,22 @@ public:
     void multiply(const PyramidT& multiplier);
 
 private:
+    //! \brief carve the levels out of \c m_storage
+    void buildLevels();
+
     //! \brief number of rows for the higher level of the pyramid
     size_t m_rows;
     //! \brief number of cols for the higher level of the pyramid
     size_t m_cols;
-    //! \brief container of PyramidS
+    //! \brief gradients of all the levels
+    std::vector< XYGradient > m_storage;
+    //! \brief views of the levels inside \c m_storage
     PyramidContainer m_pyramid;
+    //! \brief the input image downsampled to all the levels but the first
+    std::vector< float > m_images;
+    //! \brief sum of the divergences of the odd levels, of the size of the
+    //! second level
+    std::vector< float > m_divergence;
 };
 
 // free functions (mostly in the header file to improve testability)
@@ -165,6 +223,8 @@ void calculateAndAddDivergence(const PyramidS& G, float* divG);
 float calculateScaleFactor(float g);
 
 //! \brief transform gradient \a G to R
+//! \note G to W is exponential and W to R is a table lookup: both are folded
+//! in a table of R over log(1 + W) on a uniform grid, indexed directly
 struct TransformToR
 {
     TransformToR(float detailFactor);
@@ -174,6 +234,7 @@ private:
 };
 
 //! \brief transform from \a R to G
+//! \note as \c TransformToR, with a table of log(1 + W) over R
 struct TransformToG
 {
     TransformToG(float detailFactor);
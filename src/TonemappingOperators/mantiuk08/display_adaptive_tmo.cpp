@@ -44,15 +44,12 @@
 
 #include "display_adaptive_tmo.h"
 
-#include <gsl/gsl_vector.h>
-#include <gsl/gsl_matrix.h>
-#include <gsl/gsl_blas.h>
-#include <gsl/gsl_interp.h>
-#include "cqp/gsl_cqp.h"
+#include "tonecurve_qp.h"
 
 #include "Libpfs/progress.h"
 #include "Libpfs/array2d.h"
-#include "Libpfs/utils/sse.h"
+#include "Libpfs/colorspace/restorecolor.h"
+#include "Libpfs/utils/statistics.h"
 
 #ifdef BRANCH_PREDICTION
 #define likely(x)       __builtin_expect((x),1)
@@ -68,45 +65,6 @@
 #define MIN_PHVAL 1e-8f          // Minimum value allowed in HDR images
 #define MAX_PHVAL 1e8f           // Maximum value allowed in HDR images
 
-/**
- *  Simple RAII wrapper for gsl_matrix
- */
-class auto_matrix
-{
-      gsl_matrix *m;
-
-   public:
-      auto_matrix(gsl_matrix *m): m(m) {}
-      ~auto_matrix() { gsl_matrix_free(m); }
-      operator gsl_matrix* () { return m; }
-};
-
-/**
- *  Simple RAII wrapper for gsl_vector
- */
-class auto_vector
-{
-      gsl_vector *v;
-
-   public:
-      auto_vector(gsl_vector *v): v(v) {}
-      ~auto_vector() { gsl_vector_free(v); }
-      operator gsl_vector* () { return v; }
-};
-
-/**
- *  Simple RAII wrapper for gsl_cqpminimizer
- */
-class auto_cqpminimizer
-{
-      gsl_cqpminimizer *v;
-
-   public:
-      auto_cqpminimizer(gsl_cqpminimizer *v): v(v) {}
-      ~auto_cqpminimizer() { gsl_cqpminimizer_free(v); }
-      operator gsl_cqpminimizer* () { return v; }
-};
-
 // =============== Tone-curve filtering ==============
 
 datmoToneCurve::datmoToneCurve() : own_y_i( false ), x_i( NULL ), y_i( NULL )
@@ -147,47 +105,18 @@ void datmoToneCurve::free()
 
 static inline float safe_log10( float x, const float min_x = MIN_PHVAL, const float max_x = MAX_PHVAL )
 {
-  if( x < min_x )
-    return log10(min_x);
-  else if( x > max_x )
-    return log10(max_x);
-  else return log10( x );
-}
-
-#ifdef LUMINANCE_USE_SSE
-
-#define LOG2_10 3.3219280948874f
-#define LOG2_10__1 (1.0f/LOG2_10)
-static inline v4sf safe_log10( v4sf x, const float min_x = MIN_PHVAL, const float max_x = MAX_PHVAL )
-{
-  x = _mm_max_ps(x, _mm_set1_ps(min_x));
-  x = _mm_min_ps(x, _mm_set1_ps(max_x));
-  return _mm_log2_ps(x) * _mm_set1_ps(LOG2_10__1);
+  // no branches, so that loops calling it can be vectorized
+  return std::log10( std::min( std::max( x, min_x ), max_x ) );
 }
 
-#endif
-
 /**
  * Find the lowest non-zero value. Used to avoid log10(0).
  */
 static float min_positive( const float *x, size_t len )
 {
-  float min_val = MAX_PHVAL;
-  for( size_t k=0; k < len; k++ )
-    if( unlikely(x[k] < min_val && x[k] > 0) )
-      min_val = x[k];
-
-  return min_val;
+  return std::min( pfs::utils::computeStatistics( x, len ).minPositive, MAX_PHVAL );
 }
 
-  
-static void mult_rows( const gsl_matrix *A, const gsl_vector *b, gsl_matrix *C )
-{
-  assert( A->size1 == b->size );
-  for( size_t j=0; j < A->size2; j++ )
-    for( size_t i=0; i < A->size1; i++ ) 
-      gsl_matrix_set( C, i, j, gsl_matrix_get(A,i,j)*gsl_vector_get(b,i) );        
-}
 
 /**
  * Lookup table on a uniform array & interpolation
@@ -282,70 +211,73 @@ static void dumpPFS( const char *fileName, const int width, const int height, fl
 #endif
 
 
-static void compute_gaussian_level( const int width, const int height,
-                                    const pfs::Array2Df& in, pfs::Array2Df& out, int level, pfs::Array2Df& temp )
-{
+// Separable kernel of the gaussian pyramid, its taps are 2^level pixels apart
+static const int gauss_kernel_len = 5;
+static const float gauss_kernel_a = 0.4f;
+static const float gauss_kernel[gauss_kernel_len] = { 0.25f - gauss_kernel_a/2.f,
+                                                      0.25f,
+                                                      gauss_kernel_a,
+                                                      0.25f,
+                                                      0.25f - gauss_kernel_a/2.f };
 
-  const float kernel_a = 0.4f;
-
-  const int kernel_len = 5;
-  const int kernel_len_2 = kernel_len/2;
-  const float kernel[kernel_len] = { 0.25f - kernel_a/2.f,
-                                     0.25f,
-                                     kernel_a,
-                                     0.25f,
-                                     0.25f - kernel_a/2.f };
+/**
+ * Mirror an index out of [0, size) back into it
+ */
+static inline int mirror_index( int l, const int size )
+{
+  if( unlikely( l < 0 ) )
+    l = -l;
+  if( unlikely( l >= size ) )
+    l = 2*size - 2 - l;
+  // very coarse levels of very small images
+  return std::max( 0, std::min( l, size-1 ) );
+}
 
+/**
+ * Filter the rows of 'in' with the kernel of pyramid level 'level'
+ */
+static void gaussian_filter_rows( const int width, const int height,
+                                  const float* in, float* out, const int level )
+{
   const int step = 1<<level;
 
-  // FIXME: without the following (with using operator () ) there
-  // seems to be a performance drop - need to investigate if gcc can
-  // be made to optimize this better.  If this can't be made faster
-  // with using the overloaded operator then this optimization should
-  // be applied to the other TMOs as well.
-  const float* in_raw = in.data();
-  float* temp_raw = temp.data();
-  float* out_raw = out.data();
-
-  // Filter rows
-#pragma omp parallel for default(none) shared(in_raw, temp_raw, kernel)
+#pragma omp parallel for
   for( int r=0; r < height; r++ ) {
+    const float* in_row = in + r*width;
+    float* out_row = out + r*width;
     for( int c=0; c < width; c++ ) {
       float sum = 0;
-      for( int j=0; j< kernel_len; j++ ) {
-        int l = (j-kernel_len_2)*step+c;
-        if( unlikely( l < 0 ) )
-          l = -l;
-        if( unlikely( l >= width ) )
-          l = 2*width - 2 - l;
-        sum += in_raw[r*width+l] * kernel[j];
-      }
-      temp_raw[r*width+c] = sum;
-    }    
+      for( int j=0; j < gauss_kernel_len; j++ )
+        sum += in_row[mirror_index( (j-gauss_kernel_len/2)*step+c, width )] * gauss_kernel[j];
+      out_row[c] = sum;
+    }
   }
-    
-  // Filter columns
-#pragma omp parallel for default(none) shared(temp_raw, out_raw, kernel)
-  for( int c=0; c < width; c++ ) {
-    for( int r=0; r < height; r++ ) {
-      float sum = 0;
-      for( int j=0; j< kernel_len; j++ ) {
-        int l = (j-kernel_len_2)*step+r;
-        if( unlikely(l < 0) )
-          l = -l;
-        if( unlikely(l >= height) )
-          l = 2*height - 2 - l;
-        sum += temp_raw[l*width+c] * kernel[j];
-      }
-      out_raw[r*width+c] = sum;
-    }    
-  }    
 }
 
-static inline float clamp_channel( const float v )
+/**
+ * Filter the columns of 'in' with the kernel of pyramid level 'level',
+ * computing the single row 'r' of the output. The row is a weighted sum of
+ * five rows of the input, so memory is read sequentially (walking down the
+ * columns touches one float per cache line).
+ */
+static inline void gaussian_filter_columns_row( const int width, const int height,
+                                                const float* in, float* out_row,
+                                                const int r, const int level )
 {
-  return (v > MIN_PHVAL ? v : MIN_PHVAL);  
+  const int step = 1<<level;
+
+  const float* rows[gauss_kernel_len];
+  for( int j=0; j < gauss_kernel_len; j++ )
+    rows[j] = in + mirror_index( (j-gauss_kernel_len/2)*step+r, height )*width;
+
+  for( int c=0; c < width; c++ ) {
+    float sum = 0;
+    for( int j=0; j < gauss_kernel_len; j++ )
+      sum += rows[j][c] * gauss_kernel[j];
+    out_row[c] = sum;
+  }
 }
+
   
 /** Compute conditional probability density function
  */
@@ -449,24 +381,66 @@ std::unique_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int
   const float min_val = std::max( min_positive( L, pix_count ), MIN_PHVAL );
   
   // Compute log10 of an image
-#pragma omp parallel for default(none) shared(LP_high_raw, L)
-#ifndef LUMINANCE_USE_SSE
+#pragma omp parallel for
   for( int i=0; i < pix_count; i++ )
     LP_high_raw[i] = safe_log10( L[i], min_val );
-#else
-  for( int i=0; i < pix_count-3; i+=4 )
-    _mm_store_ps(&LP_high_raw[i], safe_log10( _mm_load_ps(&L[i]), min_val ));
-  // In case pix_count%4 > 0
-  for( int i=pix_count-3; i < pix_count; i++ )
-    LP_high_raw[i] = safe_log10( L[i], min_val );
-#endif
   
-  bool warn_out_of_range = false;
+  int warn_out_of_range = 0;
   C->total = 0;
+
+  const int hist_size = C->x_count*C->g_count;
   
   for( int f=0; f<C->f_count; f++ ) {
-      
-    compute_gaussian_level( width, height, *LP_high, *LP_low, f, temp );
+
+    gaussian_filter_rows( width, height, LP_high->data(), temp.data(), f );
+
+    const int gi_tp = C->g_count/2+1;
+    const int gi_tn = C->g_count/2-1;
+    const int gi_t = C->g_count/2;
+    const float* high_raw = LP_high->data();
+    const float* temp_raw = temp.data();
+    float* low_raw = LP_low->data();
+    double* C_f = &(*C)(0,0,f);
+
+    // The column pass of the filter is fused with the histogram of the
+    // band-pass, so each row is binned while it is still in the cache. Every
+    // thread fills its own histogram: the counts are integers, so merging
+    // them in any order gives the same result as the serial loop.
+#pragma omp parallel
+    {
+      std::vector<double> hist( hist_size, 0. );
+
+#pragma omp for reduction(|:warn_out_of_range)
+      for( int r=0; r < height; r++ ) {
+        const float* high_row = high_raw + r*width;
+        float* low_row = low_raw + r*width;
+        gaussian_filter_columns_row( width, height, temp_raw, low_row, r, f );
+
+        for( int c=0; c < width; c++ ) {
+          float g = high_row[c] - low_row[c]; // Compute band-pass
+          int x_i = round_int( (low_row[c] - C->l_min)/C->delta );
+          if( unlikely(x_i < 0 || x_i >= C->x_count) ) {
+            warn_out_of_range = 1;
+            continue;
+          }
+          int g_i = round_int( (g + C->g_max) / C->delta );
+          if( unlikely(g_i < 0 || g_i >= C->g_count) )
+            continue;
+
+          if( g > thr && g < C->delta/2 ) {
+            // above the threshold +
+            hist[x_i + gi_tp*C->x_count]++;
+          } else if( g < -thr && g > -C->delta/2 ) {
+            // above the threshold -
+            hist[x_i + gi_tn*C->x_count]++;
+          } else hist[x_i + g_i*C->x_count]++;
+        }
+      }
+
+#pragma omp critical
+      for( int i=0; i < hist_size; i++ )
+        C_f[i] += hist[i];
+    }
 
 // For debug purposes only
 #ifdef DEBUG	
@@ -474,32 +448,6 @@ std::unique_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int
     sprintf( fname, "l_%d.pfs", f+1 );
     dumpPFS( fname, width, height, LP_low, "Y" );
 #endif	
-    
-    const int gi_tp = C->g_count/2+1;
-    const int gi_tn = C->g_count/2-1;
-    const int gi_t = C->g_count/2;
-    // Can't parallelize this loop due to the increments on shared data
-    // at the end, and making those increments critical sections makes
-    // things worse.
-    for( int i=0; i < pix_count; i++ ) {
-      float g = (*LP_high)(i) - (*LP_low)(i); // Compute band-pass
-      int x_i = round_int( ((*LP_low)(i) - C->l_min)/C->delta );
-      if( unlikely(x_i < 0 || x_i >= C->x_count) ) {
-        warn_out_of_range = true;
-        continue;
-      }
-      int g_i = round_int( (g + C->g_max) / C->delta );
-      if( unlikely(g_i < 0 || g_i >= C->g_count) )
-        continue;
-        
-      if( g > thr && g < C->delta/2 ) {
-        // above the threshold + 
-        (*C)(x_i,gi_tp,f)++;
-      } else if( g < -thr && g > -C->delta/2 ) {
-        // above the threshold -
-        (*C)(x_i,gi_tn,f)++;          
-      } else (*C)(x_i,g_i,f)++;        
-    }
 
     for( int i = 0; i < C->x_count; i++ ) {      
       // Special case: flat field and no gradients
@@ -546,108 +494,6 @@ std::unique_ptr<datmoConditionalDensity> datmo_compute_conditional_density( int
   
 
 
-// =============== Quadratic programming solver ==============
-
-const static gsl_matrix null_matrix = {0,0,0,0,0,0};          
-const static gsl_vector null_vector = {0,0,0,0,0};          
-
-/* objective function: 0.5*(x^t)Qx+(q^t)x */
-/* constraints: Cx>=d */
-/* Ax=b; is not used in our problem */
-static int solve( gsl_matrix *Q, gsl_vector *q, gsl_matrix *C, gsl_vector *d, gsl_vector *x)
-{
-
-  gsl_cqp_data cqpd;
-  
-  cqpd.Q = Q;
-  cqpd.q = q;
-
-  // Do not use any equality constraints (Ax=b)
-          
-  // Unfortunatelly GSL does not allow for 0-size vectors and matrices
-  // As a work-around we create a phony gsl_matrix that has 0-size.
-  // This matrix must not be passed to any gsl function!
-          
-  cqpd.A = &null_matrix;
-  cqpd.b = &null_vector;
-  
-  cqpd.C = C;
-  cqpd.d = d;
-
-  size_t n = cqpd.Q->size1;
-  size_t me = cqpd.b->size;
-  size_t mi = cqpd.d->size;  
-  
-  const size_t max_iter = 100;
-	
-  size_t iter=1;
-	
-  int status;
-	
-  const gsl_cqpminimizer_type * T;
-	
-  T = gsl_cqpminimizer_mg_pdip;
-  auto_cqpminimizer s(gsl_cqpminimizer_alloc(T, n, me, mi));
-	
-  status = gsl_cqpminimizer_set(s, &cqpd);
-  
-  const bool verbose = false;
-
-  if( verbose ) fprintf( stderr, "== Itn ======= f ======== ||gap|| ==== ||residual||\n\n");
-	
-  do
-  {		
-    status = gsl_cqpminimizer_iterate(s);
-    status = gsl_cqpminimizer_test_convergence(s, 1e-10, 1e-10);
-		  
-    if( verbose ) fprintf( stderr, "%4lu   %14.8f  %13.6e  %13.6e\n", iter, gsl_cqpminimizer_f(s), gsl_cqpminimizer_gap(s), gsl_cqpminimizer_residuals_norm(s));
-		  
-    if(status == GSL_SUCCESS)
-    {
-      size_t j;
-      if( verbose ) {
-        fprintf( stderr, "\nMinimum is found at\n");
-        for(j=0; j<gsl_cqpminimizer_x(s)->size; j++)
-          fprintf( stderr, "%9.6f ",gsl_vector_get(gsl_cqpminimizer_x(s), j));
-        fprintf( stderr, "\n\n");
-      }
-      
-      
-//       printf("\nLagrange-multipliers for Ax=b\n");
-//       for(j=0; j<gsl_cqpminimizer_lm_eq(s)->size; j++)
-//         printf("%9.6f ",gsl_vector_get(gsl_cqpminimizer_lm_eq(s), j));
-//       printf("\n\n");
-      
-//       printf("\nLagrange-multipliers for Cx>=d\n");
-//       for(j=0; j<gsl_cqpminimizer_lm_ineq(s)->size; j++)
-//         printf("%9.6f ",gsl_vector_get(gsl_cqpminimizer_lm_ineq(s), j));
-//       printf("\n\n");
-    }  
-    else
-    {
-      iter++;
-    }  
-    
-  }
-  while(status == GSL_CONTINUE && iter<=max_iter);
-
-  bool valid_solution = true;
-
-  // If the solver bahaves instable, stop at this point
-  if( status != GSL_SUCCESS ) {
-    if( gsl_cqp_minimizer_test_infeasibility( s, 1e-10 ) != GSL_SUCCESS )
-      valid_solution = false;
-  }
-  
-  if( valid_solution )
-    gsl_vector_memcpy( x, gsl_cqpminimizer_x(s) );
-
-	
-  return GSL_SUCCESS;
-}
-
-
-
 // =============== HVS functions ==============
 
 static double contrast_transducer( double C, double sensitivity, datmoVisualModel visual_model )
@@ -723,13 +569,13 @@ static double csf_datmo( double rho, double l_adapt, datmoVisualModel visual_mod
   return csf_daly( rho, 0, l_adapt, 1 );
 }
 
-static void compute_y( double *y, const gsl_vector *x, int *skip_lut, int x_count, int L, double Ld_min, double Ld_max )
+static void compute_y( double *y, const double *x, int *skip_lut, int x_count, int L, double Ld_min, double Ld_max )
 {
   double sum_d = 0;
   double alpha = 1;
   for( int k=0; k < L; k++ )
   {
-    sum_d += gsl_vector_get( x, k );
+    sum_d += x[k];
   }
   double cy = log10(Ld_min) + alpha*(log10(Ld_max)-log10(Ld_min) - sum_d);
   double dy;
@@ -746,10 +592,10 @@ static void compute_y( double *y, const gsl_vector *x, int *skip_lut, int x_coun
       if( j == (x_count-1) ) { // The last node
         dy = 0;
         y[i] = cy;
-        cy += gsl_vector_get( x, skip_lut[i] );
+        cy += x[skip_lut[i]];
         continue;
       } else 
-        dy = gsl_vector_get( x, skip_lut[i] ) / (double)(j-i);
+        dy = x[skip_lut[i]] / (double)(j-i);
     }
     y[i] = cy;
     cy += dy;      
@@ -760,6 +606,23 @@ static void compute_y( double *y, const gsl_vector *x, int *skip_lut, int x_coun
 
 // =============== Tone mapping ==============
 
+/**
+ * Columns of the matrix A for the segments between nodes 'from' and 'to':
+ * the segments which are not skipped are numbered consecutively, so the
+ * columns are the range [col_from, col_to)
+ */
+static void segment_columns( const std::vector<int>& skip_lut, int from, int to, int& col_from, int& col_to )
+{
+  col_from = col_to = 0;
+  for( int l = from; l <= to-1; l++ ) {
+    if( skip_lut[l] == -1 )
+      continue;
+    if( col_from == col_to )
+      col_from = skip_lut[l];
+    col_to = skip_lut[l]+1;
+  }
+}
+
 /**
  * Solve the quadratic programming problem to find the optimal tone
  * curve for the given conditional denstity structure.
@@ -852,18 +715,15 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
 
   // Ale = [eye(interval_count); -ones(1,interval_count)];
   
-  auto_matrix Ale(gsl_matrix_calloc(L+1, L));
-  gsl_matrix_set_identity( Ale );
-  gsl_matrix_view lower_row = gsl_matrix_submatrix( Ale, L, 0, 1, L );
-  gsl_matrix_set_all( &lower_row.matrix, -1 );
-
   // ble = [zeros(interval_count,1); -d_dr];
-  auto_vector ble(gsl_vector_calloc(L+1));
-  gsl_vector_set( ble, L, -d_dr );  
- 
-  auto_matrix A(gsl_matrix_calloc(M, L));
-  auto_vector B(gsl_vector_alloc(M));
-  auto_vector N(gsl_vector_alloc(M));
+  // (both are implicit in solve_tonecurve_qp())
+
+  // Every row of A is a range of ones: the segments between two nodes.
+  // Row k is stored as the columns [A_from[k], A_to[k])
+  std::vector<int> A_from(M);
+  std::vector<int> A_to(M);
+  std::vector<double> B(M);
+  std::vector<double> N(M);
 
   std::vector<size_t> band(M);  // Frequency band (index)
   std::vector<size_t> back_x(M); // Background luminance (index) 
@@ -884,21 +744,17 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
         const int to = std::max(i,j);
         
 //      A(k,min(i,j):(max(i,j)-1)) = 1;
-        for( int l = from; l <= to-1; l++ ) {          
-          if( skip_lut[l] == -1 )
-            continue;
-          gsl_matrix_set( A, k, skip_lut[l], 1 );
-        }        
+        segment_columns( skip_lut, from, to, A_from[k], A_to[k] );
 
         if( scene_l_adapt == -1 ) {
           sensitivity = csf_lut[f].interp( C->x_scale[from] );
         }
 
 //      B(k,1) = l_scale(max(i,j)) - l_scale(min(i,j));
-        gsl_vector_set( B, k, contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity, visual_model ) );
+        B[k] = contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity, visual_model );
 
 //      N(k,k) = jpf(j-i+max_neigh+1,i,band);
-        gsl_vector_set( N, k, (*C)(i,j-i+max_neigh,f) );
+        N[k] = (*C)(i,j-i+max_neigh,f);
 
         band[k] = f;
         back_x[k] = i;
@@ -908,13 +764,9 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
   }
   
   if( white_y > 0 ) {
-    for( int l = white_i; l < C->x_count-1; l++ ) {          
-      if( skip_lut[l] == -1 )
-        continue;
-      gsl_matrix_set( A, k, skip_lut[l], 1 );
-    }        
-    gsl_vector_set( B, k, 0 );        
-    gsl_vector_set( N, k, C->total * 0.1 ); // Strength of reference white anchoring
+    segment_columns( skip_lut, white_i, C->x_count-1, A_from[k], A_to[k] );
+    B[k] = 0;
+    N[k] = C->total * 0.1; // Strength of reference white anchoring
     band[k] = 0;
     back_x[k] = white_i;
     k++;    
@@ -930,13 +782,9 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
         while( !used_var[to] )
           to++;
         assert( k < M );
-        for( int l = from; l <= to-1; l++ ) {          
-          if( skip_lut[l] == -1 )
-            continue;
-          gsl_matrix_set( A, k, skip_lut[l], 1 );
-        }        
+        segment_columns( skip_lut, from, to, A_from[k], A_to[k] );
         //const double sensitivity = csf_daly( C->f_scale[C->f_count-1], 0., 1000., 1. );
-        //gsl_vector_set( B, k, contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity ) );
+        //B[k] = contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity );
         double sensitivity;
         if( scene_l_adapt == -1 ) {
           sensitivity = csf_lut[C->f_count-1].interp( C->x_scale[from] );
@@ -944,9 +792,9 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
           sensitivity = csf_datmo( C->f_scale[C->f_count-1], scene_l_adapt, visual_model );
 
         // const double sensitivity = csf_datmo( C->f_scale[C->f_count-1], scene_l_adapt, visual_model );
-        gsl_vector_set( B, k, contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity, visual_model ) );
+        B[k] = contrast_transducer( (C->x_scale[to] - C->x_scale[from])*enh_factor, sensitivity, visual_model );
 
-        gsl_vector_set( N, k, C->total * 0.1 ); // Strength of framework anchoring
+        N[k] = C->total * 0.1; // Strength of framework anchoring
         band[k] = C->f_count-1;
         back_x[k] = to;
         k++;
@@ -955,17 +803,15 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
     }
   }
 
-  auto_matrix H(gsl_matrix_alloc(L, L));
-  auto_vector f(gsl_vector_alloc(L));
-  auto_matrix NA(gsl_matrix_alloc(M, L));
-  auto_matrix AK(gsl_matrix_alloc(M, L)); 
-  auto_vector Ax(gsl_vector_alloc(M));
-  auto_vector K(gsl_vector_alloc(M));
-  auto_vector x(gsl_vector_alloc(L));
-  auto_vector x_old(gsl_vector_alloc(L));
+  std::vector<double> H(L*L);
+  std::vector<double> f(L);
+  std::vector<double> D((L+1)*(L+1));
+  std::vector<double> Ax(M);
+  std::vector<double> K(M);
+  std::vector<double> x(L, d_dr/L);
+  std::vector<double> x_old(L);
+  std::vector<double> x_sum(L+1);
 
-  gsl_vector_set_all( x, d_dr/L );
-  
   int max_iter = 200;
   if( !(visual_model & vm_contrast_masking) )
           max_iter = 1;
@@ -975,49 +821,72 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
 //    fprintf( stderr, "Iteration #%d\n", it );
 
     // Compute y values for the current solution
-    compute_y( y, x, &skip_lut[0], C->x_count, L, dm->display(0), dm->display(1) );
+    compute_y( y, &x[0], &skip_lut[0], C->x_count, L, dm->display(0), dm->display(1) );
 
     // Ax = A*x
-    gsl_blas_dgemv( CblasNoTrans, 1, A, x, 0, Ax ); 
+    x_sum[0] = 0;
+    for( int i=0; i < L; i++ )
+      x_sum[i+1] = x_sum[i] + x[i];
+    for( int k=0; k < M; k++ )
+      Ax[k] = x_sum[A_to[k]] - x_sum[A_from[k]];
 
     // T(rng{band}) = cont_transd( Ax(rng{band}), band, DD(rng{band},:)*y' ) ./ Axd(rng{band});
     for( int k=0; k < M; k++ ){
       double sensitivity = csf_lut[band[k]].interp( y[back_x[k]] );
-      const double Ax_k = gsl_vector_get( Ax, k );
+      const double Ax_k = Ax[k];
       const double denom = (fabs(Ax_k) < 0.0001 ? 1. : Ax_k );
-      //gsl_vector_set( K, k, contrast_transducer( Ax_k, sensitivity ) / denom );
-      gsl_vector_set( K, k, contrast_transducer( Ax_k, sensitivity, visual_model ) / denom );
+      //K[k] = contrast_transducer( Ax_k, sensitivity ) / denom;
+      K[k] = contrast_transducer( Ax_k, sensitivity, visual_model ) / denom;
     }
 
-    // AK = A*K;
-    mult_rows( A, K, AK );  
-        
-    // NA = N*A;
-    mult_rows( AK, N, NA );  
-  
-    // H = AK'*NA;
-    gsl_blas_dgemm( CblasTrans, CblasNoTrans, 1, AK, NA, 0, H );
-  
-    // f = -B'*NA = - NA' * B;
-    gsl_blas_dgemv( CblasTrans, -1, NA, B, 0, f );
+    // H = (A.*K)'*N*(A.*K);
+    // f = -B'*N*(A.*K);
+    // Each row of A adds its weight to a square block of H and to a range of
+    // f: accumulate the corners in difference arrays, then integrate them
+    std::fill( D.begin(), D.end(), 0. );
+    std::fill( f.begin(), f.end(), 0. );
+    for( int k=0; k < M; k++ ) {
+      const int from = A_from[k];
+      const int to = A_to[k];
+      if( from == to )
+        continue;
+      const double w = N[k]*K[k]*K[k];
+      D[from*(L+1)+from] += w;
+      D[from*(L+1)+to] -= w;
+      D[to*(L+1)+from] -= w;
+      D[to*(L+1)+to] += w;
+
+      const double b = N[k]*K[k]*B[k];
+      f[from] -= b;
+      if( to < L )
+        f[to] += b;
+    }
+    for( int i=1; i < L; i++ )
+      f[i] += f[i-1];
+    for( int i=0; i < L; i++ ) {
+      double row_sum = 0;
+      for( int j=0; j < L; j++ ) {
+        row_sum += D[i*(L+1)+j];
+        H[i*L+j] = row_sum + (i > 0 ? H[(i-1)*L+j] : 0.);
+      }
+    }
 
-    gsl_vector_memcpy( x_old, x );
-    
-    solve( H, f, Ale, ble, x );
+    x_old = x;
 
-    /*
-    if (status == GSL_FAILURE)
-    {
-        std::cout << "GSL_FAILURE" << std::endl;
-        return PFSTMO_ERROR;
+    // warm start from the previous solution
+    if( !solve_tonecurve_qp( H, f, d_dr, x ) ) {
+      // no optimum within the iterations: keep the previous tone curve
+      // rather than a partial one, as it was done when the interior-point
+      // solver became unstable
+      x = x_old;
+      break;
     }
-    */
 
     // Check for convergence
     double min_delta = (C->x_scale[1]-C->x_scale[0])/10.; // minimum acceptable change
     bool converged = true;
     for( int i=0; i < L; i++ ) {
-      double delta = fabs( gsl_vector_get(x,i) - gsl_vector_get(x_old,i) );
+      double delta = fabs( x[i] - x_old[i] );
       if( delta > min_delta ) {
         converged = false;
         break;
@@ -1031,10 +900,10 @@ static int optimize_tonecurve( datmoConditionalDensity *C_pub, DisplayFunction *
 	return PFSTMO_ABORTED; // PFSTMO_OK is right 
   
 //   for( int i=0; i < L; i++ )
-//     fprintf( stderr, "%9.6f ", gsl_vector_get( x, i ) );
+//     fprintf( stderr, "%9.6f ", x[i] );
 //   fprintf( stderr, "\n" );
 
-  compute_y( y, x, &skip_lut[0], C->x_count, L, dm->display(0), dm->display(1) );
+  compute_y( y, &x[0], &skip_lut[0], C->x_count, L, dm->display(0), dm->display(1) );
 
   return PFSTMO_OK;
 }
@@ -1050,6 +919,42 @@ int datmo_compute_tone_curve( datmoToneCurve *tc, datmoConditionalDensity *cond_
 
 
 
+namespace
+{
+//! \brief tone curve and color correction of a pixel, from its luminance
+struct ToneCurveCC
+{
+  ToneCurveCC( UniformArrayLUT& tc_lut, UniformArrayLUT& cc_lut ) :
+    tc_lut( &tc_lut ), cc_lut( &cc_lut )
+  {}
+
+  void operator()( size_t, float Y, float& L, float& s ) const
+  {
+    const float logY = log10( Y );
+    L = tc_lut->interp( logY );
+    s = cc_lut->interp( logY );
+  }
+
+  UniformArrayLUT* tc_lut;
+  UniformArrayLUT* cc_lut;
+};
+
+//! \brief pixel values of the display for a luminance
+struct InverseDisplay
+{
+  explicit InverseDisplay( DisplayFunction *df ) :
+    df( df )
+  {}
+
+  float operator()( float L ) const
+  {
+    return df->inv_display( L );
+  }
+
+  DisplayFunction *df;
+};
+}
+
 /**
  * Apply tone curve with color correction (http://zgk.wi.ps.pl/color_correction/)
  */
@@ -1075,31 +980,13 @@ int datmo_apply_tone_curve_cc( float *R_out, float *G_out, float *B_out, int wid
   }
   cc_lut.y_i[tc->size-1] = 1;
   
-  const long pix_count = width*height;
-
-#pragma omp parallel for default(none) shared(R_in,G_in,B_in,L_in,R_out,G_out,B_out,tc_lut,cc_lut,df)
-  for (long i=0; i < pix_count; i++)
-  {
-    float L_fix = clamp_channel(L_in[i]);
-    const float L_out = tc_lut.interp( log10(L_fix) );
-    const float s = cc_lut.interp( log10(L_fix) ); // color correction
-#ifdef LUMINANCE_USE_SSE
-    v4sf vec = _mm_set_ps(R_in[i], G_in[i], B_in[i], 0) / _mm_set1_ps(L_fix);
-    vec = _mm_max_ps(vec, _mm_set1_ps(MIN_PHVAL));
-    vec = _mm_pow_ps(vec, _mm_set1_ps(s));
-    vec = vec * _mm_set1_ps(L_out);
-    vec = df->inv_display(vec);
-    float tmp[4];
-    _mm_store_ps(tmp, vec);
-    R_out[i] = tmp[3];
-    G_out[i] = tmp[2];
-    B_out[i] = tmp[1];
-#else
-    R_out[i] = df->inv_display(powf(clamp_channel(R_in[i]/L_fix), s) * L_out);
-    G_out[i] = df->inv_display(powf(clamp_channel(G_in[i]/L_fix), s) * L_out);
-    B_out[i] = df->inv_display(powf(clamp_channel(B_in[i]/L_fix), s) * L_out);
-#endif
-  }
+  pfs::colorspace::restoreColor(pfs::CS_RGB, R_in, G_in, B_in,
+                                pfs::colorspace::LuminanceArray(L_in, MIN_PHVAL),
+                                ToneCurveCC(tc_lut, cc_lut),
+                                InverseDisplay(df),
+                                pfs::CS_RGB, R_out, G_out, B_out,
+                                static_cast<size_t>(width)*height,
+                                MIN_PHVAL);
 
   return PFSTMO_OK;  
 }
@@ -39,11 +39,32 @@
 #include "Libpfs/progress.h"
 #include "Libpfs/frame.h"
 #include "Libpfs/colorspace/colorspace.h"
+#include "TonemappingOperators/pfstmo.h"
 #include "display_adaptive_tmo.h"
 
 using namespace std;
 
+namespace
+{
+//! \brief image statistics: they only depend on the input luminance
+struct Mantiuk08Analysis : public TmoAnalysis
+{
+  explicit Mantiuk08Analysis(std::unique_ptr<datmoConditionalDensity> C)
+    : m_C(std::move(C))
+  {}
+
+  std::unique_ptr<datmoConditionalDensity> m_C;
+};
+}
+
 void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast_enhance_factor, float white_y, bool setluminance, pfs::Progress &ph)
+{
+  TmoAnalysisPtr analysis;
+  pfstmo_mantiuk08(frame, saturation_factor, contrast_enhance_factor, white_y,
+                   setluminance, analysis, ph);
+}
+
+void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast_enhance_factor, float white_y, bool setluminance, TmoAnalysisPtr& analysis, pfs::Progress &ph)
 {
   //--- default tone mapping parameters;
   //float contrast_enhance_factor = 1.f;
@@ -85,10 +106,10 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
   ds->print( stderr );
 #endif
 
-  pfs::Channel *inX, *inY, *inZ;
-  frame.getXYZChannels(inX, inY, inZ);
+  pfs::Channel *inR, *inG, *inB;
+  frame.getXYZChannels(inR, inG, inB);
 
-  if ( !inX || !inY || !inZ )
+  if ( !inR || !inG || !inB )
   {
       if (df != NULL)
           delete df;
@@ -98,8 +119,8 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
   const int cols = frame.getWidth();
   const int rows = frame.getHeight();
   
-  pfs::Array2Df R( cols, rows );
-  pfs::transformColorSpace(pfs::CS_XYZ, inX, inY, inZ, pfs::CS_RGB, inX, &R, inZ);
+  pfs::Array2Df Y( cols, rows );
+  pfs::transformRGB2Y(inR, inG, inB, &Y);
   
   if( white_y == -2.f )
   {
@@ -128,13 +149,22 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
   }
 */
 
-  std::unique_ptr<datmoConditionalDensity> C = datmo_compute_conditional_density( cols, rows, inY->data(), ph);
-  if( C.get() == NULL )
+  Mantiuk08Analysis* statistics = dynamic_cast<Mantiuk08Analysis*>(analysis.get());
+  if( statistics == NULL )
   {
-    delete df;
-    delete ds;
-    throw pfs::Exception("failed to analyse the image");
+    std::unique_ptr<datmoConditionalDensity> C = datmo_compute_conditional_density( cols, rows, Y.data(), ph);
+    if( C.get() == NULL )
+    {
+      delete df;
+      delete ds;
+      throw pfs::Exception("failed to analyse the image");
+    }
+
+    std::shared_ptr<Mantiuk08Analysis> new_statistics(new Mantiuk08Analysis(std::move(C)));
+    analysis = new_statistics;
+    statistics = new_statistics.get();
   }
+  datmoConditionalDensity* C = statistics->m_C.get();
   
   datmoTCFilter rc_filter( fps, log10(df->display(0)), log10(df->display(1)) );
 
@@ -142,7 +172,7 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
   datmoToneCurve *tc = rc_filter.getToneCurvePtr();
 
   int res;
-  res = datmo_compute_tone_curve( tc, C.get(), df, ds, contrast_enhance_factor, white_y, visual_model, scene_l_adapt, ph);
+  res = datmo_compute_tone_curve( tc, C, df, ds, contrast_enhance_factor, white_y, visual_model, scene_l_adapt, ph);
   if( res != PFSTMO_OK )
   {
     delete df;
@@ -152,8 +182,8 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
 
   datmoToneCurve *tc_filt = rc_filter.filterToneCurve();
 
-  res = datmo_apply_tone_curve_cc( inX->data(), R.data(), inZ->data(),
-          cols, rows, inX->data(), R.data(), inZ->data(), inY->data(), tc_filt, df, saturation_factor );
+  res = datmo_apply_tone_curve_cc( inR->data(), inG->data(), inB->data(),
+          cols, rows, inR->data(), inG->data(), inB->data(), Y.data(), tc_filt, df, saturation_factor );
   if( res != PFSTMO_OK )
   {
     delete df;
@@ -163,7 +193,6 @@ void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast
 
   ph.setValue( 100 );
 
-  pfs::transformColorSpace( pfs::CS_RGB, inX, &R, inZ, pfs::CS_XYZ, inX, inY, inZ );
   frame.getTags().setTag("LUMINANCE", "DISPLAY");
 
   delete df;
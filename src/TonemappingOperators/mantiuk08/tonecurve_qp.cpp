@@ -0,0 +1,238 @@
+/**
+ * @brief Quadratic programming solver for the tone curve of the Display
+ * Adaptive TMO
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "tonecurve_qp.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+/**
+ * Cholesky factorization of the n*n matrix A (row major), in place in its
+ * lower triangle. Pivots are kept away from zero: a segment which is barely
+ * constrained by the image makes H close to singular.
+ */
+void cholesky( std::vector<double>& A, int n )
+{
+  double max_diag = 0;
+  for( int i=0; i < n; i++ )
+    max_diag = std::max( max_diag, A[i*n+i] );
+  const double min_pivot = std::max( max_diag*1e-12, 1e-300 );
+
+  for( int j=0; j < n; j++ ) {
+    double* row_j = &A[j*n];
+    double d = row_j[j];
+    for( int k=0; k < j; k++ )
+      d -= row_j[k]*row_j[k];
+    const double l = std::sqrt( std::max( d, min_pivot ) );
+    row_j[j] = l;
+
+    for( int i=j+1; i < n; i++ ) {
+      double* row_i = &A[i*n];
+      double s = row_i[j];
+      for( int k=0; k < j; k++ )
+        s -= row_i[k]*row_j[k];
+      row_i[j] = s/l;
+    }
+  }
+}
+
+/**
+ * Solve L*L'*x = b, with L computed by cholesky(). b is replaced by x.
+ */
+void cholesky_solve( const std::vector<double>& L, int n, std::vector<double>& b )
+{
+  for( int i=0; i < n; i++ ) {
+    double s = b[i];
+    for( int k=0; k < i; k++ )
+      s -= L[i*n+k]*b[k];
+    b[i] = s/L[i*n+i];
+  }
+  for( int i=n-1; i >= 0; i-- ) {
+    double s = b[i];
+    for( int k=i+1; k < n; k++ )
+      s -= L[k*n+i]*b[k];
+    b[i] = s/L[i*n+i];
+  }
+}
+}
+
+bool solve_tonecurve_qp( const std::vector<double>& H, const std::vector<double>& f,
+                         double d_max, std::vector<double>& x )
+{
+  const int n = f.size();
+  if( n == 0 )
+    return true;
+
+  // Feasible starting point
+  if( (int)x.size() != n )
+    x.assign( n, d_max/n );
+  double sum = 0;
+  for( int i=0; i < n; i++ ) {
+    x[i] = std::max( x[i], 0. );
+    sum += x[i];
+  }
+  if( sum > d_max ) {
+    for( int i=0; i < n; i++ )
+      x[i] *= d_max/sum;
+    sum = d_max;
+  }
+  if( sum == 0 )
+    x.assign( n, d_max/n );
+
+  // Working set: segments held at 0 and the dynamic range constraint
+  std::vector<char> at_bound( n );
+  for( int i=0; i < n; i++ )
+    at_bound[i] = (x[i] == 0);
+  bool sum_active = (sum >= d_max);
+
+  // Multipliers are negligible below this value
+  double scale = 0;
+  for( int i=0; i < n; i++ )
+    scale = std::max( scale, std::max( std::fabs( f[i] ), H[i*n+i]*d_max ) );
+  const double tolerance = 1e-10*scale;
+
+  std::vector<int> free_idx;
+  std::vector<double> L, u, v;
+  std::vector<double> z( n );
+
+  const int max_iter = 10*(n+1);
+  for( int it=0; it < max_iter; it++ ) {
+
+    free_idx.clear();
+    for( int i=0; i < n; i++ )
+      if( !at_bound[i] )
+        free_idx.push_back( i );
+    const int m = free_idx.size();
+
+    // Minimum on the working set: H_FF*z_F = -f_F - mu, where mu is the
+    // multiplier of the dynamic range constraint if it is active
+    std::fill( z.begin(), z.end(), 0. );
+    double mu = 0;
+    if( m > 0 ) {
+      L.resize( m*m );
+      for( int a=0; a < m; a++ )
+        for( int b=0; b < m; b++ )
+          L[a*m+b] = H[free_idx[a]*n+free_idx[b]];
+      cholesky( L, m );
+
+      u.resize( m );
+      for( int a=0; a < m; a++ )
+        u[a] = -f[free_idx[a]];
+      cholesky_solve( L, m, u );
+
+      if( sum_active ) {
+        v.assign( m, 1. );
+        cholesky_solve( L, m, v );
+        double sum_u = 0, sum_v = 0;
+        for( int a=0; a < m; a++ ) {
+          sum_u += u[a];
+          sum_v += v[a];
+        }
+        mu = (sum_u - d_max)/sum_v;
+        for( int a=0; a < m; a++ )
+          u[a] -= mu*v[a];
+      }
+      for( int a=0; a < m; a++ )
+        z[free_idx[a]] = u[a];
+    }
+
+    // Move towards z, until a constraint not in the working set blocks
+    double alpha = 1;
+    int blocking = -1;
+    bool blocking_sum = false;
+    for( int a=0; a < m; a++ ) {
+      const int i = free_idx[a];
+      if( z[i] < 0 ) {
+        const double alpha_i = x[i]/(x[i] - z[i]);
+        if( alpha_i < alpha ) {
+          alpha = alpha_i;
+          blocking = i;
+        }
+      }
+    }
+    if( !sum_active ) {
+      double sum_x = 0, sum_z = 0;
+      for( int a=0; a < m; a++ ) {
+        sum_x += x[free_idx[a]];
+        sum_z += z[free_idx[a]];
+      }
+      if( sum_z > d_max ) {
+        const double alpha_sum = std::max( d_max - sum_x, 0. )/(sum_z - sum_x);
+        if( alpha_sum < alpha ) {
+          alpha = alpha_sum;
+          blocking = -1;
+          blocking_sum = true;
+        }
+      }
+    }
+
+    for( int a=0; a < m; a++ ) {
+      const int i = free_idx[a];
+      x[i] += alpha*(z[i] - x[i]);
+    }
+
+    if( blocking_sum ) {
+      sum_active = true;
+      continue;
+    }
+    if( blocking != -1 ) {
+      at_bound[blocking] = 1;
+      x[blocking] = 0;
+      continue;
+    }
+
+    // x = z: optimal if no multiplier is negative, otherwise the constraint
+    // with the most negative one leaves the working set
+    int worst = -1;
+    double worst_lambda = -tolerance;
+    bool worst_sum = false;
+    if( sum_active && mu < worst_lambda ) {
+      worst_lambda = mu;
+      worst_sum = true;
+    }
+    for( int i=0; i < n; i++ ) {
+      if( !at_bound[i] )
+        continue;
+      // gradient of the objective along x_i
+      double g = f[i];
+      for( int a=0; a < m; a++ )
+        g += H[i*n+free_idx[a]]*z[free_idx[a]];
+      const double lambda = g + (sum_active ? mu : 0.);
+      if( lambda < worst_lambda ) {
+        worst_lambda = lambda;
+        worst = i;
+        worst_sum = false;
+      }
+    }
+
+    if( worst_sum )
+      sum_active = false;
+    else if( worst != -1 )
+      at_bound[worst] = 0;
+    else
+      return true;
+  }
+
+  return false;
+}
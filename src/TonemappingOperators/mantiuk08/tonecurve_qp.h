@@ -0,0 +1,50 @@
+/**
+ * @brief Quadratic programming solver for the tone curve of the Display
+ * Adaptive TMO
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef TONECURVE_QP_H
+#define TONECURVE_QP_H
+
+#include <vector>
+
+/**
+ * Minimize 0.5*x'*H*x + f'*x subject to x >= 0 and sum(x) <= d_max.
+ *
+ * This is the problem solved at every iteration of the tone curve
+ * optimization: x are the heights of the segments of the (monotonic) tone
+ * curve and d_max is the dynamic range of the display. Primal active-set
+ * method: every step solves the problem restricted to the free segments with
+ * a dense Cholesky factorization, there are no more than a couple of hundreds
+ * of them.
+ *
+ * @param H symmetric positive definite n*n matrix, row major
+ * @param f vector of n elements
+ * @param d_max bound of the sum of x, must be > 0
+ * @param x on input the starting point (ie: the solution of the previous
+ * iteration, projected onto the feasible set if needed), on output the
+ * solution. If empty, the starting point spreads d_max evenly.
+ * @return true if the solution satisfies the optimality conditions, false if
+ * the iterations ran out (x is feasible anyway)
+ */
+bool solve_tonecurve_qp( const std::vector<double>& H, const std::vector<double>& f,
+                         double d_max, std::vector<double>& x );
+
+#endif
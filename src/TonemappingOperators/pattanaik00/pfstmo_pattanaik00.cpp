@@ -44,15 +44,16 @@
 
 namespace
 {
-void multiplyChannels( pfs::Array2Df& X, pfs::Array2Df& Y, pfs::Array2Df& Z, float mult )
+void multiplyChannels( pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B, float mult )
 {
-    int size = Y.getCols() * Y.getRows();
+    int size = G.getCols() * G.getRows();
 
+#pragma omp parallel for
     for ( int i=0 ; i<size; i++ )
     {
-        X(i) *= mult;
-        Y(i) *= mult;
-        Z(i) *= mult;
+        R(i) *= mult;
+        G(i) *= mult;
+        B(i) *= mult;
     }
 }
 }
@@ -81,11 +82,11 @@ void pfstmo_pattanaik00(pfs::Frame& frame,
 
     std::unique_ptr<VisualAdaptationModel> am(new VisualAdaptationModel());
 
-    pfs::Channel *X, *Y, *Z;
-    frame.getXYZChannels( X, Y, Z );
+    pfs::Channel *R, *G, *B;
+    frame.getXYZChannels( R, G, B );
     //---
 
-    if ( Y==NULL || X==NULL || Z==NULL)
+    if ( R==NULL || G==NULL || B==NULL)
     {
         throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
     }
@@ -93,9 +94,17 @@ void pfstmo_pattanaik00(pfs::Frame& frame,
     frame.getTags().setTag("LUMINANCE", "RELATIVE");
     // adaptation model
     if ( multiplier != 1.0f ) {
-        multiplyChannels(*X, *Y, *Z, multiplier );
+        multiplyChannels(*R, *G, *B, multiplier );
     }
 
+    // the operator works on the RGB channels of the frame, it only needs the
+    // luminance on the side
+    int w = R->getWidth();
+    int h = R->getHeight();
+
+    pfs::Array2Df Y(w,h);
+    pfs::transformRGB2Y(R, G, B, &Y);
+
     if( !local )
     {
         if( !timedependence )
@@ -103,22 +112,13 @@ void pfstmo_pattanaik00(pfs::Frame& frame,
             if( !autolum )
                 am->setAdaptation(Acone, Arod);
             else
-                am->setAdaptation(*Y);
+                am->setAdaptation(Y);
         }
         else
-            am->calculateAdaptation(*Y, 1.0f/fps);
+            am->calculateAdaptation(Y, 1.0f/fps);
     }
     // tone mapping
-    int w = Y->getWidth();
-    int h = Y->getHeight();
-
-    pfs::Array2Df R(w,h);
-    pfs::Array2Df G(w,h);
-    pfs::Array2Df B(w,h);
-
-    pfs::transformColorSpace( pfs::CS_XYZ, X, Y, Z, pfs::CS_RGB, &R, &G, &B );
-    tmo_pattanaik00( R, G, B, *Y, am.get(), local, ph );
-    pfs::transformColorSpace( pfs::CS_RGB, &R, &G, &B, pfs::CS_XYZ, X, Y, Z );
+    tmo_pattanaik00( *R, *G, *B, Y, am.get(), local, ph );
 
     if (!ph.canceled())
     {
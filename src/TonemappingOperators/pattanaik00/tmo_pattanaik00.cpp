@@ -31,11 +31,14 @@
  * $Id: tmo_pattanaik00.cpp,v 1.3 2008/11/04 23:43:08 rafm Exp $
  */
 
+#include <algorithm>
 #include <cmath>
 
 #include "tmo_pattanaik00.h"
 
 #include "TonemappingOperators/pfstmo.h"
+#include "TonemappingOperators/tonecurve_lut.h"
+#include "Libpfs/utils/statistics.h"
 #include "Libpfs/pfs.h"
 #include "Libpfs/array2d.h"
 #include "Libpfs/progress.h"
@@ -102,6 +105,126 @@ void calculateLocalAdaptation(const pfs::Array2Df& Y, int x, int y, float& Acone
 }
 }
 
+namespace
+{
+//! \brief response of the receptors, function of the luminance only when the
+//! adaptation is global: how much the colour ratios are compressed (Scolor)
+//! and the terms of the cones and of the rods of the output
+class GlobalResponse
+{
+public:
+    GlobalResponse(float Bcone, float Brod, float sigma_cone, float sigma_rod,
+                   float S_d, float disp_x, float disp_y, float disp_z,
+                   float display_sigma, float display_white)
+        : Bcone(Bcone), Brod(Brod), sigma_cone(sigma_cone), sigma_rod(sigma_rod)
+        , S_d(S_d), disp_x(disp_x), disp_y(disp_y), disp_z(disp_z)
+        , display_sigma(display_sigma), display_white(display_white)
+    {}
+
+    void operator()(float l, float& Scolor, float& Icone, float& Irod) const
+    {
+        // receptor responses
+        float Rrod = Brod*model_response(l, sigma_rod );
+        float Rcone = Bcone*model_response(l, sigma_cone );
+        float Rlum = Rrod + Rcone;
+        if( Rlum>0.0f )
+        {
+            Rrod /= Rlum;
+            Rcone /= Rlum;
+        }
+
+        Scolor = (Bcone*pow(sigma_cone,n)*n*pow(l,n))
+                / pow( pow(l,n)+pow(sigma_cone,n), 2 );
+        Scolor /= S_d;
+
+        // appearance model
+        float Ra = (Rlum - disp_x)*disp_y+disp_z;
+        Ra = (Ra<1.0f) ? ((Ra>0.0f) ? Ra : 0.0f ) : 0.9999999f;
+
+        // inverse display model
+        float I = display_sigma * pow(Ra/(1.0f-Ra), 1.0f/n) / display_white;
+
+        Icone = I*Rcone;
+        Irod = I*Rrod;
+    }
+
+private:
+    float Bcone, Brod, sigma_cone, sigma_rod, S_d;
+    float disp_x, disp_y, disp_z, display_sigma, display_white;
+};
+
+//! \brief one of the outputs of GlobalResponse, as a tone curve
+class GlobalResponseCurve
+{
+public:
+    GlobalResponseCurve(const GlobalResponse& response, int output)
+        : m_response(response)
+        , m_output(output)
+    {}
+
+    float operator()(float l) const
+    {
+        float out[3];
+        m_response(l, out[0], out[1], out[2]);
+        return out[m_output];
+    }
+
+private:
+    const GlobalResponse& m_response;
+    int m_output;
+};
+
+//! \brief global adaptation: the response is compiled in three tone curves of
+//! the luminance, only the compression of the colour ratios is left per
+//! channel
+void tonemapGlobal(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
+                   const pfs::Array2Df& Y, const GlobalResponse& response,
+                   pfs::Progress& ph)
+{
+    const size_t size = Y.getCols()*Y.getRows();
+    const pfs::utils::Statistics range = pfs::utils::computeRange(Y.data(), size);
+    const float minLum = std::min(range.minPositive, range.max);
+
+    ToneCurveLut curves[3];
+    for ( int k=0 ; k < 3 ; k++ )
+    {
+        curves[k].compile(minLum, range.max, GlobalResponseCurve(response, k));
+    }
+
+    float* channels[] = {R.data(), G.data(), B.data()};
+    const float* lum = Y.data();
+
+    pfs::ProgressReporter progress(ph, size, 0, 100, 16384);
+    const long chunks = progress.chunks();
+
+#pragma omp parallel for schedule(dynamic)
+    for ( long c=0 ; c < chunks ; c++ )
+    {
+        if ( progress.canceled() )
+            continue;
+        size_t begin, end;
+        progress.chunk(c, begin, end);
+
+        for ( size_t i=begin ; i < end ; i++ )
+        {
+            const float l = lum[i];
+            // the curves share the grid
+            const ToneCurveLut::Position p = curves[0].position(l);
+            const float Scolor = curves[0].value(p);
+            const float Icone = curves[1].value(p);
+            const float Irod = curves[2].value(p);
+
+            for ( int k=0 ; k < 3 ; k++ )
+            {
+                float v = pow( channels[k][i]/l, Scolor )*Icone + Irod;
+                channels[k][i] = (v<1.0f) ? ((v>0.0f) ? v : 0.0f) : 1.0f;
+            }
+        }
+        progress.advance(end - begin);
+    }
+}
+}
+
 // tone mapping operator code
 void tmo_pattanaik00(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
                      const pfs::Array2Df& Y,
@@ -203,6 +326,17 @@ void tmo_pattanaik00(pfs::Array2Df& R, pfs::Array2Df& G, pfs::Array2Df& B,
 
     int im_width = Y.getCols();
     int im_height = Y.getRows();
+
+    if ( !local )
+    {
+        // with global adaptation the response only depends on the luminance
+        const GlobalResponse response(Bcone, Brod, sigma_cone, sigma_rod, S_d,
+                                      disp_x, disp_y, disp_z,
+                                      display_sigma, display_white);
+        tonemapGlobal(R, G, B, Y, response, ph);
+        return;
+    }
+
     for ( int x=0 ; x < im_width ; x++ )
     {
         ph.setValue(100*x/im_width);
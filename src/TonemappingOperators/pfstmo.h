@@ -29,6 +29,9 @@
 #ifndef PFSTMO_H
 #define PFSTMO_H
 
+#include <cstddef>
+#include <memory>
+
 namespace pfs
 {
 class Frame;
@@ -48,16 +51,70 @@ class Progress;
 #define PFSTMO_ABORTED        -1      /* User aborted (from callback) */
 #define PFSTMO_ERROR          -2      /* Failed, encountered error */
 
+//! \brief Intermediate results of an operator that only depend on the input
+//! frame and on some of its parameters (the "analysis" stage).
+//!
+//! Operators supporting it take a \c TmoAnalysisPtr: if empty it is filled
+//! with the analysis of the current frame, otherwise its content is reused and
+//! only the cheap "synthesis" stage runs. The caller must guarantee that
+//! neither the input frame nor the analysis parameters changed in between
+//! (see TonemapSession).
+class TmoAnalysis
+{
+public:
+    virtual ~TmoAnalysis() {}
+};
+
+typedef std::shared_ptr<TmoAnalysis> TmoAnalysisPtr;
+
+//! \brief Statistics of the whole frame an operator depends on besides the
+//! pixels it processes (ie: log average luminance, range of the output).
+//!
+//! Operators supporting it take a \c TmoGlobalsPtr: if empty it is filled
+//! with the statistics of the input frame, otherwise the input is taken as a
+//! region of the frame the statistics were measured on, possibly at another
+//! resolution, and they replace the statistics of the region. The region is
+//! then tonemapped as it looks in the whole frame (see
+//! TonemapOperator::tonemapRegion()).
+class TmoGlobals
+{
+public:
+    TmoGlobals()
+        : m_left(0.f)
+        , m_top(0.f)
+        , m_scale(1.f)
+    {}
+
+    virtual ~TmoGlobals() {}
+
+    //! \brief position of the input in the frame the statistics were measured
+    //! on: pixel (x, y) of the input is at (m_left + x*m_scale,
+    //! m_top + y*m_scale) in that frame. Set by the caller before reusing the
+    //! statistics on a region.
+    float m_left;
+    float m_top;
+    float m_scale;
+};
+
+typedef std::shared_ptr<TmoGlobals> TmoGlobalsPtr;
+
 void pfstmo_ashikhmin02(pfs::Frame& frame, bool simple_flag, float lc_value, int eq, pfs::Progress &ph);
+void pfstmo_ashikhmin02(pfs::Frame& frame, bool simple_flag, float lc_value, int eq, TmoGlobalsPtr& globals, pfs::Progress &ph);
 void pfstmo_drago03(pfs::Frame& frame, float biasValue, pfs::Progress& ph);
 void pfstmo_durand02(pfs::Frame& frame, float sigma_s, float sigma_r, float baseContrast, pfs::Progress &ph);
+void pfstmo_durand02(pfs::Frame& frame, float sigma_s, float sigma_r, float baseContrast, TmoAnalysisPtr& analysis, pfs::Progress &ph);
+void pfstmo_durand02(pfs::Frame& frame, float sigma_s, float sigma_r, float baseContrast, TmoAnalysisPtr& analysis, TmoGlobalsPtr& globals, pfs::Progress &ph);
 void pfstmo_fattal02(pfs::Frame& frame, float opt_alpha, float opt_beta, float opt_saturation, float opt_noise, bool newfattal, bool fftsolver, int detail_level, pfs::Progress &ph);
+void pfstmo_fattal02(pfs::Frame& frame, float opt_alpha, float opt_beta, float opt_saturation, float opt_noise, bool newfattal, bool fftsolver, int detail_level, TmoAnalysisPtr& analysis, pfs::Progress &ph);
 void pfstmo_ferradans11(pfs::Frame& frame, float opt_rho, float opt_inv_alpha, pfs::Progress &ph);
 void pfstmo_mai11(pfs::Frame& frame, pfs::Progress &ph);
 void pfstmo_mantiuk06(pfs::Frame& frame, float scaleFactor, float saturationFactor, float detailFactor, bool cont_eq, pfs::Progress &ph);
+void pfstmo_mantiuk06(pfs::Frame& frame, float scaleFactor, float saturationFactor, float detailFactor, bool cont_eq, TmoAnalysisPtr& analysis, pfs::Progress &ph);
 void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast_enhance_factor, float white_y, bool setluminance, pfs::Progress &ph);
+void pfstmo_mantiuk08(pfs::Frame& frame, float saturation_factor, float contrast_enhance_factor, float white_y, bool setluminance, TmoAnalysisPtr& analysis, pfs::Progress &ph);
 void pfstmo_pattanaik00(pfs::Frame& frame, bool local, float multiplier, float Acone, float Arod, bool autolum, pfs::Progress &ph);
 void pfstmo_reinhard02 (pfs::Frame& frame, float key, float phi, int num, int low, int high, bool use_scales, pfs::Progress &ph);
+void pfstmo_reinhard02 (pfs::Frame& frame, float key, float phi, int num, int low, int high, bool use_scales, TmoGlobalsPtr& globals, pfs::Progress &ph);
 void pfstmo_reinhard05(pfs::Frame& frame, float brightness, float chromaticadaptation, float lightadaptation, pfs::Progress &ph);
 
 #endif
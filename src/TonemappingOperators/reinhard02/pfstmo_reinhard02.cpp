@@ -37,6 +37,10 @@
 
 #include "Libpfs/frame.h"
 #include "Libpfs/exception.h"
+#include "Libpfs/colorspace/colorspace.h"
+#include "Libpfs/colorspace/restorecolor.h"
+#include "Libpfs/colorspace/rgb.h"
+#include "TonemappingOperators/pfstmo.h"
 #include "tmo_reinhard02.h"
 
 namespace pfs
@@ -44,7 +48,51 @@ namespace pfs
 class Progress;
 }
 
+namespace
+{
+//! \brief log average and maximum luminance of the whole frame
+struct Reinhard02Globals : public TmoGlobals
+{
+    double m_avgLuminance;
+    double m_maxLuminance;
+};
+
+void luminanceStatistics(const pfs::Array2Df& Y, double& avg, double& max)
+{
+  const int size = static_cast<int>(Y.size());
+
+  double sum = 0.;
+  float maxY = 0.f;
+#pragma omp parallel
+  {
+    double threadSum = 0.;
+    float threadMax = 0.f;
+#pragma omp for nowait
+    for (int i = 0; i < size; i++)
+    {
+      // same offset as Reinhard02::log_average()
+      threadSum += log( 0.00001 + Y(i) );
+      threadMax = ( Y(i) > threadMax ) ? Y(i) : threadMax;
+    }
+#pragma omp critical
+    {
+      sum += threadSum;
+      maxY = ( threadMax > maxY ) ? threadMax : maxY;
+    }
+  }
+
+  avg = exp( sum / size );
+  max = maxY;
+}
+}
+
 void pfstmo_reinhard02(pfs::Frame& frame, float key, float phi, int num, int low, int high, bool use_scales, pfs::Progress &ph )
+{
+  TmoGlobalsPtr globals;
+  pfstmo_reinhard02(frame, key, phi, num, low, high, use_scales, globals, ph);
+}
+
+void pfstmo_reinhard02(pfs::Frame& frame, float key, float phi, int num, int low, int high, bool use_scales, TmoGlobalsPtr& globals, pfs::Progress &ph )
 {
   //--- default tone mapping parameters;
   //float key = 0.18;
@@ -63,39 +111,42 @@ void pfstmo_reinhard02(pfs::Frame& frame, float key, float phi, int num, int low
   std::cout << ", upper scale: " << high;
   std::cout << ", use scales: " << use_scales << ")" << std::endl;
 #endif
-  pfs::Channel *X, *Y, *Z;
-  frame.getXYZChannels( X, Y, Z );
+  pfs::Channel *R, *G, *B;
+  frame.getXYZChannels( R, G, B );
   //---
 
-  if ( Y==NULL || X==NULL || Z==NULL ) {
+  if ( R==NULL || G==NULL || B==NULL ) {
      throw pfs::Exception( "Missing X, Y, Z channels in the PFS stream" );
   }
 
   frame.getTags().setTag("LUMINANCE", "RELATIVE");
   // tone mapping
-  size_t w = Y->getWidth();
-  size_t h = Y->getHeight();
+  size_t w = R->getWidth();
+  size_t h = R->getHeight();
+  pfs::Array2Df Y(w, h);
   pfs::Array2Df L(w, h);
 
-  Reinhard02 tmoperator( Y, &L, use_scales, key, phi, num, low, high, temporal_coherent, ph );
+  pfs::transformRGB2Y(R, G, B, &Y);
 
-  tmoperator.tmo_reinhard02();
-
-  // TODO: this section can be rewritten using SSE Function
-  for (size_t x = 0; x < w; x++)
+  Reinhard02Globals* stats = dynamic_cast<Reinhard02Globals*>(globals.get());
+  if ( stats == NULL )
   {
-    for (size_t y = 0; y < h; y++)
-    {
-      float yr = (*Y)(x,y);
-      float scale = 0.f;
-      if (yr != 0.f)
-      {
-         scale = L(x,y) / yr;
-      }
-
-      (*Y)(x,y) *= scale;
-      (*X)(x,y) *= scale;
-      (*Z)(x,y) *= scale;
-    }
+    std::shared_ptr<Reinhard02Globals> new_stats(new Reinhard02Globals);
+    luminanceStatistics(Y, new_stats->m_avgLuminance, new_stats->m_maxLuminance);
+
+    globals = new_stats;
+    stats = new_stats.get();
   }
+
+  Reinhard02 tmoperator( &Y, &L, use_scales, key, phi, num, low, high, temporal_coherent, ph );
+  tmoperator.setLuminanceStatistics(stats->m_avgLuminance, stats->m_maxLuminance);
+
+  tmoperator.tmo_reinhard02();
+
+  // RGB in, sRGB out
+  pfs::colorspace::restoreColor(pfs::CS_RGB, *R, *G, *B,
+                                pfs::colorspace::LuminanceArray(Y),
+                                pfs::colorspace::ToneArray(L),
+                                pfs::colorspace::ConvertRGB2SRGB(),
+                                pfs::CS_RGB, *R, *G, *B);
 }
@@ -105,6 +105,11 @@ void Reinhard02::tonemap_image ()
 
   if (m_white < 1e20)
     Lmax2 = m_white * m_white;
+  else if (m_fixed_statistics)
+  {
+    Lmax2 = m_fixed_max_luminance * m_key / m_fixed_avg_luminance;
+    Lmax2 *= Lmax2;
+  }
   else
   {
     if( m_temporal_coherent ) {
@@ -173,7 +178,9 @@ void Reinhard02::scale_to_midtone ()
   int    hh          = m_cvts.ymax >> 1;
 
   double avg;
-  if( m_temporal_coherent ) {
+  if( m_fixed_statistics )
+    avg = m_fixed_avg_luminance;
+  else if( m_temporal_coherent ) {
     m_avg_luminance.set( log_average() );
     avg = m_avg_luminance.get();
   } else avg = log_average();
@@ -278,6 +285,9 @@ Reinhard02::Reinhard02(const pfs::Array2Df *Y, pfs::Array2Df* L,
     , m_key(key)
     , m_phi(phi)
     , m_white(1e20)
+    , m_fixed_statistics(false)
+    , m_fixed_avg_luminance(1.)
+    , m_fixed_max_luminance(1.)
     , m_range(num)
     , m_scale_low(low)
     , m_scale_high(high)
@@ -290,6 +300,13 @@ Reinhard02::Reinhard02(const pfs::Array2Df *Y, pfs::Array2Df* L,
     m_L = L;
 }
 
+void Reinhard02::setLuminanceStatistics(double avg_luminance, double max_luminance)
+{
+  m_fixed_statistics = true;
+  m_fixed_avg_luminance = avg_luminance;
+  m_fixed_max_luminance = max_luminance;
+}
+
 void Reinhard02::tmo_reinhard02()
 {
   m_ph.setValue( 0 );
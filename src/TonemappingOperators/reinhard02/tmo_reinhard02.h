@@ -104,6 +104,11 @@ public:
 
     void tmo_reinhard02();
 
+    //! \brief scale the input with the log average \a avg_luminance and the
+    //! maximum \a max_luminance of another frame (ie: the frame the input was
+    //! cut from) instead of its own
+    void setLuminanceStatistics(double avg_luminance, double max_luminance);
+
 private:
 	TemporalSmoothVariable<double> m_avg_luminance, m_max_luminance;
 	CVTS m_cvts;
@@ -116,6 +121,8 @@ private:
 	bool m_use_scales;
 	bool m_use_border;
 	double m_key, m_phi, m_white;
+	bool m_fixed_statistics;
+	double m_fixed_avg_luminance, m_fixed_max_luminance;
 	int m_range, m_scale_low, m_scale_high;
 	bool  m_temporal_coherent;
 	const double m_alpha;	
@@ -32,7 +32,9 @@
 
 #include "tmo_reinhard05.h"
 #include "TonemappingOperators/pfstmo.h"
+#include "TonemappingOperators/tonecurve_lut.h"
 #include "Libpfs/progress.h"
+#include "Libpfs/utils/statistics.h"
 
 #include <assert.h>
 #include <algorithm>
@@ -40,6 +42,7 @@
 #include <iostream>
 #include <cmath>
 #include <limits>
+#include <vector>
 
 using namespace std;
 
@@ -81,25 +84,6 @@ void computeAverage(const float* samples, size_t numSamples, float& average)
 }
 
 
-class Normalizer
-{
-private:
-    const float& min_;
-    const float& max_;
-
-public:
-    Normalizer(const float& min, const float& max):
-        min_(min),
-        max_(max)
-    {}
-
-    void operator() (float& value)
-    {
-        value = (value - min_)/(max_ - min_);
-    }
-};
-
-
 struct LuminanceProperties
 {
     float max;
@@ -134,80 +118,81 @@ void computeLuminanceProperties(const float* samples,
     luminanceProperties.imageBrightness = std::exp(-params.m_brightness);
 }
 
+//! \brief response of the photoreceptors to the adaptation level Ia (without
+//! the sample itself)
+class PhotoreceptorCurve
+{
+public:
+    explicit PhotoreceptorCurve(const LuminanceProperties& lumProps)
+        : brightness_(lumProps.imageBrightness)
+        , contrast_(lumProps.imageContrast)
+    {}
+
+    float operator()(float Ia) const
+    {
+        return std::pow(brightness_*Ia, contrast_);
+    }
+
+private:
+    float brightness_;
+    float contrast_;
+};
+
+//! \brief transforms a sample of a channel, tracks the range of the output
 class ChannelTransformation
 {
 public:
-    ChannelTransformation(float& min_sample, float& max_sample,
-                          const float& channelAverage,
+    ChannelTransformation(const ToneCurveLut& response,
+                          float channelAverage,
                           const Reinhard05Params& params,
                           const LuminanceProperties& lumProps)
-        : min_sample_(min_sample)
-        , max_sample_(max_sample)
-        , channelAverage_(channelAverage)
-        , params_(params)
-        , lumProps_(lumProps)
+        : response_(response)
+        , chromatic_(params.m_chromaticAdaptation)
+        , light_(params.m_lightAdaptation)
+        // global light adaptation
+        , Ig_((params.m_chromaticAdaptation*channelAverage)
+              + ((1.f - params.m_chromaticAdaptation)*lumProps.average))
     {}
 
-    float operator()(float ch_sample, const float y_sample)
+    float operator()(float ch_sample, float y_sample,
+                     float& min_sample, float& max_sample) const
     {
         if ( y_sample != 0.0f && ch_sample != 0.0f )
         {
             // local light adaptation
-            float Il = (params_.m_chromaticAdaptation * ch_sample)
-                    + ((1.f - params_.m_chromaticAdaptation)*y_sample);
-            // global light adaptation
-            float Ig = (params_.m_chromaticAdaptation*channelAverage_)
-                    + ((1.f - params_.m_chromaticAdaptation)*lumProps_.average);
+            float Il = (chromatic_ * ch_sample) + ((1.f - chromatic_)*y_sample);
             // interpolated light adaptation
-            float Ia = (params_.m_lightAdaptation*Il)
-                    + ((1.f - params_.m_lightAdaptation)*Ig);
+            float Ia = (light_*Il) + ((1.f - light_)*Ig_);
             // photoreceptor equation
-            ch_sample /= ch_sample
-                    + std::pow(lumProps_.imageBrightness*Ia, lumProps_.imageContrast);
+            ch_sample /= ch_sample + response_(Ia);
 
-            max_sample_ = std::max(ch_sample, max_sample_);
-            min_sample_ = std::min(ch_sample, min_sample_);
+            max_sample = std::max(ch_sample, max_sample);
+            min_sample = std::min(ch_sample, min_sample);
         }
         return ch_sample;
     }
 
-private:
-    // output
-    float& min_sample_;
-    float& max_sample_;
+    //! \brief bounds of the adaptation level of the samples in
+    //! [\a minSample, \a maxSample], with luminance in [\a minY, \a maxY]
+    void adaptationRange(float minSample, float maxSample,
+                         float minY, float maxY,
+                         float& minIa, float& maxIa) const
+    {
+        minIa = std::min(minIa, light_*((chromatic_*minSample) + ((1.f - chromatic_)*minY))
+                         + ((1.f - light_)*Ig_));
+        maxIa = std::max(maxIa, light_*((chromatic_*maxSample) + ((1.f - chromatic_)*maxY))
+                         + ((1.f - light_)*Ig_));
+    }
 
-    const float& channelAverage_;
-    const Reinhard05Params& params_;
-    const LuminanceProperties& lumProps_;
+private:
+    const ToneCurveLut& response_;
+    float chromatic_;
+    float light_;
+    float Ig_;
 };
 
-inline
-void transformChannel(const float* samplesChannel,
-                      const float* samplesLuminance,
-                      float* outputSamples,
-                      size_t numSamples,
-                      float channelAverage,
-                      const Reinhard05Params& params,
-                      const LuminanceProperties& lumProps,
-                      float& minSample, float& maxSample)
-{
-    transform(samplesChannel,
-              samplesChannel + numSamples,
-              samplesLuminance,
-              outputSamples,
-              ChannelTransformation(minSample,
-                                    maxSample,
-                                    channelAverage,
-                                    params,
-                                    lumProps)
-              );
-}
-
-void normalizeChannel(float* samples, size_t numSamples, float min, float max)
-{
-    for_each(samples, samples + numSamples, Normalizer(min, max));
-}
-
+//! pixels per tile of the parallel loops
+const size_t CHUNK = 16384;
 }
 
 void tmo_reinhard05(size_t width, size_t height,
@@ -227,36 +212,80 @@ void tmo_reinhard05(size_t width, size_t height,
     LuminanceProperties luminanceProperties;
     computeLuminanceProperties(nY, imSize, luminanceProperties, params);
 
+    // the photoreceptor equation only depends on the adaptation level:
+    // compile it over the range of the adaptation of the positive samples
+    const pfs::utils::Statistics Yrange = pfs::utils::computeRange(nY, imSize);
+    float* channels[] = {nR, nG, nB};
+    ToneCurveLut response;
+    std::vector<ChannelTransformation> transforms;
+    {
+        float minIa = numeric_limits<float>::max();
+        float maxIa = 0.f;
+        for (int c = 0; c < 3; c++)
+        {
+            transforms.push_back(ChannelTransformation(response, Cav[c],
+                                                       params, luminanceProperties));
+            const pfs::utils::Statistics range = pfs::utils::computeRange(channels[c], imSize);
+            transforms.back().adaptationRange(range.minPositive, range.max,
+                                              Yrange.minPositive, Yrange.max,
+                                              minIa, maxIa);
+        }
+        minIa = std::max(minIa, numeric_limits<float>::min());
+        response.compile(minIa, maxIa, PhotoreceptorCurve(luminanceProperties));
+    }
+
     // output
     float max_col = std::numeric_limits<float>::min();
     float min_col = std::numeric_limits<float>::max();
 
-    // transform Red Channel
-    transformChannel(nR, nY, nR, imSize, Cav[0], params, luminanceProperties, min_col, max_col);
-    ph.setValue(22);
-
-    // transform Green Channel
-    transformChannel(nG, nY, nG, imSize, Cav[1], params, luminanceProperties, min_col, max_col);
-    ph.setValue(44);
-
-    // transform Blue Channel
-    transformChannel(nB, nY, nB, imSize, Cav[2], params, luminanceProperties, min_col, max_col);
-    ph.setValue(66);
+    {
+        pfs::ProgressReporter progress(ph, imSize, 0, 66, CHUNK);
+        const long chunks = progress.chunks();
 
+#pragma omp parallel
+        {
+            float t_max_col = max_col;
+            float t_min_col = min_col;
+
+#pragma omp for schedule(dynamic) nowait
+            for (long c = 0; c < chunks; c++)
+            {
+                if (progress.canceled())
+                {
+                    continue;
+                }
+                size_t begin, end;
+                progress.chunk(c, begin, end);
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    nR[i] = transforms[0](nR[i], nY[i], t_min_col, t_max_col);
+                    nG[i] = transforms[1](nG[i], nY[i], t_min_col, t_max_col);
+                    nB[i] = transforms[2](nB[i], nY[i], t_min_col, t_max_col);
+                }
+                progress.advance(end - begin);
+            }
+
+#pragma omp critical
+            {
+                max_col = std::max(max_col, t_max_col);
+                min_col = std::min(min_col, t_min_col);
+            }
+        }
+    }
 
     if (!ph.canceled())
     {
         //--- normalize intensities
-        // normalize RED channel
-        normalizeChannel(nR, imSize, min_col, max_col);
-        ph.setValue(77);  // done!
-
-        // normalize GREEN channel
-        normalizeChannel(nG, imSize, min_col, max_col);
-        ph.setValue(88);
+        const float range_col = max_col - min_col;
 
-        // normalize BLUE channel
-        normalizeChannel(nB, imSize, min_col, max_col);
+#pragma omp parallel for
+        for (long i = 0; i < (long)imSize; i++)
+        {
+            nR[i] = (nR[i] - min_col)/range_col;
+            nG[i] = (nG[i] - min_col)/range_col;
+            nB[i] = (nB[i] - min_col)/range_col;
+        }
         ph.setValue(99);
     }
 }
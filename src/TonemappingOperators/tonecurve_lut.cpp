@@ -0,0 +1,89 @@
+/**
+ * @brief Tone curves of the global operators compiled into lookup tables
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "TonemappingOperators/tonecurve_lut.h"
+
+#include "Libpfs/progress.h"
+
+namespace
+{
+//! pixels per tile of the parallel loops
+const size_t CHUNK = 16384;
+}
+
+void applyToneCurveScale(const ToneCurveLut& scale, const float* lum,
+                         float* C1, float* C2, float* C3, size_t size,
+                         pfs::Progress& ph, int from, int to)
+{
+    pfs::ProgressReporter progress(ph, size, from, to, CHUNK);
+    const long chunks = progress.chunks();
+
+#pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < chunks; c++)
+    {
+        if (progress.canceled())
+        {
+            continue;
+        }
+        size_t begin, end;
+        progress.chunk(c, begin, end);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            const float l = lum[i];
+            const float s = (l > 0.f) ? scale(l) : 0.f;
+            C1[i] *= s;
+            C2[i] *= s;
+            C3[i] *= s;
+        }
+        progress.advance(end - begin);
+    }
+    progress.finish();
+}
+
+void applyToneCurve(const ToneCurveLut& curve,
+                    const float* in1, const float* in2, const float* in3,
+                    float* out1, float* out2, float* out3, size_t size,
+                    pfs::Progress& ph, int from, int to)
+{
+    pfs::ProgressReporter progress(ph, size, from, to, CHUNK);
+    const long chunks = progress.chunks();
+
+#pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < chunks; c++)
+    {
+        if (progress.canceled())
+        {
+            continue;
+        }
+        size_t begin, end;
+        progress.chunk(c, begin, end);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            out1[i] = curve(in1[i]);
+            out2[i] = curve(in2[i]);
+            out3[i] = curve(in3[i]);
+        }
+        progress.advance(end - begin);
+    }
+    progress.finish();
+}
@@ -0,0 +1,158 @@
+/**
+ * @brief Tone curves of the global operators compiled into lookup tables
+ *
+ * This file is a part of LuminanceHDR package.
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef TONECURVE_LUT_H
+#define TONECURVE_LUT_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+namespace pfs
+{
+class Progress;
+}
+
+//! \brief Function of a positive value (luminance, colour channel...),
+//! sampled uniformly in the log domain.
+//!
+//! The table is indexed with the bits of the IEEE float: the exponent and the
+//! leading bits of the mantissa are the integer and the fractional part of a
+//! piecewise linear log2, so a lookup takes a couple of integer operations and
+//! a linear interpolation, no logarithm. There are 2^FRACTION_BITS samples per
+//! octave, the interpolation error is below 1e-5 (relative) for the smooth
+//! curves of the global operators.
+class ToneCurveLut
+{
+public:
+    static const int FRACTION_BITS = 8;
+
+    //! \brief position of a value in the table
+    struct Position
+    {
+        size_t index;
+        float weight;
+    };
+
+    ToneCurveLut()
+        : m_first(0)
+        , m_lo(0)
+        , m_hi(0)
+    {}
+
+    //! \brief sample \a curve over [\a min, \a max], with 0 < \a min <= \a max.
+    //! Lookups clamp their argument to this range: zeros, negative values and
+    //! NaNs map to \a min or \a max. A \a min below FLT_MIN (zero, denormals)
+    //! is raised to FLT_MIN, \a curve is never called on them.
+    template <typename Curve>
+    void compile(float min, float max, Curve curve);
+
+    float min() const       { return asFloat(m_lo); }
+    float max() const       { return asFloat(m_hi); }
+    size_t size() const     { return m_samples.size(); }
+
+    Position position(float x) const
+    {
+        int32_t bits = asBits(x);
+        bits = (bits < m_lo) ? m_lo : bits;
+        bits = (bits > m_hi) ? m_hi : bits;
+        const int32_t offset = bits - m_first;
+
+        Position p;
+        p.index = offset >> SHIFT;
+        p.weight = (offset & MASK)*(1.f/(MASK + 1));
+        return p;
+    }
+
+    float value(const Position& p) const
+    {
+        const float* s = &m_samples[p.index];
+        return s[0] + p.weight*(s[1] - s[0]);
+    }
+
+    float operator()(float x) const
+    {
+        return value(position(x));
+    }
+
+private:
+    static const int SHIFT = 23 - FRACTION_BITS;
+    static const int32_t MASK = (1 << SHIFT) - 1;
+
+    static int32_t asBits(float x)
+    {
+        int32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+
+    static float asFloat(int32_t bits)
+    {
+        float x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    //! bits of the first sample, of the lower and upper end of the range
+    int32_t m_first;
+    int32_t m_lo;
+    int32_t m_hi;
+    std::vector<float> m_samples;
+};
+
+template <typename Curve>
+void ToneCurveLut::compile(float min, float max, Curve curve)
+{
+    // compared as bits: denormals and zero have a null exponent, the first
+    // sample would be taken at 0
+    const int32_t lowest = asBits(FLT_MIN);
+    m_lo = std::max(asBits(min), lowest);
+    m_hi = std::max(asBits(max), m_lo);
+    m_first = m_lo & ~MASK;
+
+    // one more sample after the last segment, position() reads s[1]
+    const size_t size = ((m_hi - m_first) >> SHIFT) + 2;
+    m_samples.resize(size);
+    for (size_t k = 0; k < size; k++)
+    {
+        m_samples[k] = curve(asFloat(m_first + (static_cast<int32_t>(k) << SHIFT)));
+    }
+}
+
+//! \brief colour = colour*scale(lum), for every pixel: tone curves which
+//! scale the colour channels by the ratio between the output and the input
+//! luminance. Pixels with lum <= 0 are set to 0. In parallel, the progress
+//! goes from \a from to \a to.
+void applyToneCurveScale(const ToneCurveLut& scale, const float* lum,
+                         float* C1, float* C2, float* C3, size_t size,
+                         pfs::Progress& ph, int from = 0, int to = 100);
+
+//! \brief out = curve(in), for the three channels. In parallel, the progress
+//! goes from \a from to \a to.
+void applyToneCurve(const ToneCurveLut& curve,
+                    const float* in1, const float* in2, const float* in3,
+                    float* out1, float* out2, float* out3, size_t size,
+                    pfs::Progress& ph, int from = 0, int to = 100);
+
+#endif // TONECURVE_LUT_H
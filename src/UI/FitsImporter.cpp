@@ -28,6 +28,8 @@
 #include <QFile>
 #include <QtConcurrentMap>
 #include <QtConcurrentFilter>
+#include <QtConcurrentRun>
+#include <QFuture>
 #include <QDebug>
 #include <QRgb>
 #include <QImage>
@@ -47,6 +49,7 @@
 #include <Libpfs/utils/transform.h>
 #include <Libpfs/colorspace/convert.h>
 #include <Libpfs/colorspace/normalizer.h>
+#include <Libpfs/io/fitsreader.h>
 
 using namespace pfs;
 using namespace pfs::colorspace;
@@ -54,6 +57,20 @@ using namespace pfs::colorspace;
 static const int previewWidth = 300;
 static const int previewHeight = 200;
 
+// load one channel, returns the error message or an empty string
+static QString loadFitsItem(HdrCreationItem* item)
+{
+    try {
+        LoadFile(true)(*item);
+    }
+    catch (std::runtime_error &err)
+    {
+        qDebug() << err.what();
+        return QString(err.what());
+    }
+    return QString();
+}
+
 FitsImporter::~FitsImporter() 
 {
 }
@@ -195,20 +212,35 @@ void FitsImporter::on_pushButtonLoad_clicked()
     m_tmpdata.push_back( HdrCreationItem(m_luminosityChannel) );
     m_tmpdata.push_back( HdrCreationItem(m_hChannel) );
 
-    // parallel load of the data...
-    // connect(&m_futureWatcher, SIGNAL(finished()), this, SLOT(loadFilesDone()), Qt::DirectConnection);
-
-    // Start the computation.
-    // m_futureWatcher.setFuture( QtConcurrent::map(m_tmpdata.begin(), m_tmpdata.end(), LoadFile()) );
+    // parallel load of the data, if CFITSIO can read more files at once
     QString error_string;
-    try {
-        std::for_each(m_tmpdata.begin(), m_tmpdata.end(), LoadFile(true));
+    if (pfs::io::FitsReader::isThreadSafe())
+    {
+        QList< QFuture<QString> > futures;
+        for (HdrCreationItemContainer::iterator i = m_tmpdata.begin(); i != m_tmpdata.end(); ++i)
+        {
+            futures.push_back( QtConcurrent::run(loadFitsItem, &*i) );
+        }
+        for (int i = 0; i < futures.size(); ++i)
+        {
+            if (error_string.isEmpty())
+                error_string = futures[i].result();
+            else
+                futures[i].waitForFinished();
+        }
     }
-    catch (std::runtime_error &err)
+    else
+    {
+        for (HdrCreationItemContainer::iterator i = m_tmpdata.begin(); i != m_tmpdata.end(); ++i)
+        {
+            error_string = loadFitsItem(&*i);
+            if (!error_string.isEmpty())
+                break;
+        }
+    }
+    if (!error_string.isEmpty())
     {
         QApplication::restoreOverrideCursor();
-        error_string = QString(err.what());
-        qDebug() << err.what();
     }
 
     loadFilesDone(error_string);
@@ -37,6 +37,8 @@ namespace
 {
 const static QString IMAGE_QUALITY_KEY = "imagequalitydialog/quality";
 const static int IMAGE_QUALITY_DEFAULT = 98;
+const static QString TARGET_SIZE_KEY = "imagequalitydialog/target_size";
+const static int TARGET_SIZE_DEFAULT = 500;
 }
 
 ImageQualityDialog::ImageQualityDialog(const pfs::Frame* frame,
@@ -73,6 +75,16 @@ ImageQualityDialog::ImageQualityDialog(const pfs::Frame* frame,
 		m_ui->fileSizePanel->setVisible(false);
 	}
 
+    // only the JPEG encoder can predict the quality for a given size
+    if (frame && m_format.startsWith("jp"))
+    {
+        m_ui->targetSizeSpinBox->setValue(m_options->value(TARGET_SIZE_KEY, TARGET_SIZE_DEFAULT).toInt());
+    }
+    else
+    {
+        m_ui->targetSizePanel->setVisible(false);
+    }
+
 #ifdef Q_OS_MAC
     this->setWindowModality(Qt::WindowModal); // In OS X, the QMessageBox is modal to the window
 #endif
@@ -84,6 +96,10 @@ ImageQualityDialog::~ImageQualityDialog()
 	{
 		m_options->setValue(IMAGE_QUALITY_KEY, getQuality());
 	}
+    if (m_ui->targetSizePanel->isVisibleTo(this))
+    {
+        m_options->setValue(TARGET_SIZE_KEY, m_ui->targetSizeSpinBox->value());
+    }
 }
 
 int ImageQualityDialog::getQuality(void) const
@@ -128,6 +144,16 @@ void ImageQualityDialog::on_getSizeButton_clicked()
     setCursor(QCursor(Qt::ArrowCursor));
 }
 
+void ImageQualityDialog::on_fitSizeButton_clicked()
+{
+    setCursor(QCursor(Qt::WaitCursor));
+    size_t quality = pfs::io::JpegWriter::predictQuality(
+                *m_frame, pfs::Params(),
+                size_t(m_ui->targetSizeSpinBox->value())*1024);
+    m_ui->spinBox->setValue(static_cast<int>(quality));
+    setCursor(QCursor(Qt::ArrowCursor));
+}
+
 void ImageQualityDialog::reset(int)
 {
     m_ui->label_filesize->setText(tr("Unknown"));
@@ -49,6 +49,7 @@ public:
 
 protected slots:
     void on_getSizeButton_clicked();
+    void on_fitSizeButton_clicked();
     void reset(int);
 
 protected:
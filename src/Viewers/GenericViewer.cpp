@@ -310,10 +310,16 @@ void GenericViewer::slotCornerButtonPressed()
 {
     mPanIconWidget = new PanIconWidget(this);
 
-    // is there a way to avoid this call?
-    // how expensive is to call this function?
-    QImage image = this->getQImage();
-    mPanIconWidget->setImage(&image);
+    ImagePyramidPtr pyramid = mPixmap->pyramid();
+    if ( pyramid )
+    {
+        mPanIconWidget->setImage(*pyramid);
+    }
+    else
+    {
+        QImage image = this->getQImage();
+        mPanIconWidget->setImage(&image);
+    }
 
     float zf = this->getScaleFactor();
     float leftviewpos = (float)(mView->horizontalScrollBar()->value());
@@ -370,12 +376,12 @@ float GenericViewer::getScaleFactor()
 
 QImage GenericViewer::getQImage() const
 {
-    return mPixmap->pixmap().toImage();
+    return mPixmap->image();
 }
 
 void GenericViewer::setQImage(const QImage& qimage)
 {
-    mPixmap->setPixmap(QPixmap::fromImage(qimage));
+    mPixmap->setImage(qimage);
 }
 
 int GenericViewer::getWidth()
@@ -419,9 +425,17 @@ void GenericViewer::startDragging()
 {
 	QDrag *drag = new QDrag(this);
 	QMimeData *mimeData = new QMimeData;
-	mimeData->setImageData(mPixmap->pixmap().toImage());
+	mimeData->setImageData(getQImage());
 	drag->setMimeData(mimeData);
-	drag->setPixmap(mPixmap->pixmap().scaledToHeight(mPixmap->pixmap().height()/10));
+	ImagePyramidPtr pyramid = mPixmap->pyramid();
+	if ( pyramid )
+	{
+		drag->setPixmap(QPixmap::fromImage(pyramid->thumbnail(pyramid->size()/10)));
+	}
+	else
+	{
+		drag->setPixmap(mPixmap->pixmap().scaledToHeight(mPixmap->pixmap().height()/10));
+	}
 
     /*Qt::DropAction dropAction =*/ drag->exec();
 }
@@ -149,7 +149,7 @@ public Q_SLOTS:
     virtual QString getExifComment() = 0;
 
     //! \brief returns a QImage that reflects the content of the viewerport
-    QImage getQImage() const;
+    virtual QImage getQImage() const;
 
     //! \brief set new QImage
     void setQImage(const QImage& qimage);
@@ -29,6 +29,8 @@
 
 #include <QFileInfo>
 #include <QDebug>
+#include <QGraphicsPixmapItem>
+#include <QScrollBar>
 
 #include <cmath>
 #include <cassert>
@@ -38,6 +40,7 @@
 
 #include "Fileformat/pfsoutldrimage.h"
 #include "Viewers/IGraphicsPixmapItem.h"
+#include "Viewers/IGraphicsView.h"
 #include "Viewers/LuminanceRangeWidget.h"
 
 #include "Libpfs/array2d.h"
@@ -52,11 +55,15 @@ namespace // anonymous namespace
 // In this way, we let know the compiler it can mess up as much as it wants with the code,
 // because it will only used inside this compilation unit
 
-const pfs::Array2Df* getPrimaryChannel(const pfs::Frame& frame)
+const pfs::Channel* getPrimaryChannel(const pfs::Frame& frame)
 {
     return frame.getChannel("Y");
 }
 
+// delay between the last change of the mapping parameters and the refresh of
+// the full resolution pixmap
+const int FULL_REFRESH_DELAY = 300; // msec
+
 } // end anonymous namespace
 
 HdrViewer::HdrViewer(pfs::Frame* frame, QWidget *parent, bool ns)
@@ -64,6 +71,7 @@ HdrViewer::HdrViewer(pfs::Frame* frame, QWidget *parent, bool ns)
     , m_mappingMethod(MAP_GAMMA2_2)
     , m_minValue(0.f)
     , m_maxValue(1.f)
+    , m_viewportItem(NULL)
 {
     initUi();
 
@@ -80,7 +88,7 @@ HdrViewer::HdrViewer(pfs::Frame* frame, QWidget *parent, bool ns)
         m_maxValue = powf( 10.0f, m_lumRange->getRangeWindowMax() );
 
         QScopedPointer<QImage> qImage(mapFrameToImage(getFrame()));
-        mPixmap->setPixmap(QPixmap::fromImage(*qImage));
+        mPixmap->setImage(*qImage);
 
         updateView();
         m_lumRange->blockSignals(false);
@@ -105,6 +113,15 @@ void HdrViewer::initUi()
     connect( m_lumRange, SIGNAL( updateRangeWindow() ), this, SLOT( updateRangeWindow() ) );
     mToolBar->setSizePolicy(QSizePolicy::Preferred,QSizePolicy::Fixed);
 
+    m_viewportItem = new QGraphicsPixmapItem(mPixmap);
+    m_viewportItem->setAcceptedMouseButtons(Qt::NoButton);
+    m_viewportItem->setAcceptHoverEvents(false);
+    m_viewportItem->hide();
+
+    m_refreshTimer.setSingleShot(true);
+    m_refreshTimer.setInterval(FULL_REFRESH_DELAY);
+    connect(&m_refreshTimer, SIGNAL(timeout()), this, SLOT(refreshPixmap()));
+
     retranslateUi();
 }
 
@@ -135,14 +152,51 @@ void HdrViewer::retranslateUi()
 
 void HdrViewer::refreshPixmap()
 {
+    m_refreshTimer.stop();
+
     setCursor( Qt::WaitCursor );
 
     QScopedPointer<QImage> qImage(mapFrameToImage(getFrame()));
-    mPixmap->setPixmap(QPixmap::fromImage(*qImage));
+    mPixmap->setImage(*qImage);
+    m_viewportItem->hide();
 
     unsetCursor();
 }
 
+void HdrViewer::refreshViewport()
+{
+    const pfs::Frame* frame = getFrame();
+    if ( frame == NULL ) return;
+
+    const QRect frame_rect(0, 0, frame->getWidth(), frame->getHeight());
+    const QRect region =
+            mView->mapToScene(mView->viewport()->rect()).boundingRect().toAlignedRect()
+            .intersected(frame_rect);
+
+    if ( region.isEmpty() )
+    {
+        m_refreshTimer.start();
+        return;
+    }
+
+    // no point in mapping more pixels than the ones shown on screen
+    const int step = qMax(1, static_cast<int>(1.f/getScaleFactor()));
+
+    QImage image((region.width() + step - 1)/step,
+                 (region.height() + step - 1)/step,
+                 QImage::Format_RGB32);
+    mapHDRPFSToQImage(*frame, image, region, step,
+                      m_minValue, m_maxValue, m_mappingMethod);
+
+    m_viewportItem->setPixmap(QPixmap::fromImage(image));
+    m_viewportItem->setPos(region.topLeft());
+    m_viewportItem->setScale(step);
+    m_viewportItem->show();
+
+    // restart the countdown for the full resolution pixmap
+    m_refreshTimer.start();
+}
+
 void HdrViewer::updatePixmap()
 {
 #ifdef QT_DEBUG
@@ -175,7 +229,7 @@ void HdrViewer::setRangeWindow( float min, float max )
     m_minValue = min;
     m_maxValue = max;
 
-    refreshPixmap();
+    refreshViewport();
 }
 
 int HdrViewer::getLumMappingMethod()
@@ -188,7 +242,7 @@ void HdrViewer::setLumMappingMethod( int method )
     m_mappingMethodCB->setCurrentIndex( method );
     m_mappingMethod = static_cast<RGBMappingType>(method);
 
-    refreshPixmap();
+    refreshViewport();
 }
 
 //! empty dtor
@@ -222,9 +276,24 @@ RGBMappingType HdrViewer::getLuminanceMappingMethod()
     return m_mappingMethod;
 }
 
-QImage* HdrViewer::mapFrameToImage(pfs::Frame* in_frame)
+QImage HdrViewer::getQImage() const
+{
+    if ( m_refreshTimer.isActive() )
+    {
+        // mPixmap is stale
+        QScopedPointer<QImage> qImage(mapFrameToImage(getFrame()));
+        return *qImage;
+    }
+    return GenericViewer::getQImage();
+}
+
+QImage* HdrViewer::mapFrameToImage(const pfs::Frame* in_frame) const
 {
-    return fromLDRPFStoQImage(in_frame, m_minValue, m_maxValue, m_mappingMethod);
+    QImage* image = new QImage(in_frame->getWidth(), in_frame->getHeight(),
+                               QImage::Format_RGB32);
+    mapHDRPFSToQImage(*in_frame, *image, image->rect(), 1,
+                      m_minValue, m_maxValue, m_mappingMethod);
+    return image;
 }
 
 void HdrViewer::keyPressEvent(QKeyEvent *event)
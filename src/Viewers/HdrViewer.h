@@ -37,6 +37,7 @@
 #include <QLabel>
 #include <QScopedPointer>
 #include <QKeyEvent>
+#include <QTimer>
 
 #include "GenericViewer.h"
 
@@ -47,6 +48,7 @@ class Frame;
 }
 
 class LuminanceRangeWidget;
+class QGraphicsPixmapItem;
 
 class HdrViewer : public GenericViewer
 {
@@ -73,6 +75,10 @@ public:
 
     RGBMappingType getLuminanceMappingMethod();
 
+    //! \brief returns the full resolution mapping of the frame, even if only
+    //! the visible area has been refreshed so far
+    QImage getQImage() const;
+
 public Q_SLOTS:
     void updateRangeWindow();
     int getLumMappingMethod();
@@ -81,6 +87,9 @@ public Q_SLOTS:
 protected Q_SLOTS:
     virtual void updatePixmap();
 
+private Q_SLOTS:
+    void refreshPixmap();
+
 protected:
     // Methods
 	virtual void retranslateUi();
@@ -95,13 +104,21 @@ protected:
 
 private:
     void initUi();
-    void refreshPixmap();
+
+    //! \brief maps only the area of the frame currently visible, at the
+    //! resolution of the screen, and schedules the refresh of the full pixmap
+    void refreshViewport();
 
     RGBMappingType m_mappingMethod;
     float m_minValue;
     float m_maxValue;
 
-    QImage* mapFrameToImage(pfs::Frame* in_frame);
+    // shows the result of refreshViewport() on top of mPixmap, until the full
+    // resolution pixmap is refreshed
+    QGraphicsPixmapItem* m_viewportItem;
+    QTimer m_refreshTimer;
+
+    QImage* mapFrameToImage(const pfs::Frame* in_frame) const;
 };
 
 inline bool HdrViewer::isHDR()
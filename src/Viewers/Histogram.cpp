@@ -31,6 +31,7 @@
 #include <assert.h>
 
 #include <Libpfs/array2d.h>
+#include <Libpfs/utils/statistics.h>
 
 Histogram::Histogram( int bins, int accuracy )
     : bins( bins )
@@ -45,48 +46,26 @@ Histogram::~Histogram()
 
 void Histogram::computeLog( const pfs::Array2Df *image )
 {
-  const int size = image->getRows()*image->getCols();
-
-  float max, min;               // Find min, max
-  {
-    min = 999999999.0f;
-    max = -999999999.0f;
-    
-    for( int i = 0; i < size; i += accuracy ) {
-      float v = (*image)(i);
-      if( v > max ) max = v;
-      else if( v < min ) min = v;
-    }
+  const pfs::utils::Statistics stats =
+    pfs::utils::computeStatistics( image->data(), image->size() );
+  if( stats.positive == 0 ) {
+    for( int i = 0; i < bins; i++ )
+      P[i] = 0;
+    return;
   }
-  computeLog( image, min, max );
+  computeLog( image, log10( stats.minPositive ), log10( stats.max ) );
 }
 
 
 void Histogram::computeLog( const pfs::Array2Df *image, float min, float max )
 {
-  const int size = image->getRows()*image->getCols();
-  
-  // Empty all bins
-  for( int i = 0; i < bins; i++ )
-    P[i] = 0;
-
-  float count = 0;
-  float binWidth = (max-min)/(float)bins;
-  for( int i = 0; i < size; i += accuracy ) {
-    float v = (*image)(i);
-    if( v <= 0 ) continue;
-    v = log10(v);
-    int bin = (int)((v-min)/binWidth);
-    if( bin > bins || bin < 0 ) continue;
-    if( bin == bins ) bin = bins-1;
-    P[bin] += 1;
-    count++;
-  }
+  pfs::utils::Histogram hist( bins, min, max, pfs::utils::Histogram::LOG10 );
+  hist.compute( image->data(), image->size(), accuracy );
 
   // Normalize, to get probability
+  const float count = (float)hist.total();
   for( int i = 0; i < bins; i++ )
-    P[i] /= (float)(count/accuracy);
-  
+    P[i] = count > 0 ? hist.count(i) / (count/accuracy) : 0;
 }
 
 float Histogram::getMaxP() const
@@ -25,6 +25,8 @@
 #include <QDebug>
 #include <QGraphicsScene>
 #include <QGraphicsView>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
 
 #include "Viewers/IGraphicsPixmapItem.h"
 #include "Viewers/ISelectionBox.h"
@@ -35,6 +37,9 @@ IGraphicsPixmapItem::IGraphicsPixmapItem(QGraphicsItem *parent):
     mSelectionBox(NULL),
     mIsSelectionEnabled(true)
 {
+    // exposedRect is needed to draw the visible tiles only
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+
     mDropShadow->setBlurRadius(10);
     mDropShadow->setOffset(0,0);
     //this->setGraphicsEffect(mDropShadow);
@@ -71,6 +76,96 @@ void IGraphicsPixmapItem::removeSelection()
     }
 }
 
+void IGraphicsPixmapItem::setImage(const QImage& image)
+{
+    prepareGeometryChange();
+    if ( mPyramid ) mPyramid->disconnect(this);
+    mPyramid = ImagePyramidPtr(new ImagePyramid(image));
+    // queued: the levels are built on the thread pool
+    connect(mPyramid.data(), SIGNAL(levelReady(int)),
+            this, SLOT(levelReady(int)), Qt::QueuedConnection);
+    update();
+}
+
+void IGraphicsPixmapItem::levelReady(int level)
+{
+    if ( !mPyramid || !scene() ) return;
+
+    // repaint only if a view is zoomed out enough to draw from this level
+    foreach (QGraphicsView* view, scene()->views())
+    {
+        if ( mPyramid->levelForScale(
+                    QStyleOptionGraphicsItem::levelOfDetailFromTransform(view->transform())) >= level )
+        {
+            update();
+            return;
+        }
+    }
+}
+
+QImage IGraphicsPixmapItem::image() const
+{
+    if ( mPyramid ) return mPyramid->image();
+
+    return pixmap().toImage();
+}
+
+QRectF IGraphicsPixmapItem::boundingRect() const
+{
+    if ( mPyramid ) return QRectF(QPointF(0, 0), mPyramid->size());
+
+    return QGraphicsPixmapItem::boundingRect();
+}
+
+QPainterPath IGraphicsPixmapItem::shape() const
+{
+    if ( mPyramid )
+    {
+        QPainterPath path;
+        path.addRect(boundingRect());
+        return path;
+    }
+    return QGraphicsPixmapItem::shape();
+}
+
+void IGraphicsPixmapItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    if ( !mPyramid )
+    {
+        QGraphicsPixmapItem::paint(painter, option, widget);
+        return;
+    }
+
+    const qreal scale =
+            QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int level = mPyramid->levelForScale(scale);
+    const int tile_side = ImagePyramid::TILE_SIZE << level;
+
+    const QRect bounds(QPoint(0, 0), mPyramid->size());
+    const QRect exposed = option->exposedRect.toAlignedRect().intersected(bounds);
+    if ( exposed.isEmpty() ) return;
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform,
+                           transformationMode() == Qt::SmoothTransformation);
+
+    for (int row = exposed.top()/tile_side; row <= exposed.bottom()/tile_side; ++row)
+    {
+        for (int col = exposed.left()/tile_side; col <= exposed.right()/tile_side; ++col)
+        {
+            const QPixmap tile = mPyramid->tile(level, col, row);
+            // the last pixel of an odd sized level covers one pixel past the
+            // border of the image: draw only the part inside
+            const QRect target = QRect(col*tile_side, row*tile_side,
+                                       tile.width() << level, tile.height() << level)
+                    .intersected(bounds);
+            const QRectF source(0, 0,
+                                qreal(target.width())/(1 << level),
+                                qreal(target.height())/(1 << level));
+            painter->drawPixmap(QRectF(target), tile, source);
+        }
+    }
+}
+
 void IGraphicsPixmapItem::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
     if (!mIsSelectionEnabled && event->button() == Qt::LeftButton) {
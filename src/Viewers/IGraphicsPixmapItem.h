@@ -33,6 +33,8 @@
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsDropShadowEffect>
 
+#include "Viewers/ImagePyramid.h"
+
 class ISelectionBox;    // forward declaration
 
 class IGraphicsPixmapItem : public QObject, public virtual QGraphicsPixmapItem
@@ -49,25 +51,47 @@ public:
     void enableSelectionTool();
     void disableSelectionTool();
 
+    //! \brief show \a image: the item builds its ImagePyramid and, when zoomed
+    //! out, draws the visible tiles of the matching level only
+    void setImage(const QImage& image);
+
+    //! \brief full resolution image currently shown
+    QImage image() const;
+
+    //! \brief pyramid of the image currently shown (NULL before setImage())
+    ImagePyramidPtr pyramid() const;
+
+    virtual QRectF boundingRect() const;
+    virtual QPainterPath shape() const;
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
 Q_SIGNALS:
     void selectionReady(bool);
 	void startDragging();
 
+private Q_SLOTS:
+    void levelReady(int level);
+
 protected:
     virtual void mousePressEvent(QGraphicsSceneMouseEvent *e);
     virtual void mouseMoveEvent(QGraphicsSceneMouseEvent *e);
     virtual void mouseReleaseEvent(QGraphicsSceneMouseEvent *e);
 
-    //virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
-
     QGraphicsDropShadowEffect* mDropShadow;
     ISelectionBox* mSelectionBox;
 
     bool mIsSelectionEnabled;
 
+    ImagePyramidPtr mPyramid;
+
     enum { IDLE, SELECTING } mMouseState;
 };
 
+inline ImagePyramidPtr IGraphicsPixmapItem::pyramid() const
+{
+    return mPyramid;
+}
+
 inline bool IGraphicsPixmapItem::hasSelection()
 {
     return (mSelectionBox != NULL);
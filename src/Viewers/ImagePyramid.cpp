@@ -0,0 +1,272 @@
+/**
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include "Viewers/ImagePyramid.h"
+
+#include <QCache>
+#include <QHash>
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+#include <cmath>
+
+#include "Common/LuminanceOptions.h"
+
+namespace
+{
+struct TileKey
+{
+    TileKey(quint64 id, int level, int col, int row)
+        : m_id(id), m_level(level), m_col(col), m_row(row)
+    {}
+
+    quint64 m_id;
+    int m_level;
+    int m_col;
+    int m_row;
+};
+
+inline bool operator==(const TileKey& lhs, const TileKey& rhs)
+{
+    return lhs.m_id == rhs.m_id && lhs.m_level == rhs.m_level &&
+            lhs.m_col == rhs.m_col && lhs.m_row == rhs.m_row;
+}
+
+inline uint qHash(const TileKey& key)
+{
+    return ::qHash(key.m_id) ^ ::qHash((key.m_level << 24) ^ (key.m_row << 12) ^ key.m_col);
+}
+
+//! \brief memory set in the preferences for the tiles and the levels of
+//! every pyramid, in KB. Only used from the GUI thread.
+int& cacheBudget()
+{
+    static int budget = qMax(0, LuminanceOptions().getViewerTileCacheSize())*1024;
+    return budget;
+}
+
+//! \brief memory held by the levels of every pyramid, in KB
+QAtomicInt s_levelsCost(0);
+
+//! \brief tiles of every pyramid, cost in KB. Only used from the GUI thread.
+QCache<TileKey, QPixmap>& tileCache()
+{
+    static QCache<TileKey, QPixmap> cache(cacheBudget());
+    return cache;
+}
+
+//! \brief give the tiles what the levels leave of the budget
+void updateTileCacheCost()
+{
+    QCache<TileKey, QPixmap>& cache = tileCache();
+    const int cost = qMax(0, cacheBudget() - s_levelsCost.load());
+    if ( cache.maxCost() != cost ) cache.setMaxCost(cost);
+}
+
+int imageCost(const QImage& image)
+{
+    return qMax(1, image.bytesPerLine()*image.height()/1024);
+}
+
+QAtomicInt s_nextId(1);
+
+//! \brief 2x2 box filter, the last row/column is replicated on odd sizes
+QImage halve(const QImage& in)
+{
+    const int in_width = in.width();
+    const int in_height = in.height();
+    const int out_width = qMax(1, (in_width + 1)/2);
+    const int out_height = qMax(1, (in_height + 1)/2);
+
+    QImage out(out_width, out_height, in.format());
+
+    const uchar* in_bits = in.constBits();
+    const int in_bpl = in.bytesPerLine();
+    uchar* out_bits = out.bits();
+    const int out_bpl = out.bytesPerLine();
+
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < out_height; ++y)
+    {
+        const uchar* row0 = in_bits + (2*y)*in_bpl;
+        const uchar* row1 = in_bits + qMin(2*y + 1, in_height - 1)*in_bpl;
+        uchar* out_row = out_bits + y*out_bpl;
+
+        for (int x = 0; x < out_width; ++x)
+        {
+            const int x0 = 4*(2*x);
+            const int x1 = 4*qMin(2*x + 1, in_width - 1);
+            for (int c = 0; c < 4; ++c)
+            {
+                out_row[4*x + c] = static_cast<uchar>(
+                            (row0[x0 + c] + row0[x1 + c] +
+                             row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+    }
+    return out;
+}
+
+QImage::Format pyramidFormat(const QImage& image)
+{
+    // premultiplied alpha, so the box filter does not bleed the colour of
+    // transparent pixels
+    return image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                   : QImage::Format_RGB32;
+}
+}
+
+ImagePyramid::ImagePyramid(const QImage& image)
+    : m_id(s_nextId.fetchAndAddOrdered(1))
+    , m_size(image.size())
+    , m_abort(0)
+    , m_cost(0)
+{
+    const QImage::Format format = pyramidFormat(image);
+    if ( image.format() == format )
+    {
+        // shared with the caller: not held by the pyramid
+        m_levels.push_back(image);
+    }
+    else
+    {
+        m_levels.push_back(image.convertToFormat(format));
+        m_cost.store(imageCost(m_levels.back()));
+        s_levelsCost.fetchAndAddOrdered(m_cost.load());
+    }
+
+    m_future = QtConcurrent::run(this, &ImagePyramid::build);
+}
+
+ImagePyramid::~ImagePyramid()
+{
+    // a build still queued in the pool is run here and returns straight away
+    m_abort.store(1);
+    m_future.waitForFinished();
+
+    QCache<TileKey, QPixmap>& cache = tileCache();
+    foreach (const TileKey& key, cache.keys())
+    {
+        if ( key.m_id == m_id ) cache.remove(key);
+    }
+
+    s_levelsCost.fetchAndAddOrdered(-m_cost.load());
+    updateTileCacheCost();
+}
+
+void ImagePyramid::build()
+{
+    QImage current = level(0);
+    while ( current.width() > TILE_SIZE || current.height() > TILE_SIZE )
+    {
+        if ( m_abort.load() ) return;
+
+        current = halve(current);
+
+        const int cost = imageCost(current);
+        m_cost.fetchAndAddOrdered(cost);
+        s_levelsCost.fetchAndAddOrdered(cost);
+
+        int built;
+        {
+            QMutexLocker locker(&m_mutex);
+            m_levels.push_back(current);
+            built = m_levels.size() - 1;
+        }
+        emit levelReady(built);
+    }
+}
+
+void ImagePyramid::updateSettings()
+{
+    cacheBudget() = qMax(0, LuminanceOptions().getViewerTileCacheSize())*1024;
+    updateTileCacheCost();
+}
+
+QSize ImagePyramid::size() const
+{
+    return m_size;
+}
+
+QImage ImagePyramid::image() const
+{
+    return level(0);
+}
+
+int ImagePyramid::levelCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_levels.size();
+}
+
+QImage ImagePyramid::level(int level) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_levels[qBound(0, level, m_levels.size() - 1)];
+}
+
+int ImagePyramid::levelForScale(qreal scale) const
+{
+    if ( scale >= 1.0 ) return 0;
+
+    // 1e-6: do not pick a finer level because of rounding at exact powers of 2
+    const int level = static_cast<int>(std::floor(std::log(1.0/scale)/std::log(2.0) + 1e-6));
+    return qMin(level, levelCount() - 1);
+}
+
+QPixmap ImagePyramid::tile(int level, int col, int row) const
+{
+    Q_ASSERT(level < levelCount());
+
+    // the levels built since the last call shrink the room for the tiles
+    updateTileCacheCost();
+
+    QCache<TileKey, QPixmap>& cache = tileCache();
+    const TileKey key(m_id, level, col, row);
+
+    if ( const QPixmap* cached = cache.object(key) )
+    {
+        return *cached;
+    }
+
+    const QImage source = this->level(level);
+    const QRect rect = QRect(col*TILE_SIZE, row*TILE_SIZE, TILE_SIZE, TILE_SIZE)
+            .intersected(source.rect());
+
+    QPixmap* pixmap = new QPixmap(QPixmap::fromImage(source.copy(rect)));
+    const QPixmap result = *pixmap;
+    // ARGB32: 4 bytes per pixel
+    cache.insert(key, pixmap, qMax(1, rect.width()*rect.height()*4/1024));
+    return result;
+}
+
+QImage ImagePyramid::thumbnail(const QSize& bound) const
+{
+    const QSize target = m_size.scaled(bound, Qt::KeepAspectRatio);
+
+    int idx = levelCount() - 1;
+    QImage source = level(idx);
+    while ( idx > 0 &&
+            (source.width() < target.width() || source.height() < target.height()) )
+    {
+        source = level(--idx);
+    }
+    return source.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
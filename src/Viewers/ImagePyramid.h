@@ -0,0 +1,116 @@
+/**
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ *
+ * Multi-resolution copy of the image shown by the viewers
+ *
+ */
+
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QPixmap>
+#include <QRect>
+#include <QSharedPointer>
+#include <QSize>
+#include <QVector>
+
+//!
+//! Holds an image and its downsampled copies, each one half the size of the
+//! previous one, down to a single tile. Level 0 is available straight away,
+//! the others are built on the global QThreadPool.
+//!
+//! Rendering goes through tile(): tiles are converted to QPixmap on demand and
+//! kept in a cache shared by all the pyramids. The memory set in the
+//! preferences (LuminanceOptions::getViewerTileCacheSize()) covers the levels
+//! held by the pyramids first, the tiles get what is left. Only the tiles
+//! actually shown are uploaded, at the level matching the zoom factor.
+//!
+//! levelReady() is emitted from the worker thread each time a level has been
+//! built: connect to it with a queued connection to repaint.
+//!
+class ImagePyramid : public QObject
+{
+    Q_OBJECT
+public:
+    //! side of a tile, in pixels of its level
+    static const int TILE_SIZE = 256;
+
+    explicit ImagePyramid(const QImage& image);
+    ~ImagePyramid();
+
+    //! \brief size of the full resolution image
+    QSize size() const;
+
+    //! \brief full resolution image
+    QImage image() const;
+
+    //! \brief number of levels built so far (at least 1)
+    int levelCount() const;
+
+    //! \return level \a level, or the coarsest level built so far if \a level
+    //! is not ready yet
+    QImage level(int level) const;
+
+    //! \return coarsest level built so far whose pixels are not larger than
+    //! the screen pixels at zoom \a scale
+    int levelForScale(qreal scale) const;
+
+    //! \brief tile (\a col, \a row) of \a level, at most TILE_SIZE pixels
+    //! wide and high. Its top left corner is at (col, row)*(TILE_SIZE << level)
+    //! in full resolution coordinates.
+    //! \note must be called from the GUI thread, with \a level < levelCount()
+    QPixmap tile(int level, int col, int row) const;
+
+    //! \return a copy of the image that fits in \a bound, keeping the aspect
+    //! ratio, scaled from the smallest level larger than \a bound
+    QImage thumbnail(const QSize& bound) const;
+
+    //! \brief re-read the size of the tile cache from LuminanceOptions
+    //! \note call it from the GUI thread when the preferences change
+    static void updateSettings();
+
+Q_SIGNALS:
+    //! \brief level \a level can now be passed to tile()
+    void levelReady(int level);
+
+private:
+    ImagePyramid(const ImagePyramid&);
+    ImagePyramid& operator=(const ImagePyramid&);
+
+    void build();
+
+    const quint64 m_id;         // key of the tiles in the cache
+    const QSize m_size;
+
+    mutable QMutex m_mutex;     // protects m_levels
+    QVector<QImage> m_levels;
+
+    QAtomicInt m_abort;
+    QAtomicInt m_cost;          // KB held by m_levels, counted in the budget
+    QFuture<void> m_future;
+};
+
+typedef QSharedPointer<ImagePyramid> ImagePyramidPtr;
+
+#endif // IMAGEPYRAMID_H
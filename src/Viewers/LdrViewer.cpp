@@ -39,7 +39,7 @@
 #include "Common/LuminanceOptions.h"
 
 #include <Libpfs/frame.h>
-#include <Libpfs/utils/resourcehandlerlcms.h>
+#include <Libpfs/colorspace/iccmanager.h>
 
 using namespace pfs;
 
@@ -74,17 +74,11 @@ bool doCMSTransform(QImage& qImage, bool doProof, bool doGamutCheck)
         return false;
     }
 
-    utils::ScopedCmsProfile hsRGB( cmsCreate_sRGBProfile() );
-    utils::ScopedCmsProfile hOut(
-                cmsOpenProfileFromFile(
-                    QFile::encodeName( monitor_fname ).constData(), "r")
-                );
-
-    utils::ScopedCmsProfile hProof;
-    utils::ScopedCmsTransform xform;
+    colorspace::IccManager& icc = colorspace::IccManager::instance();
+    const std::string monitor_profile = QFile::encodeName( monitor_fname ).constData();
 
     // Check whether the output profile is open
-    if ( !hOut )
+    if ( !icc.profile(monitor_profile) )
     {
         QMessageBox::warning(0,
                              QObject::tr("Warning"),
@@ -95,13 +89,11 @@ bool doCMSTransform(QImage& qImage, bool doProof, bool doGamutCheck)
     }
 
     //
+    std::string printer_profile;
     if (doProof && !printer_fname.isEmpty())
     {
-        hProof.reset(
-                    cmsOpenProfileFromFile(
-                        QFile::encodeName( printer_fname ).constData(), "r")
-                    );
-        if ( !hProof )
+        printer_profile = QFile::encodeName( printer_fname ).constData();
+        if ( !icc.profile(printer_profile) )
         {
             QMessageBox::warning(0,
                                  QObject::tr("Warning"),
@@ -119,21 +111,20 @@ bool doCMSTransform(QImage& qImage, bool doProof, bool doGamutCheck)
         doProof = false;
     }
 
+    // transforms are built once and kept by IccManager
+    colorspace::IccTransformPtr xform;
     if (doProof)
     {
         cmsUInt32Number dwFlags = doGamutCheck ? cmsFLAGS_SOFTPROOFING | cmsFLAGS_GAMUTCHECK : cmsFLAGS_SOFTPROOFING;
-        cmsUInt16Number alarmCodes[cmsMAXCHANNELS] = { 0 };
-        alarmCodes[1] = 0xFFFF;
-        cmsSetAlarmCodes(alarmCodes);
-        xform.reset( cmsCreateProofingTransform(hsRGB.data(), TYPE_BGRA_8, //TYPE_RGBA_8,
-                                                hOut.data(), TYPE_BGRA_8, //TYPE_RGBA_8,
-                                                hProof.data(), INTENT_PERCEPTUAL, INTENT_ABSOLUTE_COLORIMETRIC, dwFlags) );
+        xform = icc.proofingTransform(colorspace::IccManager::SRGB, TYPE_BGRA_8, //TYPE_RGBA_8,
+                                      monitor_profile, TYPE_BGRA_8, //TYPE_RGBA_8,
+                                      printer_profile, INTENT_PERCEPTUAL, INTENT_ABSOLUTE_COLORIMETRIC, dwFlags);
     }
     else
     {
-        xform.reset( cmsCreateTransform(hsRGB.data(), TYPE_BGRA_8, //TYPE_RGBA_8,
-                                        hOut.data(), TYPE_BGRA_8, //TYPE_RGBA_8,
-                                        INTENT_PERCEPTUAL, 0) );
+        xform = icc.transform(colorspace::IccManager::SRGB, TYPE_BGRA_8, //TYPE_RGBA_8,
+                              monitor_profile, TYPE_BGRA_8, //TYPE_RGBA_8,
+                              INTENT_PERCEPTUAL, 0);
     }
 
     if ( !xform )
@@ -146,8 +137,9 @@ bool doCMSTransform(QImage& qImage, bool doProof, bool doGamutCheck)
         return false;
     }
 
-    cmsDoTransform( xform.data(), qImage.bits(), qImage.bits(),
-                    qImage.width()*qImage.height() );
+    // tabulated once per transform, then interpolated on all the threads
+    icc.lut8(xform)->apply(qImage.bits(), qImage.bytesPerLine(),
+                           qImage.width(), qImage.height());
 
     return true;
 }
@@ -220,7 +212,7 @@ void LdrViewer::updatePixmap()
     QScopedPointer<QImage> temp_qimage( fromLDRPFStoQImage(getFrame()));
 
     doCMSTransform(*temp_qimage, false, false);
-    mPixmap->setPixmap(QPixmap::fromImage(*temp_qimage));
+    mPixmap->setImage(*temp_qimage);
 
     informativeLabel->setText( tr("LDR image [%1 x %2]").arg(getWidth()).arg(getHeight()) );
 }
@@ -256,7 +248,7 @@ void LdrViewer::doSoftProofing(bool doGamutCheck)
     QScopedPointer<QImage> src_image( fromLDRPFStoQImage(getFrame()) );
     if ( doCMSTransform(*src_image, true, doGamutCheck) )
     {
-        mPixmap->setPixmap(QPixmap::fromImage(*src_image));
+        mPixmap->setImage(*src_image);
     }
 }
 
@@ -265,6 +257,6 @@ void LdrViewer::undoSoftProofing()
     QScopedPointer<QImage> src_image( fromLDRPFStoQImage(getFrame()) );
     if ( doCMSTransform(*src_image, false, false) )
     {
-        mPixmap->setPixmap(QPixmap::fromImage(*src_image));
+        mPixmap->setImage(*src_image);
     }
 }
@@ -38,7 +38,7 @@
 #include <QMouseEvent>
 #include <cassert>
 
-#include <Libpfs/array2d.h>
+#include <Libpfs/channel.h>
 
 #include "Histogram.h"
 
@@ -267,7 +267,7 @@ void LuminanceRangeWidget::shrinkRange()
   emit updateRangeWindow();
 }
 
-void LuminanceRangeWidget::setHistogramImage( const pfs::Array2Df *image )
+void LuminanceRangeWidget::setHistogramImage( const pfs::Channel *image )
 {
   histogramImage = image;
   delete histogram;
@@ -278,15 +278,9 @@ void LuminanceRangeWidget::setHistogramImage( const pfs::Array2Df *image )
 void LuminanceRangeWidget::fitToDynamicRange()
 {
   if( histogramImage != NULL ) {
-    float min = 99999999.0f;
-    float max = -99999999.0f;
-
-    int size = histogramImage->getRows()*histogramImage->getCols();
-    for( int i = 0; i < size; i++ ) {
-      float v = (*histogramImage)(i);
-      if( v > max ) max = v;
-      else if( v < min ) min = v;
-    }
+    const pfs::utils::Statistics stats = histogramImage->getStatistics();
+    float min = stats.min;
+    float max = stats.max;
 
     if( min <= 0.000001f ) min = 0.000001f; // If data contains negative values
 
@@ -31,6 +31,10 @@
 #include "Viewers/Histogram.h"
 #include "Libpfs/array2d_fwd.h"
 
+namespace pfs {
+class Channel;
+}
+
 class LuminanceRangeWidget : public QFrame {
   Q_OBJECT
 public:
@@ -80,7 +84,7 @@ private:
   float valuePointer;
 
   Histogram *histogram;
-  const pfs::Array2Df *histogramImage;
+  const pfs::Channel *histogramImage;
 
   QRect getPaintRect() const;
   
@@ -96,7 +100,7 @@ public:
 
   void setRangeWindowMinMax( float min, float max );
   
-  void setHistogramImage( const pfs::Array2Df *image );
+  void setHistogramImage( const pfs::Channel *image );
 
   void showValuePointer( float value );
   void hideValuePointer();
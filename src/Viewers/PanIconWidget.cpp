@@ -48,13 +48,31 @@ PanIconWidget::PanIconWidget(QWidget *parent, Qt::WindowFlags flags) :
 	setMouseTracking(true); //necessary?
 }
 
+namespace
+{
+const int ICON_WIDTH = 180;
+const int ICON_HEIGHT = 120;
+}
+
 void PanIconWidget::setImage(const QImage *fullsize)
 {
-        m_image           = new QImage(fullsize->scaled(180,120,Qt::KeepAspectRatio));
+    setThumbnail(fullsize->scaled(ICON_WIDTH, ICON_HEIGHT, Qt::KeepAspectRatio),
+                 fullsize->size());
+}
+
+void PanIconWidget::setImage(const ImagePyramid& pyramid)
+{
+    setThumbnail(pyramid.thumbnail(QSize(ICON_WIDTH, ICON_HEIGHT)), pyramid.size());
+}
+
+void PanIconWidget::setThumbnail(const QImage& thumbnail, const QSize& fullsize)
+{
+	delete m_image;
+	m_image           = new QImage(thumbnail);
 	m_width           = m_image->width();
 	m_height          = m_image->height();
-        m_orgWidth        = fullsize->width();
-        m_orgHeight       = fullsize->height();
+	m_orgWidth        = fullsize.width();
+	m_orgHeight       = fullsize.height();
 	setFixedSize(m_width+2*frameWidth(), m_height+2*frameWidth());
 // 	m_rect = QRect(width()/2-m_width/2, height()/2-m_height/2, m_width, m_height);
 	//KPopupFrame::setMainWidget = resize
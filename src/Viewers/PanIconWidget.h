@@ -27,6 +27,8 @@
 
 #include <QFrame>
 
+#include "Viewers/ImagePyramid.h"
+
 class PanIconWidget : public QFrame
 {
 Q_OBJECT
@@ -34,6 +36,9 @@ public:
     PanIconWidget(QWidget *parent=0, Qt::WindowFlags flags=Qt::Popup);
     ~PanIconWidget();
     void setImage(const QImage * fullsize_zoomed_image);
+    //! \brief takes the thumbnail from an existing pyramid, without touching
+    //! the full resolution image
+    void setImage(const ImagePyramid& pyramid);
     void popup(const QPoint &pos);
     void setRegionSelection(QRect regionSelection);
     void setMouseFocus(void);
@@ -53,6 +58,7 @@ protected:
 private:
 	/** Recalculate the target selection position and emit 'selectionMoved'.*/
 	void regionSelectionMoved( );
+	void setThumbnail(const QImage& thumbnail, const QSize& fullsize);
 	//coordinates relative to this widget
 	int      xpos;
 	int      ypos;
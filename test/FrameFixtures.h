@@ -0,0 +1,118 @@
+/*
+ * This file is a part of Luminance HDR package
+ * ----------------------------------------------------------------------
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+//! \brief frames used as input by the tests of the operators and of the
+//! frame manipulation functions, and their comparison
+
+#ifndef FRAMEFIXTURES_H
+#define FRAMEFIXTURES_H
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "Libpfs/frame.h"
+
+#include "SeqInt.h"
+
+struct RandPositive
+{
+    float operator()()
+    {
+        return (static_cast<float>(rand())/(RAND_MAX))*1000.f + 0.01f;
+    }
+};
+
+//! \brief frame whose three channels hold 0, 1, 2... in row major order
+inline
+pfs::Frame* buildSeqFrame(size_t width, size_t height)
+{
+    pfs::Frame* frame = new pfs::Frame(width, height);
+
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels(X, Y, Z);
+    std::generate(X->begin(), X->end(), SeqInt());
+    std::generate(Y->begin(), Y->end(), SeqInt());
+    std::generate(Z->begin(), Z->end(), SeqInt());
+
+    return frame;
+}
+
+//! \brief frame of random positive values (see RandPositive), from the
+//! current seed of rand()
+inline
+pfs::Frame* buildRandomFrame(size_t width, size_t height)
+{
+    pfs::Frame* frame = new pfs::Frame(width, height);
+
+    pfs::Channel *X, *Y, *Z;
+    frame->createXYZChannels(X, Y, Z);
+    std::generate(X->begin(), X->end(), RandPositive());
+    std::generate(Y->begin(), Y->end(), RandPositive());
+    std::generate(Z->begin(), Z->end(), RandPositive());
+
+    return frame;
+}
+
+//! \brief RGB frame with a smooth content spanning 4 orders of magnitude and
+//! some texture, so that local operators have something to work on
+inline
+pfs::Frame* buildTexturedFrame(size_t width, size_t height)
+{
+    pfs::Frame* frame = new pfs::Frame(width, height);
+
+    pfs::Channel *R, *G, *B;
+    frame->createXYZChannels(R, G, B);
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            const float base = std::pow(10.f, 3.f*x/width + std::sin(0.05f*y));
+            const float noise = static_cast<float>(rand())/RAND_MAX;
+            (*R)(x, y) = base*(0.8f + 0.2f*noise);
+            (*G)(x, y) = base;
+            (*B)(x, y) = base*(1.2f - 0.2f*noise);
+        }
+    }
+    return frame;
+}
+
+//! \brief compare every pixel of \a frame with \a reference
+inline
+void compareFrames(const pfs::Frame& reference, const pfs::Frame& frame,
+                   float tolerance)
+{
+    const pfs::Channel *X1, *Y1, *Z1;
+    const pfs::Channel *X2, *Y2, *Z2;
+    reference.getXYZChannels(X1, Y1, Z1);
+    frame.getXYZChannels(X2, Y2, Z2);
+
+    ASSERT_EQ(reference.getWidth(), frame.getWidth());
+    ASSERT_EQ(reference.getHeight(), frame.getHeight());
+    for (size_t idx = 0; idx < X1->size(); ++idx)
+    {
+        ASSERT_NEAR((*X1)(idx), (*X2)(idx), tolerance);
+        ASSERT_NEAR((*Y1)(idx), (*Y2)(idx), tolerance);
+        ASSERT_NEAR((*Z1)(idx), (*Z2)(idx), tolerance);
+    }
+}
+
+#endif // FRAMEFIXTURES_H
@@ -0,0 +1,303 @@
+/**
+ * This file is a part of Luminance HDR package.
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+//! \brief Throughput of the Radiance RGBE reader and writer, compared with
+//! the serial scanline-by-scanline codec they replaced (reproduced below).
+//! Usage: RGBEBenchmark [-i input.hdr] [-w width -h height] [-r repeat]
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Libpfs/frame.h>
+#include <Libpfs/io/rgbereader.h>
+#include <Libpfs/io/rgbewriter.h>
+#include <Libpfs/io/rgbecommon.h>
+#include <Libpfs/utils/msec_timer.h>
+#include <Libpfs/utils/resourcehandlerstdio.h>
+
+using namespace std;
+using namespace pfs;
+using namespace pfs::io;
+
+namespace po = boost::program_options;
+
+namespace legacy
+{
+void rgbe2rgb(const Trgbe_pixel& rgbe, float exposure, float &r, float &g, float &b)
+{
+    if ( rgbe.e != 0 )
+    {
+        int e = rgbe.e - int(128+8);
+        double f = ldexp( 1.0, e ) * WHITE_EFFICACY / exposure;
+
+        r = (float)(rgbe.r * f);
+        g = (float)(rgbe.g * f);
+        b = (float)(rgbe.b * f);
+    }
+    else
+        r = g = b = 0.f;
+}
+
+void RLERead(FILE* file, Trgbe* scanline, int size)
+{
+    int peek = 0;
+    while ( peek < size )
+    {
+        Trgbe p[2];
+        if ( fread(p, sizeof(p), 1, file) == 0) {
+            throw ReadException("RGBE: Invalid data size");
+        }
+        if ( p[0]>128 )
+        {
+            int run_len = p[0]-128;
+            while ( run_len > 0 )
+            {
+                scanline[peek++] = p[1];
+                run_len--;
+            }
+        }
+        else
+        {
+            scanline[peek++] = p[1];
+
+            int nonrun_len = p[0]-1;
+            if ( nonrun_len > 0 )
+            {
+                if ( fread(scanline+peek, sizeof(*scanline), nonrun_len, file) == 0) {
+                    throw ReadException("RGBE: Invalid data size");
+                }
+                peek += nonrun_len;
+            }
+        }
+    }
+}
+
+//! \brief reads the pixels of a file whose header has already been parsed,
+//! only RLE scanlines
+void readRadiance(FILE *file, int width, int height, float exposure,
+                  Array2Df &X, Array2Df &Y, Array2Df &Z)
+{
+    std::vector<Trgbe> scanline(width*4);
+
+    for (int y = 0; y < height; ++y)
+    {
+        Trgbe header[4];
+        if ( fread(header, sizeof(header), 1, file) != 1 ) {
+            throw ReadException("RGBE: invalid data size");
+        }
+        for (int ch = 0; ch < 4 ; ++ch) {
+            RLERead(file, scanline.data()+width*ch, width);
+        }
+        for (int x = 0; x < width; ++x)
+        {
+            Trgbe_pixel rgbe;
+            rgbe.r = scanline[x+width*0];
+            rgbe.g = scanline[x+width*1];
+            rgbe.b = scanline[x+width*2];
+            rgbe.e = scanline[x+width*3];
+
+            rgbe2rgb(rgbe, exposure, X(x,y), Y(x,y), Z(x,y));
+        }
+    }
+}
+
+//! \brief skips the header written by RGBEWriter
+void skipHeader(FILE* file)
+{
+    char line[256];
+    while ( fgets(line, sizeof(line), file) != NULL )
+    {
+        if ( line[0] == '-' || line[0] == '+' ) return;
+    }
+    throw InvalidHeader("RGBE: unknown image size");
+}
+}
+
+namespace
+{
+long fileSize(const std::string& filename)
+{
+    utils::ScopedStdIoFile file(fopen(filename.c_str(), "rb"));
+    if ( !file ) return 0;
+    fseek(file.data(), 0, SEEK_END);
+    return ftell(file.data());
+}
+
+void fillSynthetic(Frame& frame)
+{
+    Channel *R, *G, *B;
+    frame.createXYZChannels(R, G, B);
+
+    const int width = frame.getWidth();
+    const int height = frame.getHeight();
+
+    // smooth gradients with a sun-like hot spot, as in a sky probe, plus some
+    // noise so that the RLE does not collapse whole scanlines
+#pragma omp parallel for
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const float u = float(x)/width;
+            const float v = float(y)/height;
+            const float d2 = (u - 0.3f)*(u - 0.3f) + (v - 0.2f)*(v - 0.2f);
+            const float sun = 5e4f*std::exp(-d2*4000.f);
+            const float noise = ((x*7919 + y*104729) % 1021)/1021.f*0.05f;
+            (*R)(x, y) = 0.5f + u + noise + sun;
+            (*G)(x, y) = 0.7f + v + ((x/64 + y/64) % 2)*0.1f + sun;
+            (*B)(x, y) = 1.2f - v + sun;
+        }
+    }
+}
+
+double throughput(double amount, double msec)
+{
+    return (msec > 0.) ? amount/(msec/1000.) : 0.;
+}
+
+void report(const std::string& what, long bytes, long pixels, double msec, double reference)
+{
+    cout << what << ": " << msec << " ms, "
+         << throughput(bytes/(1024.*1024.), msec) << " MB/s, "
+         << throughput(pixels/1e6, msec) << " Mpixel/s";
+    if ( reference > 0. ) cout << " (x" << reference/msec << ")";
+    cout << endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::string input;
+    std::string temp;
+    int width;
+    int height;
+    int repeat;
+
+    po::options_description desc("Allowed options: ");
+    desc.add_options()
+            ("input,i", po::value<std::string>(&input), "input file (default: synthetic image)")
+            ("width,w", po::value<int>(&width)->default_value(8192), "width of the synthetic image")
+            ("height,h", po::value<int>(&height)->default_value(4096), "height of the synthetic image")
+            ("repeat,r", po::value<int>(&repeat)->default_value(3), "runs of each test, the best one is reported")
+            ("temp,t", po::value<std::string>(&temp)->default_value("rgbe_benchmark.hdr"), "temporary file")
+            ;
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        Frame frame(0, 0);
+        if ( input.empty() )
+        {
+            Frame synthetic(width, height);
+            fillSynthetic(synthetic);
+            frame.swap(synthetic);
+        }
+        else
+        {
+            RGBEReader reader(input);
+            reader.read(frame, Params());
+        }
+        width = frame.getWidth();
+        height = frame.getHeight();
+
+        // writer
+        double writeTime = 0.;
+        for (int run = 0; run < repeat; ++run)
+        {
+            msec_timer t;
+            t.start();
+            RGBEWriter writer(temp);
+            writer.write(frame, Params());
+            t.stop_and_update();
+            writeTime = (run == 0) ? t.get_time() : std::min(writeTime, t.get_time());
+        }
+        const long bytes = fileSize(temp);
+        const long pixels = long(width)*height;
+        cout << width << "x" << height << ", " << bytes << " bytes" << endl;
+        report("RGBEWriter", bytes, pixels, writeTime, 0.);
+
+        // reader, against the serial one
+        Frame legacyFrame(width, height);
+        Channel *X, *Y, *Z;
+        legacyFrame.createXYZChannels(X, Y, Z);
+
+        double legacyTime = 0.;
+        for (int run = 0; run < repeat; ++run)
+        {
+            utils::ScopedStdIoFile file(fopen(temp.c_str(), "rb"));
+            msec_timer t;
+            t.start();
+            legacy::skipHeader(file.data());
+            legacy::readRadiance(file.data(), width, height, 1.f, *X, *Y, *Z);
+            t.stop_and_update();
+            legacyTime = (run == 0) ? t.get_time() : std::min(legacyTime, t.get_time());
+        }
+        report("serial reader", bytes, pixels, legacyTime, 0.);
+
+        Frame result(0, 0);
+        double readTime = 0.;
+        for (int run = 0; run < repeat; ++run)
+        {
+            msec_timer t;
+            t.start();
+            RGBEReader reader(temp);
+            reader.read(result, Params());
+            t.stop_and_update();
+            readTime = (run == 0) ? t.get_time() : std::min(readTime, t.get_time());
+        }
+        report("RGBEReader", bytes, pixels, readTime, legacyTime);
+
+        // both readers must agree, up to the float rounding of the scale
+        const Channel *R, *G, *B;
+        result.getXYZChannels(R, G, B);
+        float maxError = 0.f;
+        for (size_t i = 0; i < R->size(); ++i)
+        {
+            const float pairs[3][2] = { { (*R)(i), (*X)(i) },
+                                        { (*G)(i), (*Y)(i) },
+                                        { (*B)(i), (*Z)(i) } };
+            for (int c = 0; c < 3; ++c)
+            {
+                const float error = std::fabs(pairs[c][0] - pairs[c][1]) /
+                        std::max(std::fabs(pairs[c][1]), 1e-30f);
+                maxError = std::max(maxError, error);
+            }
+        }
+        cout << "max relative difference: " << maxError << endl;
+
+        std::remove(temp.c_str());
+        return (maxError < 1e-6f) ? 0 : 1;
+    }
+    catch (std::exception& ex)
+    {
+        cerr << ex.what() << endl;
+        std::remove(temp.c_str());
+        return 1;
+    }
+}
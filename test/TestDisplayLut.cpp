@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+
+#include "Libpfs/colorspace/displaylut.h"
+
+using namespace pfs::colorspace;
+
+namespace
+{
+float referenceGamma(float sample, float gamma)
+{
+    return std::pow(sample, 1.f/gamma)*255.f + 0.5f;
+}
+}
+
+TEST(TestDisplayLut, Boundaries)
+{
+    const DisplayLut& lut = DisplayLut::get(MAP_GAMMA2_2);
+
+    ASSERT_EQ(lut(-1.f), 0);
+    ASSERT_EQ(lut(0.f), 0);
+    ASSERT_EQ(lut(NAN), 0);
+    ASSERT_EQ(lut(1.f), 255);
+    ASSERT_EQ(lut(10.f), 255);
+}
+
+TEST(TestDisplayLut, Gamma22)
+{
+    const DisplayLut& lut = DisplayLut::get(MAP_GAMMA2_2);
+
+    srand(11);
+    for (int idx = 0; idx < 100000; ++idx)
+    {
+        // uniform in the log domain, so the dark end is tested as well
+        const float sample = std::pow(10.f, -6.f*rand()/RAND_MAX);
+        const int expected = static_cast<int>(referenceGamma(sample, 2.2f));
+
+        ASSERT_NEAR(lut(sample), expected, 1) << sample;
+    }
+}
+
+TEST(TestDisplayLut, Linear)
+{
+    const DisplayLut& lut = DisplayLut::get(MAP_LINEAR);
+
+    for (int idx = 0; idx < 256; ++idx)
+    {
+        ASSERT_NEAR(lut(idx/255.f), idx, 1);
+    }
+}
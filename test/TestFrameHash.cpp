@@ -0,0 +1,40 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/utils/hash.h"
+
+#include "FrameFixtures.h"
+
+using namespace pfs;
+
+TEST(TestFrameHash, SameContentSameHash)
+{
+    std::unique_ptr<Frame> frame(buildSeqFrame(1000, 700));
+    std::unique_ptr<Frame> other(pfs::copy(frame.get()));
+
+    ASSERT_EQ(utils::hash(*frame), utils::hash(*frame));
+    ASSERT_EQ(utils::hash(*frame), utils::hash(*other));
+}
+
+TEST(TestFrameHash, ContentChangesHash)
+{
+    std::unique_ptr<Frame> frame(buildSeqFrame(1000, 700));
+    const uint64_t reference = utils::hash(*frame);
+
+    Channel* Y = frame->getChannel("Y");
+    (*Y)(999, 699) += 1.f;
+
+    ASSERT_NE(reference, utils::hash(*frame));
+}
+
+TEST(TestFrameHash, SizeChangesHash)
+{
+    // same number of samples, same content, different shape
+    std::unique_ptr<Frame> frame1(buildSeqFrame(100, 70));
+    std::unique_ptr<Frame> frame2(buildSeqFrame(70, 100));
+
+    ASSERT_NE(utils::hash(*frame1), utils::hash(*frame2));
+}
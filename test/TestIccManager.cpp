@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "Libpfs/array2d.h"
+#include "Libpfs/colorspace/iccmanager.h"
+
+using namespace pfs;
+using namespace pfs::colorspace;
+
+namespace
+{
+float linearToSRGB(float sample)
+{
+    return (sample <= 0.0031308f) ? 12.92f*sample
+                                  : 1.055f*std::pow(sample, 1.f/2.4f) - 0.055f;
+}
+}
+
+TEST(TestIccManager, TransformsAreCached)
+{
+    IccManager& manager = IccManager::instance();
+
+    IccTransformPtr t1 = manager.transform(IccManager::SRGB, TYPE_RGB_8,
+                                           IccManager::SRGB, TYPE_RGB_8,
+                                           INTENT_PERCEPTUAL);
+    IccTransformPtr t2 = manager.transform(IccManager::SRGB, TYPE_RGB_8,
+                                           IccManager::SRGB, TYPE_RGB_8,
+                                           INTENT_PERCEPTUAL);
+    IccTransformPtr t3 = manager.transform(IccManager::SRGB, TYPE_RGB_8,
+                                           IccManager::SRGB, TYPE_RGB_8,
+                                           INTENT_RELATIVE_COLORIMETRIC);
+
+    ASSERT_TRUE(t1);
+    ASSERT_EQ(t1.get(), t2.get());
+    ASSERT_NE(t1.get(), t3.get());
+
+    // handles survive the cache
+    manager.clear();
+    std::vector<unsigned char> pixel(3, 128);
+    transformImage(t1, pixel.data(), 3, pixel.data(), 3, 1, 1);
+
+    IccTransformPtr t4 = manager.transform(IccManager::SRGB, TYPE_RGB_8,
+                                           IccManager::SRGB, TYPE_RGB_8,
+                                           INTENT_PERCEPTUAL);
+    ASSERT_NE(t1.get(), t4.get());
+}
+
+TEST(TestIccManager, MissingProfile)
+{
+    IccManager& manager = IccManager::instance();
+
+    ASSERT_FALSE(manager.profile("/this/profile/does/not/exist.icc"));
+    ASSERT_FALSE(manager.transform(IccManager::SRGB, TYPE_RGB_8,
+                                   "/this/profile/does/not/exist.icc", TYPE_RGB_8,
+                                   INTENT_PERCEPTUAL));
+}
+
+TEST(TestIccManager, StridedIdentity)
+{
+    const size_t width = 37;
+    const size_t height = 101;
+    const size_t bytesPerLine = 4*width + 12;
+
+    std::vector<unsigned char> image(bytesPerLine*height);
+    for (size_t idx = 0; idx < image.size(); ++idx)
+    {
+        image[idx] = static_cast<unsigned char>(idx*7);
+    }
+    const std::vector<unsigned char> reference(image);
+
+    IccTransformPtr xform = IccManager::instance().transform(
+                IccManager::SRGB, TYPE_BGRA_8,
+                IccManager::SRGB, TYPE_BGRA_8, INTENT_PERCEPTUAL);
+    ASSERT_TRUE(xform);
+    transformImage(xform, image.data(), bytesPerLine,
+                   image.data(), bytesPerLine, width, height);
+
+    for (size_t row = 0; row < height; ++row)
+    {
+        for (size_t x = 0; x < 4*width; ++x)
+        {
+            // alpha is not copied by LCMS, only the colour channels matter
+            if ( x % 4 == 3 ) continue;
+            ASSERT_NEAR(reference[row*bytesPerLine + x],
+                        image[row*bytesPerLine + x], 1);
+        }
+        // padding is not touched
+        for (size_t x = 4*width; x < bytesPerLine; ++x)
+        {
+            ASSERT_EQ(reference[row*bytesPerLine + x], image[row*bytesPerLine + x]);
+        }
+    }
+}
+
+TEST(TestIccManager, Lut8)
+{
+    const size_t width = 256;
+    const size_t height = 256;
+
+    std::vector<unsigned char> image(4*width*height);
+    srand(7);
+    for (size_t idx = 0; idx < image.size(); ++idx)
+    {
+        image[idx] = static_cast<unsigned char>(rand());
+    }
+    // corners of the cube
+    for (size_t idx = 0; idx < 8; ++idx)
+    {
+        image[4*idx] = (idx & 1) ? 255 : 0;
+        image[4*idx + 1] = (idx & 2) ? 255 : 0;
+        image[4*idx + 2] = (idx & 4) ? 255 : 0;
+    }
+    std::vector<unsigned char> reference(image);
+
+    IccManager& manager = IccManager::instance();
+    IccTransformPtr xform = manager.transform(IccManager::SRGB, TYPE_BGRA_8,
+                                              IccManager::LINEAR_SRGB, TYPE_BGRA_8,
+                                              INTENT_PERCEPTUAL);
+    ASSERT_TRUE(xform);
+    IccLut8Ptr lut = manager.lut8(xform);
+    ASSERT_EQ(lut.get(), manager.lut8(xform).get());
+
+    transformImage(xform, reference.data(), 4*width, reference.data(), 4*width,
+                   width, height);
+    lut->apply(image.data(), 4*width, width, height);
+
+    for (size_t idx = 0; idx < image.size(); ++idx)
+    {
+        if ( idx % 4 == 3 ) continue;
+        ASSERT_NEAR(reference[idx], image[idx], 1) << idx;
+    }
+}
+
+TEST(TestIccManager, FloatPipeline)
+{
+    IccManager& manager = IccManager::instance();
+    IccTransformPtr encode = manager.transform(IccManager::LINEAR_SRGB, TYPE_RGB_FLT,
+                                               IccManager::SRGB, TYPE_RGB_FLT,
+                                               INTENT_RELATIVE_COLORIMETRIC);
+    IccTransformPtr decode = manager.transform(IccManager::SRGB, TYPE_RGB_FLT,
+                                               IccManager::LINEAR_SRGB, TYPE_RGB_FLT,
+                                               INTENT_RELATIVE_COLORIMETRIC);
+    ASSERT_TRUE(encode);
+    ASSERT_TRUE(decode);
+
+    const size_t width = 64;
+    const size_t height = 40;
+    Array2Df red(width, height);
+    Array2Df green(width, height);
+    Array2Df blue(width, height);
+    for (size_t idx = 0; idx < width*height; ++idx)
+    {
+        // up to 4, HDR values are not clipped
+        red(idx) = green(idx) = blue(idx) = 4.f*idx/(width*height);
+    }
+    const Array2Df reference(red);
+
+    transformImage(encode, red, green, blue);
+    for (size_t idx = 0; idx < width*height; ++idx)
+    {
+        if ( reference(idx) <= 1.f )
+        {
+            ASSERT_NEAR(linearToSRGB(reference(idx)), green(idx), 2e-3f);
+        }
+        else
+        {
+            ASSERT_GT(green(idx), 1.f);
+        }
+    }
+
+    transformImage(decode, red, green, blue);
+    for (size_t idx = 0; idx < width*height; ++idx)
+    {
+        ASSERT_NEAR(reference(idx), red(idx), 2e-3f*std::max(1.f, reference(idx)));
+        ASSERT_NEAR(reference(idx), green(idx), 2e-3f*std::max(1.f, reference(idx)));
+        ASSERT_NEAR(reference(idx), blue(idx), 2e-3f*std::max(1.f, reference(idx)));
+    }
+}
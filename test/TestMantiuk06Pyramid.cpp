@@ -140,6 +140,47 @@ TEST(TestPyramidTBasic, CopyCtor)
     EXPECT_EQ(copyPyramid.numLevels(), 9u);
 }
 
+TEST(TestPyramidTBasic, CopyIsDeep)
+{
+    pfs::Array2Df samples(300, 200);
+    std::generate(samples.begin(), samples.end(), RandZeroOne());
+
+    PyramidT pyramid(200, 300);
+    pyramid.computeGradients(samples);
+
+    PyramidT copyPyramid = pyramid;
+    pyramid.scale(2.f);
+
+    PyramidT::const_iterator it = pyramid.begin();
+    PyramidT::const_iterator copyIt = copyPyramid.begin();
+    for ( ; it != pyramid.end(); ++it, ++copyIt)
+    {
+        ASSERT_NE(it->data(), copyIt->data());
+        for (size_t idx = 0; idx < it->size(); ++idx)
+        {
+            ASSERT_EQ(it->data()[idx].gX(), 2.f*copyIt->data()[idx].gX());
+            ASSERT_EQ(it->data()[idx].gY(), 2.f*copyIt->data()[idx].gY());
+        }
+    }
+}
+
+// G to R and back to G scales G by log(10), as in the original implementation
+TEST(TestTransform, RoundTrip)
+{
+    const float detailFactors[] = { 1.0f, 1.5f };
+    for (size_t d = 0; d < 2; ++d)
+    {
+        TransformToR toR(detailFactors[d]);
+        TransformToG toG(detailFactors[d]);
+
+        for (float g = -1.7f/detailFactors[d]; g < 1.7f/detailFactors[d];
+             g += 0.001f)
+        {
+            ASSERT_NEAR(toG(toR(g)), 2.3025851f*g, 1e-3f);
+        }
+    }
+}
+
 TEST_P(TestPyramidT, Ctor)
 {
     // EXPECT_EQ(newPyramid_.numLevels(), 9u);
@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+#include <vector>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+
+#include "TonemappingOperators/mantiuk08/tonecurve_qp.h"
+#include "TonemappingOperators/mantiuk08/cqp/gsl_cqp.h"
+
+namespace
+{
+//! \brief problem with the structure of the tone curve optimization: every
+//! contrast seen in the image constrains the sum of a range of segments
+struct ToneCurveProblem
+{
+    //! \param regularize if false, H is only positive semi-definite: segments
+    //! covered by no row or always together are not constrained by the image
+    ToneCurveProblem(int n, int m, unsigned seed, bool regularize = true)
+        : n(n)
+        , H(n*n, 0.)
+        , f(n, 0.)
+        , d_max(2.3)
+    {
+        std::srand(seed);
+        for (int k = 0; k < m; ++k)
+        {
+            const int from = std::rand() % n;
+            const int to = std::min(n, from + 1 + std::rand() % 8);
+            const double w = 1. + std::rand() % 1000;
+            const double b = 0.5*static_cast<double>(std::rand())/RAND_MAX;
+
+            for (int i = from; i < to; ++i)
+            {
+                f[i] -= w*b;
+                for (int j = from; j < to; ++j)
+                {
+                    H[i*n + j] += w;
+                }
+            }
+        }
+        // every segment is constrained at least a bit
+        for (int i = 0; regularize && i < n; ++i)
+        {
+            H[i*n + i] += 1.;
+        }
+    }
+
+    double objective(const std::vector<double>& x) const
+    {
+        double value = 0.;
+        for (int i = 0; i < n; ++i)
+        {
+            double hx = 0.;
+            for (int j = 0; j < n; ++j)
+            {
+                hx += H[i*n + j]*x[j];
+            }
+            value += 0.5*x[i]*hx + f[i]*x[i];
+        }
+        return value;
+    }
+
+    int n;
+    std::vector<double> H;
+    std::vector<double> f;
+    double d_max;
+};
+
+//! \brief reference solution, with the interior-point solver the tone curve
+//! used to be optimized with
+std::vector<double> solveCqp(const ToneCurveProblem& p)
+{
+    const int n = p.n;
+    gsl_matrix* Q = gsl_matrix_alloc(n, n);
+    gsl_vector* q = gsl_vector_alloc(n);
+    gsl_matrix* C = gsl_matrix_calloc(n + 1, n);
+    gsl_vector* d = gsl_vector_calloc(n + 1);
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            gsl_matrix_set(Q, i, j, p.H[i*n + j]);
+        }
+        gsl_vector_set(q, i, p.f[i]);
+        gsl_matrix_set(C, i, i, 1.);
+        gsl_matrix_set(C, n, i, -1.);
+    }
+    gsl_vector_set(d, n, -p.d_max);
+
+    const gsl_matrix null_matrix = {0,0,0,0,0,0};
+    const gsl_vector null_vector = {0,0,0,0,0};
+
+    gsl_cqp_data cqpd;
+    cqpd.Q = Q;
+    cqpd.q = q;
+    cqpd.A = &null_matrix;
+    cqpd.b = &null_vector;
+    cqpd.C = C;
+    cqpd.d = d;
+
+    gsl_cqpminimizer* s = gsl_cqpminimizer_alloc(gsl_cqpminimizer_mg_pdip, n, 0, n + 1);
+    gsl_cqpminimizer_set(s, &cqpd);
+    int status;
+    size_t iter = 0;
+    do
+    {
+        gsl_cqpminimizer_iterate(s);
+        status = gsl_cqpminimizer_test_convergence(s, 1e-10, 1e-10);
+    }
+    while (status == GSL_CONTINUE && ++iter < 100);
+
+    std::vector<double> x(n);
+    for (int i = 0; i < n; ++i)
+    {
+        x[i] = gsl_vector_get(gsl_cqpminimizer_x(s), i);
+    }
+
+    gsl_cqpminimizer_free(s);
+    gsl_vector_free(d);
+    gsl_matrix_free(C);
+    gsl_vector_free(q);
+    gsl_matrix_free(Q);
+    return x;
+}
+
+void checkOptimality(const ToneCurveProblem& p, const std::vector<double>& x)
+{
+    const int n = p.n;
+    const double sum = std::accumulate(x.begin(), x.end(), 0.);
+    ASSERT_LE(sum, p.d_max*(1. + 1e-9));
+
+    std::vector<double> g(p.f);
+    for (int i = 0; i < n; ++i)
+    {
+        ASSERT_GE(x[i], 0.);
+        for (int j = 0; j < n; ++j)
+        {
+            g[i] += p.H[i*n + j]*x[j];
+        }
+    }
+
+    // multiplier of the dynamic range constraint, from the free segments
+    double lambda = 0.;
+    for (int i = 0; i < n; ++i)
+    {
+        if (x[i] > 0.)
+        {
+            lambda = -g[i];
+            break;
+        }
+    }
+    const double tolerance = 1e-6*(1. + *std::max_element(p.H.begin(), p.H.end()));
+    if (sum < p.d_max*(1. - 1e-9))
+    {
+        EXPECT_NEAR(0., lambda, tolerance);
+    }
+    EXPECT_GE(lambda, -tolerance);
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (x[i] > 0.)
+        {
+            EXPECT_NEAR(0., g[i] + lambda, tolerance) << "segment " << i;
+        }
+        else
+        {
+            EXPECT_GE(g[i] + lambda, -tolerance) << "segment " << i;
+        }
+    }
+}
+}
+
+TEST(TestMantiuk08ToneCurveQP, Optimality)
+{
+    for (unsigned seed = 1; seed <= 20; ++seed)
+    {
+        ToneCurveProblem p(20 + 7*seed, 40*seed, seed);
+        std::vector<double> x;
+        EXPECT_TRUE(solve_tonecurve_qp(p.H, p.f, p.d_max, x));
+        checkOptimality(p, x);
+    }
+}
+
+TEST(TestMantiuk08ToneCurveQP, WarmStart)
+{
+    ToneCurveProblem p(120, 2000, 7);
+    std::vector<double> cold;
+    ASSERT_TRUE(solve_tonecurve_qp(p.H, p.f, p.d_max, cold));
+
+    // an infeasible starting point is projected back
+    std::vector<double> warm(p.n, 1.);
+    warm[3] = -1.;
+    ASSERT_TRUE(solve_tonecurve_qp(p.H, p.f, p.d_max, warm));
+
+    for (int i = 0; i < p.n; ++i)
+    {
+        EXPECT_NEAR(cold[i], warm[i], 1e-9);
+    }
+}
+
+TEST(TestMantiuk08ToneCurveQP, MatchesInteriorPointSolver)
+{
+    for (unsigned seed = 1; seed <= 20; ++seed)
+    {
+        ToneCurveProblem p(20 + 7*seed, 40*seed, seed);
+        std::vector<double> x;
+        solve_tonecurve_qp(p.H, p.f, p.d_max, x);
+        const std::vector<double> reference = solveCqp(p);
+
+        // the reference stops close to the optimum, not on it
+        const double obj = p.objective(x);
+        const double obj_ref = p.objective(reference);
+        EXPECT_LE(obj, obj_ref + 1e-6*std::fabs(obj_ref)) << "seed " << seed;
+        for (int i = 0; i < p.n; ++i)
+        {
+            EXPECT_NEAR(reference[i], x[i], 1e-3) << "seed " << seed << ", segment " << i;
+        }
+    }
+}
+
+TEST(TestMantiuk08ToneCurveQP, RankDeficient)
+{
+    for (unsigned seed = 1; seed <= 20; ++seed)
+    {
+        // fewer rows than segments: H is singular
+        ToneCurveProblem p(30 + 5*seed, 2 + seed, seed, false);
+        std::vector<double> x;
+        EXPECT_TRUE(solve_tonecurve_qp(p.H, p.f, p.d_max, x)) << "seed " << seed;
+        for (int i = 0; i < p.n; ++i)
+        {
+            ASSERT_TRUE(std::isfinite(x[i])) << "seed " << seed << ", segment " << i;
+        }
+        checkOptimality(p, x);
+    }
+
+    // all the segments in a single row: H has rank 1
+    ToneCurveProblem p(16, 0, 1, false);
+    for (int i = 0; i < p.n; ++i)
+    {
+        p.f[i] = -3.;
+        for (int j = 0; j < p.n; ++j)
+        {
+            p.H[i*p.n + j] = 1.;
+        }
+    }
+    std::vector<double> x;
+    EXPECT_TRUE(solve_tonecurve_qp(p.H, p.f, p.d_max, x));
+    checkOptimality(p, x);
+    EXPECT_NEAR(p.d_max, std::accumulate(x.begin(), x.end(), 0.), 1e-9);
+}
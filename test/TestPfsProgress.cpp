@@ -0,0 +1,141 @@
+/**
+* This file is a part of LuminanceHDR package.
+* ----------------------------------------------------------------------
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program; if not, write to the Free Software
+*  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+* ----------------------------------------------------------------------
+*
+*/
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "Libpfs/progress.h"
+
+using namespace pfs;
+
+namespace
+{
+//! \brief records every value it receives, cancels itself at \a cancelAt
+class RecordingProgress : public Progress
+{
+public:
+    explicit RecordingProgress(int cancelAt = -1)
+        : m_cancelAt(cancelAt)
+    {}
+
+    void setValue(int value)
+    {
+        Progress::setValue(value);
+        m_values.push_back(value);
+        if (m_cancelAt >= 0 && value >= m_cancelAt)
+        {
+            cancel();
+        }
+    }
+
+    const std::vector<int>& values() const
+    {
+        return m_values;
+    }
+
+private:
+    int m_cancelAt;
+    std::vector<int> m_values;
+};
+}
+
+TEST(TestPfsProgress, Chunks)
+{
+    Progress ph;
+    ProgressReporter progress(ph, 10001, 0, 100, 1000);
+    ASSERT_EQ(11u, progress.chunks());
+
+    size_t covered = 0;
+    for (size_t c = 0; c < progress.chunks(); ++c)
+    {
+        size_t begin, end;
+        progress.chunk(c, begin, end);
+        EXPECT_EQ(covered, begin);
+        covered = end;
+    }
+    EXPECT_EQ(10001u, covered);
+}
+
+TEST(TestPfsProgress, ThrottledReports)
+{
+    RecordingProgress ph;
+    {
+        ProgressReporter progress(ph, 1000000, 20, 80);
+        for (int i = 0; i < 1000000; ++i)
+        {
+            progress.advance();
+        }
+        progress.finish();
+    }
+
+    // the first value is reported immediately, the last one by finish()
+    const std::vector<int>& values = ph.values();
+    ASSERT_GE(values.size(), 2u);
+    EXPECT_LE(values.size(), 61u);
+    EXPECT_EQ(20, values.front());
+    EXPECT_EQ(80, values.back());
+    for (size_t i = 1; i < values.size(); ++i)
+    {
+        EXPECT_LT(values[i - 1], values[i]);
+    }
+}
+
+TEST(TestPfsProgress, CancelFromParallelLoop)
+{
+    // nothing is throttled on the cancellation side: the request is seen at
+    // the first poll after it
+    Progress ph;
+    ProgressReporter progress(ph, 100000, 0, 100, 100);
+    const long chunks = progress.chunks();
+
+    long processed = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:processed)
+    for (long c = 0; c < chunks; ++c)
+    {
+        if (progress.canceled())
+        {
+            continue;
+        }
+        if (c == 10)
+        {
+            ph.cancel();
+        }
+        size_t begin, end;
+        progress.chunk(c, begin, end);
+        processed += end - begin;
+        progress.advance(end - begin);
+    }
+
+    EXPECT_TRUE(progress.canceled());
+    EXPECT_LT(processed, 100000);
+}
+
+TEST(TestPfsProgress, FinishAfterCancel)
+{
+    RecordingProgress ph(10);
+    ProgressReporter progress(ph, 100, 10, 100);
+    EXPECT_TRUE(ph.canceled());
+
+    progress.advance(100);
+    EXPECT_TRUE(progress.canceled());
+
+    progress.finish();
+    EXPECT_EQ(10, ph.values().back());
+}
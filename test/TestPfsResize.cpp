@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+
+#include "Libpfs/array2d.h"
+#include "Libpfs/frame.h"
+#include "Libpfs/manip/resize.h"
+
+#include "SeqInt.h"
+
+using namespace pfs;
+
+namespace
+{
+const ResizeFilter FILTERS[] = {RESIZE_AUTO, RESIZE_BOX, RESIZE_BILINEAR,
+                                RESIZE_AREA, RESIZE_MITCHELL, RESIZE_LANCZOS3};
+const size_t NUM_FILTERS = sizeof(FILTERS)/sizeof(FILTERS[0]);
+}
+
+TEST(TestPfsResize, ConstantIsPreserved)
+{
+    Array2Df input(37, 23);
+    std::fill(input.begin(), input.end(), 3.5f);
+
+    for (size_t f = 0; f < NUM_FILTERS; ++f)
+    {
+        Array2Df smaller(11, 7);
+        resize(&input, &smaller, FILTERS[f]);
+        for (Array2Df::const_iterator it = smaller.begin(); it != smaller.end(); ++it)
+        {
+            ASSERT_NEAR(3.5f, *it, 10e-5f) << "filter " << FILTERS[f];
+        }
+
+        Array2Df larger(80, 50);
+        resize(&input, &larger, FILTERS[f]);
+        for (Array2Df::const_iterator it = larger.begin(); it != larger.end(); ++it)
+        {
+            ASSERT_NEAR(3.5f, *it, 10e-5f) << "filter " << FILTERS[f];
+        }
+    }
+}
+
+TEST(TestPfsResize, AreaHalving)
+{
+    const float ref[] = {3.5f, 5.5f, 7.5f,
+                         15.5f, 17.5f, 19.5f};
+
+    Array2Df input(6, 4);
+    std::generate(input.begin(), input.end(), SeqInt());
+
+    Array2Df output(3, 2);
+    resize(&input, &output, RESIZE_AREA);
+
+    for (size_t idx = 0; idx < 6; ++idx)
+    {
+        ASSERT_NEAR(ref[idx], output.data()[idx], 10e-5f);
+    }
+}
+
+// a ramp sampled at the pixel centres stays a ramp, also through the box
+// decimation of the large ratios
+TEST(TestPfsResize, RampLargeReduction)
+{
+    Array2Df input(512, 8);
+    for (size_t y = 0; y < input.getRows(); ++y)
+    {
+        for (size_t x = 0; x < input.getCols(); ++x)
+        {
+            input(x, y) = x + 0.5f;
+        }
+    }
+
+    for (size_t f = 0; f < NUM_FILTERS; ++f)
+    {
+        if ( FILTERS[f] == RESIZE_BOX ) continue;
+
+        Array2Df output(16, 2);
+        resize(&input, &output, FILTERS[f]);
+
+        // skip the borders, where the kernels are truncated
+        for (size_t x = 3; x < output.getCols() - 3; ++x)
+        {
+            ASSERT_NEAR((x + 0.5f)*32.f, output(x, 1), 10e-3f) << "filter " << FILTERS[f];
+        }
+    }
+}
+
+// the box decimation of the large ratios covers the input evenly, also when
+// the ratio is not an integer
+TEST(TestPfsResize, RampNonIntegerReduction)
+{
+    Array2Df input(1000, 8);
+    for (size_t y = 0; y < input.getRows(); ++y)
+    {
+        for (size_t x = 0; x < input.getCols(); ++x)
+        {
+            input(x, y) = x + 0.5f;
+        }
+    }
+
+    const ResizeFilter filters[] = {RESIZE_BILINEAR, RESIZE_MITCHELL, RESIZE_LANCZOS3};
+    for (size_t f = 0; f < 3; ++f)
+    {
+        Array2Df output(30, 2);
+        resize(&input, &output, filters[f]);
+
+        for (size_t x = 3; x < output.getCols() - 3; ++x)
+        {
+            ASSERT_NEAR((x + 0.5f)*1000.f/30.f, output(x, 1), 0.5f) << "filter " << filters[f];
+        }
+    }
+}
+
+TEST(TestPfsResize, CheckerboardDoesNotAlias)
+{
+    Array2Df input(256, 256);
+    for (size_t y = 0; y < input.getRows(); ++y)
+    {
+        for (size_t x = 0; x < input.getCols(); ++x)
+        {
+            input(x, y) = static_cast<float>((x + y) % 2);
+        }
+    }
+
+    const ResizeFilter filters[] = {RESIZE_AREA, RESIZE_MITCHELL, RESIZE_LANCZOS3};
+    for (size_t f = 0; f < 3; ++f)
+    {
+        Array2Df output(20, 20);
+        resize(&input, &output, filters[f]);
+        for (Array2Df::const_iterator it = output.begin(); it != output.end(); ++it)
+        {
+            ASSERT_NEAR(0.5f, *it, 0.02f) << "filter " << filters[f];
+        }
+    }
+}
+
+TEST(TestPfsResize, FrameAllChannels)
+{
+    Frame frame(300, 200);
+    Channel* X;
+    Channel* Y;
+    Channel* Z;
+    frame.createXYZChannels(X, Y, Z);
+    std::fill(X->begin(), X->end(), 1.f);
+    std::fill(Y->begin(), Y->end(), 2.f);
+    std::fill(Z->begin(), Z->end(), 3.f);
+
+    Frame* resized = resize(&frame, 60, RESIZE_LANCZOS3);
+
+    ASSERT_EQ(60u, resized->getWidth());
+    ASSERT_EQ(40u, resized->getHeight());
+
+    Channel* rX;
+    Channel* rY;
+    Channel* rZ;
+    resized->getXYZChannels(rX, rY, rZ);
+    ASSERT_TRUE(rX != NULL && rY != NULL && rZ != NULL);
+
+    for (size_t idx = 0; idx < rX->size(); ++idx)
+    {
+        ASSERT_NEAR(1.f, (*rX)(idx), 10e-5f);
+        ASSERT_NEAR(2.f, (*rY)(idx), 10e-5f);
+        ASSERT_NEAR(3.f, (*rZ)(idx), 10e-5f);
+    }
+    delete resized;
+}
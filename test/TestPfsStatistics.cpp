@@ -0,0 +1,242 @@
+/**
+* This file is a part of LuminanceHDR package.
+* ----------------------------------------------------------------------
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program; if not, write to the Free Software
+*  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+* ----------------------------------------------------------------------
+*
+*/
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include "Libpfs/channel.h"
+#include "Libpfs/utils/statistics.h"
+
+using namespace pfs;
+using namespace pfs::utils;
+
+namespace
+{
+std::vector<float> randomData(size_t size, unsigned seed)
+{
+    std::srand(seed);
+    std::vector<float> data(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        // log-uniform over 8 decades, plus some zeros and negative values
+        const float u = static_cast<float>(std::rand())/RAND_MAX;
+        data[i] = std::pow(10.f, -4.f + 8.f*u);
+        if ( i % 97 == 0 ) data[i] = 0.f;
+        if ( i % 101 == 0 ) data[i] = -u;
+    }
+    return data;
+}
+}
+
+TEST(TestPfsStatistics, SummaryMatchesSerial)
+{
+    const std::vector<float> data = randomData(100003, 1);
+
+    float min = data[0];
+    float max = data[0];
+    float minPositive = 1e30f;
+    double sum = 0.0;
+    double logSum = 0.0;
+    size_t positive = 0;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+        sum += data[i];
+        if ( data[i] > 0.f )
+        {
+            minPositive = std::min(minPositive, data[i]);
+            logSum += std::log(data[i]);
+            ++positive;
+        }
+    }
+
+    Statistics stats = computeStatistics(data.data(), data.size());
+    EXPECT_EQ(data.size(), stats.size);
+    EXPECT_EQ(positive, stats.positive);
+    EXPECT_EQ(min, stats.min);
+    EXPECT_EQ(max, stats.max);
+    EXPECT_EQ(minPositive, stats.minPositive);
+    EXPECT_NEAR(sum/data.size(), stats.mean, 1e-4*std::fabs(sum/data.size()));
+    EXPECT_NEAR(logSum/positive, stats.logMean, 1e-4);
+}
+
+TEST(TestPfsStatistics, RangeMatchesStatistics)
+{
+    const std::vector<float> data = randomData(100003, 5);
+
+    Statistics stats = computeStatistics(data.data(), data.size());
+    Statistics range = computeRange(data.data(), data.size());
+    EXPECT_EQ(stats.size, range.size);
+    EXPECT_EQ(stats.positive, range.positive);
+    EXPECT_EQ(stats.min, range.min);
+    EXPECT_EQ(stats.max, range.max);
+    EXPECT_EQ(stats.minPositive, range.minPositive);
+}
+
+TEST(TestPfsStatistics, ExactQuantilesMatchSort)
+{
+    const std::vector<float> data = randomData(65537, 2);
+    std::vector<float> sorted(data);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<float> p;
+    p.push_back(0.f);
+    p.push_back(0.001f);
+    p.push_back(0.01f);
+    p.push_back(0.5f);
+    p.push_back(0.99f);
+    p.push_back(0.999f);
+    p.push_back(1.f);
+
+    std::vector<float> q;
+    quantiles(data.data(), data.size(), p, q);
+    ASSERT_EQ(p.size(), q.size());
+    for (size_t i = 0; i < p.size(); ++i)
+    {
+        const size_t rank = std::min(sorted.size() - 1,
+                                     static_cast<size_t>(static_cast<double>(p[i])*sorted.size()));
+        EXPECT_EQ(sorted[rank], q[i]) << "p = " << p[i];
+    }
+
+    EXPECT_EQ(sorted[sorted.size()/2], quantile(data.data(), data.size(), 0.5f));
+}
+
+TEST(TestPfsStatistics, HistogramCountsAndQuantile)
+{
+    std::vector<float> data(1000);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<float>(i)/(data.size() - 1);
+    }
+
+    Histogram hist(10, 0.f, 1.f);
+    hist.compute(data.data(), data.size());
+    EXPECT_EQ(data.size(), hist.total());
+    for (size_t b = 0; b < hist.bins(); ++b)
+    {
+        EXPECT_EQ(100u, hist.count(b)) << "bin " << b;
+    }
+    EXPECT_NEAR(0.25f, hist.quantile(0.25), 0.1f);
+
+    // every other sample, out of range values skipped or clamped
+    Histogram narrow(4, 0.25f, 0.75f);
+    narrow.compute(data.data(), data.size(), 2);
+    EXPECT_EQ(250u, narrow.total());
+
+    narrow.compute(data.data(), data.size(), 1, true);
+    EXPECT_EQ(data.size(), narrow.total());
+}
+
+TEST(TestPfsStatistics, LogHistogram)
+{
+    std::vector<float> data;
+    data.push_back(0.f);
+    data.push_back(-1.f);
+    data.push_back(0.01f);
+    data.push_back(1.f);
+    data.push_back(50.f);
+    data.push_back(100.f);
+
+    Histogram hist(4, -2.f, 2.f, Histogram::LOG10);
+    hist.compute(data.data(), data.size());
+    EXPECT_EQ(4u, hist.total());
+    EXPECT_EQ(1u, hist.count(0));
+    EXPECT_EQ(0u, hist.count(1));
+    EXPECT_EQ(1u, hist.count(2));
+    EXPECT_EQ(2u, hist.count(3));
+}
+
+TEST(TestPfsStatistics, QuantilesSkipNonFinite)
+{
+    std::vector<float> data;
+    for (int i = 0; i < 10; ++i)
+    {
+        data.push_back(static_cast<float>(i + 1));
+    }
+    data.push_back(std::numeric_limits<float>::quiet_NaN());
+    data.push_back(std::numeric_limits<float>::infinity());
+    data.push_back(-std::numeric_limits<float>::infinity());
+
+    EXPECT_EQ(1.f, quantile(data.data(), data.size(), 0.f));
+    EXPECT_EQ(6.f, quantile(data.data(), data.size(), 0.5f));
+    EXPECT_EQ(10.f, quantile(data.data(), data.size(), 1.f));
+
+    Histogram hist(10, 0.f, 10.f);
+    hist.compute(data.data(), data.size(), 1, true);
+    EXPECT_EQ(10u, hist.total());
+    EXPECT_EQ(0u, hist.count(0));
+
+    const std::vector<float> nan(4, std::numeric_limits<float>::quiet_NaN());
+    EXPECT_EQ(0.f, quantile(nan.data(), nan.size(), 0.5f));
+}
+
+TEST(TestPfsStatistics, ChannelCacheFollowsWrites)
+{
+    Channel channel(16, 8, "Y");
+    channel.fill(2.f);
+
+    EXPECT_EQ(2.f, channel.getStatistics().max);
+    // no write: same generation, the cached values are returned
+    const size_t generation = channel.generation();
+    EXPECT_EQ(2.f, channel.getStatistics().max);
+    EXPECT_EQ(generation, channel.generation());
+
+    // element writes are not tracked until touch()
+    channel(3, 2) = 5.f;
+    EXPECT_EQ(generation, channel.generation());
+    EXPECT_EQ(2.f, channel.getStatistics().max);
+    channel.touch();
+    EXPECT_NE(generation, channel.generation());
+    EXPECT_EQ(5.f, channel.getStatistics().max);
+
+    *channel.begin() = 7.f;
+    EXPECT_EQ(7.f, channel.getStatistics().max);
+
+    channel.data()[4] = -1.f;
+    EXPECT_EQ(-1.f, channel.getStatistics().min);
+
+    // writes through the base class are seen as well
+    Array2Df& base = channel;
+    std::fill(base.row_begin(0) + 5, base.row_begin(0) + 6, 9.f);
+    EXPECT_EQ(9.f, channel.getStatistics().max);
+
+    // a pointer taken before the statistics must be followed by touch()
+    float* raw = base.data();
+    EXPECT_EQ(9.f, channel.getStatistics().max);
+    raw[6] = 11.f;
+    base.touch();
+    EXPECT_EQ(11.f, channel.getStatistics().max);
+
+    Channel other(16, 8, "X");
+    other.fill(1.f);
+    EXPECT_EQ(1.f, other.getStatistics().max);
+    channel.swap(other);
+    EXPECT_EQ(1.f, channel.getStatistics().max);
+    EXPECT_EQ(11.f, other.getStatistics().max);
+
+    // a copy never shares the generation of its source
+    Array2Df copy(base);
+    EXPECT_NE(channel.generation(), copy.generation());
+}
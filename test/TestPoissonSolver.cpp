@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 
 #include <Libpfs/array2d.h>
+#include <Libpfs/progress.h>
 #include <TonemappingOperators/fattal02/pde.h>
 #include <HdrWizard/AutoAntighosting.h>
 
@@ -48,3 +49,61 @@ TEST(solve_pde_dct, Test1)
     ASSERT_LE(residual, 1e-2);
 }
 
+TEST(solve_pde_multigrid, Test1)
+{
+    Array2Df U(300,200);
+    Array2Df divergence(300,200);
+
+    // zero mean, as the reflective boundaries require
+    for (int j = 0; j < 200; j++)
+    {
+        for (int i = 0; i < 300; i++)
+        {
+            divergence(i, j) = std::exp(
+                        -std::pow(i-100.f, 2.f)/50.f -
+                        std::pow(j-80.f, 2.f)/50.f) -
+                    std::exp(
+                        -std::pow(i-220.f, 2.f)/50.f -
+                        std::pow(j-120.f, 2.f)/50.f);
+        }
+    }
+
+    pfs::Progress ph;
+    solve_pde_multigrid(&divergence, &U, ph);
+    float residual = residual_pde(&U, &divergence);
+
+    ASSERT_LE(residual, 1e-2);
+
+    // more V-cycles, from the previous solution
+    solve_pde_multigrid(&divergence, &U, ph, false);
+
+    ASSERT_LE(residual_pde(&U, &divergence), residual);
+}
+
+TEST(PoissonSolverDct, Reuse)
+{
+    Array2Df U1(120,80);
+    Array2Df U2(120,80);
+    Array2Df divergence(120,80);
+
+    for (int j = 0; j < 80; j++)
+    {
+        for (int i = 0; i < 120; i++)
+        {
+            // cosine modes: a solution exists with reflective borders
+            divergence(i, j) = std::cos(6.2831853f*i/119.f)*
+                    std::cos(6.2831853f*j/79.f);
+        }
+    }
+
+    PoissonSolverDct solver(120, 80);
+    solver.solve(divergence, U1);
+    ASSERT_LE(residual_pde(&U1, &divergence), 1e-2);
+
+    // same plans, same result
+    solver.solve(divergence, U2);
+    for (size_t i = 0; i < U1.size(); i++)
+    {
+        ASSERT_EQ(U1(i), U2(i));
+    }
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+#include "Libpfs/array2d.h"
+#include "Libpfs/manip/projection.h"
+
+namespace
+{
+const ProjectionFilter FILTERS[] = {PROJECTION_NEAREST, PROJECTION_BILINEAR,
+                                    PROJECTION_BICUBIC, PROJECTION_LANCZOS3};
+const size_t NUM_FILTERS = sizeof(FILTERS)/sizeof(FILTERS[0]);
+
+const char* const NAMES[] = {"mirrorball", "angular", "cylindrical", "polar"};
+const size_t NUM_NAMES = sizeof(NAMES)/sizeof(NAMES[0]);
+
+// -ffast-math folds std::isfinite
+bool isFinite(double v)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return (bits & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL;
+}
+
+Projection* getProjection(const char* name)
+{
+    char buffer[32];
+    std::strncpy(buffer, name, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    return ProjectionFactory::getProjection(buffer);
+}
+
+//! \brief cylindrical projection which has no source pixel for the lower
+//! hemisphere: NaN for the back, out of [0, 1] for the front
+class HalfProjection : public Projection
+{
+public:
+    Vector3D uvToDirection(double u, double v) const
+    {
+        return m_cylindrical->uvToDirection(u, v);
+    }
+
+    Point2D directionToUV(const Vector3D& direction) const
+    {
+        if ( direction.y >= 0 ) return m_cylindrical->directionToUV(direction);
+        if ( direction.z < 0 )
+        {
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            return Point2D(nan, nan);
+        }
+        return Point2D(-3., 2.);
+    }
+
+    bool isValidPixel(double, double) const { return true; }
+    double getSizeRatio() const { return 2; }
+
+    HalfProjection()
+        : m_cylindrical(getProjection("cylindrical"))
+    {
+        name = "half";
+    }
+    ~HalfProjection() { delete m_cylindrical; }
+
+private:
+    Projection* m_cylindrical;
+};
+}
+
+TEST(TestProjection, DirectionsJustOutsideTheSphere)
+{
+    // unit vectors after rounding: dot products just above 1
+    const double over = 1. + 1e-12;
+    Vector3D directions[4];
+    directions[0].x = 1e-9;  directions[0].y = 0.;     directions[0].z = -over;
+    directions[1].x = 1e-9;  directions[1].y = 0.;     directions[1].z = over;
+    directions[2].x = 1e-9;  directions[2].y = over;   directions[2].z = 0.;
+    directions[3].x = 0.;    directions[3].y = -over;  directions[3].z = 1e-9;
+
+    for (size_t n = 0; n < NUM_NAMES; ++n)
+    {
+        Projection* projection = getProjection(NAMES[n]);
+        ASSERT_TRUE(projection != NULL) << NAMES[n];
+        for (size_t d = 0; d < 4; ++d)
+        {
+            const Point2D p = projection->directionToUV(directions[d]);
+            EXPECT_TRUE(isFinite(p.x) && isFinite(p.y)) << NAMES[n] << " " << d;
+            EXPECT_TRUE(p.x >= 0. && p.x <= 1.) << NAMES[n] << " " << d;
+            EXPECT_TRUE(p.y >= 0. && p.y <= 1.) << NAMES[n] << " " << d;
+        }
+        delete projection;
+    }
+}
+
+TEST(TestProjection, ConstantIsPreserved)
+{
+    pfs::Array2Df input(64, 32);
+    std::fill(input.begin(), input.end(), 2.5f);
+
+    for (size_t src = 0; src < NUM_NAMES; ++src)
+    {
+        for (size_t dst = 0; dst < NUM_NAMES; ++dst)
+        {
+            for (size_t f = 0; f < NUM_FILTERS; ++f)
+            {
+                TransformInfo info;
+                info.srcProjection = getProjection(NAMES[src]);
+                info.dstProjection = getProjection(NAMES[dst]);
+                info.filter = FILTERS[f];
+                info.oversampleFactor = 2;
+                info.xRotate = 90.;
+                info.yRotate = 45.;
+
+                pfs::Array2Df output(40, 40);
+                transformArray(&input, &output, &info);
+
+                for (int y = 0; y < 40; ++y)
+                {
+                    for (int x = 0; x < 40; ++x)
+                    {
+                        const float v = output(x, y);
+                        ASSERT_TRUE(isFinite(v));
+                        if ( info.dstProjection->isValidPixel((x + 0.5)/40, (y + 0.5)/40) )
+                        {
+                            ASSERT_NEAR(2.5f, v, 1e-4f)
+                                    << NAMES[src] << " -> " << NAMES[dst]
+                                    << " filter " << FILTERS[f] << " at " << x << "," << y;
+                        }
+                    }
+                }
+                delete info.srcProjection;
+                delete info.dstProjection;
+            }
+        }
+    }
+}
+
+TEST(TestProjection, PointsOutsideTheSourceAreSkipped)
+{
+    pfs::Array2Df input(64, 32);
+    std::fill(input.begin(), input.end(), 2.5f);
+
+    HalfProjection source;
+    for (size_t f = 0; f < NUM_FILTERS; ++f)
+    {
+        TransformInfo info;
+        info.srcProjection = &source;
+        info.dstProjection = getProjection("cylindrical");
+        info.filter = FILTERS[f];
+        info.oversampleFactor = 3;
+
+        pfs::Array2Df output(64, 32);
+        const size_t generation = output.generation();
+        transformArray(&input, &output, &info);
+        // written through the element accessors, then marked as modified
+        EXPECT_NE(generation, output.generation());
+
+        for (int y = 0; y < 32; ++y)
+        {
+            for (int x = 0; x < 64; ++x)
+            {
+                const float v = output(x, y);
+                ASSERT_TRUE(isFinite(v)) << x << "," << y;
+                // the upper half has a source, the lower half does not
+                if ( y < 15 )       ASSERT_NEAR(2.5f, v, 1e-4f) << x << "," << y;
+                else if ( y > 16 )  ASSERT_EQ(0.f, v) << x << "," << y;
+            }
+        }
+        delete info.dstProjection;
+    }
+}
@@ -0,0 +1,218 @@
+/*
+ * This file is a part of Luminance HDR package
+ * ----------------------------------------------------------------------
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * ----------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdlib>
+
+#include <Libpfs/array2d.h>
+#include <Libpfs/colorspace/colorspace.h>
+#include <Libpfs/colorspace/restorecolor.h>
+
+using namespace pfs;
+
+namespace
+{
+const size_t COLS = 97;
+const size_t ROWS = 13;
+
+void fillRGB(Array2Df& R, Array2Df& G, Array2Df& B)
+{
+    srand(7);
+    for (size_t i = 0; i < R.size(); ++i)
+    {
+        const float l = std::pow(10.f, -2.f + 5.f*i/R.size());
+        R(i) = l*(0.1f + static_cast<float>(rand())/RAND_MAX);
+        G(i) = l*(0.1f + static_cast<float>(rand())/RAND_MAX);
+        B(i) = l*(0.1f + static_cast<float>(rand())/RAND_MAX);
+    }
+    // black pixel
+    R(0) = G(0) = B(0) = 0.f;
+}
+
+//! \brief tone mapped luminance: Y/(1 + Y)
+void compress(const Array2Df& Y, Array2Df& L)
+{
+    for (size_t i = 0; i < Y.size(); ++i)
+    {
+        L(i) = Y(i)/(1.f + Y(i));
+    }
+}
+}
+
+TEST(TestRestoreColor, ScaleRGB)
+{
+    Array2Df R(COLS, ROWS), G(COLS, ROWS), B(COLS, ROWS);
+    Array2Df Y(COLS, ROWS), L(COLS, ROWS);
+    fillRGB(R, G, B);
+    transformRGB2Y(&R, &G, &B, &Y);
+    compress(Y, L);
+
+    Array2Df outR(COLS, ROWS), outG(COLS, ROWS), outB(COLS, ROWS);
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             colorspace::LuminanceArray(Y),
+                             colorspace::ToneArray(L),
+                             colorspace::TransferLinear(),
+                             CS_RGB, outR, outG, outB);
+
+    EXPECT_EQ(0.f, outR(0));
+    EXPECT_EQ(0.f, outG(0));
+    EXPECT_EQ(0.f, outB(0));
+    for (size_t i = 1; i < R.size(); ++i)
+    {
+        const float scale = L(i)/Y(i);
+        ASSERT_NEAR(R(i)*scale, outR(i), 1e-6f*R(i)*scale);
+        ASSERT_NEAR(G(i)*scale, outG(i), 1e-6f*G(i)*scale);
+        ASSERT_NEAR(B(i)*scale, outB(i), 1e-6f*B(i)*scale);
+    }
+
+    // the luminance of the output is the tone mapped one
+    Array2Df outY(COLS, ROWS);
+    transformRGB2Y(&outR, &outG, &outB, &outY);
+    for (size_t i = 1; i < R.size(); ++i)
+    {
+        ASSERT_NEAR(L(i), outY(i), 1e-5f*L(i));
+    }
+}
+
+TEST(TestRestoreColor, Saturation)
+{
+    Array2Df R(COLS, ROWS), G(COLS, ROWS), B(COLS, ROWS);
+    Array2Df Y(COLS, ROWS), L(COLS, ROWS);
+    fillRGB(R, G, B);
+    transformRGB2Y(&R, &G, &B, &Y);
+    compress(Y, L);
+
+    const float s = 0.6f;
+    Array2Df outR(R), outG(G), outB(B);
+    // in place
+    colorspace::restoreColor(outR, outG, outB, Y, L, s);
+
+    for (size_t i = 1; i < R.size(); ++i)
+    {
+        const float r = std::pow(R(i)/Y(i), s)*L(i);
+        const float g = std::pow(G(i)/Y(i), s)*L(i);
+        const float b = std::pow(B(i)/Y(i), s)*L(i);
+        ASSERT_NEAR(r, outR(i), 1e-5f*r);
+        ASSERT_NEAR(g, outG(i), 1e-5f*g);
+        ASSERT_NEAR(b, outB(i), 1e-5f*b);
+    }
+}
+
+TEST(TestRestoreColor, ColorSpaces)
+{
+    Array2Df R(COLS, ROWS), G(COLS, ROWS), B(COLS, ROWS);
+    Array2Df Y(COLS, ROWS), L(COLS, ROWS);
+    fillRGB(R, G, B);
+    transformRGB2Y(&R, &G, &B, &Y);
+    compress(Y, L);
+
+    // reference: RGB in, RGB out
+    Array2Df refR(COLS, ROWS), refG(COLS, ROWS), refB(COLS, ROWS);
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             colorspace::LuminanceRGB(),
+                             colorspace::ToneArray(L, 0.8f),
+                             colorspace::TransferLinear(),
+                             CS_RGB, refR, refG, refB);
+
+    // XYZ in, RGB out
+    Array2Df X(COLS, ROWS), Z(COLS, ROWS), Y2(COLS, ROWS);
+    transformColorSpace(CS_RGB, &R, &G, &B, CS_XYZ, &X, &Y2, &Z);
+    Array2Df outR(COLS, ROWS), outG(COLS, ROWS), outB(COLS, ROWS);
+    colorspace::restoreColor(CS_XYZ, X, Y2, Z,
+                             colorspace::LuminanceArray(Y2),
+                             colorspace::ToneArray(L, 0.8f),
+                             colorspace::TransferLinear(),
+                             CS_RGB, outR, outG, outB);
+    for (size_t i = 1; i < R.size(); ++i)
+    {
+        ASSERT_NEAR(refR(i), outR(i), 1e-4f*refR(i) + 1e-6f);
+        ASSERT_NEAR(refG(i), outG(i), 1e-4f*refG(i) + 1e-6f);
+        ASSERT_NEAR(refB(i), outB(i), 1e-4f*refB(i) + 1e-6f);
+    }
+
+    // RGB in, XYZ out
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             colorspace::LuminanceArray(Y),
+                             colorspace::ToneArray(L, 0.8f),
+                             colorspace::TransferLinear(),
+                             CS_XYZ, X, Y2, Z);
+    transformColorSpace(CS_XYZ, &X, &Y2, &Z, CS_RGB, &outR, &outG, &outB);
+    for (size_t i = 1; i < R.size(); ++i)
+    {
+        ASSERT_NEAR(refR(i), outR(i), 1e-4f*refR(i) + 1e-6f);
+        ASSERT_NEAR(refG(i), outG(i), 1e-4f*refG(i) + 1e-6f);
+        ASSERT_NEAR(refB(i), outB(i), 1e-4f*refB(i) + 1e-6f);
+    }
+}
+
+TEST(TestRestoreColor, Clamp)
+{
+    Array2Df R(COLS, ROWS), G(COLS, ROWS), B(COLS, ROWS);
+    Array2Df Y(COLS, ROWS);
+    fillRGB(R, G, B);
+    transformRGB2Y(&R, &G, &B, &Y);
+
+    // no tone mapping at all
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             colorspace::LuminanceArray(Y),
+                             colorspace::ToneArray(Y),
+                             colorspace::TransferClamp(0.f, 1.f),
+                             CS_RGB, R, G, B);
+    for (size_t i = 0; i < R.size(); ++i)
+    {
+        ASSERT_LE(0.f, R(i));
+        ASSERT_GE(1.f, R(i));
+        ASSERT_LE(0.f, G(i));
+        ASSERT_GE(1.f, G(i));
+        ASSERT_LE(0.f, B(i));
+        ASSERT_GE(1.f, B(i));
+    }
+    EXPECT_EQ(1.f, R(R.size() - 1));
+}
+
+TEST(TestRestoreColor, MinimumRatio)
+{
+    Array2Df R(COLS, ROWS), G(COLS, ROWS), B(COLS, ROWS);
+    Array2Df Y(COLS, ROWS), L(COLS, ROWS);
+    fillRGB(R, G, B);
+    transformRGB2Y(&R, &G, &B, &Y);
+    compress(Y, L);
+    // null and negative channels
+    G(5) = 0.f;
+    B(5) = -B(5);
+
+    const float minRatio = 1e-8f;
+    const float s = 0.6f;
+    Array2Df outR(COLS, ROWS), outG(COLS, ROWS), outB(COLS, ROWS);
+    colorspace::restoreColor(CS_RGB, R, G, B,
+                             colorspace::LuminanceArray(Y, minRatio),
+                             colorspace::ToneArray(L, s),
+                             colorspace::TransferLinear(),
+                             CS_RGB, outR, outG, outB,
+                             minRatio);
+
+    const float floor = std::pow(minRatio, s)*L(5);
+    EXPECT_LT(0.f, floor);
+    EXPECT_NEAR(floor, outG(5), 1e-5f*floor);
+    EXPECT_NEAR(floor, outB(5), 1e-5f*floor);
+    EXPECT_NEAR(std::pow(R(5)/Y(5), s)*L(5), outR(5),
+                1e-5f*std::pow(R(5)/Y(5), s)*L(5));
+}
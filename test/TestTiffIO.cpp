@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <tiffio.h>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/params.h"
+#include "Libpfs/io/ioexception.h"
+#include "Libpfs/io/tiffreader.h"
+#include "Libpfs/io/tiffwriter.h"
+
+using namespace pfs;
+using namespace pfs::io;
+
+namespace
+{
+// the strip size does not divide the height: the last strip is short
+const size_t WIDTH = 53;
+const size_t HEIGHT = 37;
+const size_t ROWS_PER_STRIP = 8;
+
+const int MODE_UINT16 = 1;
+const int MODE_FLOAT32 = 2;
+
+//! \brief frame whose samples are exact in 16 bit: k/65535
+void fillFrame(Frame& frame)
+{
+    Channel* X;
+    Channel* Y;
+    Channel* Z;
+    frame.createXYZChannels(X, Y, Z);
+
+    Channel* channels[3] = {X, Y, Z};
+    for (size_t c = 0; c < 3; ++c)
+    {
+        for (size_t y = 0; y < HEIGHT; ++y)
+        {
+            for (size_t x = 0; x < WIDTH; ++x)
+            {
+                const uint32_t k = (x*977 + y*1531 + c*4099 + x*y*7) % 65536;
+                (*channels[c])(x, y) = k/65535.f;
+            }
+        }
+    }
+}
+
+std::string fileName(int mode, int predictor, bool deflate)
+{
+    char buffer[64];
+    std::sprintf(buffer, "TestTiffIO_%d_%d_%d.tif", mode, predictor, int(deflate));
+    return buffer;
+}
+
+void writeTiff(const std::string& filename, const Frame& frame,
+               int mode, int predictor, bool deflate,
+               size_t rowsPerStrip = ROWS_PER_STRIP)
+{
+    TiffWriter writer(filename);
+    ASSERT_TRUE(writer.write(frame, Params("tiff_mode", mode)
+                             ("predictor", predictor)
+                             ("deflateCompression", deflate)
+                             ("rows_per_strip", rowsPerStrip)));
+}
+
+//! \brief decoded samples of the file, as stored
+template <typename T>
+std::vector<T> readSamples(const std::string& filename)
+{
+    std::vector<T> samples;
+    TIFF* tif = TIFFOpen(filename.c_str(), "r");
+    if ( !tif ) return samples;
+
+    uint32 width = 0;
+    uint32 height = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+
+    samples.resize(size_t(width)*height*3);
+    for (uint32 row = 0; row < height; ++row)
+    {
+        if ( TIFFReadScanline(tif, &samples[size_t(row)*width*3], row) < 0 )
+        {
+            samples.clear();
+            break;
+        }
+    }
+    TIFFClose(tif);
+    return samples;
+}
+
+void readFrame(const std::string& filename, Frame& frame)
+{
+    TiffReader reader(filename);
+    reader.read(frame, Params());
+}
+
+void expectSameFrame(Frame& expected, Frame& actual, const std::string& name)
+{
+    ASSERT_EQ(expected.getWidth(), actual.getWidth()) << name;
+    ASSERT_EQ(expected.getHeight(), actual.getHeight()) << name;
+
+    const Channel* e[3];
+    const Channel* a[3];
+    expected.getXYZChannels(e[0], e[1], e[2]);
+    actual.getXYZChannels(a[0], a[1], a[2]);
+    for (size_t c = 0; c < 3; ++c)
+    {
+        ASSERT_TRUE(e[c] != NULL && a[c] != NULL) << name;
+        for (size_t i = 0; i < WIDTH*HEIGHT; ++i)
+        {
+            ASSERT_EQ((*e[c])(i), (*a[c])(i)) << name << " channel " << c << " at " << i;
+        }
+    }
+}
+}
+
+TEST(TestTiffIO, Uint16RoundTrip)
+{
+    Frame frame(WIDTH, HEIGHT);
+    fillFrame(frame);
+
+    const Channel* channels[3];
+    frame.getXYZChannels(channels[0], channels[1], channels[2]);
+    std::vector<uint16_t> expected(WIDTH*HEIGHT*3);
+    for (size_t i = 0; i < WIDTH*HEIGHT; ++i)
+    {
+        for (size_t c = 0; c < 3; ++c)
+        {
+            expected[i*3 + c] = static_cast<uint16_t>((*channels[c])(i)*65535.f + 0.5f);
+        }
+    }
+
+    const std::string reference = fileName(MODE_UINT16, PREDICTOR_NONE, false);
+    writeTiff(reference, frame, MODE_UINT16, PREDICTOR_NONE, false);
+    ASSERT_EQ(expected, readSamples<uint16_t>(reference));
+    Frame referenceFrame;
+    readFrame(reference, referenceFrame);
+
+    const int predictors[] = {PREDICTOR_NONE, PREDICTOR_HORIZONTAL};
+    for (size_t p = 0; p < 2; ++p)
+    {
+        const std::string name = fileName(MODE_UINT16, predictors[p], true);
+        writeTiff(name, frame, MODE_UINT16, predictors[p], true);
+        ASSERT_EQ(expected, readSamples<uint16_t>(name)) << name;
+
+        Frame read;
+        readFrame(name, read);
+        expectSameFrame(referenceFrame, read, name);
+        std::remove(name.c_str());
+    }
+    std::remove(reference.c_str());
+}
+
+TEST(TestTiffIO, Float32RoundTrip)
+{
+    Frame frame(WIDTH, HEIGHT);
+    fillFrame(frame);
+
+    const Channel* channels[3];
+    frame.getXYZChannels(channels[0], channels[1], channels[2]);
+    std::vector<float> expected(WIDTH*HEIGHT*3);
+    for (size_t i = 0; i < WIDTH*HEIGHT; ++i)
+    {
+        for (size_t c = 0; c < 3; ++c)
+        {
+            expected[i*3 + c] = (*channels[c])(i);
+        }
+    }
+
+    const int predictors[] = {PREDICTOR_NONE, PREDICTOR_FLOATINGPOINT, PREDICTOR_NONE};
+    const bool deflate[] = {false, true, true};
+    for (size_t p = 0; p < 3; ++p)
+    {
+        const std::string name = fileName(MODE_FLOAT32, predictors[p], deflate[p]);
+        writeTiff(name, frame, MODE_FLOAT32, predictors[p], deflate[p]);
+        ASSERT_EQ(expected, readSamples<float>(name)) << name;
+
+        // no profile is written for float files: the samples are read as they are
+        Frame read;
+        readFrame(name, read);
+        expectSameFrame(frame, read, name);
+        std::remove(name.c_str());
+    }
+}
+
+TEST(TestTiffIO, AutomaticStripSize)
+{
+    Frame frame(WIDTH, HEIGHT);
+    fillFrame(frame);
+
+    const std::string reference = fileName(MODE_FLOAT32, PREDICTOR_NONE, false);
+    writeTiff(reference, frame, MODE_FLOAT32, PREDICTOR_NONE, false);
+    const std::string name = fileName(MODE_FLOAT32, PREDICTOR_FLOATINGPOINT, true);
+    writeTiff(name, frame, MODE_FLOAT32, PREDICTOR_FLOATINGPOINT, true, 0);
+
+    ASSERT_EQ(readSamples<float>(reference), readSamples<float>(name));
+    std::remove(reference.c_str());
+    std::remove(name.c_str());
+}
+
+TEST(TestTiffIO, UnsupportedPredictorThrows)
+{
+    Frame frame(WIDTH, HEIGHT);
+    fillFrame(frame);
+
+    const std::string name = fileName(MODE_UINT16, PREDICTOR_FLOATINGPOINT, true);
+    TiffWriter writer(name);
+    EXPECT_THROW(writer.write(frame, Params("tiff_mode", MODE_UINT16)
+                              ("predictor", int(PREDICTOR_FLOATINGPOINT))),
+                 pfs::io::WriteException);
+    std::remove(name.c_str());
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "Libpfs/progress.h"
+#include "TonemappingOperators/tonecurve_lut.h"
+
+namespace
+{
+struct PowerCurve
+{
+    explicit PowerCurve(float exponent)
+        : m_exponent(exponent)
+    {}
+
+    float operator()(float x) const
+    {
+        return std::pow(x, m_exponent);
+    }
+
+    float m_exponent;
+};
+
+struct LogCurve
+{
+    float operator()(float x) const
+    {
+        return std::log1p(x)/std::log(2.f + x);
+    }
+};
+}
+
+TEST(TestToneCurveLut, Accuracy)
+{
+    ToneCurveLut power;
+    power.compile(1e-6f, 1e6f, PowerCurve(0.4f));
+    ToneCurveLut log;
+    log.compile(1e-6f, 1e6f, LogCurve());
+
+    // 256 samples per octave
+    EXPECT_LE(power.size(), 41u*256u);
+
+    for (float x = 1e-6f; x < 1e6f; x *= 1.0137f)
+    {
+        const float p = std::pow(x, 0.4f);
+        EXPECT_NEAR(p, power(x), 1e-5f*p) << x;
+        const float l = LogCurve()(x);
+        EXPECT_NEAR(l, log(x), 1e-5f*l) << x;
+    }
+    EXPECT_FLOAT_EQ(std::pow(1e6f, 0.4f), power(1e6f));
+}
+
+TEST(TestToneCurveLut, Clamping)
+{
+    ToneCurveLut lut;
+    lut.compile(0.01f, 100.f, PowerCurve(0.5f));
+
+    EXPECT_FLOAT_EQ(0.1f, lut(0.01f));
+    EXPECT_FLOAT_EQ(10.f, lut(100.f));
+
+    EXPECT_FLOAT_EQ(0.1f, lut(0.f));
+    EXPECT_FLOAT_EQ(0.1f, lut(-5.f));
+    EXPECT_FLOAT_EQ(0.1f, lut(1e-30f));
+    EXPECT_FLOAT_EQ(10.f, lut(1e30f));
+    EXPECT_FLOAT_EQ(10.f, lut(std::numeric_limits<float>::infinity()));
+    EXPECT_FLOAT_EQ(10.f, lut(std::numeric_limits<float>::quiet_NaN()));
+}
+
+TEST(TestToneCurveLut, ZeroAndDenormalMinimum)
+{
+    // scale of a curve y = x^0.5, infinite at 0
+    const float minimums[] = { 0.f, 1e-40f, -1.f };
+    for (size_t m = 0; m < sizeof(minimums)/sizeof(minimums[0]); ++m)
+    {
+        ToneCurveLut lut;
+        lut.compile(minimums[m], 100.f, PowerCurve(-0.5f));
+
+        EXPECT_EQ(FLT_MIN, lut.min());
+        for (float x = 1e-37f; x < 100.f; x *= 1.37f)
+        {
+            const float s = 1.f/std::sqrt(x);
+            EXPECT_NEAR(s, lut(x), 1e-5f*s) << x;
+        }
+        const float s_min = 1.f/std::sqrt(FLT_MIN);
+        EXPECT_FLOAT_EQ(s_min, lut(0.f));
+        EXPECT_FLOAT_EQ(s_min, lut(1e-40f));
+    }
+}
+
+TEST(TestToneCurveLut, ApplyScale)
+{
+    const size_t size = 100000;
+    std::vector<float> lum(size), R(size), G(size), B(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        lum[i] = (i % 100 == 0) ? 0.f : std::pow(10.f, -3.f + 6.f*i/size);
+        R[i] = 0.5f*lum[i] + 1.f;
+        G[i] = lum[i];
+        B[i] = 2.f*lum[i];
+    }
+
+    // scale of a curve y = x^0.5
+    ToneCurveLut scale;
+    scale.compile(1e-3f, 1e3f, PowerCurve(-0.5f));
+
+    pfs::Progress ph;
+    // the luminance is one of the channels, like in XYZ
+    applyToneCurveScale(scale, lum.data(), R.data(), lum.data(), B.data(), size, ph);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        const float s = (G[i] > 0.f) ? 1.f/std::sqrt(G[i]) : 0.f;
+        ASSERT_NEAR(s*G[i], lum[i], 1e-5f*s*G[i]);
+        ASSERT_NEAR(s*(0.5f*G[i] + 1.f), R[i], 1e-5f*s*(0.5f*G[i] + 1.f));
+        ASSERT_NEAR(s*2.f*G[i], B[i], 1e-5f*s*2.f*G[i]);
+    }
+    EXPECT_EQ(100, ph.value());
+}
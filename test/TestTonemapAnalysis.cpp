@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/tm/TonemapOperator.h"
+#include "Core/TonemappingOptions.h"
+#include "TonemappingOperators/pfstmo.h"
+
+#include "FrameFixtures.h"
+
+using namespace pfs;
+
+namespace
+{
+float maxDifference(const Frame& a, const Frame& b)
+{
+    const Channel *X1, *Y1, *Z1;
+    const Channel *X2, *Y2, *Z2;
+    a.getXYZChannels(X1, Y1, Z1);
+    b.getXYZChannels(X2, Y2, Z2);
+
+    float diff = 0.f;
+    for (size_t idx = 0; idx < X1->size(); ++idx)
+    {
+        diff = std::max(diff, std::fabs((*X1)(idx) - (*X2)(idx)));
+        diff = std::max(diff, std::fabs((*Y1)(idx) - (*Y2)(idx)));
+        diff = std::max(diff, std::fabs((*Z1)(idx) - (*Z2)(idx)));
+    }
+    return diff;
+}
+
+//! \brief tonemap with \a first, then with \a second reusing the analysis:
+//! \a second only changes options outside of the analysis key, the result
+//! must be the one of a fresh run
+void testReusedAnalysis(TonemappingOptions& first, TonemappingOptions& second,
+                        float tolerance)
+{
+    srand(7);
+    std::unique_ptr<Frame> input(buildRandomFrame(64, 48));
+    first.origxsize = first.xsize = input->getWidth();
+    second.origxsize = second.xsize = input->getWidth();
+    Progress ph;
+
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(first.tmoperator));
+    ASSERT_EQ(tmo->analysisKey(&first), tmo->analysisKey(&second));
+
+    TmoAnalysisPtr analysis;
+    std::unique_ptr<Frame> firstFrame(pfs::copy(input.get()));
+    tmo->tonemapFrameWithAnalysis(*firstFrame, &first, analysis, ph);
+    ASSERT_TRUE(analysis.get() != NULL);
+
+    std::unique_ptr<Frame> reused(pfs::copy(input.get()));
+    tmo->tonemapFrameWithAnalysis(*reused, &second, analysis, ph);
+
+    std::unique_ptr<Frame> reference(pfs::copy(input.get()));
+    tmo->tonemapFrame(*reference, &second, ph);
+
+    // the changed option is not a no-op
+    EXPECT_GT(maxDifference(*firstFrame, *reference), 10*tolerance);
+    compareFrames(*reference, *reused, tolerance);
+}
+}
+
+TEST(TestTonemapAnalysis, Mantiuk06ReusedAnalysis)
+{
+    srand(7);
+    std::unique_ptr<Frame> input(buildRandomFrame(64, 48));
+    Progress ph;
+
+    // first run fills the analysis
+    TmoAnalysisPtr analysis;
+    std::unique_ptr<Frame> first(pfs::copy(input.get()));
+    pfstmo_mantiuk06(*first, 0.1f, 0.8f, 1.0f, false, analysis, ph);
+    ASSERT_TRUE(analysis.get() != NULL);
+
+    // second run only changes the saturation: the analysis is reused
+    std::unique_ptr<Frame> reused(pfs::copy(input.get()));
+    pfstmo_mantiuk06(*reused, 0.1f, 0.5f, 1.0f, false, analysis, ph);
+
+    std::unique_ptr<Frame> reference(pfs::copy(input.get()));
+    pfstmo_mantiuk06(*reference, 0.1f, 0.5f, 1.0f, false, ph);
+
+    compareFrames(*reference, *reused, 1e-5f);
+}
+
+TEST(TestTonemapAnalysis, Mantiuk08ReusedAnalysis)
+{
+    TonemappingOptions first;
+    first.tmoperator = mantiuk08;
+
+    // the statistics do not depend on any option
+    TonemappingOptions saturation(first);
+    saturation.operator_options.mantiuk08options.colorsaturation = 0.5f;
+    testReusedAnalysis(first, saturation, 1e-5f);
+
+    TonemappingOptions display(first);
+    display.operator_options.mantiuk08options.contrastenhancement = 2.f;
+    display.operator_options.mantiuk08options.luminancelevel = 50.f;
+    display.operator_options.mantiuk08options.setluminance = true;
+    testReusedAnalysis(first, display, 1e-5f);
+}
+
+TEST(TestTonemapAnalysis, Fattal02ReusedAnalysis)
+{
+    TonemappingOptions first;
+    first.tmoperator = fattal;
+
+    TonemappingOptions second(first);
+    second.operator_options.fattaloptions.color = 0.4f;
+    testReusedAnalysis(first, second, 1e-5f);
+}
+
+TEST(TestTonemapAnalysis, Durand02ReusedAnalysis)
+{
+    TonemappingOptions first;
+    first.tmoperator = durand;
+
+    TonemappingOptions second(first);
+    second.operator_options.durandoptions.base = 3.f;
+    testReusedAnalysis(first, second, 1e-5f);
+}
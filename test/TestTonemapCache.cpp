@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <memory>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+
+#include "Libpfs/frame.h"
+#include "Common/LuminanceOptions.h"
+#include "Core/TonemapCache.h"
+
+#include "FrameFixtures.h"
+
+using namespace pfs;
+
+namespace
+{
+// 128x128, 3 channels: 192 KB in memory, a bit more on disk
+const size_t SIDE = 128;
+const int NUM_FRAMES = 6;
+
+QByteArray key(int i)
+{
+    return QByteArray("frame") + QByteArray::number(i);
+}
+
+//! \brief cache sizes in MB, the settings are kept in settings.ini in the
+//! working directory (portable mode), not in the ones of the user
+void setupCache(int memory_size, bool disk_active, int disk_size)
+{
+    LuminanceOptions::isCurrentPortableMode = true;
+
+    // an unknown temporary directory is replaced by the one of the system
+    QDir::current().mkpath("TestTonemapCache");
+
+    LuminanceOptions options;
+    options.setTempDir(QDir::current().absoluteFilePath("TestTonemapCache"));
+    options.setTonemapCacheSize(memory_size);
+    options.setTonemapDiskCacheActive(disk_active);
+    options.setTonemapDiskCacheSize(disk_size);
+
+    TonemapCache& cache = TonemapCache::getInstance();
+    cache.updateSettings();
+    cache.clear();
+}
+
+void teardownCache()
+{
+    TonemapCache::getInstance().clear();
+    QDir("TestTonemapCache").removeRecursively();
+    QFile::remove("settings.ini");
+}
+
+bool isCached(const QByteArray& key)
+{
+    std::unique_ptr<Frame> frame(TonemapCache::getInstance().get(key));
+    return frame.get() != NULL;
+}
+
+//! \brief inserts NUM_FRAMES frames, getting the first one back before the
+//! last insert: the second one is the least recently used and goes first
+void overfill()
+{
+    srand(5);
+    std::unique_ptr<Frame> frame(buildRandomFrame(SIDE, SIDE));
+    TonemapCache& cache = TonemapCache::getInstance();
+
+    for (int i = 0; i < NUM_FRAMES - 1; ++i)
+    {
+        cache.insert(key(i), *frame);
+    }
+    ASSERT_TRUE(isCached(key(0)));
+
+    cache.insert(key(NUM_FRAMES - 1), *frame);
+}
+}
+
+TEST(TestTonemapCache, MemoryEvictsLeastRecentlyUsed)
+{
+    // room for 5 frames
+    setupCache(1, false, 0);
+    overfill();
+
+    EXPECT_FALSE(isCached(key(1)));
+    EXPECT_TRUE(isCached(key(0)));
+    for (int i = 2; i < NUM_FRAMES; ++i)
+    {
+        EXPECT_TRUE(isCached(key(i))) << i;
+    }
+    teardownCache();
+}
+
+TEST(TestTonemapCache, DiskEvictsLeastRecentlyUsed)
+{
+    // nothing in memory, room for 5 frames on disk
+    setupCache(0, true, 1);
+    overfill();
+
+    EXPECT_FALSE(isCached(key(1)));
+    EXPECT_TRUE(isCached(key(0)));
+    for (int i = 2; i < NUM_FRAMES; ++i)
+    {
+        EXPECT_TRUE(isCached(key(i))) << i;
+    }
+    teardownCache();
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <boost/ref.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/tm/TonemapOperator.h"
+#include "Core/TonemappingOptions.h"
+
+#include "FrameFixtures.h"
+
+using namespace pfs;
+
+namespace
+{
+Frame* tonemap(const Frame& input, TonemappingOptions opts)
+{
+    std::unique_ptr<Frame> output(pfs::copy(&input));
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(opts.tmoperator));
+    Progress ph;
+
+    tmo->tonemapFrame(*output, &opts, ph);
+    return output.release();
+}
+
+//! \brief tonemaps \a input \a runs times, as soon as all the workers are
+//! ready, and keeps the last result
+struct TonemapWorker
+{
+    TonemapWorker(const Frame& input, const TonemappingOptions& opts,
+                  int runs, boost::barrier& start)
+        : m_input(input)
+        , m_opts(opts)
+        , m_runs(runs)
+        , m_start(start)
+        , m_failed(false)
+    {}
+
+    void operator()()
+    {
+        m_start.wait();
+        try
+        {
+            for (int run = 0; run < m_runs; ++run)
+            {
+                m_result.reset(tonemap(m_input, m_opts));
+            }
+        }
+        catch (...)
+        {
+            m_failed = true;
+        }
+    }
+
+    const Frame& m_input;
+    TonemappingOptions m_opts;
+    int m_runs;
+    boost::barrier& m_start;
+    bool m_failed;
+    std::shared_ptr<Frame> m_result;
+};
+
+//! \brief tonemap \a input with every option in \a opts from \a threads
+//! threads at the same time, comparing the results with serial runs
+void testConcurrent(const std::vector<TonemappingOptions>& opts,
+                    size_t threads, int runs, float tolerance)
+{
+    srand(5);
+    std::unique_ptr<Frame> input(buildTexturedFrame(160, 120));
+
+    std::vector< std::shared_ptr<Frame> > references;
+    for (size_t idx = 0; idx < opts.size(); ++idx)
+    {
+        references.push_back(std::shared_ptr<Frame>(tonemap(*input, opts[idx])));
+    }
+
+    boost::barrier start(threads);
+    std::vector< std::shared_ptr<TonemapWorker> > workers;
+    boost::thread_group group;
+    for (size_t idx = 0; idx < threads; ++idx)
+    {
+        workers.push_back(std::shared_ptr<TonemapWorker>(
+                              new TonemapWorker(*input, opts[idx % opts.size()],
+                                                runs, start)));
+        group.create_thread(boost::ref(*workers.back()));
+    }
+    group.join_all();
+
+    for (size_t idx = 0; idx < threads; ++idx)
+    {
+        ASSERT_FALSE(workers[idx]->m_failed);
+        ASSERT_TRUE(workers[idx]->m_result.get() != NULL);
+        compareFrames(*references[idx % opts.size()], *workers[idx]->m_result,
+                      tolerance);
+    }
+}
+}
+
+TEST(TestTonemapConcurrency, Mantiuk06)
+{
+    TonemappingOptions mapping;
+    mapping.tmoperator = mantiuk06;
+    mapping.operator_options.mantiuk06options.contrastequalization = false;
+
+    TonemappingOptions equalization = mapping;
+    equalization.operator_options.mantiuk06options.contrastequalization = true;
+    equalization.operator_options.mantiuk06options.detailfactor = 3.f;
+
+    std::vector<TonemappingOptions> opts;
+    opts.push_back(mapping);
+    opts.push_back(equalization);
+
+    testConcurrent(opts, 8, 3, 1e-5f);
+}
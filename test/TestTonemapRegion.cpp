@@ -0,0 +1,280 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+
+#include "Libpfs/frame.h"
+#include "Libpfs/progress.h"
+#include "Libpfs/manip/copy.h"
+#include "Libpfs/manip/cut.h"
+#include "Libpfs/tm/TonemapOperator.h"
+#include "Core/TonemappingOptions.h"
+
+#include "FrameFixtures.h"
+
+using namespace pfs;
+
+namespace
+{
+//! \brief compare the pixels of \a region with the same pixels of \a full:
+//! every difference must be within \a tolerance, their average within
+//! \a meanTolerance
+void compareRegion(const Frame& full, const Frame& region,
+                   size_t x_ul, size_t y_ul,
+                   float tolerance, float meanTolerance)
+{
+    const Channel *R1, *G1, *B1;
+    const Channel *R2, *G2, *B2;
+    full.getXYZChannels(R1, G1, B1);
+    region.getXYZChannels(R2, G2, B2);
+
+    double sum = 0.;
+    for (size_t y = 0; y < region.getHeight(); ++y)
+    {
+        for (size_t x = 0; x < region.getWidth(); ++x)
+        {
+            ASSERT_NEAR((*R1)(x_ul + x, y_ul + y), (*R2)(x, y), tolerance);
+            ASSERT_NEAR((*G1)(x_ul + x, y_ul + y), (*G2)(x, y), tolerance);
+            ASSERT_NEAR((*B1)(x_ul + x, y_ul + y), (*B2)(x, y), tolerance);
+            sum += std::fabs((*R1)(x_ul + x, y_ul + y) - (*R2)(x, y)) +
+                    std::fabs((*G1)(x_ul + x, y_ul + y) - (*G2)(x, y)) +
+                    std::fabs((*B1)(x_ul + x, y_ul + y) - (*B2)(x, y));
+        }
+    }
+    EXPECT_LE(sum/(3*region.size()), meanTolerance);
+}
+
+const size_t LARGE_WIDTH = 1280;
+const size_t LARGE_HEIGHT = 960;
+const size_t LARGE_X_UL = 560;
+const size_t LARGE_Y_UL = 400;
+const size_t LARGE_X_BR = 720;
+const size_t LARGE_Y_BR = 560;
+
+//! \brief tonemap the region [x_ul, x_br) x [y_ul, y_br) of \a input and
+//! compare it with the full frame
+void testRegion(TonemappingOptions& opts, const Frame& input,
+                size_t x_ul, size_t y_ul, size_t x_br, size_t y_br,
+                float tolerance, float meanTolerance)
+{
+    opts.origxsize = opts.xsize = input.getWidth();
+    Progress ph;
+
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(opts.tmoperator));
+    ASSERT_GE(tmo->regionHalo(&opts), 0);
+
+    std::unique_ptr<Frame> full(pfs::copy(&input));
+    tmo->tonemapFrame(*full, &opts, ph);
+
+    std::unique_ptr<Frame> region(tmo->tonemapRegion(input, x_ul, y_ul, x_br, y_br,
+                                                     &opts, ph));
+    ASSERT_TRUE(region.get() != NULL);
+    ASSERT_EQ(x_br - x_ul, region->getWidth());
+    ASSERT_EQ(y_br - y_ul, region->getHeight());
+
+    compareRegion(*full, *region, x_ul, y_ul, tolerance, meanTolerance);
+}
+
+//! \brief small frame: the halo of the local operators covers all of it and
+//! the global statistics are computed at full resolution
+void testRegion(TonemappingOptions& opts, float tolerance)
+{
+    srand(11);
+    std::unique_ptr<Frame> input(buildTexturedFrame(200, 150));
+
+    testRegion(opts, *input, 70, 40, 150, 110, tolerance, tolerance);
+}
+
+//! \brief frame larger than the preview the global statistics are computed
+//! on (REGION_PREVIEW_PIXELS), with a region far enough from the borders
+//! that the region and its halo only cover a part of the frame
+void testLargeRegion(TonemappingOptions& opts, const Frame& input,
+                     float tolerance, float meanTolerance)
+{
+    ASSERT_EQ(LARGE_WIDTH, input.getWidth());
+    ASSERT_EQ(LARGE_HEIGHT, input.getHeight());
+
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(opts.tmoperator));
+    const size_t halo = tmo->regionHalo(&opts);
+    ASSERT_LT(halo, LARGE_X_UL);
+    ASSERT_LT(halo, LARGE_Y_UL);
+    ASSERT_LT(LARGE_X_BR + halo, LARGE_WIDTH);
+    ASSERT_LT(LARGE_Y_BR + halo, LARGE_HEIGHT);
+
+    testRegion(opts, input, LARGE_X_UL, LARGE_Y_UL, LARGE_X_BR, LARGE_Y_BR,
+               tolerance, meanTolerance);
+}
+
+void testLargeRegion(TonemappingOptions& opts, float tolerance, float meanTolerance)
+{
+    srand(11);
+    std::unique_ptr<Frame> input(buildTexturedFrame(LARGE_WIDTH, LARGE_HEIGHT));
+
+    testLargeRegion(opts, *input, tolerance, meanTolerance);
+}
+
+//! \brief operator depending on the whole frame: its halo covers the frame
+//! and the region is cut from the tonemapping of the whole frame, which it
+//! must reproduce exactly
+void testWholeFrameRegion(TonemappingOptions& opts, const Frame& input)
+{
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(opts.tmoperator));
+    const size_t halo = tmo->regionHalo(&opts);
+    ASSERT_GE(halo, input.getWidth());
+    ASSERT_GE(halo, input.getHeight());
+
+    testRegion(opts, input, LARGE_X_UL, LARGE_Y_UL, LARGE_X_BR, LARGE_Y_BR, 0.f, 0.f);
+}
+
+//! \brief textured frame with a coarse checkerboard on its right side only:
+//! the part of the frame around the region does not have the statistics of
+//! the whole frame
+Frame* buildUnevenFrame()
+{
+    srand(11);
+    Frame* frame = buildTexturedFrame(LARGE_WIDTH, LARGE_HEIGHT);
+
+    Channel *R, *G, *B;
+    frame->getXYZChannels(R, G, B);
+    for (size_t y = 0; y < frame->getHeight(); ++y)
+    {
+        for (size_t x = 0; x < frame->getWidth(); ++x)
+        {
+            const float detail = (x >= 1024 && (x/32 + y/32) % 2) ? 10.f : 1.f;
+            (*R)(x, y) *= detail;
+            (*G)(x, y) *= detail;
+            (*B)(x, y) *= detail;
+        }
+    }
+    return frame;
+}
+}
+
+TEST(TestTonemapRegion, Reinhard02Global)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = reinhard02;
+    opts.operator_options.reinhard02options.scales = false;
+
+    // global operator, with the statistics of the whole frame: no difference
+    testRegion(opts, 1e-5f);
+}
+
+TEST(TestTonemapRegion, Ashikhmin02Simple)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = ashikhmin;
+    opts.operator_options.ashikhminoptions.simple = true;
+
+    testRegion(opts, 1e-5f);
+}
+
+TEST(TestTonemapRegion, Durand02)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = durand;
+    opts.operator_options.durandoptions.spatial = 4.f;
+
+    // the halo covers the support of the bilateral filter
+    testRegion(opts, 1e-2f);
+}
+
+TEST(TestTonemapRegion, Reinhard02GlobalLarge)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = reinhard02;
+    opts.operator_options.reinhard02options.scales = false;
+
+    // log average and maximum of the downsampled frame: well below an 8 bit
+    // step
+    testLargeRegion(opts, 5e-4f, 2e-4f);
+}
+
+TEST(TestTonemapRegion, Reinhard02Scales)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = reinhard02;
+    opts.operator_options.reinhard02options.scales = true;
+
+    testRegion(opts, 1e-5f);
+
+    // the halo of the coarsest scale fits in the large frame
+    opts.operator_options.reinhard02options.range = 5;
+    testLargeRegion(opts, 1e-3f, 2e-4f);
+}
+
+TEST(TestTonemapRegion, Ashikhmin02SimpleLarge)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = ashikhmin;
+    opts.operator_options.ashikhminoptions.simple = true;
+
+    testLargeRegion(opts, 5e-4f, 2e-4f);
+}
+
+TEST(TestTonemapRegion, Ashikhmin02Local)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = ashikhmin;
+    opts.operator_options.ashikhminoptions.simple = false;
+
+    testRegion(opts, 1e-5f);
+
+    srand(11);
+    std::unique_ptr<Frame> input(buildTexturedFrame(LARGE_WIDTH, LARGE_HEIGHT));
+    testWholeFrameRegion(opts, *input);
+}
+
+TEST(TestTonemapRegion, Durand02Large)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = durand;
+    opts.operator_options.durandoptions.spatial = 4.f;
+
+    // below half an 8 bit step
+    testLargeRegion(opts, 1.9e-3f, 5e-4f);
+}
+
+TEST(TestTonemapRegion, Fattal02)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = fattal;
+
+    testRegion(opts, 1e-5f);
+
+    srand(11);
+    std::unique_ptr<Frame> input(buildTexturedFrame(LARGE_WIDTH, LARGE_HEIGHT));
+    testWholeFrameRegion(opts, *input);
+
+    std::unique_ptr<Frame> uneven(buildUnevenFrame());
+    testWholeFrameRegion(opts, *uneven);
+}
+
+TEST(TestTonemapRegion, Mantiuk06)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = mantiuk06;
+
+    testRegion(opts, 1e-5f);
+
+    srand(11);
+    std::unique_ptr<Frame> input(buildTexturedFrame(LARGE_WIDTH, LARGE_HEIGHT));
+    testWholeFrameRegion(opts, *input);
+
+    std::unique_ptr<Frame> uneven(buildUnevenFrame());
+    testWholeFrameRegion(opts, *uneven);
+}
+
+TEST(TestTonemapRegion, UnsupportedOperator)
+{
+    TonemappingOptions opts;
+    opts.tmoperator = drago;
+
+    std::unique_ptr<TonemapOperator> tmo(TonemapOperator::getTonemapOperator(opts.tmoperator));
+    EXPECT_LT(tmo->regionHalo(&opts), 0);
+
+    std::unique_ptr<Frame> input(buildTexturedFrame(16, 16));
+    Progress ph;
+    EXPECT_THROW(tmo->tonemapRegion(*input, 0, 0, 8, 8, &opts, ph), std::runtime_error);
+}